@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "capture.h"
+
+int capture_begin(Capture *cap)
+{
+	char path[] = "/tmp/vesper-capture-XXXXXX";
+
+	cap->data = NULL;
+	cap->capacity = 0;
+
+	fflush(stdout);
+
+	cap->fd = mkstemp(path);
+
+	if (cap->fd < 0)
+	{
+		return -1;
+	}
+
+	// Only the descriptor is needed, nothing else should find the file
+	unlink(path);
+
+	cap->saved_stdout = dup(STDOUT_FILENO);
+
+	if (cap->saved_stdout < 0 || dup2(cap->fd, STDOUT_FILENO) < 0)
+	{
+		close(cap->fd);
+		return -1;
+	}
+
+	// Same buffering the editor uses, one write per flushed frame
+	setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+	return 0;
+}
+
+// Flushes stdout and returns everything written since the last call in cap->data
+size_t capture_take(Capture *cap)
+{
+	fflush(stdout);
+
+	off_t size = lseek(cap->fd, 0, SEEK_END);
+
+	if (size <= 0)
+	{
+		return 0;
+	}
+
+	if ((size_t)size + 1 > cap->capacity)
+	{
+		char *new_data = realloc(cap->data, size + 1);
+
+		if (new_data == NULL)
+		{
+			return 0;
+		}
+
+		cap->data = new_data;
+		cap->capacity = size + 1;
+	}
+
+	size_t got = 0;
+
+	while (got < (size_t)size)
+	{
+		ssize_t n = pread(cap->fd, cap->data + got, size - got, got);
+
+		if (n <= 0)
+		{
+			break;
+		}
+
+		got += n;
+	}
+
+	cap->data[got] = '\0';
+
+	// Start the next frame at offset 0 again
+	if (ftruncate(cap->fd, 0) < 0)
+	{
+		return 0;
+	}
+	lseek(cap->fd, 0, SEEK_SET);
+
+	return got;
+}
+
+void capture_end(Capture *cap)
+{
+	fflush(stdout);
+	dup2(cap->saved_stdout, STDOUT_FILENO);
+	close(cap->saved_stdout);
+	close(cap->fd);
+
+	free(cap->data);
+	cap->data = NULL;
+	cap->capacity = 0;
+}
@@ -0,0 +1,23 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+
+// Points stdout at a scratch file so frames the editor writes can be read
+// back and fed to a VtScreen. stdout keeps its own buffering, so the time
+// spent formatting and flushing a frame is the same as on a terminal.
+
+typedef struct
+{
+	int saved_stdout;
+	int fd;
+	char *data;
+	size_t capacity;
+
+} Capture;
+
+int capture_begin(Capture *cap);
+size_t capture_take(Capture *cap);
+void capture_end(Capture *cap);
+
+#endif
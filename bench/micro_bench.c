@@ -0,0 +1,770 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../src/alloc.h"
+#include "../src/buffer.h"
+#include "../src/editor.h"
+#include "../src/file_io.h"
+#include "../src/highlight.h"
+#include "../src/utils.h"
+
+// Microbenchmarks for the buffer, search, lexer, undo and save paths at 1 KB,
+// 1 MB and 100 MB. Each case repeats until it has MIN_CASE_NS of timed work
+// (setup is not timed, but caps a case at MAX_CASE_NS of wall time) and
+// reports ns/op, and MB/s where a case scans text.
+//
+//   micro_bench [--sizes 1K,1M,100M] [--filter NAME] [--json FILE] [--csv FILE]
+//               [--baseline FILE] [--threshold PCT]
+//
+// --baseline compares with a --json file from an earlier run and fails
+// when a case got slower by more than --threshold percent (default 25).
+
+#define MIN_CASE_NS 200000000LL
+#define MAX_CASE_NS 2000000000LL
+#define MAX_RESULTS 128
+
+typedef struct
+{
+	char name[64];
+	size_t size;
+	size_t ops;
+	long long ns;
+	size_t bytes;    // Text scanned, 0 when MB/s means nothing for the case
+	size_t allocs;   // Tagged allocations made inside the timed sections
+
+} Result;
+
+typedef struct
+{
+	long long start;
+	long long total;
+	long long created;
+	size_t alloc_start;
+	size_t allocs;
+
+} Timer;
+
+static Result results[MAX_RESULTS];
+static size_t result_count = 0;
+static unsigned long long rng_state = 88172645463325252ULL;
+
+static unsigned long long rng_next(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static Timer timer_new(void)
+{
+	Timer t = { 0, 0, monotonic_ns(), 0, 0 };
+
+	return t;
+}
+
+// Enough timed work, or too long spent on setup between the timed parts
+static bool timer_done(Timer *t, long long budget)
+{
+	return t->total >= budget || monotonic_ns() - t->created >= MAX_CASE_NS;
+}
+
+static size_t total_allocs(void)
+{
+	MemStats stats;
+
+	mem_get_total(&stats);
+	return stats.total_count;
+}
+
+static void timer_start(Timer *t)
+{
+	t->alloc_start = total_allocs();
+	t->start = monotonic_ns();
+}
+
+static void timer_stop(Timer *t)
+{
+	t->total += monotonic_ns() - t->start;
+	t->allocs += total_allocs() - t->alloc_start;
+}
+
+static void add_result(const char *name, size_t size, size_t ops, Timer *t, size_t bytes)
+{
+	if (result_count == MAX_RESULTS)
+	{
+		return;
+	}
+
+	Result *r = &results[result_count++];
+
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->size = size;
+	r->ops = ops;
+	r->ns = t->total;
+	r->bytes = bytes;
+	r->allocs = t->allocs;
+
+	fprintf(stderr, ".");
+}
+
+static double ns_per_op(Result *r)
+{
+	return r->ops > 0 ? (double)r->ns / r->ops : 0;
+}
+
+static double allocs_per_op(Result *r)
+{
+	return r->ops > 0 ? (double)r->allocs / r->ops : 0;
+}
+
+static double mb_per_s(Result *r)
+{
+	return r->bytes > 0 && r->ns > 0 ? (double)r->bytes / (1 << 20) / (r->ns / 1e9) : 0;
+}
+
+// size bytes of C-looking text, so lines and tokens are realistic
+static char *make_text(size_t size)
+{
+	static const char *lines[] = {
+		"/* block comment */\n",
+		"static int counter_value = 0x2A; // tail\n",
+		"int add(int a, int b) { return a + b; }\n",
+		"    char *name = \"quoted string\";\n",
+		"\n",
+	};
+	char *text = malloc(size);
+	size_t used = 0;
+	size_t i = 0;
+
+	while (used < size)
+	{
+		const char *line = lines[i++ % 5];
+		size_t len = strlen(line);
+
+		if (len > size - used)
+		{
+			len = size - used;
+		}
+
+		memcpy(text + used, line, len);
+		used += len;
+	}
+
+	return text;
+}
+
+static GapBuffer *make_buffer(const char *text, size_t size)
+{
+	GapBuffer *buffer = buffer_create(size + 1024);
+
+	buffer_insert_text(buffer, text, size);
+
+	return buffer;
+}
+
+static void move_gap_to(GapBuffer *buffer, size_t pos)
+{
+	while (buffer->gap_start > pos)
+	{
+		buffer_move_cursor_left(buffer);
+	}
+
+	while (buffer->gap_start < pos)
+	{
+		buffer_move_cursor_right(buffer);
+	}
+}
+
+// Typing a whole file one character at a time, growth included
+static void bench_insert_char_sequential(const char *text, size_t size)
+{
+	Timer t = timer_new();
+	size_t ops = 0;
+
+	while (!timer_done(&t, MIN_CASE_NS))
+	{
+		GapBuffer *buffer = buffer_create(16);
+
+		timer_start(&t);
+		for (size_t i = 0; i < size; i++)
+		{
+			buffer_insert_char(buffer, text[i]);
+		}
+		timer_stop(&t);
+
+		ops += size;
+		buffer_free(buffer);
+	}
+
+	add_result("insert_char_sequential", size, ops, &t, 0);
+}
+
+// Jumping somewhere in the file and typing one character there
+static void bench_insert_char_random(const char *text, size_t size)
+{
+	GapBuffer *buffer = make_buffer(text, size);
+	Timer t = timer_new();
+	size_t ops = 0;
+
+	while (!timer_done(&t, MIN_CASE_NS))
+	{
+		size_t pos = rng_next() % buffer_length(buffer);
+
+		timer_start(&t);
+		move_gap_to(buffer, pos);
+		buffer_insert_char(buffer, 'x');
+		timer_stop(&t);
+
+		ops++;
+	}
+
+	add_result("insert_char_random", size, ops, &t, 0);
+	buffer_free(buffer);
+}
+
+// One doubling of a full buffer with the gap in the middle
+static void bench_buffer_grow(const char *text, size_t size)
+{
+	Timer t = timer_new();
+	size_t ops = 0;
+
+	while (!timer_done(&t, MIN_CASE_NS))
+	{
+		GapBuffer *buffer = buffer_create(size);
+
+		buffer_insert_text(buffer, text, size);
+		move_gap_to(buffer, size / 2);
+
+		timer_start(&t);
+		buffer_grow(buffer);
+		timer_stop(&t);
+
+		ops++;
+		buffer_free(buffer);
+	}
+
+	add_result("buffer_grow", size, ops, &t, size * ops);
+}
+
+// Rebuilding the line index after an edit at the top of the file
+static void bench_line_index_rebuild(const char *text, size_t size)
+{
+	GapBuffer *buffer = make_buffer(text, size);
+	Timer t = timer_new();
+	size_t ops = 0;
+
+	move_gap_to(buffer, 0);
+
+	while (!timer_done(&t, MIN_CASE_NS))
+	{
+		buffer_insert_char(buffer, 'x');
+		buffer_delete_char(buffer);
+
+		timer_start(&t);
+		buffer_line_start(buffer, buffer_get_total_lines(buffer) - 1);
+		timer_stop(&t);
+
+		ops++;
+	}
+
+	add_result("line_index_rebuild", size, ops, &t, size * ops);
+	buffer_free(buffer);
+}
+
+// buffer_get_line_length and buffer_get_total_lines with the index built
+static void bench_line_length(const char *text, size_t size)
+{
+	GapBuffer *buffer = make_buffer(text, size);
+	Timer t = timer_new();
+	size_t ops = 0;
+	size_t sink = 0;
+
+	buffer_line_start(buffer, buffer_get_total_lines(buffer) - 1);
+
+	while (!timer_done(&t, MIN_CASE_NS))
+	{
+		timer_start(&t);
+		for (int i = 0; i < 1000; i++)
+		{
+			size_t line = rng_next() % buffer_get_total_lines(buffer);
+			sink += buffer_get_line_length(buffer, line);
+		}
+		timer_stop(&t);
+
+		ops += 1000;
+	}
+
+	add_result("line_length", size, ops + (sink & 0), &t, 0);
+	buffer_free(buffer);
+}
+
+// Cursor row/col to buffer offset for the last line, as n/N and AI context do
+static void bench_screen_to_index(const char *text, size_t size)
+{
+	GapBuffer *buffer = make_buffer(text, size);
+	Timer t = timer_new();
+	size_t ops = 0;
+	size_t last_line = buffer_get_total_lines(buffer) - 1;
+
+	while (!timer_done(&t, MIN_CASE_NS))
+	{
+		timer_start(&t);
+		buffer_screen_to_index(buffer, last_line, 0);
+		timer_stop(&t);
+
+		ops++;
+	}
+
+	add_result("screen_to_index", size, ops, &t, size * ops);
+	buffer_free(buffer);
+}
+
+// A pattern that isn't there, so the whole buffer is scanned
+static void bench_find(const char *text, size_t size, bool forward)
+{
+	GapBuffer *buffer = make_buffer(text, size);
+	Timer t = timer_new();
+	size_t ops = 0;
+
+	move_gap_to(buffer, size / 2);
+
+	while (!timer_done(&t, MIN_CASE_NS))
+	{
+		timer_start(&t);
+		if (forward)
+		{
+			buffer_find_pattern(buffer, "no such pattern", 0);
+		}
+		else
+		{
+			buffer_find_pattern_backward(buffer, "no such pattern", buffer->capacity - 1);
+		}
+		timer_stop(&t);
+
+		ops++;
+	}
+
+	add_result(forward ? "find_pattern" : "find_pattern_backward", size, ops, &t, size * ops);
+	buffer_free(buffer);
+}
+
+// classify_token at random offsets, the per-character path of the old renderer
+static void bench_classify_token(const char *text, size_t size)
+{
+	GapBuffer *buffer = make_buffer(text, size);
+	Timer t = timer_new();
+	size_t ops = 0;
+	size_t sink = 0;
+
+	while (!timer_done(&t, MIN_CASE_NS))
+	{
+		size_t pos = rng_next() % size;
+
+		timer_start(&t);
+		sink += classify_token(buffer, pos, LANG_C);
+		timer_stop(&t);
+
+		ops++;
+	}
+
+	add_result("classify_token", size, ops + (sink & 0), &t, 0);
+	buffer_free(buffer);
+}
+
+// Recording a 16 character insert, and undoing/redoing it in the buffer
+static void bench_undo(const char *text, size_t size)
+{
+	static char word[] = "typed_word_here ";
+	GapBuffer *buffer = make_buffer(text, size);
+	size_t cursor_x;
+	size_t cursor_y;
+	Timer push = timer_new();
+	Timer pop = timer_new();
+	Timer again = timer_new();
+	size_t ops = 0;
+
+	move_gap_to(buffer, size / 2);
+
+	while (!timer_done(&push, MIN_CASE_NS / 4) || !timer_done(&pop, MIN_CASE_NS / 4))
+	{
+		UndoManager *um = undo_manager_create();
+
+		for (int i = 0; i < 1000; i++)
+		{
+			size_t pos = buffer->gap_start;
+
+			buffer_insert_text(buffer, word, sizeof(word) - 1);
+
+			timer_start(&push);
+			undo_push_operation(um, OP_INSERT, word, sizeof(word) - 1, pos);
+			timer_stop(&push);
+		}
+
+		timer_start(&pop);
+		for (int i = 0; i < 1000; i++)
+		{
+			undo_operation(um, buffer, &cursor_x, &cursor_y);
+		}
+		timer_stop(&pop);
+
+		timer_start(&again);
+		for (int i = 0; i < 1000; i++)
+		{
+			redo_operation(um, buffer, &cursor_x, &cursor_y);
+		}
+		timer_stop(&again);
+
+		for (int i = 0; i < 1000; i++)
+		{
+			undo_operation(um, buffer, &cursor_x, &cursor_y);
+		}
+
+		ops += 1000;
+		undo_manager_free(um);
+	}
+
+	add_result("undo_push", size, ops, &push, 0);
+	add_result("undo_pop", size, ops, &pop, 0);
+	add_result("redo", size, ops, &again, 0);
+	buffer_free(buffer);
+}
+
+// Undoing and redoing a paste of the whole text at the top of the file,
+// with the gap left at the end in between
+static void bench_undo_paste(const char *text, size_t size)
+{
+	GapBuffer *buffer = make_buffer(text, size);
+	UndoManager *um = undo_manager_create();
+	size_t cursor_x;
+	size_t cursor_y;
+	Timer t = timer_new();
+	size_t ops = 0;
+
+	buffer_move_gap(buffer, 0);
+	undo_push_operation(um, OP_INSERT, text, size, 0);
+	buffer_insert_text(buffer, text, size);
+
+	while (!timer_done(&t, MIN_CASE_NS))
+	{
+		buffer_move_gap(buffer, buffer_length(buffer));
+
+		timer_start(&t);
+		undo_operation(um, buffer, &cursor_x, &cursor_y);
+		redo_operation(um, buffer, &cursor_x, &cursor_y);
+		timer_stop(&t);
+
+		ops++;
+	}
+
+	add_result("undo_redo_paste", size, ops, &t, size * ops);
+	undo_manager_free(um);
+	buffer_free(buffer);
+}
+
+// Loading a CRLF file: the \r of every line dropped in place, the way the
+// loader does it in the gap
+static void bench_crlf_to_lf(const char *text, size_t size)
+{
+	char *crlf = malloc(size * 2);
+	char *scratch = malloc(size * 2);
+	size_t crlf_len = text_lf_to_crlf(crlf, text, size);
+	Timer t = timer_new();
+	size_t ops = 0;
+
+	while (!timer_done(&t, MIN_CASE_NS))
+	{
+		memcpy(scratch, crlf, crlf_len);
+
+		timer_start(&t);
+		text_crlf_to_lf(scratch, scratch, crlf_len);
+		timer_stop(&t);
+
+		ops++;
+	}
+
+	add_result("crlf_to_lf", size, ops, &t, crlf_len * ops);
+	free(scratch);
+	free(crlf);
+}
+
+// Saving with the gap in the middle, so both spans are written. No fsync,
+// this measures the write path up to the page cache. The CRLF case goes
+// through the converting writer.
+static void bench_save_file(const char *text, size_t size, const TextFormat *format, const char *name)
+{
+	GapBuffer *buffer = make_buffer(text, size);
+	Timer t = timer_new();
+	size_t ops = 0;
+	char path[64];
+
+	snprintf(path, sizeof(path), "/tmp/micro_bench_save.%d", (int)getpid());
+	move_gap_to(buffer, size / 2);
+
+	while (!timer_done(&t, MIN_CASE_NS))
+	{
+		timer_start(&t);
+		file_save_buffer(path, buffer, format, FSYNC_NEVER);
+		timer_stop(&t);
+
+		ops++;
+	}
+
+	add_result(name, size, ops, &t, size * ops);
+	unlink(path);
+	buffer_free(buffer);
+}
+
+static void run_size(size_t size, const char *filter)
+{
+	char *text = make_text(size);
+
+	#define WANT(name) (filter == NULL || strstr((name), filter) != NULL)
+
+	if (WANT("insert_char_sequential")) bench_insert_char_sequential(text, size);
+	if (WANT("insert_char_random")) bench_insert_char_random(text, size);
+	if (WANT("buffer_grow")) bench_buffer_grow(text, size);
+	if (WANT("line_index_rebuild")) bench_line_index_rebuild(text, size);
+	if (WANT("line_length")) bench_line_length(text, size);
+	if (WANT("screen_to_index")) bench_screen_to_index(text, size);
+	if (WANT("find_pattern")) bench_find(text, size, true);
+	if (WANT("find_pattern_backward")) bench_find(text, size, false);
+	if (WANT("classify_token")) bench_classify_token(text, size);
+	if (WANT("undo_push") || WANT("undo_pop") || WANT("redo")) bench_undo(text, size);
+	if (WANT("undo_redo_paste")) bench_undo_paste(text, size);
+	if (WANT("crlf_to_lf")) bench_crlf_to_lf(text, size);
+	if (WANT("save_file")) bench_save_file(text, size, NULL, "save_file");
+	if (WANT("save_file_crlf")) bench_save_file(text, size, &(TextFormat){ ENCODING_UTF8, LINE_ENDING_CRLF }, "save_file_crlf");
+
+	#undef WANT
+
+	free(text);
+}
+
+static size_t parse_size(const char *text)
+{
+	char *end;
+	size_t size = strtoul(text, &end, 10);
+
+	if (*end == 'K' || *end == 'k')
+	{
+		size <<= 10;
+	}
+	else if (*end == 'M' || *end == 'm')
+	{
+		size <<= 20;
+	}
+	else if (*end == 'G' || *end == 'g')
+	{
+		size <<= 30;
+	}
+
+	return size;
+}
+
+static const char *size_label(size_t size, char *out, size_t out_len)
+{
+	if (size >= (1 << 20) && size % (1 << 20) == 0)
+	{
+		snprintf(out, out_len, "%zuM", size >> 20);
+	}
+	else if (size >= 1024 && size % 1024 == 0)
+	{
+		snprintf(out, out_len, "%zuK", size >> 10);
+	}
+	else
+	{
+		snprintf(out, out_len, "%zu", size);
+	}
+
+	return out;
+}
+
+static int write_json(const char *path)
+{
+	FILE *fp = fopen(path, "w");
+
+	if (fp == NULL)
+	{
+		return -1;
+	}
+
+	// One result per line so --baseline can read it back without a JSON parser
+	fprintf(fp, "{\"results\":[\n");
+
+	for (size_t i = 0; i < result_count; i++)
+	{
+		Result *r = &results[i];
+
+		fprintf(fp, "{\"name\":\"%s\",\"size\":%zu,\"ops\":%zu,\"ns\":%lld,\"ns_per_op\":%.3f,\"mb_per_s\":%.3f,\"allocs_per_op\":%.3f}%s\n",
+			r->name, r->size, r->ops, r->ns, ns_per_op(r), mb_per_s(r), allocs_per_op(r), i + 1 < result_count ? "," : "");
+	}
+
+	fprintf(fp, "]}\n");
+
+	return fclose(fp);
+}
+
+static int write_csv(const char *path)
+{
+	FILE *fp = fopen(path, "w");
+
+	if (fp == NULL)
+	{
+		return -1;
+	}
+
+	fprintf(fp, "name,size,ops,ns,ns_per_op,mb_per_s,allocs_per_op\n");
+
+	for (size_t i = 0; i < result_count; i++)
+	{
+		Result *r = &results[i];
+
+		fprintf(fp, "%s,%zu,%zu,%lld,%.3f,%.3f,%.3f\n", r->name, r->size, r->ops, r->ns, ns_per_op(r), mb_per_s(r), allocs_per_op(r));
+	}
+
+	return fclose(fp);
+}
+
+// Looks up ns/op for name/size in a file written by write_json, -1 if absent
+static double baseline_ns_per_op(FILE *fp, const char *name, size_t size)
+{
+	char line[512];
+
+	rewind(fp);
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		char found_name[64];
+		size_t found_size;
+		double found_ns;
+
+		if (sscanf(line, "{\"name\":\"%63[^\"]\",\"size\":%zu,\"ops\":%*u,\"ns\":%*d,\"ns_per_op\":%lf",
+			found_name, &found_size, &found_ns) == 3
+			&& strcmp(found_name, name) == 0 && found_size == size)
+		{
+			return found_ns;
+		}
+	}
+
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *sizes = "1K,1M,100M";
+	const char *filter = NULL;
+	const char *json_path = NULL;
+	const char *csv_path = NULL;
+	const char *baseline_path = NULL;
+	double threshold = 25.0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "Missing value for %s\n", argv[i]);
+			return 2;
+		}
+
+		if (strcmp(argv[i], "--sizes") == 0) sizes = argv[++i];
+		else if (strcmp(argv[i], "--filter") == 0) filter = argv[++i];
+		else if (strcmp(argv[i], "--json") == 0) json_path = argv[++i];
+		else if (strcmp(argv[i], "--csv") == 0) csv_path = argv[++i];
+		else if (strcmp(argv[i], "--baseline") == 0) baseline_path = argv[++i];
+		else if (strcmp(argv[i], "--threshold") == 0) threshold = strtod(argv[++i], NULL);
+		else
+		{
+			fprintf(stderr, "usage: %s [--sizes 1K,1M,100M] [--filter NAME] [--json FILE] [--csv FILE] [--baseline FILE] [--threshold PCT]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	FILE *baseline = NULL;
+
+	if (baseline_path != NULL && (baseline = fopen(baseline_path, "r")) == NULL)
+	{
+		fprintf(stderr, "Cannot read baseline %s\n", baseline_path);
+		return 2;
+	}
+
+	char *size_list = strdup(sizes);
+
+	for (char *item = strtok(size_list, ","); item != NULL; item = strtok(NULL, ","))
+	{
+		size_t size = parse_size(item);
+
+		if (size > 0)
+		{
+			run_size(size, filter);
+		}
+	}
+
+	free(size_list);
+	fprintf(stderr, "\n");
+
+	printf("%-24s %6s %12s %12s %10s %10s", "case", "size", "ops", "ns/op", "MB/s", "allocs/op");
+	if (baseline != NULL)
+	{
+		printf(" %12s %8s", "baseline", "change");
+	}
+	printf("\n");
+
+	int regressions = 0;
+
+	for (size_t i = 0; i < result_count; i++)
+	{
+		Result *r = &results[i];
+		char label[24];
+
+		printf("%-24s %6s %12zu %12.1f %10.1f %10.3f", r->name, size_label(r->size, label, sizeof(label)), r->ops, ns_per_op(r), mb_per_s(r), allocs_per_op(r));
+
+		if (baseline != NULL)
+		{
+			double before = baseline_ns_per_op(baseline, r->name, r->size);
+
+			if (before > 0)
+			{
+				double change = (ns_per_op(r) - before) / before * 100.0;
+
+				printf(" %12.1f %+7.1f%%", before, change);
+
+				if (change > threshold)
+				{
+					printf("  SLOWER");
+					regressions++;
+				}
+			}
+			else
+			{
+				printf(" %12s %8s", "-", "new");
+			}
+		}
+
+		printf("\n");
+	}
+
+	if (baseline != NULL)
+	{
+		fclose(baseline);
+	}
+
+	// Every case frees what it made, anything live here is a leak
+	printf("\n");
+	mem_print_stats(stdout);
+
+	if ((json_path != NULL && write_json(json_path) != 0) || (csv_path != NULL && write_csv(csv_path) != 0))
+	{
+		fprintf(stderr, "Cannot write results\n");
+		return 2;
+	}
+
+	if (regressions > 0)
+	{
+		printf("\n%d cases more than %.0f%% slower than the baseline\n", regressions, threshold);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,577 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/alloc.h"
+#include "../src/buffer.h"
+#include "../src/highlight.h"
+#include "../src/render.h"
+#include "../src/utils.h"
+#include "capture.h"
+#include "vt.h"
+
+// Headless render benchmark. Every frame goes through render_text and
+// draw_status_line exactly like editor_draw_frame does, the bytes are read
+// back and replayed into a VtScreen, and the resulting screen is checked
+// against the buffer. Prints ns/frame and bytes/frame per scenario.
+
+typedef struct
+{
+	GapBuffer *buffer;
+	Highlighter highlighter;
+	Highlighter reference;   // Separate lexer state to check colors against
+	LanguageType language;
+
+	size_t screen_rows;
+	size_t screen_cols;
+	size_t row_offset;
+	size_t cursor_x;
+	size_t cursor_y;
+	bool in_search_mode;
+	char search_pattern[256];
+
+	Capture capture;
+	VtScreen vt;
+	TokenType *tokens;
+
+	long long *frame_ns;
+	size_t frames;
+	size_t frames_capacity;
+	size_t total_bytes;
+	size_t max_bytes;
+	size_t bad_frames;
+	char first_error[256];
+
+} Bench;
+
+static char *generate_c(size_t lines, size_t *len)
+{
+	static const char *templates[] = {
+		"/* Block comment opened on one line",
+		"   and closed on the next one */",
+		"static int function_%zu(int value, const char *name)",
+		"{",
+		"    int total = value * %zu + 0x1F; // trailing comment",
+		"    char *label = \"string number %zu with spaces\";",
+		"    for (int i = 0; i < total; i++) { total -= i; }",
+		"    return total;",
+		"}",
+		"",
+	};
+	size_t template_count = sizeof(templates) / sizeof(templates[0]);
+	size_t capacity = lines * 64 + 64;
+	char *text = malloc(capacity);
+	size_t used = 0;
+
+	for (size_t line = 0; line < lines; line++)
+	{
+		used += snprintf(text + used, capacity - used, templates[line % template_count], line);
+
+		if (line + 1 < lines)
+		{
+			text[used++] = '\n';
+		}
+	}
+
+	*len = used;
+	return text;
+}
+
+static char *generate_python(size_t lines, size_t *len)
+{
+	static const char *templates[] = {
+		"import os",
+		"class Handler%zu(object):",
+		"    def handle(self, request, retries=%zu):",
+		"        # Comments and strings should both be colored",
+		"        message = \"request %zu\" + 'done'",
+		"        if retries > 3 and request is not None:",
+		"            return self.handle(request, retries - 1)",
+		"        return message",
+		"",
+	};
+	size_t template_count = sizeof(templates) / sizeof(templates[0]);
+	size_t capacity = lines * 64 + 64;
+	char *text = malloc(capacity);
+	size_t used = 0;
+
+	for (size_t line = 0; line < lines; line++)
+	{
+		used += snprintf(text + used, capacity - used, templates[line % template_count], line);
+
+		if (line + 1 < lines)
+		{
+			text[used++] = '\n';
+		}
+	}
+
+	*len = used;
+	return text;
+}
+
+static char *generate_log(size_t lines, size_t *len)
+{
+	static const char *levels[] = { "INFO", "DEBUG", "WARN", "ERROR" };
+	size_t capacity = lines * 160 + 64;
+	char *text = malloc(capacity);
+	size_t used = 0;
+
+	for (size_t line = 0; line < lines; line++)
+	{
+		used += snprintf(text + used, capacity - used,
+			"2024-03-%02zu 12:%02zu:%02zu.%03zu %-5s [worker-%zu] GET /api/items/%zu status=200 bytes=%zu",
+			line % 28 + 1, line / 60 % 60, line % 60, line % 1000, levels[line % 4], line % 16, line, line * 37 % 100000);
+
+		// Every so often a line long enough to need clipping
+		if (line % 7 == 0)
+		{
+			used += snprintf(text + used, capacity - used, " trace=%0*zu", 60, line);
+		}
+
+		if (line + 1 < lines)
+		{
+			text[used++] = '\n';
+		}
+	}
+
+	*len = used;
+	return text;
+}
+
+static GapBuffer *buffer_from_text(char *text, size_t len)
+{
+	GapBuffer *buffer = buffer_create(len + 4096);
+
+	buffer_insert_text(buffer, text, len);
+	free(text);
+
+	return buffer;
+}
+
+static int bench_begin(Bench *b, GapBuffer *buffer, LanguageType language, size_t rows, size_t cols)
+{
+	memset(b, 0, sizeof(Bench));
+
+	b->buffer = buffer;
+	b->language = language;
+	b->screen_rows = rows;
+	b->screen_cols = cols;
+
+	highlighter_init(&b->highlighter, language);
+	highlighter_init(&b->reference, language);
+
+	b->tokens = malloc(sizeof(TokenType) * cols);
+	b->frames_capacity = 1024;
+	b->frame_ns = malloc(sizeof(long long) * b->frames_capacity);
+
+	if (b->tokens == NULL || b->frame_ns == NULL || vt_init(&b->vt, rows, cols) < 0)
+	{
+		return -1;
+	}
+
+	render_invalidate();
+
+	return capture_begin(&b->capture);
+}
+
+static void bench_error(Bench *b, const char *fmt, size_t row, size_t col, const char *detail)
+{
+	if (b->first_error[0] == '\0')
+	{
+		char where[64];
+
+		snprintf(where, sizeof(where), "frame %zu row %zu col %zu: ", b->frames, row, col);
+		strncpy(b->first_error, where, sizeof(b->first_error) - 1);
+		strncat(b->first_error, fmt, sizeof(b->first_error) - strlen(b->first_error) - 1);
+		strncat(b->first_error, detail, sizeof(b->first_error) - strlen(b->first_error) - 1);
+	}
+}
+
+static unsigned char expected_color(Bench *b, TokenType token)
+{
+	if (b->language == LANG_NONE)
+	{
+		return 0;
+	}
+
+	switch (token)
+	{
+		case KEYWORDS:  return 95;
+		case STRINGS:   return 92;
+		case COMMENTS:  return 90;
+		case NUMBERS:   return 93;
+		case OPERATORS: return 96;
+		default:        return 37;
+	}
+}
+
+// Compares every text row, its colors and the status line with what the
+// buffer says should be there, returns false on the first difference
+static bool bench_check_screen(Bench *b)
+{
+	size_t text_rows = b->screen_rows - 1;
+	size_t total_lines = buffer_get_total_lines(b->buffer);
+	size_t pattern_len = strlen(b->search_pattern);
+	char line_text[1024];
+	char expected[1024];
+	char actual[1024];
+
+	if (b->vt.wraps > 0 || b->vt.scrolls > 0)
+	{
+		bench_error(b, "output wrapped or scrolled the terminal", 0, 0, "");
+		return false;
+	}
+
+	for (size_t row = 0; row < text_rows; row++)
+	{
+		size_t line = b->row_offset + row;
+		size_t line_len = 0;
+
+		if (line < total_lines)
+		{
+			size_t start = buffer_line_start(b->buffer, line);
+
+			line_len = highlight_line(&b->reference, b->buffer, line, b->tokens, b->screen_cols);
+
+			if (line_len > sizeof(line_text) - 1)
+			{
+				line_len = sizeof(line_text) - 1;
+			}
+
+			for (size_t col = 0; col < line_len; col++)
+			{
+				line_text[col] = buffer_char_at(b->buffer, start + col);
+			}
+		}
+
+		size_t len = line_len < b->screen_cols ? line_len : b->screen_cols;
+
+		memcpy(expected, line_text, len);
+		expected[len] = '\0';
+
+		// Trailing blanks are indistinguishable from cleared cells
+		while (len > 0 && expected[len - 1] == ' ')
+		{
+			expected[--len] = '\0';
+		}
+
+		vt_row_text(&b->vt, row, actual);
+
+		if (strcmp(expected, actual) != 0)
+		{
+			bench_error(b, "text differs, got: ", row, 0, actual);
+			return false;
+		}
+
+		for (size_t col = 0; col < len; col++)
+		{
+			VtCell *cell = vt_cell(&b->vt, row, col);
+
+			if (b->in_search_mode && pattern_len > 0)
+			{
+				// A match that starts on screen is highlighted even if it runs past the edge
+				bool in_match = false;
+
+				for (size_t from = col + 1 > pattern_len ? col + 1 - pattern_len : 0; from <= col; from++)
+				{
+					if (from + pattern_len <= line_len && memcmp(line_text + from, b->search_pattern, pattern_len) == 0)
+					{
+						in_match = true;
+					}
+				}
+
+				if (in_match != (cell->bg == 43))
+				{
+					bench_error(b, "search highlight differs", row, col, "");
+					return false;
+				}
+			}
+			else
+			{
+				unsigned char want = expected_color(b, b->tokens[col]);
+
+				// NORMALTXT is only switched to after some other color
+				if (cell->fg != want && !(want == 37 && cell->fg == 0))
+				{
+					bench_error(b, "color differs", row, col, "");
+					return false;
+				}
+			}
+		}
+	}
+
+	if (b->in_search_mode)
+	{
+		snprintf(expected, sizeof(expected), "/%s", b->search_pattern);
+	}
+	else
+	{
+		snprintf(expected, sizeof(expected), " -- NORMAL -- Row: %zu, Col: %zu", b->cursor_y, b->cursor_x);
+	}
+
+	expected[b->screen_cols] = '\0';
+	vt_row_text(&b->vt, text_rows, actual);
+
+	if (strcmp(expected, actual) != 0 || !vt_cell(&b->vt, text_rows, 0)->reverse)
+	{
+		bench_error(b, "status line differs, got: ", text_rows, 0, actual);
+		return false;
+	}
+
+	return true;
+}
+
+// Draws one frame the way editor_draw_frame does and checks the result
+static void bench_frame(Bench *b)
+{
+	DirtyLines dirty = b->buffer->dirty;
+	EditorMode mode = b->in_search_mode ? SEARCH : NORMAL;
+
+	long long start = monotonic_ns();
+
+	render_text(b->buffer, &b->highlighter, b->row_offset, b->screen_rows - 1, 0, b->screen_cols, b->in_search_mode, b->search_pattern);
+	draw_status_line(b->cursor_x, b->cursor_y, b->screen_rows, mode, NULL, "", b->search_pattern, true);
+	printf("\x1b[%zu;%zuH", b->cursor_y - b->row_offset + 1, b->cursor_x + 1);
+	fflush(stdout);
+
+	long long elapsed = monotonic_ns() - start;
+
+	size_t bytes = capture_take(&b->capture);
+
+	if (b->frames == b->frames_capacity)
+	{
+		b->frames_capacity *= 2;
+		b->frame_ns = realloc(b->frame_ns, sizeof(long long) * b->frames_capacity);
+	}
+
+	b->frame_ns[b->frames] = elapsed;
+	b->total_bytes += bytes;
+
+	if (bytes > b->max_bytes)
+	{
+		b->max_bytes = bytes;
+	}
+
+	vt_feed(&b->vt, b->capture.data, bytes);
+	highlighter_invalidate(&b->reference, &dirty);
+
+	if (!bench_check_screen(b))
+	{
+		b->bad_frames++;
+	}
+
+	b->frames++;
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static bool bench_end(Bench *b, const char *name)
+{
+	capture_end(&b->capture);
+
+	long long total_ns = 0;
+
+	for (size_t i = 0; i < b->frames; i++)
+	{
+		total_ns += b->frame_ns[i];
+	}
+
+	qsort(b->frame_ns, b->frames, sizeof(long long), compare_ns);
+
+	size_t frames = b->frames > 0 ? b->frames : 1;
+
+	printf("%-16s %8zu %10lld %10lld %10lld %10zu %10zu  %s\n",
+		name, b->frames, total_ns / (long long)frames,
+		b->frame_ns[b->frames / 2], b->frame_ns[b->frames * 99 / 100],
+		b->total_bytes / frames, b->max_bytes,
+		b->bad_frames == 0 ? "ok" : "FAIL");
+
+	if (b->bad_frames > 0)
+	{
+		printf("    %zu bad frames, first at %s\n", b->bad_frames, b->first_error);
+	}
+
+	fflush(stdout);
+
+	bool ok = b->bad_frames == 0;
+
+	vt_free(&b->vt);
+	highlighter_free(&b->highlighter);
+	highlighter_free(&b->reference);
+	free(b->tokens);
+	free(b->frame_ns);
+	buffer_free(b->buffer);
+
+	return ok;
+}
+
+// Pages through the whole file from top to bottom
+static bool scenario_scroll(const char *name, GapBuffer *buffer, LanguageType language, size_t rows, size_t cols)
+{
+	Bench b;
+
+	if (bench_begin(&b, buffer, language, rows, cols) < 0)
+	{
+		return false;
+	}
+
+	size_t total_lines = buffer_get_total_lines(buffer);
+	size_t page = rows - 1;
+
+	for (size_t top = 0; top < total_lines; top += page)
+	{
+		b.row_offset = top;
+		b.cursor_y = top;
+		bench_frame(&b);
+	}
+
+	return bench_end(&b, name);
+}
+
+// Types into the middle of the file one character per frame, with newlines
+static bool scenario_type(const char *name, GapBuffer *buffer, LanguageType language, size_t rows, size_t cols, size_t chars)
+{
+	static const char snippet[] = "        total = total + item * 2  # running sum\n";
+	Bench b;
+
+	if (bench_begin(&b, buffer, language, rows, cols) < 0)
+	{
+		return false;
+	}
+
+	size_t middle = buffer_get_total_lines(buffer) / 2;
+	size_t target = buffer_line_start(buffer, middle);
+
+	while (buffer->gap_start > target)
+	{
+		buffer_move_cursor_left(buffer);
+	}
+
+	b.row_offset = middle > rows / 2 ? middle - rows / 2 : 0;
+
+	for (size_t i = 0; i < chars; i++)
+	{
+		buffer_insert_char(buffer, snippet[i % (sizeof(snippet) - 1)]);
+
+		b.cursor_y = buffer->gap_line;
+		b.cursor_x = buffer->gap_start - buffer_line_start(buffer, buffer->gap_line);
+
+		// Same rule as scroll() in the editor
+		if (b.cursor_y >= b.row_offset + rows - 1)
+		{
+			b.row_offset = b.cursor_y - rows + 2;
+		}
+
+		bench_frame(&b);
+	}
+
+	return bench_end(&b, name);
+}
+
+// Search highlighting while paging, including the frames that turn it on
+static bool scenario_search(const char *name, GapBuffer *buffer, LanguageType language, size_t rows, size_t cols, const char *pattern)
+{
+	Bench b;
+
+	if (bench_begin(&b, buffer, language, rows, cols) < 0)
+	{
+		return false;
+	}
+
+	size_t total_lines = buffer_get_total_lines(buffer);
+	size_t page = rows - 1;
+
+	bench_frame(&b);
+
+	// Typing the pattern one letter at a time, as in the / prompt
+	b.in_search_mode = true;
+
+	for (size_t i = 0; pattern[i] != '\0'; i++)
+	{
+		b.search_pattern[i] = pattern[i];
+		b.search_pattern[i + 1] = '\0';
+		bench_frame(&b);
+	}
+
+	for (size_t top = 0; top < total_lines; top += page)
+	{
+		b.row_offset = top;
+		b.cursor_y = top;
+		bench_frame(&b);
+	}
+
+	return bench_end(&b, name);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t rows = 24;
+	size_t cols = 80;
+	size_t scroll_lines = 1000000;
+	size_t type_chars = 10000;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "--rows") == 0)
+		{
+			rows = strtoul(argv[i + 1], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--cols") == 0)
+		{
+			cols = strtoul(argv[i + 1], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--lines") == 0)
+		{
+			scroll_lines = strtoul(argv[i + 1], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--chars") == 0)
+		{
+			type_chars = strtoul(argv[i + 1], NULL, 10);
+		}
+	}
+
+	if (rows < 2 || cols < 20 || cols > 1000)
+	{
+		fprintf(stderr, "usage: %s [--rows N] [--cols N] [--lines N] [--chars N]\n", argv[0]);
+		return 2;
+	}
+
+	size_t len;
+	bool ok = true;
+
+	printf("screen %zux%zu, %zu lines to scroll, %zu chars to type\n\n", rows, cols, scroll_lines, type_chars);
+	printf("%-16s %8s %10s %10s %10s %10s %10s  %s\n",
+		"scenario", "frames", "ns/frame", "p50", "p99", "bytes/frm", "max bytes", "screen");
+
+	char *text = generate_c(scroll_lines, &len);
+	ok &= scenario_scroll("scroll-c", buffer_from_text(text, len), LANG_C, rows, cols);
+
+	text = generate_python(scroll_lines, &len);
+	ok &= scenario_scroll("scroll-python", buffer_from_text(text, len), LANG_PYTHON, rows, cols);
+
+	text = generate_log(scroll_lines, &len);
+	ok &= scenario_scroll("scroll-log", buffer_from_text(text, len), LANG_NONE, rows, cols);
+
+	text = generate_c(20000, &len);
+	ok &= scenario_type("type-c", buffer_from_text(text, len), LANG_C, rows, cols, type_chars);
+
+	text = generate_python(20000, &len);
+	ok &= scenario_type("type-python", buffer_from_text(text, len), LANG_PYTHON, rows, cols, type_chars);
+
+	text = generate_python(scroll_lines / 10, &len);
+	ok &= scenario_search("search-python", buffer_from_text(text, len), LANG_PYTHON, rows, cols, "return");
+
+	text = generate_log(scroll_lines / 10, &len);
+	ok &= scenario_search("search-log", buffer_from_text(text, len), LANG_NONE, rows, cols, "status=200");
+
+	// Everything is freed by now, what's left live is kept across frames
+	printf("\n");
+	mem_print_stats(stdout);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/alloc.h"
+#include "../src/editor.h"
+#include "../src/input.h"
+#include "../src/utils.h"
+#include "capture.h"
+#include "vt.h"
+
+// Replays a keystroke recording (vesper --record FILE) through the editor's
+// own key handling and frame drawing, headless, against a fixed file.
+// Chunks are fed exactly as read() returned them, a lone ESC resolves when
+// the recorded gap to the next chunk is longer than escape_timeout_ms, and
+// one frame is drawn per chunk like the event loop does. Reports latency
+// percentiles per key, per frame and from input to finished frame.
+
+extern EditorState state;
+
+typedef struct
+{
+	long long usec;
+	char *bytes;
+	size_t len;
+
+} Chunk;
+
+typedef struct
+{
+	long long *ns;
+	size_t count;
+	size_t capacity;
+
+} Samples;
+
+typedef struct
+{
+	InputDecoder input;
+	Capture capture;
+	VtScreen vt;
+
+	Samples key;
+	Samples frame;
+	Samples total;
+	size_t frame_bytes;
+	bool quit;
+
+} Replay;
+
+static void samples_add(Samples *s, long long ns)
+{
+	if (s->count == s->capacity)
+	{
+		s->capacity = s->capacity == 0 ? 1024 : s->capacity * 2;
+		s->ns = realloc(s->ns, sizeof(long long) * s->capacity);
+	}
+
+	s->ns[s->count++] = ns;
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static long long samples_percentile(Samples *s, size_t percent)
+{
+	if (s->count == 0)
+	{
+		return 0;
+	}
+
+	size_t index = s->count * percent / 100;
+
+	return s->ns[index < s->count ? index : s->count - 1];
+}
+
+static int hex_value(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static Chunk *load_recording(const char *path, size_t *count)
+{
+	FILE *fp = fopen(path, "r");
+
+	if (fp == NULL)
+	{
+		return NULL;
+	}
+
+	Chunk *chunks = NULL;
+	size_t capacity = 0;
+	char *line = NULL;
+	size_t line_capacity = 0;
+	ssize_t line_len;
+
+	*count = 0;
+
+	while ((line_len = getline(&line, &line_capacity, fp)) > 0)
+	{
+		char *hex;
+		long long usec = strtoll(line, &hex, 10);
+
+		if (line[0] == '#' || hex == line)
+		{
+			continue;
+		}
+
+		while (*hex == ' ')
+		{
+			hex++;
+		}
+
+		if (*count == capacity)
+		{
+			capacity = capacity == 0 ? 256 : capacity * 2;
+			chunks = realloc(chunks, sizeof(Chunk) * capacity);
+		}
+
+		Chunk *chunk = &chunks[*count];
+		chunk->usec = usec;
+		chunk->bytes = malloc(strlen(hex) / 2 + 1);
+		chunk->len = 0;
+
+		while (hex_value(hex[0]) >= 0 && hex_value(hex[1]) >= 0)
+		{
+			chunk->bytes[chunk->len++] = (char)(hex_value(hex[0]) << 4 | hex_value(hex[1]));
+			hex += 2;
+		}
+
+		(*count)++;
+	}
+
+	free(line);
+	fclose(fp);
+
+	return chunks;
+}
+
+// Applies every decoded key, then draws one frame for the lot
+static void replay_drain(Replay *r)
+{
+	KeyEvent event;
+	bool any = false;
+	long long burst_start = monotonic_ns();
+
+	while (!r->quit && input_next_key(&r->input, &event))
+	{
+		long long start = monotonic_ns();
+
+		if (!editor_handle_key(state.buffer, state.filename, &event))
+		{
+			r->quit = true;
+		}
+
+		samples_add(&r->key, monotonic_ns() - start);
+		any = true;
+	}
+
+	if (!any || r->quit)
+	{
+		return;
+	}
+
+	long long start = monotonic_ns();
+
+	editor_draw_frame(state.buffer);
+
+	long long end = monotonic_ns();
+
+	samples_add(&r->frame, end - start);
+	samples_add(&r->total, end - burst_start);
+
+	size_t bytes = capture_take(&r->capture);
+	r->frame_bytes += bytes;
+	vt_feed(&r->vt, r->capture.data, bytes);
+}
+
+static void print_samples(const char *name, Samples *s)
+{
+	qsort(s->ns, s->count, sizeof(long long), compare_ns);
+
+	printf("%-14s %8zu %10.1f %10.1f %10.1f\n", name, s->count,
+		samples_percentile(s, 50) / 1000.0,
+		samples_percentile(s, 99) / 1000.0,
+		s->count > 0 ? s->ns[s->count - 1] / 1000.0 : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t rows = 24;
+	size_t cols = 80;
+	double max_p99_us = 0;
+	bool dump = false;
+	int arg = 1;
+
+	while (arg < argc && strncmp(argv[arg], "--", 2) == 0)
+	{
+		if (strcmp(argv[arg], "--dump") == 0)
+		{
+			dump = true;
+			arg++;
+		}
+		else if (arg + 1 < argc && strcmp(argv[arg], "--rows") == 0)
+		{
+			rows = strtoul(argv[arg + 1], NULL, 10);
+			arg += 2;
+		}
+		else if (arg + 1 < argc && strcmp(argv[arg], "--cols") == 0)
+		{
+			cols = strtoul(argv[arg + 1], NULL, 10);
+			arg += 2;
+		}
+		else if (arg + 1 < argc && strcmp(argv[arg], "--max-p99-us") == 0)
+		{
+			max_p99_us = strtod(argv[arg + 1], NULL);
+			arg += 2;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if (argc - arg != 2 || rows < 2 || cols < 20 || cols > 1000)
+	{
+		fprintf(stderr, "usage: %s [--rows N] [--cols N] [--max-p99-us N] [--dump] RECORDING FILE\n", argv[0]);
+		return 2;
+	}
+
+	size_t chunk_count;
+	Chunk *chunks = load_recording(argv[arg], &chunk_count);
+
+	if (chunks == NULL)
+	{
+		fprintf(stderr, "Cannot read recording %s\n", argv[arg]);
+		return 2;
+	}
+
+	Replay r;
+	memset(&r, 0, sizeof(Replay));
+
+	editor_init(argv[arg + 1]);
+
+	// The file only sets the starting point, :w and Ctrl-S must not touch it
+	state.filename = NULL;
+	state.screen_rows = rows;
+	state.screen_cols = cols;
+
+	input_init(&r.input);
+
+	if (vt_init(&r.vt, rows, cols) < 0 || capture_begin(&r.capture) < 0)
+	{
+		fprintf(stderr, "Cannot set up the virtual terminal\n");
+		return 2;
+	}
+
+	editor_draw_frame(state.buffer);
+	vt_feed(&r.vt, r.capture.data, capture_take(&r.capture));
+
+	long long escape_timeout_us = (long long)state.config.escape_timeout_ms * 1000;
+	long long paste_timeout_us = (long long)INPUT_PASTE_TIMEOUT_MS * 1000;
+
+	for (size_t i = 0; i < chunk_count && !r.quit; i++)
+	{
+		// Nothing followed the ESC in time, the editor would have taken it as
+		// a key. Same for a paste that stalled without its terminator.
+		InputPartial partial = input_partial(&r.input);
+		long long gap = i > 0 ? chunks[i].usec - chunks[i - 1].usec : 0;
+
+		if ((partial == INPUT_PARTIAL_ESCAPE && gap >= escape_timeout_us)
+			|| (partial == INPUT_IN_PASTE && gap >= paste_timeout_us))
+		{
+			input_expire_escape(&r.input);
+			replay_drain(&r);
+		}
+
+		size_t fed = 0;
+
+		while (fed < chunks[i].len && !r.quit)
+		{
+			fed += input_feed(&r.input, chunks[i].bytes + fed, chunks[i].len - fed);
+			replay_drain(&r);
+		}
+	}
+
+	if (!r.quit && input_partial(&r.input) != INPUT_IDLE)
+	{
+		input_expire_escape(&r.input);
+		replay_drain(&r);
+	}
+
+	capture_end(&r.capture);
+
+	printf("%zu chunks from %s against %s, %zux%zu\n\n", chunk_count, argv[arg], argv[arg + 1], rows, cols);
+	printf("%-14s %8s %10s %10s %10s\n", "stage", "count", "p50 us", "p99 us", "max us");
+	print_samples("key", &r.key);
+	print_samples("frame", &r.frame);
+	print_samples("input->frame", &r.total);
+	printf("\n%zu bytes/frame on average\n", r.frame.count > 0 ? r.frame_bytes / r.frame.count : 0);
+
+	if (dump)
+	{
+		char text[1024];
+
+		printf("\nFinal screen:\n");
+
+		for (size_t row = 0; row < rows; row++)
+		{
+			vt_row_text(&r.vt, row, text);
+			printf("|%s\n", text);
+		}
+	}
+
+	printf("\n");
+	mem_print_stats(stdout);
+
+	double p99_us = samples_percentile(&r.total, 99) / 1000.0;
+
+	if (max_p99_us > 0 && p99_us > max_p99_us)
+	{
+		printf("\nFAIL: input->frame p99 %.1f us is over the %.1f us limit\n", p99_us, max_p99_us);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,385 @@
+#include <stdlib.h>
+#include <string.h>
+#include "vt.h"
+
+static const VtCell blank_cell = { ' ', 0, 0, false, false };
+
+int vt_init(VtScreen *vt, size_t rows, size_t cols)
+{
+	memset(vt, 0, sizeof(VtScreen));
+
+	vt->cells = malloc(sizeof(VtCell) * rows * cols);
+
+	if (vt->cells == NULL)
+	{
+		return -1;
+	}
+
+	vt->rows = rows;
+	vt->cols = cols;
+	vt->pen = blank_cell;
+	vt->parse_state = VT_GROUND;
+
+	for (size_t i = 0; i < rows * cols; i++)
+	{
+		vt->cells[i] = blank_cell;
+	}
+
+	return 0;
+}
+
+void vt_free(VtScreen *vt)
+{
+	free(vt->cells);
+	vt->cells = NULL;
+}
+
+VtCell *vt_cell(VtScreen *vt, size_t row, size_t col)
+{
+	return &vt->cells[row * vt->cols + col];
+}
+
+// Copies a row's characters into out (cols + 1 bytes) without trailing blanks
+size_t vt_row_text(VtScreen *vt, size_t row, char *out)
+{
+	size_t len = 0;
+
+	for (size_t col = 0; col < vt->cols; col++)
+	{
+		out[col] = vt_cell(vt, row, col)->ch;
+
+		if (out[col] != ' ')
+		{
+			len = col + 1;
+		}
+	}
+
+	out[len] = '\0';
+	return len;
+}
+
+static void vt_clear_range(VtScreen *vt, size_t row, size_t from_col, size_t to_col)
+{
+	for (size_t col = from_col; col < to_col && col < vt->cols; col++)
+	{
+		*vt_cell(vt, row, col) = blank_cell;
+	}
+}
+
+static void vt_scroll_up(VtScreen *vt)
+{
+	memmove(vt->cells, vt->cells + vt->cols, sizeof(VtCell) * (vt->rows - 1) * vt->cols);
+	vt_clear_range(vt, vt->rows - 1, 0, vt->cols);
+	vt->scrolls++;
+}
+
+static void vt_line_feed(VtScreen *vt)
+{
+	if (vt->cursor_row + 1 < vt->rows)
+	{
+		vt->cursor_row++;
+	}
+	else
+	{
+		vt_scroll_up(vt);
+	}
+}
+
+static void vt_put_char(VtScreen *vt, char c)
+{
+	if (vt->wrap_pending)
+	{
+		vt->wrap_pending = false;
+		vt->cursor_col = 0;
+		vt_line_feed(vt);
+		vt->wraps++;
+	}
+
+	VtCell *cell = vt_cell(vt, vt->cursor_row, vt->cursor_col);
+	*cell = vt->pen;
+	cell->ch = c;
+
+	if (vt->cursor_col + 1 < vt->cols)
+	{
+		vt->cursor_col++;
+	}
+	else
+	{
+		vt->wrap_pending = true;
+	}
+}
+
+static int vt_param(VtScreen *vt, size_t index, int fallback)
+{
+	if (index >= vt->param_count || vt->params[index] == 0)
+	{
+		return fallback;
+	}
+
+	return vt->params[index];
+}
+
+static void vt_move_to(VtScreen *vt, int row, int col)
+{
+	if (row < 0)
+	{
+		row = 0;
+	}
+	if (col < 0)
+	{
+		col = 0;
+	}
+
+	vt->cursor_row = (size_t)row < vt->rows ? (size_t)row : vt->rows - 1;
+	vt->cursor_col = (size_t)col < vt->cols ? (size_t)col : vt->cols - 1;
+	vt->wrap_pending = false;
+}
+
+static void vt_select_graphic_rendition(VtScreen *vt)
+{
+	if (vt->param_count == 0)
+	{
+		vt->pen = blank_cell;
+		return;
+	}
+
+	for (size_t i = 0; i < vt->param_count; i++)
+	{
+		int p = vt->params[i];
+
+		if (p == 0)
+		{
+			vt->pen = blank_cell;
+		}
+		else if (p == 2)
+		{
+			vt->pen.dim = true;
+		}
+		else if (p == 22)
+		{
+			vt->pen.dim = false;
+		}
+		else if (p == 7)
+		{
+			vt->pen.reverse = true;
+		}
+		else if (p == 27)
+		{
+			vt->pen.reverse = false;
+		}
+		else if ((p >= 30 && p <= 37) || (p >= 90 && p <= 97))
+		{
+			vt->pen.fg = p;
+		}
+		else if (p == 39)
+		{
+			vt->pen.fg = 0;
+		}
+		else if ((p >= 40 && p <= 47) || (p >= 100 && p <= 107))
+		{
+			vt->pen.bg = p;
+		}
+		else if (p == 49)
+		{
+			vt->pen.bg = 0;
+		}
+	}
+}
+
+static void vt_dispatch_csi(VtScreen *vt, char final)
+{
+	// Mode switches like ?25l or ?2004h don't change what's on screen
+	if (vt->private_marker)
+	{
+		return;
+	}
+
+	int row = (int)vt->cursor_row;
+	int col = (int)vt->cursor_col;
+
+	switch (final)
+	{
+		case 'H':
+		case 'f':
+			vt_move_to(vt, vt_param(vt, 0, 1) - 1, vt_param(vt, 1, 1) - 1);
+			break;
+
+		case 'A':
+			vt_move_to(vt, row - vt_param(vt, 0, 1), col);
+			break;
+
+		case 'B':
+			vt_move_to(vt, row + vt_param(vt, 0, 1), col);
+			break;
+
+		case 'C':
+			vt_move_to(vt, row, col + vt_param(vt, 0, 1));
+			break;
+
+		case 'D':
+			vt_move_to(vt, row, col - vt_param(vt, 0, 1));
+			break;
+
+		case 'K':
+		{
+			int mode = vt_param(vt, 0, 0);
+
+			if (mode == 0)
+			{
+				vt_clear_range(vt, vt->cursor_row, vt->cursor_col, vt->cols);
+			}
+			else if (mode == 1)
+			{
+				vt_clear_range(vt, vt->cursor_row, 0, vt->cursor_col + 1);
+			}
+			else
+			{
+				vt_clear_range(vt, vt->cursor_row, 0, vt->cols);
+			}
+			break;
+		}
+
+		case 'J':
+		{
+			int mode = vt_param(vt, 0, 0);
+			size_t first_row = mode == 0 ? vt->cursor_row + 1 : 0;
+			size_t last_row = mode == 1 ? vt->cursor_row : vt->rows;
+
+			if (mode == 0)
+			{
+				vt_clear_range(vt, vt->cursor_row, vt->cursor_col, vt->cols);
+			}
+			else if (mode == 1)
+			{
+				vt_clear_range(vt, vt->cursor_row, 0, vt->cursor_col + 1);
+			}
+
+			for (size_t r = first_row; r < last_row; r++)
+			{
+				vt_clear_range(vt, r, 0, vt->cols);
+			}
+			break;
+		}
+
+		case 'm':
+			vt_select_graphic_rendition(vt);
+			break;
+
+		default:
+			break;
+	}
+}
+
+void vt_feed(VtScreen *vt, const char *data, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		unsigned char c = (unsigned char)data[i];
+
+		switch (vt->parse_state)
+		{
+			case VT_GROUND:
+				if (c == 27)
+				{
+					vt->parse_state = VT_ESCAPE;
+				}
+				else if (c == '\r')
+				{
+					vt->cursor_col = 0;
+					vt->wrap_pending = false;
+				}
+				else if (c == '\n')
+				{
+					vt_line_feed(vt);
+					vt->wrap_pending = false;
+				}
+				else if (c == '\b')
+				{
+					if (vt->cursor_col > 0)
+					{
+						vt->cursor_col--;
+					}
+					vt->wrap_pending = false;
+				}
+				else if (c == '\t')
+				{
+					size_t next = (vt->cursor_col / 8 + 1) * 8;
+					vt->cursor_col = next < vt->cols ? next : vt->cols - 1;
+				}
+				else if (c >= 0x20 && c != 0x7F)
+				{
+					// Bytes of a UTF-8 sequence each take a cell, close enough here
+					vt_put_char(vt, (char)c);
+				}
+				break;
+
+			case VT_ESCAPE:
+				if (c == '[')
+				{
+					vt->parse_state = VT_CSI;
+					vt->param_count = 0;
+					vt->private_marker = false;
+					memset(vt->params, 0, sizeof(vt->params));
+				}
+				else if (c == ']')
+				{
+					vt->parse_state = VT_OSC;
+				}
+				else
+				{
+					vt->parse_state = VT_GROUND;
+				}
+				break;
+
+			case VT_CSI:
+				if (c >= '0' && c <= '9')
+				{
+					if (vt->param_count == 0)
+					{
+						vt->param_count = 1;
+					}
+
+					int *param = &vt->params[vt->param_count - 1];
+
+					if (*param < 10000)
+					{
+						*param = *param * 10 + (c - '0');
+					}
+				}
+				else if (c == ';')
+				{
+					if (vt->param_count == 0)
+					{
+						vt->param_count = 1;
+					}
+
+					if (vt->param_count < VT_MAX_PARAMS)
+					{
+						vt->param_count++;
+					}
+				}
+				else if (c == '?' || c == '>' || c == '=')
+				{
+					vt->private_marker = true;
+				}
+				else if (c >= 0x40 && c <= 0x7E)
+				{
+					vt_dispatch_csi(vt, (char)c);
+					vt->parse_state = VT_GROUND;
+				}
+				break;
+
+			case VT_OSC:
+				// Window titles and the like end with BEL or ESC backslash
+				if (c == 7)
+				{
+					vt->parse_state = VT_GROUND;
+				}
+				else if (c == 27)
+				{
+					vt->parse_state = VT_ESCAPE;
+				}
+				break;
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef VT_SCREEN_H
+#define VT_SCREEN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Just enough of a VT100/xterm to check what the renderer puts on screen:
+// cursor movement, erase, SGR colors, autowrap and scrolling. Everything
+// else is parsed and ignored.
+
+typedef struct
+{
+	char ch;
+	unsigned char fg;   // SGR color number (30-37, 90-97), 0 for the default
+	unsigned char bg;   // SGR color number (40-47, 100-107), 0 for the default
+	bool reverse;
+	bool dim;
+
+} VtCell;
+
+typedef enum
+{
+	VT_GROUND,
+	VT_ESCAPE,
+	VT_CSI,
+	VT_OSC
+
+} VtParseState;
+
+#define VT_MAX_PARAMS 16
+
+typedef struct
+{
+	size_t rows;
+	size_t cols;
+	VtCell *cells;
+
+	size_t cursor_row;
+	size_t cursor_col;
+	bool wrap_pending;   // Wrote the last column, the next char wraps
+	VtCell pen;          // Attributes given to newly written cells
+
+	VtParseState parse_state;
+	int params[VT_MAX_PARAMS];
+	size_t param_count;
+	bool private_marker;
+
+	// Things a correct frame should never cause
+	size_t wraps;
+	size_t scrolls;
+
+} VtScreen;
+
+int vt_init(VtScreen *vt, size_t rows, size_t cols);
+void vt_free(VtScreen *vt);
+void vt_feed(VtScreen *vt, const char *data, size_t len);
+VtCell *vt_cell(VtScreen *vt, size_t row, size_t col);
+size_t vt_row_text(VtScreen *vt, size_t row, char *out);
+
+#endif
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <curl/curl.h>
+#include "ai.h"
+#include "alloc.h"
+#include "event_loop.h"
+#include "trace.h"
+
+struct ResponseBuffer
+{
+	char *data;
+	size_t size;
+};
+
+// Callback function for libcurl - receives response data
+size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    size_t total_size = size * nmemb;
+    struct ResponseBuffer *response = (struct ResponseBuffer *)userp;
+    
+    // Reallocate buffer to fit new data
+    char *ptr = mem_realloc(MEM_AI, response->data, response->size + total_size + 1);
+    if (ptr == NULL) {
+        return 0;  // Out of memory
+    }
+    
+    response->data = ptr;
+    memcpy(&(response->data[response->size]), contents, total_size);
+    response->size += total_size;
+    response->data[response->size] = '\0';
+    
+    return total_size;
+}
+
+char* call_claude_api(char *context, char *api_key)
+{
+	struct ResponseBuffer response;
+	response.data = NULL;
+	response.size = 0;
+
+	CURL *curl = curl_easy_init();
+
+	if (curl == NULL)
+	{
+		return NULL;	
+	}
+
+	char json[4096];
+
+	snprintf(json, sizeof(json),
+    "{"
+    "\"model\":\"claude-sonnet-4-20250514\","
+    "\"max_tokens\":200,"
+    "\"messages\":[{\"role\":\"user\",\"content\":\"Complete this code, reply with ONLY the completion code, no explanation, no markdown, no backticks:\\n%s\"}]"
+    "}",
+    context);
+
+	char auth_header[512];
+	snprintf(auth_header, sizeof(auth_header), "x-api-key: %s", api_key);
+
+	struct curl_slist *headers = NULL;
+	
+	headers = curl_slist_append(headers, auth_header);
+	
+	headers = curl_slist_append(headers, "anthropic-version: 2023-06-01");
+
+	headers = curl_slist_append(headers, "content-type: application/json");
+
+	curl_easy_setopt(curl, CURLOPT_URL, "https://api.anthropic.com/v1/messages");
+
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json);
+
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+
+	// Runs on a worker thread, so curl must not use signals for timeouts
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+	CURLcode res = curl_easy_perform(curl);
+
+	if (res != CURLE_OK)
+	{
+		curl_slist_free_all(headers);
+		curl_easy_cleanup(curl);
+		
+		if (response.data != NULL)
+		{
+			mem_free(MEM_AI, response.data);
+		}
+
+		return NULL;
+	}
+
+	curl_slist_free_all(headers);
+	curl_easy_cleanup(curl);
+
+	char *text_start = strstr(response.data, "\"text\":\"");
+	if (text_start != NULL)
+	{
+		text_start += 8;
+    
+    // Find end by scanning for \" (escaped quote followed by nothing more)
+    // Better: find the last "}] before stop_reason
+    char *stop = strstr(response.data, "\"stop_reason\"");
+    if (stop != NULL)
+    {
+        // Work backwards from stop_reason to find closing "}
+        while (stop > text_start && !(*stop == '"' && *(stop-1) == '}'))
+        {
+            stop--;
+        }
+        if (stop > text_start)
+        {
+            *(stop - 1) = '\0';
+        }
+    }
+    
+    char *result = mem_strdup(MEM_AI, text_start);
+    // Convert escape sequences
+    char *src = result;
+    char *dst = result;
+    while (*src)
+    {
+        if (*src == '\\' && *(src+1) == 'n')
+        {
+            *dst = '\n'; src += 2;
+        }
+        else if (*src == '\\' && *(src+1) == '"')
+        {
+            *dst = '"'; src += 2;
+        }
+        else
+        {
+            *dst = *src; src++;
+        }
+        dst++;
+    }
+    *dst = '\0';
+    
+    mem_free(MEM_AI, response.data);
+    return result;
+   }
+
+	// No text field, e.g. an error response
+	mem_free(MEM_AI, response.data);
+	return NULL;
+}
+
+
+char* read_api_key()
+{
+    // Try environment variable first
+    char *key = getenv("ANTHROPIC_API_KEY");
+    if (key != NULL && strlen(key) > 0)
+    {
+        // Found in environment, return a copy
+        return mem_strdup(MEM_AI, key);
+    }
+    
+    // Try reading from config file
+    char config_path[1024];
+    snprintf(config_path, sizeof(config_path), "%s/.vesperrc", getenv("HOME"));
+    
+    FILE *fp = fopen(config_path, "r");
+    if (fp != NULL)
+    {
+        char line[1024];
+        while (fgets(line, sizeof(line), fp))
+        {
+            // Look for ANTHROPIC_API_KEY=...
+            if (strncmp(line, "ANTHROPIC_API_KEY=", 18) == 0)
+            {
+                // Extract key (after the =)
+                char *key_start = line + 18;
+                
+                // Remove newline if present
+                char *newline = strchr(key_start, '\n');
+                if (newline) *newline = '\0';
+                
+                fclose(fp);
+                return mem_strdup(MEM_AI, key_start);
+            }
+        }
+        fclose(fp);
+    }
+    
+    // Not found anywhere
+    return NULL;
+}
+
+typedef struct
+{
+	EventLoop *loop;
+	char *context;
+	char *api_key;
+	char *suggestion;
+	AiCallback callback;
+	void *data;
+	Completion done;
+
+} AiRequest;
+
+// Requests have no timeout and their workers are detached, so quitting
+// doesn't wait for them: after ai_shutdown they finish without the loop
+static pthread_mutex_t ai_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool ai_stopped = false;
+
+void ai_init(void)
+{
+	// Not thread safe, so it has to happen before any worker starts
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+}
+
+// Call before the loop is freed. No worker posts to it once this returns.
+void ai_shutdown(void)
+{
+	pthread_mutex_lock(&ai_lock);
+	ai_stopped = true;
+	pthread_mutex_unlock(&ai_lock);
+}
+
+static void ai_request_free(AiRequest *request)
+{
+	mem_free(MEM_AI, request->context);
+	mem_free(MEM_AI, request->api_key);
+	mem_free(MEM_AI, request);
+}
+
+// Runs back on the loop's thread once the worker is done
+static void ai_request_done(void *data)
+{
+	AiRequest *request = data;
+
+	TRACE_BEGIN("ai callback");
+	request->callback(request->suggestion, request->data);
+	TRACE_END("ai callback");
+
+	ai_request_free(request);
+}
+
+static void *ai_worker(void *data)
+{
+	AiRequest *request = data;
+
+	TRACE_THREAD_NAME("ai worker");
+	TRACE_BEGIN("ai request");
+	request->suggestion = call_claude_api(request->context, request->api_key);
+	TRACE_END("ai request");
+
+	// Held while posting, so ai_shutdown can't return in the middle of it
+	pthread_mutex_lock(&ai_lock);
+	bool stopped = ai_stopped;
+
+	if (!stopped)
+	{
+		event_loop_post(request->loop, &request->done, ai_request_done, request);
+	}
+
+	pthread_mutex_unlock(&ai_lock);
+
+	if (stopped)
+	{
+		mem_free(MEM_AI, request->suggestion);
+		ai_request_free(request);
+	}
+
+	return NULL;
+}
+
+// Calls the API on a worker thread so the editor keeps responding; callback
+// gets the suggestion (or NULL) on the loop's thread and must mem_free it (MEM_AI)
+bool ai_request_suggestion(EventLoop *loop, char *context, char *api_key, AiCallback callback, void *data)
+{
+	AiRequest *request = mem_alloc(MEM_AI, sizeof(AiRequest));
+
+	if (request == NULL)
+	{
+		return false;
+	}
+
+	memset(request, 0, sizeof(AiRequest));
+	request->loop = loop;
+	request->context = mem_strdup(MEM_AI, context);
+	request->api_key = mem_strdup(MEM_AI, api_key);
+	request->suggestion = NULL;
+	request->callback = callback;
+	request->data = data;
+
+	pthread_t thread;
+
+	if (request->context == NULL || request->api_key == NULL || pthread_create(&thread, NULL, ai_worker, request) != 0)
+	{
+		ai_request_free(request);
+		return false;
+	}
+
+	pthread_detach(thread);
+	return true;
+}
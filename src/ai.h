@@ -0,0 +1,15 @@
+#ifndef AI_H
+#define AI_H
+
+#include <stdbool.h>
+#include "event_loop.h"
+
+typedef void (*AiCallback)(char *suggestion, void *data);
+
+void ai_init(void);
+void ai_shutdown(void);
+char* call_claude_api(char *context, char *api_key);
+char* read_api_key();
+bool ai_request_suggestion(EventLoop *loop, char *context, char *api_key, AiCallback callback, void *data);
+
+#endif
@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "alloc.h"
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#define usable_size(ptr) malloc_usable_size(ptr)
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define usable_size(ptr) malloc_size(ptr)
+#else
+// No way to ask the size back, live bytes only cover what was never freed
+#define usable_size(ptr) ((size_t)0)
+#endif
+
+// Bytes are what the allocator really handed out, a bit over what was
+// asked for. The AI worker allocates too, so the counters are atomic.
+typedef struct
+{
+	atomic_size_t live_bytes;
+	atomic_size_t live_count;
+	atomic_size_t peak_bytes;
+	atomic_size_t total_count;
+
+} MemCounters;
+
+bool mem_overlay_enabled = false;
+
+static const char *tag_names[MEM_TAG_COUNT] = {
+	"buffer",
+	"undo",
+	"tabs",
+	"highlight",
+	"input",
+	"ai",
+};
+
+// One slot per tag plus the overall total, whose peak isn't a sum of peaks
+static MemCounters counters[MEM_TAG_COUNT + 1];
+
+static void raise_peak(MemCounters *c, size_t live)
+{
+	size_t peak = atomic_load_explicit(&c->peak_bytes, memory_order_relaxed);
+
+	while (live > peak && !atomic_compare_exchange_weak_explicit(&c->peak_bytes, &peak, live, memory_order_relaxed, memory_order_relaxed))
+	{
+	}
+}
+
+static void count_alloc(MemCounters *c, size_t bytes, bool new_block)
+{
+	size_t live = atomic_fetch_add_explicit(&c->live_bytes, bytes, memory_order_relaxed) + bytes;
+
+	if (new_block)
+	{
+		atomic_fetch_add_explicit(&c->live_count, 1, memory_order_relaxed);
+	}
+
+	atomic_fetch_add_explicit(&c->total_count, 1, memory_order_relaxed);
+	raise_peak(c, live);
+}
+
+static void count_free(MemCounters *c, size_t bytes)
+{
+	atomic_fetch_sub_explicit(&c->live_bytes, bytes, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&c->live_count, 1, memory_order_relaxed);
+}
+
+void *mem_alloc(MemTag tag, size_t size)
+{
+	void *ptr = malloc(size);
+
+	if (ptr != NULL)
+	{
+		size_t bytes = usable_size(ptr);
+
+		count_alloc(&counters[tag], bytes, true);
+		count_alloc(&counters[MEM_TAG_COUNT], bytes, true);
+	}
+
+	return ptr;
+}
+
+void *mem_realloc(MemTag tag, void *ptr, size_t size)
+{
+	if (ptr == NULL)
+	{
+		return mem_alloc(tag, size);
+	}
+
+	size_t old_bytes = usable_size(ptr);
+	void *new_ptr = realloc(ptr, size);
+
+	// On failure the old block is untouched and still counted
+	if (new_ptr != NULL)
+	{
+		size_t new_bytes = usable_size(new_ptr);
+
+		for (int i = 0; i < 2; i++)
+		{
+			MemCounters *c = i == 0 ? &counters[tag] : &counters[MEM_TAG_COUNT];
+
+			atomic_fetch_sub_explicit(&c->live_bytes, old_bytes, memory_order_relaxed);
+			count_alloc(c, new_bytes, false);
+		}
+	}
+
+	return new_ptr;
+}
+
+char *mem_strdup(MemTag tag, const char *text)
+{
+	size_t len = strlen(text);
+	char *copy = mem_alloc(tag, len + 1);
+
+	if (copy != NULL)
+	{
+		memcpy(copy, text, len + 1);
+	}
+
+	return copy;
+}
+
+void mem_free(MemTag tag, void *ptr)
+{
+	if (ptr == NULL)
+	{
+		return;
+	}
+
+	size_t bytes = usable_size(ptr);
+
+	count_free(&counters[tag], bytes);
+	count_free(&counters[MEM_TAG_COUNT], bytes);
+
+	free(ptr);
+}
+
+const char *mem_tag_name(MemTag tag)
+{
+	return tag < MEM_TAG_COUNT ? tag_names[tag] : "total";
+}
+
+static void read_counters(MemCounters *c, MemStats *out)
+{
+	out->live_bytes = atomic_load_explicit(&c->live_bytes, memory_order_relaxed);
+	out->live_count = atomic_load_explicit(&c->live_count, memory_order_relaxed);
+	out->peak_bytes = atomic_load_explicit(&c->peak_bytes, memory_order_relaxed);
+	out->total_count = atomic_load_explicit(&c->total_count, memory_order_relaxed);
+}
+
+void mem_get_stats(MemTag tag, MemStats *out)
+{
+	read_counters(&counters[tag], out);
+}
+
+void mem_get_total(MemStats *out)
+{
+	read_counters(&counters[MEM_TAG_COUNT], out);
+}
+
+// Benchmarks print this after their results
+void mem_print_stats(FILE *fp)
+{
+	MemStats stats;
+
+	fprintf(fp, "%-10s %14s %10s %14s %12s\n", "memory", "live bytes", "blocks", "peak bytes", "allocs");
+
+	for (int i = 0; i <= MEM_TAG_COUNT; i++)
+	{
+		read_counters(&counters[i], &stats);
+		fprintf(fp, "%-10s %14zu %10zu %14zu %12zu\n", mem_tag_name(i), stats.live_bytes, stats.live_count, stats.peak_bytes, stats.total_count);
+	}
+}
+
+// Sizes for the overlay, 1023 bytes then 1.0K and so on
+static void format_bytes(size_t bytes, char *out, size_t out_len)
+{
+	if (bytes < 1024)
+	{
+		snprintf(out, out_len, "%zu", bytes);
+	}
+	else if (bytes < 1024 * 1024)
+	{
+		snprintf(out, out_len, "%.1fK", bytes / 1024.0);
+	}
+	else if (bytes < 1024 * 1024 * 1024)
+	{
+		snprintf(out, out_len, "%.1fM", bytes / (1024.0 * 1024.0));
+	}
+	else
+	{
+		snprintf(out, out_len, "%.1fG", bytes / (1024.0 * 1024.0 * 1024.0));
+	}
+}
+
+void mem_draw_overlay(size_t first_row, size_t screen_cols)
+{
+	if (screen_cols < MEM_OVERLAY_COLS)
+	{
+		return;
+	}
+
+	size_t col = screen_cols - MEM_OVERLAY_COLS + 1;
+	MemStats stats;
+	char live[16];
+	char peak[16];
+
+	printf("\x1b[%zu;%zuH\x1b[7m %-10s %8s %8s %8s %8s \x1b[0m", first_row, col, "memory", "live", "blocks", "peak", "allocs");
+
+	for (int i = 0; i <= MEM_TAG_COUNT; i++)
+	{
+		read_counters(&counters[i], &stats);
+		format_bytes(stats.live_bytes, live, sizeof(live));
+		format_bytes(stats.peak_bytes, peak, sizeof(peak));
+
+		printf("\x1b[%zu;%zuH\x1b[7m %-10s %8s %8zu %8s %8zu \x1b[0m", first_row + i + 1, col, mem_tag_name(i), live, stats.live_count, peak, stats.total_count);
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Thin tagged wrappers over malloc/realloc/free that keep per-subsystem
+// counters, shown by :memstats and the benchmarks. Memory from these can
+// still be released with plain free(), it just stays counted as live.
+typedef enum
+{
+	MEM_BUFFER,      // Gap buffer text and line index
+	MEM_UNDO,        // Undo/redo stacks and their contents
+	MEM_TABS,        // Tabs, filenames and file load scratch
+	MEM_HIGHLIGHT,   // Highlighter line state and render token rows
+	MEM_INPUT,       // Paste buffer and event loop completions
+	MEM_AI,          // Requests, HTTP responses and suggestions
+	MEM_TAG_COUNT
+
+} MemTag;
+
+#define MEM_OVERLAY_ROWS (MEM_TAG_COUNT + 2)
+#define MEM_OVERLAY_COLS 48
+
+typedef struct
+{
+	size_t live_bytes;
+	size_t live_count;
+	size_t peak_bytes;
+	size_t total_count;   // Allocations ever made, reallocs included
+
+} MemStats;
+
+extern bool mem_overlay_enabled;
+
+void *mem_alloc(MemTag tag, size_t size);
+void *mem_realloc(MemTag tag, void *ptr, size_t size);
+char *mem_strdup(MemTag tag, const char *text);
+void mem_free(MemTag tag, void *ptr);
+
+const char *mem_tag_name(MemTag tag);
+void mem_get_stats(MemTag tag, MemStats *out);
+void mem_get_total(MemStats *out);
+void mem_print_stats(FILE *fp);
+void mem_draw_overlay(size_t first_row, size_t screen_cols);
+
+#endif
@@ -2,20 +2,57 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "buffer.h"
+#include "alloc.h"
+#include "profile.h"
 #include <sys/types.h>
 
+static void buffer_truncate_line_index(GapBuffer *buffer, size_t line_number);
+static bool buffer_before_write(GapBuffer *buffer, size_t from, size_t to);
+static bool buffer_unshare(GapBuffer *buffer, size_t new_capacity);
+
+// Counts eight bytes at a time: XOR turns newlines into zero bytes, and
+// the high bit of each byte in `zero` is set exactly for the zero bytes.
+// Much faster than a memchr per line on source code, where lines are short.
+size_t buffer_count_newlines(const char *text, size_t len)
+{
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+	size_t newlines = 0;
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, text + i, 8);
+
+		word ^= ones * '\n';
+
+		uint64_t zero = ~(((word & low7) + low7) | word | low7);
+		// One bit per newline at the bottom of each byte, summed by the multiply
+		newlines += (((zero >> 7) * ones) >> 56);
+	}
+
+	for (; i < len; i++)
+	{
+		newlines += text[i] == '\n';
+	}
+
+	return newlines;
+}
+
 GapBuffer* buffer_create(size_t initial_size) {
 
-	GapBuffer *buffer = malloc(sizeof(GapBuffer));
+	GapBuffer *buffer = mem_alloc(MEM_BUFFER, sizeof(GapBuffer));
 
 	if(buffer == NULL) {
 		return NULL;
 	}
 
-	buffer->data = malloc(sizeof(char) * initial_size);
+	buffer->data = mem_alloc(MEM_BUFFER, sizeof(char) * initial_size);
 	if(buffer->data ==NULL) {
-		free(buffer);
+		mem_free(MEM_BUFFER, buffer);
 		return NULL;
 	}
 
@@ -23,10 +60,52 @@ GapBuffer* buffer_create(size_t initial_size) {
 	buffer->gap_end = initial_size;
 	buffer->capacity = initial_size;
 
+	buffer->gap_line = 0;
+	buffer->line_count = 1;
+	buffer->snapshot = NULL;
+	buffer->edit_hook = NULL;
+	buffer->edit_hook_data = NULL;
+
+	buffer->line_starts = mem_alloc(MEM_BUFFER, sizeof(size_t) * 64);
+	if (buffer->line_starts == NULL)
+	{
+		mem_free(MEM_BUFFER, buffer->data);
+		mem_free(MEM_BUFFER, buffer);
+		return NULL;
+	}
+
+	// Line 0 always starts at offset 0
+	buffer->line_starts[0] = 0;
+	buffer->lines_indexed = 1;
+	buffer->line_starts_capacity = 64;
+
+	buffer_mark_all_dirty(buffer);
+
 	return buffer;
 
 }
 
+void buffer_free(GapBuffer *buffer)
+{
+	if (buffer == NULL)
+	{
+		return;
+	}
+
+	if (buffer->snapshot != NULL)
+	{
+		// A save is still reading it, the snapshot frees it when done
+		buffer->snapshot->owns_data = true;
+	}
+	else
+	{
+		mem_free(MEM_BUFFER, buffer->data);
+	}
+
+	mem_free(MEM_BUFFER, buffer->line_starts);
+	mem_free(MEM_BUFFER, buffer);
+}
+
 int buffer_cursor_to_index(GapBuffer *buffer, int cursor_pos) 
 {
 	if (cursor_pos < buffer->gap_start) 
@@ -42,14 +121,45 @@ int buffer_cursor_to_index(GapBuffer *buffer, int cursor_pos)
 
 void buffer_insert_char(GapBuffer *buffer, char c) 
 {
+	long long profile_start = profile_begin();
+
 	if (buffer->gap_start == buffer->gap_end) 
 	{
 		buffer_grow(buffer);
 	}
 
+	if (!buffer_before_write(buffer, buffer->gap_start, buffer->gap_start + 1))
+	{
+		profile_end(PROF_BUFFER_EDIT, profile_start);
+		return;
+	}
+
 	buffer->data[buffer->gap_start] = c;
 
+	if (buffer->edit_hook != NULL)
+	{
+		buffer->edit_hook(buffer->edit_hook_data, true, buffer->gap_start, &c, 1);
+	}
+
 	buffer->gap_start++;
+
+	// Offsets up to and including the start of this line are still correct
+	buffer_truncate_line_index(buffer, buffer->gap_line);
+
+	if (c == '\n')
+	{
+		// Every line below moves down by one
+		buffer_mark_dirty_from(buffer, buffer->gap_line);
+
+		buffer->gap_line++;
+		buffer->line_count++;
+	}
+	else
+	{
+		buffer_mark_dirty(buffer, buffer->gap_line);
+	}
+
+	profile_end(PROF_BUFFER_EDIT, profile_start);
 }
 
 void buffer_delete_char(GapBuffer *buffer)
@@ -59,7 +169,31 @@ void buffer_delete_char(GapBuffer *buffer)
 		return;
 	}
 
+	long long profile_start = profile_begin();
+
 	buffer->gap_start--;
+
+	if (buffer->edit_hook != NULL)
+	{
+		buffer->edit_hook(buffer->edit_hook_data, false, buffer->gap_start, &buffer->data[buffer->gap_start], 1);
+	}
+
+	if (buffer->data[buffer->gap_start] == '\n')
+	{
+		// Two lines joined, every line below moves up by one
+		buffer->gap_line--;
+		buffer->line_count--;
+
+		buffer_mark_dirty_from(buffer, buffer->gap_line);
+	}
+	else
+	{
+		buffer_mark_dirty(buffer, buffer->gap_line);
+	}
+
+	buffer_truncate_line_index(buffer, buffer->gap_line);
+
+	profile_end(PROF_BUFFER_EDIT, profile_start);
 }
 
 void buffer_move_cursor_right(GapBuffer *buffer)
@@ -69,8 +203,18 @@ void buffer_move_cursor_right(GapBuffer *buffer)
 		return;
 	}
 
+	if (!buffer_before_write(buffer, buffer->gap_start, buffer->gap_start + 1))
+	{
+		return;
+	}
+
 	buffer->data[buffer->gap_start] = buffer->data[buffer->gap_end];
 
+	if (buffer->data[buffer->gap_start] == '\n')
+	{
+		buffer->gap_line++;
+	}
+
 	buffer->gap_start++;
 	buffer->gap_end++;
 }
@@ -82,10 +226,20 @@ void buffer_move_cursor_left(GapBuffer *buffer)
 		return;
 	}
 
+	if (!buffer_before_write(buffer, buffer->gap_end - 1, buffer->gap_end))
+	{
+		return;
+	}
+
 	buffer->gap_start--;
 	buffer->gap_end--;
 
 	buffer->data[buffer->gap_end] = buffer->data[buffer->gap_start];
+
+	if (buffer->data[buffer->gap_end] == '\n')
+	{
+		buffer->gap_line--;
+	}
 }
 
 void buffer_grow(GapBuffer *buffer) 
@@ -94,8 +248,15 @@ void buffer_grow(GapBuffer *buffer)
 	size_t old_gap_end = buffer->gap_end;
 
 	size_t new_capacity = buffer->capacity * 2;
+
+	if (buffer->snapshot != NULL)
+	{
+		// realloc could free the array the snapshot reads, copy instead
+		buffer_unshare(buffer, new_capacity);
+		return;
+	}
 	
-	char *new_data = realloc(buffer->data, new_capacity * sizeof(char));
+	char *new_data = mem_realloc(MEM_BUFFER, buffer->data, new_capacity * sizeof(char));
 
 	if(new_data == NULL) 
 	{
@@ -116,87 +277,315 @@ void buffer_grow(GapBuffer *buffer)
 	
 }
 
-void buffer_print_debug(GapBuffer *buffer) {
-    printf("Buffer contents: [");
-    for (size_t i = 0; i < buffer->capacity; i++) {
-        if (i >= buffer->gap_start && i < buffer->gap_end) {
-            printf("_");  // Show gap as underscore
-        } else {
-            printf("%c", buffer->data[i]);
-        }
-    }
-    printf("]\n");
-    printf("gap_start=%zu, gap_end=%zu, capacity=%zu\n", 
-           buffer->gap_start, buffer->gap_end, buffer->capacity);
+void buffer_reserve(GapBuffer *buffer, size_t extra)
+{
+	size_t gap_size = buffer->gap_end - buffer->gap_start;
+
+	if (gap_size >= extra)
+	{
+		return;
+	}
+
+	// Grow once to the final size instead of doubling repeatedly
+	size_t new_capacity = buffer->capacity * 2;
+	size_t needed = buffer->capacity - gap_size + extra;
+
+	if (new_capacity < needed)
+	{
+		new_capacity = needed;
+	}
+
+	if (buffer->snapshot != NULL)
+	{
+		buffer_unshare(buffer, new_capacity);
+		return;
+	}
+
+	char *new_data = mem_realloc(MEM_BUFFER, buffer->data, new_capacity * sizeof(char));
+
+	if (new_data == NULL)
+	{
+		return;
+	}
+
+	buffer->data = new_data;
+
+	size_t chars_to_move = buffer->capacity - buffer->gap_end;
+	size_t new_gap_end = new_capacity - chars_to_move;
+
+	memmove(&buffer->data[new_gap_end],
+	       &buffer->data[buffer->gap_end],
+	       chars_to_move);
+
+	buffer->gap_end = new_gap_end;
+	buffer->capacity = new_capacity;
 }
 
-size_t buffer_get_line_length(GapBuffer *buffer, size_t line_number)
+// Copies the text into a new array of new_capacity, gap in the same logical
+// place, and leaves the old array to the snapshot that was sharing it
+static bool buffer_unshare(GapBuffer *buffer, size_t new_capacity)
 {
-	size_t current_row = 0;
-	size_t column_count = 0;
+	char *new_data = mem_alloc(MEM_BUFFER, new_capacity * sizeof(char));
 
-	for (size_t i = 0; i < buffer->capacity; i++)
+	if (new_data == NULL)
 	{
-		if (i >= buffer->gap_start && i < buffer->gap_end)
-		{
-			continue;
-		}
+		return false;
+	}
 
-		char c = buffer->data[i];
-		
-		if (current_row == line_number)
+	size_t back = buffer->capacity - buffer->gap_end;
+
+	memcpy(new_data, buffer->data, buffer->gap_start);
+	memcpy(&new_data[new_capacity - back], &buffer->data[buffer->gap_end], back);
+
+	buffer->snapshot->owns_data = true;
+	buffer->snapshot = NULL;
+
+	buffer->data = new_data;
+	buffer->gap_end = new_capacity - back;
+	buffer->capacity = new_capacity;
+
+	return true;
+}
+
+// Called before data[from, to) is written. Inside the snapshot's gap the
+// bytes are nobody's, typing at the spot the snapshot was taken stays
+// there; anywhere else the buffer has to move to its own copy first.
+static bool buffer_before_write(GapBuffer *buffer, size_t from, size_t to)
+{
+	BufferSnapshot *snapshot = buffer->snapshot;
+
+	if (snapshot == NULL || (from >= snapshot->gap_start && to <= snapshot->gap_end))
+	{
+		return true;
+	}
+
+	return buffer_unshare(buffer, buffer->capacity);
+}
+
+void buffer_insert_text(GapBuffer *buffer, const char *text, size_t len)
+{
+	if (len == 0)
+	{
+		return;
+	}
+
+	long long profile_start = profile_begin();
+
+	buffer_reserve(buffer, len);
+
+	if (buffer->gap_end - buffer->gap_start < len)
+	{
+		profile_end(PROF_BUFFER_EDIT, profile_start);
+		return;
+	}
+
+	if (!buffer_before_write(buffer, buffer->gap_start, buffer->gap_start + len))
+	{
+		profile_end(PROF_BUFFER_EDIT, profile_start);
+		return;
+	}
+
+	memcpy(&buffer->data[buffer->gap_start], text, len);
+
+	if (buffer->edit_hook != NULL)
+	{
+		buffer->edit_hook(buffer->edit_hook_data, true, buffer->gap_start, text, len);
+	}
+
+	buffer_commit_gap(buffer, len);
+
+	profile_end(PROF_BUFFER_EDIT, profile_start);
+}
+
+// The first len bytes of the gap were filled in by the caller, like a file
+// read straight into it; they become text before the gap
+void buffer_commit_gap(GapBuffer *buffer, size_t len)
+{
+	size_t newlines = buffer_count_newlines(&buffer->data[buffer->gap_start], len);
+
+	buffer->gap_start += len;
+
+	buffer_truncate_line_index(buffer, buffer->gap_line);
+
+	if (newlines > 0)
+	{
+		buffer_mark_dirty_from(buffer, buffer->gap_line);
+	}
+	else
+	{
+		buffer_mark_dirty(buffer, buffer->gap_line);
+	}
+
+	buffer->gap_line += newlines;
+	buffer->line_count += newlines;
+}
+
+// Puts the gap at logical offset pos with one memmove of the text in between
+void buffer_move_gap(GapBuffer *buffer, size_t pos)
+{
+	size_t length = buffer_length(buffer);
+
+	if (pos > length)
+	{
+		pos = length;
+	}
+
+	if (pos < buffer->gap_start)
+	{
+		size_t count = buffer->gap_start - pos;
+
+		if (!buffer_before_write(buffer, buffer->gap_end - count, buffer->gap_end))
 		{
-    			// We're on the line we want!
-    			// Check if this character is newline
-    			if (c == '\n')
-    			{
-        			// Found end of line - return the count
-        			return column_count;
-    			}
-    			else
-    			{
-        		// Still on the line - count this character
-        		column_count++;
-    			}
+			return;
 		}
-		
-		else
+
+		buffer->gap_line -= buffer_count_newlines(&buffer->data[pos], count);
+		memmove(&buffer->data[buffer->gap_end - count], &buffer->data[pos], count);
+
+		buffer->gap_start = pos;
+		buffer->gap_end -= count;
+	}
+	else if (pos > buffer->gap_start)
+	{
+		size_t count = pos - buffer->gap_start;
+
+		if (!buffer_before_write(buffer, buffer->gap_start, buffer->gap_start + count))
 		{
-    			// We're on a different row
-    			// Check if newline (move to next row)
-    			if (c == '\n')
-    			{
-        		current_row++;
-    			}
+			return;
 		}
+
+		buffer->gap_line += buffer_count_newlines(&buffer->data[buffer->gap_end], count);
+		memmove(&buffer->data[buffer->gap_start], &buffer->data[buffer->gap_end], count);
+
+		buffer->gap_start = pos;
+		buffer->gap_end += count;
+	}
+}
+
+// Deletes len characters starting at logical offset pos by widening the gap
+void buffer_delete_range(GapBuffer *buffer, size_t pos, size_t len)
+{
+	size_t length = buffer_length(buffer);
+
+	if (pos >= length || len == 0)
+	{
+		return;
+	}
+
+	if (len > length - pos)
+	{
+		len = length - pos;
+	}
+
+	buffer_move_gap(buffer, pos);
+
+	if (buffer->edit_hook != NULL)
+	{
+		buffer->edit_hook(buffer->edit_hook_data, false, pos, &buffer->data[buffer->gap_end], len);
+	}
+
+	long long profile_start = profile_begin();
+	size_t newlines = buffer_count_newlines(&buffer->data[buffer->gap_end], len);
+
+	if (newlines > 0)
+	{
+		buffer_mark_dirty_from(buffer, buffer->gap_line);
+	}
+	else
+	{
+		buffer_mark_dirty(buffer, buffer->gap_line);
 	}
 
-	return column_count;
+	buffer->gap_end += len;
+	buffer->line_count -= newlines;
 
+	buffer_truncate_line_index(buffer, buffer->gap_line);
+
+	profile_end(PROF_BUFFER_EDIT, profile_start);
 }
 
-size_t buffer_get_total_lines(GapBuffer *buffer)
+// Forgets the first len bytes, the way a followed log lets its oldest
+// lines go. Not an edit, the hook isn't told. The line index starts over
+// and every line is dirty: they all moved up.
+void buffer_drop_front(GapBuffer *buffer, size_t len)
 {
-	size_t line_count = 1;
+	size_t length = buffer_length(buffer);
 
-	for (size_t i = 0; i < buffer->capacity; i++)
+	if (len > length)
 	{
-		if (i >= buffer->gap_start && i < buffer->gap_end)
-                 {
-                         continue;
-                 }
+		len = length;
+	}
 
-		// Count \n amount of characters
+	if (len == 0)
+	{
+		return;
+	}
 
-		char c = buffer->data[i];
+	size_t newlines;
 
-		if (c == '\n')
+	if (buffer->gap_start >= len)
+	{
+		// The usual case, the gap is at the end: what's left slides down
+		if (!buffer_before_write(buffer, 0, buffer->gap_start))
 		{
-			line_count++;
+			return;
 		}
+
+		newlines = buffer_count_newlines(buffer->data, len);
+		memmove(buffer->data, &buffer->data[len], buffer->gap_start - len);
+		buffer->gap_start -= len;
+	}
+	else
+	{
+		// With the gap right after them, dropping them only widens it
+		buffer_move_gap(buffer, len);
+		newlines = buffer->gap_line;
+		buffer->gap_start = 0;
 	}
 
-	return line_count;
+	buffer->gap_line -= newlines;
+	buffer->line_count -= newlines;
+
+	buffer_truncate_line_index(buffer, 0);
+	buffer_mark_all_dirty(buffer);
+}
+
+void buffer_print_debug(GapBuffer *buffer) {
+    printf("Buffer contents: [");
+    for (size_t i = 0; i < buffer->capacity; i++) {
+        if (i >= buffer->gap_start && i < buffer->gap_end) {
+            printf("_");  // Show gap as underscore
+        } else {
+            printf("%c", buffer->data[i]);
+        }
+    }
+    printf("]\n");
+    printf("gap_start=%zu, gap_end=%zu, capacity=%zu\n", 
+           buffer->gap_start, buffer->gap_end, buffer->capacity);
+}
+
+size_t buffer_get_line_length(GapBuffer *buffer, size_t line_number)
+{
+	if (line_number >= buffer->line_count)
+	{
+		return 0;
+	}
+
+	size_t line_start = buffer_line_start(buffer, line_number);
+
+	if (line_number + 1 < buffer->line_count)
+	{
+		// Next line starts right after this line's newline
+		return buffer_line_start(buffer, line_number + 1) - 1 - line_start;
+	}
+
+	return buffer_length(buffer) - line_start;
+}
+
+size_t buffer_get_total_lines(GapBuffer *buffer)
+{
+	// Kept up to date by every insert and delete
+	return buffer->line_count;
 }
 
 ssize_t buffer_find_pattern(GapBuffer *buffer, char *pattern, size_t start_pos)
@@ -360,3 +749,240 @@ size_t buffer_screen_to_index(GapBuffer *buffer, size_t target_row, size_t targe
     
     return buffer->capacity;  // Return end if not found
 }
+
+size_t buffer_length(GapBuffer *buffer)
+{
+	return buffer->capacity - (buffer->gap_end - buffer->gap_start);
+}
+
+char buffer_char_at(GapBuffer *buffer, size_t pos)
+{
+	if (pos < buffer->gap_start)
+	{
+		return buffer->data[pos];
+	}
+
+	return buffer->data[pos + (buffer->gap_end - buffer->gap_start)];
+}
+
+static void buffer_truncate_line_index(GapBuffer *buffer, size_t line_number)
+{
+	// Entries after line_number may have shifted, rebuild them on demand
+	if (buffer->lines_indexed > line_number + 1)
+	{
+		buffer->lines_indexed = line_number + 1;
+	}
+}
+
+static void buffer_index_line_start(GapBuffer *buffer, size_t offset)
+{
+	if (buffer->lines_indexed >= buffer->line_starts_capacity)
+	{
+		size_t new_capacity = buffer->line_starts_capacity * 2;
+		size_t *new_starts = mem_realloc(MEM_BUFFER, buffer->line_starts, sizeof(size_t) * new_capacity);
+
+		if (new_starts == NULL)
+		{
+			return;
+		}
+
+		buffer->line_starts = new_starts;
+		buffer->line_starts_capacity = new_capacity;
+	}
+
+	buffer->line_starts[buffer->lines_indexed] = offset;
+	buffer->lines_indexed++;
+}
+
+size_t buffer_line_start(GapBuffer *buffer, size_t line_number)
+{
+	if (line_number >= buffer->line_count)
+	{
+		return buffer_length(buffer);
+	}
+
+	if (buffer->lines_indexed > line_number)
+	{
+		return buffer->line_starts[line_number];
+	}
+
+	long long profile_start = profile_begin();
+
+	// Extend the index from the last known line start, one span at a time
+	while (buffer->lines_indexed <= line_number)
+	{
+		size_t pos = buffer->line_starts[buffer->lines_indexed - 1];
+		size_t gap_size = buffer->gap_end - buffer->gap_start;
+		size_t length = buffer_length(buffer);
+		size_t wanted = buffer->lines_indexed;
+
+		while (buffer->lines_indexed <= line_number && pos < length)
+		{
+			char *span;
+			size_t span_len;
+
+			if (pos < buffer->gap_start)
+			{
+				span = &buffer->data[pos];
+				span_len = buffer->gap_start - pos;
+			}
+			else
+			{
+				span = &buffer->data[pos + gap_size];
+				span_len = length - pos;
+			}
+
+			char *newline = memchr(span, '\n', span_len);
+
+			if (newline == NULL)
+			{
+				pos += span_len;
+				continue;
+			}
+
+			pos += (size_t)(newline - span) + 1;
+			buffer_index_line_start(buffer, pos);
+		}
+
+		// Out of memory for the index, or line_count disagrees with the text
+		if (buffer->lines_indexed == wanted)
+		{
+			profile_end(PROF_LINE_INDEX, profile_start);
+			return length;
+		}
+	}
+
+	profile_end(PROF_LINE_INDEX, profile_start);
+
+	return buffer->line_starts[line_number];
+}
+
+void buffer_mark_dirty(GapBuffer *buffer, size_t line_number)
+{
+	DirtyLines *dirty = &buffer->dirty;
+
+	if (!dirty->any)
+	{
+		dirty->first = line_number;
+		dirty->last = line_number;
+		dirty->to_end = false;
+		dirty->any = true;
+		return;
+	}
+
+	if (line_number < dirty->first)
+	{
+		dirty->first = line_number;
+	}
+
+	if (line_number > dirty->last)
+	{
+		dirty->last = line_number;
+	}
+}
+
+void buffer_mark_dirty_from(GapBuffer *buffer, size_t line_number)
+{
+	buffer_mark_dirty(buffer, line_number);
+	buffer->dirty.to_end = true;
+}
+
+void buffer_mark_all_dirty(GapBuffer *buffer)
+{
+	buffer->dirty.any = false;
+	buffer_mark_dirty_from(buffer, 0);
+}
+
+void buffer_clear_dirty(GapBuffer *buffer)
+{
+	buffer->dirty.any = false;
+	buffer->dirty.to_end = false;
+}
+
+bool buffer_line_is_dirty(GapBuffer *buffer, size_t line_number)
+{
+	DirtyLines *dirty = &buffer->dirty;
+
+	if (!dirty->any || line_number < dirty->first)
+	{
+		return false;
+	}
+
+	return dirty->to_end || line_number <= dirty->last;
+}
+
+// Freezes the text as it is now without copying it. NULL while an earlier
+// snapshot is still sharing the array.
+BufferSnapshot *buffer_snapshot(GapBuffer *buffer)
+{
+	if (buffer->snapshot != NULL)
+	{
+		return NULL;
+	}
+
+	BufferSnapshot *snapshot = mem_alloc(MEM_BUFFER, sizeof(BufferSnapshot));
+
+	if (snapshot == NULL)
+	{
+		return NULL;
+	}
+
+	snapshot->data = buffer->data;
+	snapshot->gap_start = buffer->gap_start;
+	snapshot->gap_end = buffer->gap_end;
+	snapshot->capacity = buffer->capacity;
+	snapshot->owns_data = false;
+
+	buffer->snapshot = snapshot;
+
+	return snapshot;
+}
+
+// buffer may be NULL once the buffer itself is gone
+void buffer_snapshot_release(GapBuffer *buffer, BufferSnapshot *snapshot)
+{
+	if (buffer != NULL && buffer->snapshot == snapshot)
+	{
+		buffer->snapshot = NULL;
+	}
+
+	if (snapshot->owns_data)
+	{
+		mem_free(MEM_BUFFER, snapshot->data);
+	}
+
+	mem_free(MEM_BUFFER, snapshot);
+}
+
+// FNV-1a, carried on from hash
+static uint64_t hash_bytes(uint64_t hash, const char *data, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+// Both sides of the gap, as if they were one string
+static uint64_t hash_spans(const char *data, size_t gap_start, size_t gap_end, size_t capacity)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	hash = hash_bytes(hash, data, gap_start);
+	hash = hash_bytes(hash, data + gap_end, capacity - gap_end);
+
+	return hash;
+}
+
+uint64_t buffer_hash(GapBuffer *buffer)
+{
+	return hash_spans(buffer->data, buffer->gap_start, buffer->gap_end, buffer->capacity);
+}
+
+uint64_t buffer_snapshot_hash(BufferSnapshot *snapshot)
+{
+	return hash_spans(snapshot->data, snapshot->gap_start, snapshot->gap_end, snapshot->capacity);
+}
@@ -2,23 +2,77 @@
 #define GAP_BUFFER
 
 #include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
-typedef struct 
+// Span of logical lines touched since the last frame was drawn
+typedef struct
+{
+	size_t first;
+	size_t last;
+	bool to_end;   // Everything from first to the end of the file changed
+	bool any;
+
+} DirtyLines;
+
+// The text as it was at one moment, for a background save to read while
+// editing goes on. It shares the buffer's array until the buffer is about
+// to write over one of its two spans (or reallocate); then the buffer
+// moves to a copy and the old array is left to the snapshot.
+typedef struct
+{
+	char *data;
+	size_t gap_start;
+	size_t gap_end;
+	size_t capacity;
+	bool owns_data;   // The buffer moved on, data goes with the snapshot
+
+} BufferSnapshot;
+
+// Told about every edit as it happens (the swap file listens). The text
+// is what was inserted or deleted, only valid during the call. Text
+// committed with buffer_commit_gap, a file being loaded, isn't an edit.
+typedef void (*BufferEditHook)(void *data, bool insert, size_t pos, const char *text, size_t len);
+
+typedef struct
 {
 	char* data;
 	size_t gap_start;
 	size_t gap_end;
 	size_t capacity;
+
+	size_t gap_line;     // Number of newlines before the gap
+	size_t line_count;   // Newlines + 1
+
+	// Lazily built line start offsets (logical positions)
+	size_t *line_starts;
+	size_t lines_indexed;
+	size_t line_starts_capacity;
+
+	DirtyLines dirty;
+
+	BufferSnapshot *snapshot;   // Still sharing data, at most one at a time
+
+	BufferEditHook edit_hook;   // NULL when nobody listens
+	void *edit_hook_data;
 } GapBuffer;
 
+size_t buffer_count_newlines(const char *text, size_t len);
 GapBuffer* buffer_create(size_t initial_size);
+void buffer_free(GapBuffer *buffer);
 int buffer_cursor_to_index(GapBuffer* buffer, int cursor_pos);
 void buffer_insert_char(GapBuffer *buffer, char c);
 void buffer_delete_char(GapBuffer *buffer);
 void buffer_move_cursor_left(GapBuffer *buffer);
 void buffer_move_cursor_right(GapBuffer *buffer);
 void buffer_grow(GapBuffer *buffer);
+void buffer_reserve(GapBuffer *buffer, size_t extra);
+void buffer_insert_text(GapBuffer *buffer, const char *text, size_t len);
+void buffer_commit_gap(GapBuffer *buffer, size_t len);
+void buffer_move_gap(GapBuffer *buffer, size_t pos);
+void buffer_delete_range(GapBuffer *buffer, size_t pos, size_t len);
+void buffer_drop_front(GapBuffer *buffer, size_t len);
 void buffer_print_debug(GapBuffer *buffer);
 size_t buffer_get_line_length(GapBuffer *buffer, size_t line_number);
 size_t buffer_get_total_lines(GapBuffer *buffer);
@@ -26,5 +80,18 @@ ssize_t buffer_find_pattern(GapBuffer *buffer, char *patter, size_t start_pos);
 void buffer_index_to_screen(GapBuffer *buffer, size_t index, size_t *row, size_t *col);
 ssize_t buffer_find_pattern_backward(GapBuffer *buffer, char *pattern, size_t start_pos);
 size_t buffer_screen_to_index(GapBuffer *buffer, size_t target_row, size_t target_col);
+size_t buffer_length(GapBuffer *buffer);
+char buffer_char_at(GapBuffer *buffer, size_t pos);
+size_t buffer_line_start(GapBuffer *buffer, size_t line_number);
+void buffer_mark_dirty(GapBuffer *buffer, size_t line_number);
+void buffer_mark_dirty_from(GapBuffer *buffer, size_t line_number);
+void buffer_mark_all_dirty(GapBuffer *buffer);
+void buffer_clear_dirty(GapBuffer *buffer);
+bool buffer_line_is_dirty(GapBuffer *buffer, size_t line_number);
+
+BufferSnapshot *buffer_snapshot(GapBuffer *buffer);
+void buffer_snapshot_release(GapBuffer *buffer, BufferSnapshot *snapshot);
+uint64_t buffer_hash(GapBuffer *buffer);
+uint64_t buffer_snapshot_hash(BufferSnapshot *snapshot);
 
 #endif
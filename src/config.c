@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+
+static void config_set_defaults(EditorConfig *config)
+{
+	config->max_fps = 60;
+	config->escape_timeout_ms = 50;
+	config->persistent_undo = 0;
+	config->undo_budget_mb = 64;
+	config->save_fsync = FSYNC_FILE;
+	config->swap_file = 1;
+	config->swap_idle_ms = 300;
+	config->follow_max_mb = 0;
+	config->load_threads = 0;
+
+	// Half the memory there is; a bigger file would crowd out everything else
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	config->pager_min_mb = pages > 0 && page_size > 0 ? (int)(((long long)pages * page_size / 2) >> 20) : 4096;
+}
+
+static void config_apply(EditorConfig *config, char *key, char *value)
+{
+	if (strcmp(key, "max_fps") == 0)
+	{
+		int fps = atoi(value);
+
+		if (fps >= 0)
+		{
+			config->max_fps = fps;
+		}
+	}
+	else if (strcmp(key, "escape_timeout_ms") == 0)
+	{
+		int timeout = atoi(value);
+
+		if (timeout >= 0)
+		{
+			config->escape_timeout_ms = timeout;
+		}
+	}
+	else if (strcmp(key, "persistent_undo") == 0)
+	{
+		config->persistent_undo = atoi(value) != 0;
+	}
+	else if (strcmp(key, "save_fsync") == 0)
+	{
+		if (strcmp(value, "never") == 0)
+		{
+			config->save_fsync = FSYNC_NEVER;
+		}
+		else if (strcmp(value, "file") == 0)
+		{
+			config->save_fsync = FSYNC_FILE;
+		}
+		else if (strcmp(value, "full") == 0)
+		{
+			config->save_fsync = FSYNC_FULL;
+		}
+	}
+	else if (strcmp(key, "undo_budget_mb") == 0)
+	{
+		int budget = atoi(value);
+
+		if (budget >= 0)
+		{
+			config->undo_budget_mb = budget;
+		}
+	}
+	else if (strcmp(key, "swap_file") == 0)
+	{
+		config->swap_file = atoi(value) != 0;
+	}
+	else if (strcmp(key, "swap_idle_ms") == 0)
+	{
+		int idle = atoi(value);
+
+		if (idle >= 0)
+		{
+			config->swap_idle_ms = idle;
+		}
+	}
+	else if (strcmp(key, "follow_max_mb") == 0)
+	{
+		int cap = atoi(value);
+
+		if (cap >= 0)
+		{
+			config->follow_max_mb = cap;
+		}
+	}
+	else if (strcmp(key, "pager_min_mb") == 0)
+	{
+		int size = atoi(value);
+
+		if (size >= 0)
+		{
+			config->pager_min_mb = size;
+		}
+	}
+	else if (strcmp(key, "load_threads") == 0)
+	{
+		int threads = atoi(value);
+
+		if (threads >= 0)
+		{
+			config->load_threads = threads;
+		}
+	}
+}
+
+void config_load(EditorConfig *config)
+{
+	config_set_defaults(config);
+
+	char *home = getenv("HOME");
+
+	if (home == NULL)
+	{
+		return;
+	}
+
+	// Same file as the API key, one key=value per line
+	char config_path[1024];
+	snprintf(config_path, sizeof(config_path), "%s/.vesperrc", home);
+
+	FILE *fp = fopen(config_path, "r");
+
+	if (fp == NULL)
+	{
+		return;
+	}
+
+	char line[1024];
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		char *newline = strchr(line, '\n');
+		if (newline) *newline = '\0';
+
+		char *equals = strchr(line, '=');
+
+		if (equals == NULL || line[0] == '#')
+		{
+			continue;
+		}
+
+		*equals = '\0';
+		config_apply(config, line, equals + 1);
+	}
+
+	fclose(fp);
+}
@@ -0,0 +1,23 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "file_io.h"
+
+typedef struct
+{
+	int max_fps;             // Redraws per second while input is streaming in, 0 = uncapped
+	int escape_timeout_ms;   // How long a lone ESC waits for the rest of a key sequence
+	int persistent_undo;     // Keep undo history across sessions in ~/.cache/vesper/undo
+	int undo_budget_mb;      // Undo history kept per file before the oldest is dropped, 0 = no limit
+	FsyncPolicy save_fsync;  // never, file or full (file and directory)
+	int swap_file;           // Journal unsaved edits to ~/.cache/vesper/swap for crash recovery
+	int swap_idle_ms;        // Typing pause after which batched edits go to the swap file
+	int follow_max_mb;       // Text :follow keeps before dropping the oldest lines, 0 = all of it
+	int pager_min_mb;        // Files this big are paged through read-only, not loaded; 0 = never
+	int load_threads;        // Workers reading the files opened after the first, 0 = one per CPU, at least 4
+
+} EditorConfig;
+
+void config_load(EditorConfig *config);
+
+#endif
@@ -4,1834 +4,2667 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/types.h>
-#include <curl/curl.h>
+#include <sys/stat.h>
 #include "terminal.h"
 #include "editor.h"
 #include "render.h"
 #include "buffer.h"
+#include "utils.h"
+#include "input.h"
+#include "event_loop.h"
+#include "ai.h"
+#include "profile.h"
+#include "alloc.h"
+#include "trace.h"
+#include "undo_journal.h"
+#include "file_io.h"
+#include "load_pool.h"
 
 EditorState state;
 
-char *c_keywords[] = 
-{
-	"auto",
-	"break",
-	"case",
-	"char",
-	"const",
-	"continue",
-	"default",
-	"do",
-	"double",
-	"else",
-	"enum",
-	"extern",
-	"float",
-	"for",
-	"goto",
-	"if",
-	"int",
-	"long",
-	"register",
-	"return",
-	"short",
-	"signed",
-	"sizeof",
-	"static",
-	"struct",
-	"switch",
-	"typedef",
-	"union",
-	"unsigned",
-	"void",
-	"volatile",
-	"while", 
-	NULL
-};
-
-
-char *python_keywords[] = 
-{
-	"and", "as", "assert", "async", "await",
-	"break", "class", "continue",
-	"def", "del",
-	"elif", "else", "except",
-	"False", "finally", "for", "from",
-	"global",
-	"if", "import", "in", "is",
-	"lambda",
-	"None", "nonlocal", "not",
-	"or",
-	"pass",
-	"raise", "return",
-	"True", "try",
-	"while", "with",
-	"yield",
-	NULL
-};
-
-
-char *javascript_keywords[] = 
-{
-	"abstract", "arguments", "await",
-	"break",
-	"case", "catch", "class", "const", "continue",
-	"debugger", "default", "delete", "do",
-	"else", "enum", "eval", "export", "extends",
-	"false", "finally", "for", "function",
-	"if", "implements", "import", "in", "instanceof", "interface",
-	"let",
-	"new", "null",
-	"package", "private", "protected", "public",
-	"return",
-	"static", "super", "switch",
-	"this", "throw", "true", "try", "typeof",
-	"var", "void",
-	"while", "with",
-	"yield",
-	NULL
-};
-
-
-char *java_keywords[] = 
-{
-	"abstract", "assert",
-	"boolean", "break", "byte",
-	"case", "catch", "char", "class", "const", "continue",
-	"default", "do", "double",
-	"else", "enum", "extends",
-	"false", "final", "finally", "float", "for",
-	"goto",
-	"if", "implements", "import", "instanceof", "int", "interface",
-	"long",
-	"native", "new", "null",
-	"package", "private", "protected", "public",
-	"return",
-	"short", "static", "strictfp", "super", "switch", "synchronized",
-	"this", "throw", "throws", "transient", "true", "try",
-	"void", "volatile",
-	"while",
-	NULL
-};
-
-
-char *go_keywords[] = 
-{
-	"break",
-	"case", "chan", "const", "continue",
-	"default", "defer",
-	"else",
-	"fallthrough", "for", "func",
-	"go", "goto",
-	"if", "import", "interface",
-	"map",
-	"package",
-	"range", "return",
-	"select", "struct", "switch",
-	"type",
-	"var",
-	NULL
-};
-
-
-char *rust_keywords[] = 
-{
-	"as", "async", "await",
-	"break",
-	"const", "continue", "crate",
-	"dyn",
-	"else", "enum", "extern",
-	"false", "fn", "for",
-	"if", "impl", "in",
-	"let", "loop",
-	"match", "mod", "move", "mut",
-	"pub",
-	"ref", "return",
-	"self", "Self", "static", "struct", "super",
-	"trait", "true", "type",
-	"unsafe", "use",
-	"where", "while",
-	"yield",
-	NULL
-};
-
-struct ResponseBuffer
-{
-	char *data;
-	size_t size;
-};
-
-// Callback function for libcurl - receives response data
-size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp)
-{
-    size_t total_size = size * nmemb;
-    struct ResponseBuffer *response = (struct ResponseBuffer *)userp;
-    
-    // Reallocate buffer to fit new data
-    char *ptr = realloc(response->data, response->size + total_size + 1);
-    if (ptr == NULL) {
-        return 0;  // Out of memory
-    }
-    
-    response->data = ptr;
-    memcpy(&(response->data[response->size]), contents, total_size);
-    response->size += total_size;
-    response->data[response->size] = '\0';
-    
-    return total_size;
-}
-
-char* call_claude_api(char *context, char *api_key)
+void extract_current_line_context(GapBuffer *buffer, size_t cursor_y, size_t cursor_x, char *output, size_t max_len)
 {
-	struct ResponseBuffer response;
-	response.data = NULL;
-	response.size = 0;
+	size_t cursor_pos = buffer_screen_to_index(buffer, cursor_y, cursor_x);
 
-	CURL *curl = curl_easy_init();
+	size_t line_start = cursor_pos;
 
-	if (curl == NULL)
+	while(line_start > 0) 
 	{
-		return NULL;	
-	}
-
-	char json[4096];
-
-	snprintf(json, sizeof(json),
-    "{"
-    "\"model\":\"claude-sonnet-4-20250514\","
-    "\"max_tokens\":200,"
-    "\"messages\":[{\"role\":\"user\",\"content\":\"Complete this code, reply with ONLY the completion code, no explanation, no markdown, no backticks:\\n%s\"}]"
-    "}",
-    context);
-
-	char auth_header[512];
-	snprintf(auth_header, sizeof(auth_header), "x-api-key: %s", api_key);
-
-	struct curl_slist *headers = NULL;
-	
-	headers = curl_slist_append(headers, auth_header);
-	
-	headers = curl_slist_append(headers, "anthropic-version: 2023-06-01");
-
-	headers = curl_slist_append(headers, "content-type: application/json");
-
-	curl_easy_setopt(curl, CURLOPT_URL, "https://api.anthropic.com/v1/messages");
-
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json);
+		size_t check_pos = line_start - 1;
+		
+		// Skip if in gap
+		if (check_pos >= buffer->gap_start && check_pos < buffer->gap_end)
+		{
+			line_start--;
+			continue;
+						
+		}
 
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+		if (buffer->data[check_pos] == '\n')
+		{
+			break;
+		}
 
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+		line_start--;
 
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+	}
 
-	CURLcode res = curl_easy_perform(curl);
+	size_t output_len = 0;
 
-	if (res != CURLE_OK)
+	for(size_t i = line_start; i < cursor_pos && output_len < max_len - 1; i++)
 	{
-		curl_slist_free_all(headers);
-		curl_easy_cleanup(curl);
-		
-		if (response.data != NULL)
+		// Skip gap
+		if (i >= buffer->gap_start && i < buffer->gap_end)
 		{
-			free(response.data);
+			continue;
 		}
+    
+		// Copy character
+		output[output_len] = buffer->data[i];
+		output_len++;
+	}
+
+	output[output_len] = '\0';
+}
 
-		return NULL;
+void scroll()
+{
+	if (state.cursor_y >= state.row_offset + state.screen_rows - 1)
+	{
+		state.row_offset = state.cursor_y - state.screen_rows + 2;
 	}
 
-	curl_slist_free_all(headers);
-	curl_easy_cleanup(curl);
+	if (state.cursor_y < state.row_offset)
+	{
+		state.row_offset = state.cursor_y;
+	}
 
-	char *text_start = strstr(response.data, "\"text\":\"");
-	if (text_start != NULL)
+	if (state.cursor_x >= state.col_offset + state.screen_cols)
 	{
-		text_start += 8;
-    
-    // Find end by scanning for \" (escaped quote followed by nothing more)
-    // Better: find the last "}] before stop_reason
-    char *stop = strstr(response.data, "\"stop_reason\"");
-    if (stop != NULL)
-    {
-        // Work backwards from stop_reason to find closing "}
-        while (stop > text_start && !(*stop == '"' && *(stop-1) == '}'))
-        {
-            stop--;
-        }
-        if (stop > text_start)
-        {
-            *(stop - 1) = '\0';
-        }
-    }
-    
-    char *result = strdup(text_start);
-    // Convert escape sequences
-    char *src = result;
-    char *dst = result;
-    while (*src)
-    {
-        if (*src == '\\' && *(src+1) == 'n')
-        {
-            *dst = '\n'; src += 2;
-        }
-        else if (*src == '\\' && *(src+1) == '"')
-        {
-            *dst = '"'; src += 2;
-        }
-        else
-        {
-            *dst = *src; src++;
-        }
-        dst++;
-    }
-    *dst = '\0';
-    
-    free(response.data);
-    return result;
-   }
-}
+		state.col_offset = state.cursor_x - state.screen_cols + 1;
+	}
 
-bool is_c_keyword(char *word) 
-{
-	for (int i = 0; c_keywords[i] != NULL; i++)
+	if (state.cursor_x < state.col_offset)
 	{
-		if(strcmp(c_keywords[i], word) == 0)
-		{
-			return true;
-		}
+		state.col_offset = state.cursor_x;
 	}
-	return false;
 }
 
-bool is_python_keyword(char *word) 
+bool save_file(char *filename, GapBuffer *buffer, EditorState *state)
 {
-	for (int i = 0; python_keywords[i] != NULL; i++)
+	if (filename == NULL)
 	{
-		if(strcmp(python_keywords[i], word) == 0)
-		{
-			return true;
-		}
+		state->message = "Error: No filename";
+		return false;
 	}
-	return false;
-}
 
-bool is_java_keyword(char *word) 
-{
-	for (int i = 0; java_keywords[i] != NULL; i++)
+	TRACE_BEGIN("file save");
+
+	// The old file stays intact until the new one is completely written
+	if (!file_save_buffer(filename, buffer, &state->format, state->config.save_fsync))
 	{
-		if(strcmp(java_keywords[i], word) == 0)
-		{
-			return true;
-		}
+		TRACE_END("file save");
+		state->message = "Error: Cannot write file";
+		return false;
 	}
-	return false;
-}
 
-bool is_go_keyword(char *word) 
-{
-	for (int i = 0; go_keywords[i] != NULL; i++)
+	// Ctrl-S in INSERT mode: the saved state has to be a finished record,
+	// one still growing isn't in the journal and can't be marked
+	undo_split_insert(state->undo_manager);
+	undo_journal_mark_saved(state->undo_manager, buffer);
+
+	file_stamp(filename, &state->disk_stamp);
+	state->disk_node = state->undo_manager->current;
+	state->disk_compactions = state->undo_manager->compactions;
+
+	if (state->swap != NULL)
 	{
-		if(strcmp(go_keywords[i], word) == 0)
-		{
-			return true;
-		}
+		swap_rebase(state->swap, swap_mark(state->swap), &state->disk_stamp);
 	}
-	return false;
+
+	TRACE_END("file save");
+	state->message = "File saved!";
+	return true;
 }
 
-bool is_rust_keyword(char *word) 
+LanguageType detect_language(char *filename)
 {
-	for (int i = 0; rust_keywords[i] != NULL; i++)
+	if (filename == NULL)
 	{
-		if(strcmp(rust_keywords[i], word) == 0)
-		{
-			return true;
-		}
+		return LANG_NONE;
 	}
-	return false;
-}
 
-bool is_javascript_keyword(char *word) 
-{
-	for (int i = 0; javascript_keywords[i] != NULL; i++)
+	char *dot = strrchr(filename, '.');
+
+	if (dot == NULL)
 	{
-		if(strcmp(javascript_keywords[i], word) == 0)
-		{
-			return true;
-		}
+		return LANG_NONE;
 	}
-	return false;
-}
 
-bool is_digit(char c)
-{
-	if (c >= '0' && c <= '9')
+	char *extension = dot + 1;
+
+	if (strcmp(extension, "c") == 0 || strcmp(extension, "h") == 0)
 	{
-		return true;
+		return LANG_C;
+	}
+	else if (strcmp(extension, "py") == 0)
+	{
+		return LANG_PYTHON;
+	}
+	else if (strcmp(extension, "js") == 0)
+	{
+		return LANG_JAVASCRIPT;
+	}
+	else if (strcmp(extension, "java") == 0)
+	{
+		return LANG_JAVA;
+	}
+	else if (strcmp(extension, "go") == 0)
+	{
+		return LANG_GO;
+	}
+	else if (strcmp(extension, "rs") == 0)
+	{
+		return LANG_RUST;
+	}
+	else
+	{
+		return LANG_NONE;
 	}
+}
+
+// Sets up a tab for filename without reading it, the load pool does that
+// on a worker. Its text counts as what's on disk once it's in.
+static void create_tab(Tab *tab, char *filename)
+{
+	memset(tab, 0, sizeof(Tab));
 
-	return false;
+	tab->buffer = buffer_create(1024);
+	tab->format = (TextFormat){ ENCODING_UTF8, LINE_ENDING_LF };
+	tab->filename = mem_strdup(MEM_TABS, filename);
+
+	tab->language = detect_language(filename);
+	highlighter_init(&tab->highlighter, tab->language);
+
+	tab->undo_manager = undo_manager_create();
+	tab->undo_manager->budget = (size_t)state.config.undo_budget_mb << 20;
+
+	tab->modified = false;
 }
 
-bool is_operator(char c)
+static EventLoop event_loop;
+static InputDecoder input;
+static int frame_timer = -1;
+static int escape_timer = -1;
+static int swap_timer = -1;
+static bool input_lost = false;
+static long long last_frame = 0;
+static const char *record_path = NULL;
+static const char *trace_path = NULL;
+
+static void editor_request_frame(void);
+
+// For news from the loop that can come in while a command is being typed.
+// The COMMAND branch drops keys while a message is up, so none goes over it.
+void editor_show_message(char *message)
 {
-	if (c == '+' || c == '-' || c == '*' || c == '/' || c == '%' || c == '<' || c == '>' || c == '=' || c == '!' || c == '&' || c == '|' || c == '^' || c == '~' || c == '(' || c == ')' || c == '{' || c == '}' || c == '[' || c == ']' || c == ';' || c == ',' || c == '.') 
+	if (state.mode != COMMAND)
 	{
-		return true;
+		state.message = message;
 	}
-
-	return false;
 }
 
-bool is_word_char(char c)
+static void editor_on_ai_suggestion(char *response, void *data)
 {
-	if (c >= 'a' && c <= 'z')
+	state.ai_request_pending = false;
+
+	// TEMPORARY DEBUG - print to stderr so it doesn't mess up the screen
+	fprintf(stderr, "\n=== DEBUG ===\n");
+	fprintf(stderr, "Response received: %s\n", response ? response : "NULL");
+	fprintf(stderr, "=============\n");
+
+	if (response != NULL)
 	{
-		return true;
+		// Copy to suggestion buffer (truncate if too long)
+		strncpy(state.ai_suggestion, response, sizeof(state.ai_suggestion) - 1);
+		state.ai_suggestion[sizeof(state.ai_suggestion) - 1] = '\0';
+
+		// Free the response
+		mem_free(MEM_AI, response);
+
+		// Activate ghost text
+		state.ghost_text_active = true;
+		state.message = "Suggestion ready (Tab to accept, Esc to reject)";
+	}
+	else
+	{
+		state.message = "Error: Failed to get AI suggestion";
 	}
 
-	if (c >= 'A' && c <= 'Z')
+	editor_request_frame();
+}
+
+// While a file is still coming in the loader writes into the gap, so
+// nothing may edit, move the gap or save a half-read file. A followed
+// file is the file's to change, and may be missing its start. A paged
+// file is only ever there a window at a time.
+static bool editor_read_only(void)
+{
+	if (state.pager != NULL)
 	{
+		state.message = "Huge file, read-only view";
 		return true;
 	}
 
-	if (c >= '0' && c <= '9')
+	if (state.follow)
 	{
+		state.message = "Following, read-only until :follow stops it";
 		return true;
 	}
 
-	if (c == '_')
+	if (state.loader == NULL)
 	{
-		return true;
+		return false;
 	}
 
-	return false;
+	state.message = "Still loading, read-only until done";
+	return true;
 }
 
-void extract_word(GapBuffer *buffer, size_t pos, char *word_buffer, size_t max_len)
+static bool editor_save(char *filename, GapBuffer *buffer);
+static void editor_check_disk(void);
+
+static void editor_on_saved(SaveResult *result, void *data)
 {
-	size_t word_start = pos;
+	GapBuffer *buffer = data;
 
-	while (word_start > 0)
+	buffer_snapshot_release(buffer, result->snapshot);
+	state.save_pending = false;
+
+	if (result->ok)
 	{
-		size_t check_pos = word_start - 1;
-		
-		// Skip if in gap
-		if (check_pos >= buffer->gap_start && check_pos < buffer->gap_end)
-		{
-			word_start--;
-			continue;
-		}
-		
-		// Check if it's a word character
-		if (is_word_char(buffer->data[check_pos]))
-		{
-			word_start--;
-		}
-		else
+		// The file holds the text as it was when the save started
+		undo_journal_mark_saved_state(state.undo_manager, state.save_node, state.save_compactions,
+		                              result->length, result->hash);
+
+		file_stamp(state.save_filename, &state.disk_stamp);
+		state.disk_node = state.save_node;
+		state.disk_compactions = state.save_compactions;
+
+		// Edits made while it was written stay in the swap
+		if (state.swap != NULL)
 		{
-			break;  // Found non-word character, stop!
+			swap_rebase(state.swap, state.save_swap_mark, &state.disk_stamp);
 		}
-	}		
 
-	size_t word_end = pos;
+		editor_show_message("File saved!");
+	}
+	else
+	{
+		editor_show_message("Error: Cannot write file");
+		state.quit_after_save = false;
+		state.save_again = false;
+	}
 
-	while (word_end < buffer->capacity)
+	// The result comes in some time after :w, maybe with the next command
+	// already being typed, and so does what the save queued next says
+	if (state.save_again)
 	{
-		// Skip if in gap
-		if (word_end >= buffer->gap_start && word_end < buffer->gap_end)
-		{
-			word_end++;
-			continue;
-		}
-		
-		// Check if it's a word character
-		if (is_word_char(buffer->data[word_end]))
-		{
-			word_end++;
-		}
-		else
+		char *shown = state.message;
+
+		state.save_again = false;
+		editor_save(state.save_filename, buffer);
+
+		if (state.mode == COMMAND)
 		{
-			break;  // Found non-word character, stop!
+			state.message = shown;
 		}
 	}
 
-	size_t word_len = 0;
-
-	for (size_t i = word_start; i < word_end && word_len < max_len - 1; i++)
+	if (state.quit_after_save && !state.save_pending)
 	{
-		// Skip gap
-		if (i >= buffer->gap_start && i < buffer->gap_end)
-		{
-			continue;
-		}
-		
-		// Copy character
-		word_buffer[word_len] = buffer->data[i];
-		word_len++;
+		event_loop_stop(&event_loop);
+	}
+	else if (state.disk_check_deferred)
+	{
+		editor_check_disk();
 	}
 
-	// Null terminate
-	word_buffer[word_len] = '\0';
+	if (event_loop.running)
+	{
+		editor_request_frame();
+	}
 }
 
-bool is_inside_line_comment(GapBuffer *buffer, size_t pos)
+// Saves without holding up editing: the text is snapshotted as it is and
+// written by a worker while typing goes on. One save runs at a time, a
+// save asked for meanwhile goes once it is done. Without a running loop to
+// report back to (replays, shutdown) it is written right here instead.
+// false if the save already failed.
+static bool editor_save(char *filename, GapBuffer *buffer)
 {
-	size_t line_start = pos;
-
-	while(line_start > 0) 
+	if (filename == NULL)
 	{
-		size_t check_pos = line_start - 1;
-		
-		// Skip if in gap
-		if (check_pos >= buffer->gap_start && check_pos < buffer->gap_end)
-		{
-			line_start--;
-			continue;
-						
-		}
+		state.message = "Error: No filename";
+		return false;
+	}
 
-		if (buffer->data[check_pos] == '\n')
-		{
-			break;
-		}
+	if (state.save_pending)
+	{
+		state.save_again = true;
+		state.save_filename = filename;
+		state.message = "Saving...";
+		return true;
+	}
 
-		line_start--;
+	if (!event_loop.running)
+	{
+		return save_file(filename, buffer, &state);
 	}
 
-	for (size_t i = line_start; i < pos; i++)
+	UndoManager *um = state.undo_manager;
+
+	// As in save_file, save_node must be a record the journal will have
+	undo_split_insert(um);
+
+	BufferSnapshot *snapshot = buffer_snapshot(buffer);
+
+	if (snapshot == NULL)
 	{
-		// Skip if current position is in gap
-		if (i >= buffer->gap_start && i < buffer->gap_end)
-		{
-			continue;
-		}
+		return save_file(filename, buffer, &state);
+	}
 
-		if (buffer->data[i] == '/')
-		{
-			// Now we need to check the NEXT position (i+1)
-			size_t next_pos = i + 1;
-			
-			// Make sure next_pos is not beyond our search range
-			if (next_pos >= pos)
-			{
-				continue;  // Can't check beyond pos
-			}
-			
-			// Skip if next position is in gap
-			if (next_pos >= buffer->gap_start && next_pos < buffer->gap_end)
-			{
-				continue;  // Can't form "//" if second char is in gap
-			}
-			
-			// Now check if next character is also '/'
-			if (buffer->data[next_pos] == '/')
-			{
-				return true;  // Found "//" before pos!
-			}
-		}
+	state.save_node = um->current;
+	state.save_compactions = um->compactions;
+	state.save_swap_mark = state.swap != NULL ? swap_mark(state.swap) : 0;
+	state.save_filename = filename;
+
+	if (!file_save_async(&event_loop, filename, snapshot, &state.format, state.config.save_fsync, um->journal_fd >= 0,
+	                     editor_on_saved, buffer))
+	{
+		buffer_snapshot_release(buffer, snapshot);
+		return save_file(filename, buffer, &state);
 	}
 
-	return false;
+	state.save_pending = true;
+	state.message = "Saving...";
+	return true;
 }
 
-bool is_inside_string(GapBuffer *buffer, size_t pos)
+// Crash recovery. Edits are journaled to a swap file as they happen, see
+// swap.h; the journal is written after a pause in typing, in one write.
+// Steady typing still goes out every SWAP_MAX_DELAY_MS.
+#define SWAP_MAX_DELAY_MS 2000
+
+static char swap_file_path[4096];
+static char swap_message[128];
+
+static void editor_open_swap(bool resume)
 {
-	size_t line_start = pos;
+	FileStamp base;
 
-	while(line_start > 0) 
-	{
-		size_t check_pos = line_start - 1;
-		
-		// Skip if in gap
-		if (check_pos >= buffer->gap_start && check_pos < buffer->gap_end)
-		{
-			line_start--;
-			continue;
-						
-		}
+	file_stamp(state.filename, &base);
+	state.swap = swap_open(swap_file_path, &base, resume);
 
-		if (buffer->data[check_pos] == '\n')
-		{
-			break;
-		}
+	if (state.swap != NULL)
+	{
+		state.buffer->edit_hook = swap_record;
+		state.buffer->edit_hook_data = state.swap;
+	}
+}
 
-		line_start--;
+// Once the file is in: starts journaling, or asks first if a session that
+// died left edits behind. Replays don't journal, they have no loop to flush.
+static void editor_start_swap(char *filename)
+{
+	if (!state.config.swap_file || !event_loop.running ||
+	    !swap_path(filename, swap_file_path, sizeof(swap_file_path)))
+	{
+		return;
 	}
 
-	int quote_count = 0;
+	FileStamp base;
+	size_t edits = 0;
+	pid_t owner = 0;
 
-	for (size_t i = line_start; i < pos; i++)
-	{
-		if (i >= buffer->gap_start && i < buffer->gap_end)
-		{
-			continue;
-		}
+	file_stamp(filename, &base);
 
-		if (buffer->data[i] == '"')
-		{
-			bool is_escaped = false;
+	switch (swap_check(swap_file_path, &base, &edits, &owner))
+	{
+		case SWAP_RECOVERABLE:
+			snprintf(swap_message, sizeof(swap_message),
+			         "Unsaved edits from a session that died (%zu): r recover, d discard, q quit", edits);
+			state.message = swap_message;
+			state.recovery_pending = true;
+			break;
 
-			if (i > line_start)
-			{
-				size_t prev_pos = i - 1;
+		case SWAP_IN_USE:
+			// Not ours to touch, this session goes without
+			snprintf(swap_message, sizeof(swap_message), "Also being edited by process %d, no swap file",
+			         (int)owner);
+			state.message = swap_message;
+			break;
 
-				// Make sure previous position is not in gap
-				if (prev_pos < buffer->gap_start || prev_pos >= buffer->gap_end)
-				{
-					// Check if previous character is backslash
-					if (buffer->data[prev_pos] == '\\')
-					{
-						is_escaped = true;
-					}
-				}
-			}
-			
-			// If NOT escaped, count it
-			if (!is_escaped)
-			{
-				quote_count++;
-			}
-		}
-	}	
+		case SWAP_STALE:
+			state.message = "Swap file was for an older version of the file, discarded";
+			editor_open_swap(false);
+			break;
 
-	return (quote_count % 2 == 1);
+		case SWAP_NONE:
+			editor_open_swap(false);
+			break;
+	}
 }
 
-bool is_inside_block_comment(GapBuffer *buffer, size_t pos)
+static bool editor_answer_recovery(GapBuffer *buffer, int c)
 {
-	for (size_t i = pos; i > 0; i--)
+	if (c == 'q')
 	{
-		size_t check_pos = i - 1;
+		// The swap stays for next time
+		return false;
+	}
 
-		if (check_pos >= buffer->gap_start && check_pos < buffer->gap_end)
-		{
-			continue;
-		}
+	if (c == 'r')
+	{
+		size_t replayed = swap_replay(swap_file_path, buffer, state.undo_manager);
 
-		size_t next_pos = check_pos + 1;
-
-		// Make sure next_pos is not in gap and is valid
-        if (next_pos >= buffer->capacity)
-        {
-            continue;
-        }
-        
-        if (next_pos >= buffer->gap_start && next_pos < buffer->gap_end)
-        {
-            continue;
-        }
-        
-        // Now check for "*/" (closing comment)
-        if (buffer->data[check_pos] == '*' && buffer->data[next_pos] == '/')
-        {
-            return false;  // Found closing, we're outside
-        }
-        
-        // Check for "/*" (opening comment)
-        if (buffer->data[check_pos] == '/' && buffer->data[next_pos] == '*')
-        {
-            return true;  // Found opening, we're inside
-        }
-	}
-
-	return false;
+		snprintf(swap_message, sizeof(swap_message), "Recovered %zu edits, u undoes them, :w keeps them",
+		         replayed);
+		state.message = swap_message;
+		editor_open_swap(true);
+	}
+	else if (c == 'd')
+	{
+		state.message = "Discarded the unsaved edits";
+		editor_open_swap(false);
+	}
+	else
+	{
+		// Anything else asks again
+		state.message = swap_message;
+		return true;
+	}
+
+	state.recovery_pending = false;
+	scroll();
+	return true;
 }
 
-TokenType classify_token(GapBuffer *buffer, size_t pos, LanguageType lang)
+static void editor_on_swap_idle(void *data)
 {
-	if (lang == LANG_NONE)
-    {
-        return NORMALTXT;  // Only highlight C for now
-    }
-    
-    // Step 2: Check if inside string (PRIORITY)
-    if (is_inside_string(buffer, pos))
-    {
-        return STRINGS;
-    }
-    
-    // Step 3: Check if inside line comment
-    if (is_inside_line_comment(buffer, pos))
-    {
-        return COMMENTS;
-    }
-    
-    // Step 4: Check if inside block comment
-    if (is_inside_block_comment(buffer, pos))
-    {
-        return COMMENTS;
-    }
+	swap_timer = -1;
+	swap_flush(state.swap);
+}
 
-	// Check if position is in gap
-	if (pos >= buffer->gap_start && pos < buffer->gap_end)
+// After a batch of keys: typing pushes the write back until it pauses
+static void editor_schedule_swap(void)
+{
+	if (state.swap == NULL || !swap_pending(state.swap))
 	{
-		return NORMALTXT;  // Can't classify gap
+		return;
 	}
 
-	char c = buffer->data[pos];
+	event_loop_cancel_timer(&event_loop, swap_timer);
+	swap_timer = -1;
 
-	if (is_digit(c))
+	if (monotonic_ms() - state.swap->pending_since >= SWAP_MAX_DELAY_MS)
 	{
-    	return NUMBERS;
+		swap_flush(state.swap);
+		return;
 	}
 
-	if (is_operator(c))
+	swap_timer = event_loop_add_timer(&event_loop, state.config.swap_idle_ms, 0, editor_on_swap_idle, NULL);
+
+	if (swap_timer < 0)
 	{
-		return OPERATORS;
+		swap_flush(state.swap);
 	}
+}
 
-	if (is_word_char(c))
-	{
-		char word[256];
-		extract_word(buffer, pos, word, 256);
-		
-		// Check based on language
-		bool is_keyword = false;
-		
-		if (lang == LANG_C && is_c_keyword(word))
-		{
-			is_keyword = true;
-		}
-		else if (lang == LANG_PYTHON && is_python_keyword(word))
-		{
-			is_keyword = true;
-		}
-		else if (lang == LANG_JAVA && is_java_keyword(word))
-		{
-			is_keyword = true;
-		}
-		else if (lang == LANG_GO && is_go_keyword(word))
-		{
-			is_keyword = true;
-		}
-		else if (lang == LANG_JAVASCRIPT && is_javascript_keyword(word))
-		{
-			is_keyword = true;
-		}
-		else if (lang == LANG_RUST && is_rust_keyword(word))
-		{
-			is_keyword = true;
-		}
+// Changes made to the file by someone else. The watch only says something
+// happened in its directory; the file's stamp against the one from the
+// last read or write here says whether it was to the file, and not us.
+#define DISK_CHECK_DELAY_MS 20
 
-		if (is_keyword)
-		{
-			return KEYWORDS;
-		}
+static int disk_timer = -1;
+static char disk_message[64];
 
-		// It's a word, but not a keyword
-		return NORMALTXT;
-	}
+static void editor_load_file(char *filename, GapBuffer *buffer);
 
-	return NORMALTXT;
+// A record still open is typing that current doesn't show yet: it moves
+// when the record closes, not with every key
+static bool editor_modified(void)
+{
+	UndoManager *um = state.undo_manager;
+
+	return um->record_open || um->current != state.disk_node || um->compactions != state.disk_compactions;
 }
 
-char* read_api_key()
+// The text is what's on disk now, in the current undo state
+static void editor_at_disk_state(void)
 {
-    // Try environment variable first
-    char *key = getenv("ANTHROPIC_API_KEY");
-    if (key != NULL && strlen(key) > 0)
-    {
-        // Found in environment, return a copy
-        return strdup(key);
-    }
-    
-    // Try reading from config file
-    char config_path[1024];
-    snprintf(config_path, sizeof(config_path), "%s/.vesperrc", getenv("HOME"));
-    
-    FILE *fp = fopen(config_path, "r");
-    if (fp != NULL)
-    {
-        char line[1024];
-        while (fgets(line, sizeof(line), fp))
-        {
-            // Look for ANTHROPIC_API_KEY=...
-            if (strncmp(line, "ANTHROPIC_API_KEY=", 18) == 0)
-            {
-                // Extract key (after the =)
-                char *key_start = line + 18;
-                
-                // Remove newline if present
-                char *newline = strchr(key_start, '\n');
-                if (newline) *newline = '\0';
-                
-                fclose(fp);
-                return strdup(key_start);
-            }
-        }
-        fclose(fp);
-    }
-    
-    // Not found anywhere
-    return NULL;
+	state.disk_node = state.undo_manager->current;
+	state.disk_compactions = state.undo_manager->compactions;
 }
 
-void extract_current_line_context(GapBuffer *buffer, size_t cursor_y, size_t cursor_x, char *output, size_t max_len)
+// The file only grew at the end, and the buffer holds it unedited: just
+// the new bytes are read in after the text, straight into the gap, and
+// the line index picks up only their lines. false if it wasn't an append.
+static bool editor_append_from_disk(GapBuffer *buffer, const FileStamp *now)
 {
-	size_t cursor_pos = buffer_screen_to_index(buffer, cursor_y, cursor_x);
+	size_t old_size = state.disk_stamp.size;
+	size_t length = buffer_length(buffer);
 
-	size_t line_start = cursor_pos;
+	// Converted text doesn't line up with the file byte for byte, it's reloaded
+	if (now->inode != state.disk_stamp.inode || now->size <= old_size || length + state.follow_dropped != old_size ||
+	    !text_format_plain(&state.format))
+	{
+		return false;
+	}
 
-	while(line_start > 0) 
+	int fd = open(state.filename, O_RDONLY);
+
+	if (fd < 0)
 	{
-		size_t check_pos = line_start - 1;
-		
-		// Skip if in gap
-		if (check_pos >= buffer->gap_start && check_pos < buffer->gap_end)
+		return false;
+	}
+
+	// The end of what was read before has to be still there, or the file
+	// was rewritten rather than appended to
+	char check[4096];
+	size_t check_len = length < sizeof(check) ? length : sizeof(check);
+
+	buffer_move_gap(buffer, length);
+
+	if (pread(fd, check, check_len, old_size - check_len) != (ssize_t)check_len ||
+	    memcmp(check, &buffer->data[length - check_len], check_len) != 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	size_t grow = now->size - old_size;
+	size_t got = 0;
+
+	TRACE_BEGIN("disk append");
+	buffer_reserve(buffer, grow);
+
+	while (got < grow)
+	{
+		ssize_t n = pread(fd, &buffer->data[buffer->gap_start], grow - got, old_size + got);
+
+		if (n < 0 && errno == EINTR)
 		{
-			line_start--;
 			continue;
-						
 		}
 
-		if (buffer->data[check_pos] == '\n')
+		if (n <= 0)
 		{
 			break;
 		}
 
-		line_start--;
-
+		buffer_commit_gap(buffer, n);
+		got += n;
 	}
 
-	size_t output_len = 0;
+	TRACE_END("disk append");
+	close(fd);
 
-	for(size_t i = line_start; i < cursor_pos && output_len < max_len - 1; i++)
+	// Anything written after the stat is another change, read on the next check
+	state.disk_stamp = *now;
+	state.disk_stamp.size = old_size + got;
+
+	if (state.swap != NULL)
 	{
-		// Skip gap
-		if (i >= buffer->gap_start && i < buffer->gap_end)
-		{
-			continue;
-		}
-    
-		// Copy character
-		output[output_len] = buffer->data[i];
-		output_len++;
+		swap_rebase(state.swap, swap_mark(state.swap), &state.disk_stamp);
 	}
 
-	output[output_len] = '\0';
+	return true;
 }
 
-void sigwinch_handler(int sig)
+// :follow shows the end of the file as it grows
+static void editor_follow_pin(void)
 {
-	get_terminal_size(&state.screen_rows, &state.screen_cols);
-	screen_clear();
-	fflush(stdout);
+	size_t lines = buffer_get_total_lines(state.buffer);
+
+	state.cursor_y = lines > 0 ? lines - 1 : 0;
+	state.cursor_x = 0;
+	scroll();
 }
 
-void scroll()
+// Keeps a followed file under follow_max_mb by dropping its oldest lines,
+// a quarter of the limit at a time so sliding the rest down is rare. The
+// undo history and swap don't fit the shortened text, they go.
+static void editor_follow_trim(GapBuffer *buffer)
 {
-	if (state.cursor_y >= state.row_offset + state.screen_rows - 1)
-	{
-		state.row_offset = state.cursor_y - state.screen_rows + 2;
-	}
+	size_t limit = (size_t)state.config.follow_max_mb << 20;
+	size_t length = buffer_length(buffer);
 
-	if (state.cursor_y < state.row_offset)
+	if (limit == 0 || length <= limit)
 	{
-		state.row_offset = state.cursor_y;
+		return;
 	}
 
-	if (state.cursor_x >= state.col_offset + state.screen_cols)
-	{
-		state.col_offset = state.cursor_x - state.screen_cols + 1;
-	}
+	// Whole lines only. Right after an append the gap is at the end.
+	buffer_move_gap(buffer, length);
 
-	if (state.cursor_x < state.col_offset)
-	{
-		state.col_offset = state.cursor_x;
-	}
-}
+	size_t drop = length - limit / 4 * 3;
+	char *newline = memchr(&buffer->data[drop - 1], '\n', length - drop + 1);
 
-void save_file(char *filename, GapBuffer *buffer, EditorState *state)
-{
-	if (filename == NULL)
+	if (newline == NULL)
 	{
-		state->message = "Error: No filename";
 		return;
 	}
 
-	FILE *fp = fopen(filename, "w");
-
-	if (fp == NULL)
+	if (state.follow_dropped == 0)
 	{
-		state->message = "Error: Cannot write file";
-		return;
+		buffer->edit_hook = NULL;
+		swap_close(state.swap, true);
+		state.swap = NULL;
+
+		undo_manager_free(state.undo_manager);
+		state.undo_manager = undo_manager_create();
+		state.undo_manager->budget = (size_t)state.config.undo_budget_mb << 20;
+		editor_at_disk_state();
 	}
 
-	for (size_t i = 0; i < buffer->capacity; i++)
-	{
-		if (i >= buffer->gap_start && i < buffer->gap_end)
-		{
-			continue;
-		}
+	drop = newline - buffer->data + 1;
 
-		char c = buffer->data[i];
-		fputc(c, fp);
-	}
+	TRACE_BEGIN("follow trim");
+	buffer_drop_front(buffer, drop);
+	TRACE_END("follow trim");
 
-	fclose(fp);
-	state->message = "File saved!";
+	state.follow_dropped += drop;
 }
 
-UndoManager *undo_manager_create()
+// Reads the file again from scratch. Undo history was for the old text,
+// it goes, and so does the swap.
+static void editor_reload_file(void)
 {
-	UndoManager *um = malloc(sizeof(UndoManager));
-
-	um->undo_stack = malloc(sizeof(UndoOperation) * 10);
-	um->undo_count = 0;
-	um->undo_capacity = 10;
+	GapBuffer *old = state.buffer;
 
-	um->redo_stack = malloc(sizeof(UndoOperation) * 10);
-	um->redo_count = 0;
-	um->redo_capacity = 10;
+	state.follow_dropped = 0;
 
-	um->current_insert_buffer = malloc(256); // Start with 256 chars
-	um->current_insert_len = 0;
-	um->current_insert_capacity = 256;
-	um->insert_start_pos = 0;
-	um->insert_start_x = 0;
-	um->insert_start_y = 0;
-	um->in_insert_session = false;
-
-	return um;
-}
+	old->edit_hook = NULL;
+	swap_close(state.swap, true);
+	state.swap = NULL;
 
-void undo_push_operation(UndoManager *um, OpType type, char *content, size_t pos, size_t cx, size_t cy)
-{
-	// Grow stack if needed
-	if (um->undo_count >= um->undo_capacity)
-	{
-		um->undo_capacity *= 2;
-		um->undo_stack = realloc(um->undo_stack, sizeof(UndoOperation) * um->undo_capacity);
-	}
+	undo_manager_free(state.undo_manager);
+	state.undo_manager = undo_manager_create();
+	state.undo_manager->budget = (size_t)state.config.undo_budget_mb << 20;
 
-	// Create operation
-	UndoOperation op;
-	op.type = type;
-	op.content = malloc(strlen(content) + 1);
-	strcpy(op.content, content);
-	op.position = pos;
-	op.cursor_x = cx;
-	op.cursor_y = cy;
+	highlighter_free(&state.highlighter);
+	highlighter_init(&state.highlighter, state.language);
 
-	// Add to stack
-	um->undo_stack[um->undo_count] = op;
-	um->undo_count++;
+	state.buffer = buffer_create(1024);
+	buffer_free(old);
+	editor_load_file(state.filename, state.buffer);
 
-	// Clear redo stack (new action invalidates redo)
-	um->redo_count = 0;
-}
+	size_t lines = buffer_get_total_lines(state.buffer);
 
-void undo_push_operation_no_clear(UndoManager *um, OpType type, char *content, size_t pos, size_t cx, size_t cy)
-{
-	// Grow stack if needed
-	if (um->undo_count >= um->undo_capacity)
+	if (state.cursor_y >= lines)
 	{
-		um->undo_capacity *= 2;
-		um->undo_stack = realloc(um->undo_stack, sizeof(UndoOperation) * um->undo_capacity);
+		state.cursor_y = lines > 0 ? lines - 1 : 0;
 	}
 
-	// Create operation
-	UndoOperation op;
-	op.type = type;
-	op.content = malloc(strlen(content) + 1);
-	strcpy(op.content, content);
-	op.position = pos;
-	op.cursor_x = cx;
-	op.cursor_y = cy;
+	size_t line_length = buffer_get_line_length(state.buffer, state.cursor_y);
 
-	// Add to stack
-	um->undo_stack[um->undo_count] = op;
-	um->undo_count++;
+	if (state.cursor_x > line_length)
+	{
+		state.cursor_x = line_length;
+	}
 
-	// DON'T clear redo stack here!
+	scroll();
 }
 
-void redo_push_operation(UndoManager *um, OpType type, char *content, size_t pos, size_t cx, size_t cy)
+static void editor_check_disk(void)
 {
-	if (um->redo_count >= um->redo_capacity)
+	// Not while the buffer is being read or written, or typed into (INSERT
+	// types at the gap, an append would move it), nor with a question open
+	if (state.loader != NULL || state.save_pending || state.recovery_pending || state.reload_pending ||
+	    state.mode != NORMAL)
 	{
-		um->redo_capacity *= 2;
-		um->redo_stack = realloc(um->redo_stack, sizeof(UndoOperation) * um->redo_capacity);
+		state.disk_check_deferred = true;
+		return;
 	}
 
-	UndoOperation op;
-	op.type = type;
-	op.content = malloc(strlen(content) + 1);
-	strcpy(op.content, content);
-	op.position = pos;
-	op.cursor_x = cx;
-	op.cursor_y = cy;
+	state.disk_check_deferred = false;
 
-	um->redo_stack[um->redo_count] = op;
-	um->redo_count++;
-}
+	FileStamp now;
+	bool exists = file_stamp(state.filename, &now);
 
-void undo_operation(UndoManager *um, GapBuffer *buffer, EditorState *state)
-{
-	if (um->undo_count == 0)
+	if (memcmp(&now, &state.disk_stamp, sizeof(FileStamp)) == 0)
 	{
-		state->message = "Nothing to undo";
 		return;
 	}
 
-	um->undo_count--;
-	UndoOperation op = um->undo_stack[um->undo_count];
+	if (!exists)
+	{
+		state.disk_stamp = now;
+		state.message = "File deleted on disk, :w writes it back";
+	}
+	else if (editor_modified())
+	{
+		state.reload_pending = true;
+		state.message = "File changed on disk: r reload and drop your edits, k keep them";
+	}
+	else if (editor_append_from_disk(state.buffer, &now))
+	{
+		if (state.follow)
+		{
+			editor_follow_trim(state.buffer);
+			editor_follow_pin();
+		}
 
-	if (op.type == OP_INSERT)
+		snprintf(disk_message, sizeof(disk_message), "%s, %zu lines", state.follow ? "Following" : "Appended on disk",
+		         buffer_get_total_lines(state.buffer));
+		state.message = disk_message;
+	}
+	else
 	{
-		size_t len = strlen(op.content);
+		// Nothing of ours to lose. A followed log that was rotated or
+		// truncated starts over from its new beginning.
+		editor_reload_file();
 
-		for (size_t i = 0; i < len; i++)
+		if (state.follow)
 		{
-			buffer_delete_char(buffer);
+			editor_follow_pin();
 		}
 
-		state->cursor_x = op.cursor_x;
-		state->cursor_y = op.cursor_y;
+		if (state.loader == NULL)
+		{
+			state.message = "Reloaded, the file changed on disk";
+		}
 	}
 
-	else if (op.type == OP_DELETE)
-	{
-		state->cursor_x = op.cursor_x;
-		state->cursor_y = op.cursor_y;
+	editor_request_frame();
+}
 
-		size_t len = strlen(op.content);
+static bool editor_answer_reload(int c)
+{
+	if (c == 'r')
+	{
+		state.reload_pending = false;
+		editor_reload_file();
 
-		for (size_t i = 0; i < len; i++)
+		if (state.loader == NULL)
 		{
-			char c = op.content[i];
-
-			buffer_insert_char(buffer, c);
+			state.message = "Reloaded, your edits were dropped";
 		}
 	}
+	else if (c == 'k')
+	{
+		// Not asked again until the next change, :w overwrites it
+		state.reload_pending = false;
+		file_stamp(state.filename, &state.disk_stamp);
+		state.message = "Kept your edits, :w overwrites the file on disk";
+	}
+	else
+	{
+		state.message = "File changed on disk: r reload and drop your edits, k keep them";
+	}
 
-	state->cursor_x = op.cursor_x;
-	state->cursor_y = op.cursor_y;
-
-	redo_push_operation(um, op.type, op.content, op.position, op.cursor_x, op.cursor_y);
+	return true;
 }
 
-void redo_operation(UndoManager *um, GapBuffer *buffer, EditorState *state)
+static void editor_toggle_follow(void)
 {
-	if (um->redo_count == 0)
+	if (state.pager != NULL)
 	{
-		state->message = "Nothing to redo";
+		state.message = "Can't follow a huge file, it isn't loaded";
 		return;
 	}
 
-	um->redo_count--;
-	UndoOperation op = um->redo_stack[um->redo_count];
-
-	state->cursor_x = op.cursor_x;
-	state->cursor_y = op.cursor_y;
-
-	if (op.type == OP_INSERT)
+	if (state.follow)
 	{
-		size_t len = strlen(op.content);
+		state.follow = false;
+		state.message = "Stopped following";
 
-		for (size_t i = 0; i < len; i++)
+		// The start of the file was let go, get it back before editing
+		if (state.follow_dropped > 0)
 		{
-			char c = op.content[i];
-			buffer_insert_char(buffer, c);
+			editor_reload_file();
+			state.message = "Stopped following, reloaded the whole file";
 		}
+
+		return;
 	}
 
-	else if (op.type == OP_DELETE)
+	if (state.watch == NULL)
 	{
-		size_t len = strlen(op.content);
+		state.message = "Can't follow, changes to this file can't be watched";
+		return;
+	}
 
-		for (size_t i = 0; i < len; i++)
-		{
-			buffer_delete_char(buffer);
-		}
+	if (editor_modified())
+	{
+		state.message = "Save or undo your edits before following";
+		return;
 	}
 
-	undo_push_operation_no_clear(um, op.type, op.content, op.position, op.cursor_x, op.cursor_y);
+	state.follow = true;
+	state.message = "Following, :follow stops";
+	editor_follow_pin();
+
+	// Anything written since the last look comes in now
+	editor_check_disk();
 }
 
-LanguageType detect_language(char *filename)
+static void editor_on_disk_timer(void *data)
 {
-	if (filename == NULL)
-	{
-		return LANG_NONE;
-	}
-
-	char *dot = strrchr(filename, '.');
+	disk_timer = -1;
+	editor_check_disk();
+}
 
-	if (dot == NULL)
+// Writers come in bursts (a log flushing, a checkout touching many
+// files), one look after a short pause covers the lot
+static void editor_on_file_changed(void *data)
+{
+	if (disk_timer < 0)
 	{
-		return LANG_NONE;
+		disk_timer = event_loop_add_timer(&event_loop, DISK_CHECK_DELAY_MS, 0, editor_on_disk_timer, NULL);
 	}
+}
 
-	char *extension = dot + 1;
+// Once the file is in (or known not to exist yet): journaled, watched,
+// and its text taken as what's on disk
+static void editor_track_file(char *filename)
+{
+	editor_at_disk_state();
+	editor_start_swap(filename);
 
-	if (strcmp(extension, "c") == 0 || strcmp(extension, "h") == 0)
+	if (state.watch == NULL && event_loop.running)
 	{
-		return LANG_C;
+		state.watch = file_watch_start(&event_loop, filename, editor_on_file_changed, NULL);
 	}
-	else if (strcmp(extension, "py") == 0)
+
+	if (state.disk_check_deferred)
 	{
-		return LANG_PYTHON;
+		editor_check_disk();
 	}
-	else if (strcmp(extension, "js") == 0)
+}
+
+// Files over pager_min_mb are read a window at a time as the cursor gets
+// near either end of it. The window is in the buffer like any text, so
+// drawing, highlighting and cursor keys work on it unchanged; line
+// numbers, :N and searches go through the pager to the whole file.
+static char pager_message[80];
+static unsigned search_generation = 0;   // Only the latest search's result counts
+static int searches_running = 0;
+
+static void editor_on_pager_index(void *data)
+{
+	PagerIndexStatus status;
+
+	pager_index_status(state.pager, &status);
+
+	// Not over a command being typed, a message stops the typing
+	if (status.done && state.mode != COMMAND)
 	{
-		return LANG_JAVASCRIPT;
+		snprintf(pager_message, sizeof(pager_message), "%llu lines, read-only view",
+		         (unsigned long long)status.lines);
+		state.message = pager_message;
+		editor_request_frame();
 	}
-	else if (strcmp(extension, "java") == 0)
+}
+
+// Reads the window around line and puts the cursor on it, at the same
+// height on screen as before
+static void editor_pager_show(uint64_t line_start, uint64_t line, size_t col)
+{
+	size_t screen_row = state.cursor_y - state.row_offset;
+	size_t row;
+
+	if (!pager_show(state.pager, state.buffer, line_start, line, &row))
 	{
-		return LANG_JAVA;
+		state.message = "Error: Cannot read file";
+		return;
 	}
-	else if (strcmp(extension, "go") == 0)
+
+	// The highlighter's line states were for the old window
+	highlighter_free(&state.highlighter);
+	highlighter_init(&state.highlighter, state.language);
+
+	size_t line_length = buffer_get_line_length(state.buffer, row);
+
+	state.cursor_y = row;
+	state.cursor_x = col < line_length ? col : line_length;
+	state.row_offset = row > screen_row ? row - screen_row : 0;
+	scroll();
+}
+
+// After every key: within two screens of an end of the window that isn't
+// the end of the file, the window moves to have the cursor in its middle.
+// A page is at most a screen, so the edge is never reached.
+static void editor_pager_recenter(void)
+{
+	PagerWindow window = pager_window(state.pager);
+	size_t lines = buffer_get_total_lines(state.buffer);
+	size_t margin = state.screen_rows * 2;
+	bool near_top = window.start > 0 && state.row_offset < margin;
+	bool near_end = window.end < pager_size(state.pager) && state.row_offset + margin >= lines;
+
+	if (near_top || near_end)
 	{
-		return LANG_GO;
+		editor_pager_show(window.start + buffer_line_start(state.buffer, state.cursor_y),
+		                  window.first_line + state.cursor_y, state.cursor_x);
 	}
-	else if (strcmp(extension, "rs") == 0)
+}
+
+// :N, line numbers counting from 1. Past the end goes to the last line.
+static void editor_goto_line(GapBuffer *buffer, unsigned long long number)
+{
+	uint64_t line = number > 0 ? number - 1 : 0;
+
+	if (state.pager == NULL)
 	{
-		return LANG_RUST;
+		size_t lines = buffer_get_total_lines(buffer);
+
+		state.cursor_y = line < lines ? line : lines - 1;
+		state.cursor_x = 0;
+		scroll();
+		return;
 	}
-	else
+
+	uint64_t offset;
+
+	if (!pager_find_line(state.pager, line, &offset))
 	{
-		return LANG_NONE;
+		PagerIndexStatus status;
+
+		pager_index_status(state.pager, &status);
+
+		if (!status.done)
+		{
+			snprintf(pager_message, sizeof(pager_message), "Line %llu isn't indexed yet (%d%% done)", number,
+			         (int)(status.bytes * 100 / pager_size(state.pager)));
+			state.message = pager_message;
+			return;
+		}
+
+		line = status.lines - 1;
+		pager_find_line(state.pager, line, &offset);
 	}
+
+	editor_pager_show(offset, line, 0);
 }
 
-Tab* create_tab(char *filename)
+static void editor_on_pager_search(PagerMatch *match, void *data)
 {
-	Tab *tab = malloc(sizeof(Tab));
-	if (tab == NULL) 
+	searches_running--;
+
+	// Closed, replaced by a newer search or stopped with ESC
+	if (state.pager == NULL || (uintptr_t)data != search_generation)
 	{
-		return NULL;
+		return;
 	}
 
-	tab->buffer = buffer_create(1024);
+	state.search_job = NULL;
 
-	if (filename != NULL)
+	if (match->found)
 	{
-		FILE *fp = fopen(filename, "r");
+		editor_pager_show(match->line_start, match->line, match->offset - match->line_start);
+	}
 
-		if (fp != NULL)
-		{
-			fseek(fp, 0, SEEK_END);
-			long file_size = ftell(fp);
-			fseek(fp, 0, SEEK_SET);
+	if (state.mode != COMMAND)
+	{
+		state.message = match->found ? "Pattern found" : "Pattern not found";
+	}
 
-			char *contents = malloc(file_size + 1);
+	editor_request_frame();
+}
 
-			if (contents != NULL)
-			{
+// Stops the search that's running, its result is ignored when it comes
+static void editor_pager_stop_search(void)
+{
+	if (state.search_job != NULL)
+	{
+		pager_search_cancel(state.search_job);
+		state.search_job = NULL;
+		search_generation++;
+	}
+}
 
-				fread(contents, 1, file_size, fp);
-				contents[file_size] = '\0';
+// /, ?, n and N over the whole file, from the cursor, on a worker
+static void editor_pager_search(const char *pattern, bool forward)
+{
+	PagerWindow window = pager_window(state.pager);
+	size_t line_pos = buffer_line_start(state.buffer, state.cursor_y);
+	size_t line_length = buffer_get_line_length(state.buffer, state.cursor_y);
+	size_t col = state.cursor_x < line_length ? state.cursor_x : line_length;
 
-				for (size_t i = 0; i < file_size; i++)
-				{
-					buffer_insert_char(tab->buffer, contents[i]);
-				}
+	editor_pager_stop_search();
 
-				free(contents);
-			}
+	state.search_job = pager_search(state.pager, pattern, forward, window.start + line_pos + col,
+	                                window.first_line + state.cursor_y, window.start + line_pos,
+	                                editor_on_pager_search, (void *)(uintptr_t)search_generation);
 
-			fclose(fp);
-		}
+	if (state.search_job == NULL)
+	{
+		state.message = "Error: Cannot search";
+		return;
 	}
 
-	tab->cursor_x = 0;
-	tab->cursor_y = 0;
-	tab->row_offset = 0;
-	tab->col_offset = 0;
+	searches_running++;
+	state.message = "Searching...";
+}
 
-	tab->language = detect_language(filename);
+static void editor_switch_tab(size_t index);
 
-	tab->undo_manager = undo_manager_create();
+// gt and gT, round from the last tab to the first and back
+static void editor_step_tab(bool forward)
+{
+	size_t count = state.tab_count > 0 ? state.tab_count : 1;
 
-	tab->modified = false;
+	editor_switch_tab((state.active_tab + (forward ? 1 : count - 1)) % count);
+}
 
-	if (filename != NULL)
+static void editor_list_tabs(void);
+
+static char undo_message[64];
+
+// Moves the text to another state in the undo tree and says where it is
+static void editor_undo_goto(GapBuffer *buffer, size_t node, bool forward)
+{
+	UndoManager *um = state.undo_manager;
+
+	if (!undo_goto(um, node, buffer, &state.cursor_x, &state.cursor_y))
+	{
+		state.message = forward ? "Already at newest change" : "Already at oldest change";
+		return;
+	}
+
+	snprintf(undo_message, sizeof(undo_message), "Undo state %zu of %zu", um->current, um->record_count);
+	state.message = undo_message;
+}
+
+// :earlier / :later take a count of states, or a time like 30s, 10m, 2h, 1d
+static void editor_undo_travel(GapBuffer *buffer, char *arg, bool forward)
+{
+	UndoManager *um = state.undo_manager;
+	char *unit;
+	long long amount = arg[0] == '\0' ? 1 : strtoll(arg, &unit, 10);
+
+	if (arg[0] == '\0')
+	{
+		unit = arg;
+	}
+
+	long long scale = *unit == 's' ? 1 : *unit == 'm' ? 60 : *unit == 'h' ? 3600 : *unit == 'd' ? 86400 : 0;
+
+	if (amount <= 0 || (*unit != '\0' && (scale == 0 || unit[1] != '\0')))
+	{
+		state.message = "Error: Expected a count or a time like 10s, 5m, 1h, 1d";
+		return;
+	}
+
+	size_t target;
+
+	if (scale != 0)
 	{
-		tab->filename = strdup(filename);  
+		target = undo_time_target(um, forward ? amount * scale : -amount * scale);
 	}
 	else
 	{
-		tab->filename = NULL;  
+		target = undo_step_target(um, amount, forward);
 	}
 
-	return tab;
+	editor_undo_goto(buffer, target, forward);
 }
 
-void editorLoop(char *filename)
+// Inserts a paste as one edit and one undo record, bypassing the per-key
+// INSERT path so nothing is auto-indented or triggered along the way
+static void editor_handle_paste(GapBuffer *buffer, char *text, size_t len)
 {
+	if (state.mode == COMMAND || state.mode == SEARCH)
+	{
+		char *line = state.mode == COMMAND ? state.command_buffer : state.search_buffer;
+		size_t *line_len = state.mode == COMMAND ? &state.command_length : &state.search_length;
 
-	char *current_filename = filename;
+		for (size_t i = 0; i < len && text[i] != '\n' && *line_len < 255; i++)
+		{
+			if (text[i] >= 32 && text[i] <= 126)
+			{
+				line[*line_len] = text[i];
+				(*line_len)++;
+			}
+		}
 
-	// Initialize state
-	state.row_offset = 0;
-	state.col_offset = 0;
-	state.cursor_x = 0;
-	state.cursor_y = 0;
-	state.mode = NORMAL;
-	state.message = NULL;
-	state.command_buffer[0] = 0;
-	state.command_length = 0;
-	state.undo_stack = NULL;
-	state.redo_stack = NULL;
-	state.insert_buffer = NULL;
-	state.insert_start = 0;
-	state.undo_manager = undo_manager_create();
-	state.search_buffer[0] = '\0';
-	state.search_length = 0;
-	state.search_forward = true;
-	state.last_search_pattern[0] = '\0';
-	state.last_search_forward = true;
-	state.highlight_search = false;
-	state.highlight_pattern[0] = '\0';
-	state.ai_suggestion[0] = '\0';
-	state.ghost_text_active = false;
-	get_terminal_size(&state.screen_rows, &state.screen_cols);
-	signal(SIGWINCH, sigwinch_handler);
-	fprintf(stderr, "env check: %s\n", getenv("ANTHROPIC_API_KEY") ? "SET" : "NULL");
-	state.api_key = read_api_key();
+		line[*line_len] = '\0';
+		return;
+	}
 
-	if (state.api_key == NULL)
+	UndoManager *um = state.undo_manager;
+	bool in_insert_session = um->in_insert_session;
+
+	// Close the typing done so far so the paste undoes on its own
+	undo_end_insert(um);
+	undo_push_operation(um, OP_INSERT, text, len, buffer->gap_start);
+
+	buffer_insert_text(buffer, text, len);
+
+	state.cursor_y = buffer->gap_line;
+	state.cursor_x = buffer->gap_start - buffer_line_start(buffer, buffer->gap_line);
+
+	if (in_insert_session)
 	{
-		fprintf(stderr, "Warning: ANTHROPIC_API_KEY not found!\n");
-		fprintf(stderr, "Set environment variable or create ~/.vesperrc\n");
+		// Keep typing into a fresh session after the paste
+		undo_begin_insert(um, buffer->gap_start);
 	}
 
-	GapBuffer *buffer = buffer_create(1024);
+	scroll();
+}
 
-	state.language = detect_language(filename);
+void editor_draw_frame(GapBuffer *buffer)
+{
+	if (state.ghost_text_active)
+	{
+		// Ghost text can spill over any row, repaint under it every frame
+		render_repaint_all();
+	}
 
-	if (filename != NULL)
+	if (profile_enabled)
 	{
-		FILE *fp = fopen(filename, "r");
+		render_repaint_rows(0, PROFILE_OVERLAY_ROWS);
+	}
 
-		if (fp != NULL)
-		{
-			fseek(fp, 0, SEEK_END);
-			long file_size = ftell(fp);
-			fseek(fp, 0, SEEK_SET);
+	// Moves down under the profile overlay, so cover both spots
+	if (mem_overlay_enabled)
+	{
+		render_repaint_rows(0, PROFILE_OVERLAY_ROWS + MEM_OVERLAY_ROWS);
+	}
 
-			char *contents = malloc(file_size + 1);
+	TRACE_BEGIN("render_text");
+	long long stage_start = profile_begin();
+	render_text(buffer, &state.highlighter, state.row_offset, state.screen_rows - 1, state.col_offset, state.screen_cols, state.mode == SEARCH, state.search_buffer);
+	profile_end(PROF_RENDER, stage_start);
+	TRACE_END("render_text");
 
-			if (contents != NULL)
-			{
+	if (state.ghost_text_active)
+	{
+		printf("\x1b[%zu;%zuH", state.cursor_y + 1, state.cursor_x + 1);
+		printf("\x1b[2m%s\x1b[0m", state.ai_suggestion);
+		printf("\x1b[%zu;%zuH", state.cursor_y + 1, state.cursor_x + 1);
+	}
 
-				fread(contents, 1, file_size, fp);
-				contents[file_size] = '\0';
+	if (profile_enabled)
+	{
+		profile_draw_overlay(state.screen_cols);
+	}
 
-				for (size_t i = 0; i < file_size; i++)
-				{
-					buffer_insert_char(buffer, contents[i]);
-				}
+	if (mem_overlay_enabled)
+	{
+		mem_draw_overlay(profile_enabled ? PROFILE_OVERLAY_ROWS + 1 : 1, state.screen_cols);
+	}
 
-				free(contents);
-			}
+	stage_start = profile_begin();
+	// A paged file's rows count from the top of the file, not the window
+	size_t row_base = state.pager != NULL ? pager_window(state.pager).first_line : 0;
 
-			fclose(fp);
-		}
+	draw_status_line(state.cursor_x, row_base + state.cursor_y, state.screen_rows, state.mode, state.message, state.command_buffer, state.search_buffer, state.search_forward);
+	profile_end(PROF_STATUS, stage_start);
+
+	printf("\x1b[%zu;%zuH", state.cursor_y + 1, state.cursor_x + 1);
+
+	size_t output_bytes = profile_pending_output();
+
+	TRACE_BEGIN("flush");
+	stage_start = profile_begin();
+	fflush(stdout);
+	profile_end(PROF_FLUSH, stage_start);
+	TRACE_END("flush");
+
+	profile_end_frame(output_bytes);
+}
+
+// Applies one decoded key, returns false once the editor should quit
+static bool editor_process_key(GapBuffer *buffer, char *filename, KeyEvent *event)
+{
+	int c = event->key;
+
+	// :wq is waiting for its save to land, nothing else happens meanwhile
+	if (state.quit_after_save)
+	{
+		state.message = "Saving, quitting when done...";
+		return true;
 	}
-    
-	while (1)
+
+	if (state.recovery_pending)
 	{
-		printf("\x1b[2J");
-		printf("\x1b[H");
+		return editor_answer_recovery(buffer, c);
+	}
 
-		render_text(buffer, state.row_offset, state.screen_rows - 1, state.col_offset, state.screen_cols, state.mode == SEARCH, state.search_buffer, state.language);
+	if (state.reload_pending)
+	{
+		return editor_answer_reload(c);
+	}
 
-		if (state.ghost_text_active)
+	if (c == 19)
+	{
+		if (!editor_read_only())
 		{
-	
-			printf("\x1b[2m%s\x1b[0m", state.ai_suggestion);
-			fflush(stdout);
-			printf("\x1b[%zu;%zuH", state.cursor_y + 1, state.cursor_x + 1);
+			editor_save(filename, buffer);
 		}
+		scroll();
+		return true;
+	}
 
-		draw_status_line(state.cursor_x, state.cursor_y, state.screen_rows, state.mode, state.message, state.command_buffer, state.search_buffer, state.search_forward);
-
-		printf("\x1b[%zu;%zuH", state.cursor_y + 1, state.cursor_x + 1);
+	// Navigation keys work the same in every mode
+	if (c == KEY_ARROW_UP)
+	{
+		if (state.cursor_y > 0)
+		{
+			state.cursor_y--;
+		}
+		scroll();
+		return true;
+	}
+	else if (c == KEY_ARROW_DOWN)
+	{
+		if (state.cursor_y < state.screen_rows - 1)
+		{
+			state.cursor_y++;
+		}
+		scroll();
+		return true;
+	}
+	else if (c == KEY_ARROW_RIGHT)
+	{
+		if (state.cursor_x < state.screen_cols - 1)
+		{
+			state.cursor_x++;
+		}
+		scroll();
+		return true;
+	}
+	else if (c == KEY_ARROW_LEFT)
+	{
+		if (state.cursor_x > 0)
+		{
+			state.cursor_x--;
+		}
+		scroll();
+		return true;
+	}
+	else if (c == KEY_HOME)
+	{
+		state.cursor_x = 0;
+		scroll();
+		return true;
+	}
+	else if (c == KEY_END)
+	{
+		size_t line_length = buffer_get_line_length(buffer, state.cursor_y);
+		state.cursor_x = line_length;
+		scroll();
+		return true;
+	}
+	else if (c == KEY_PAGE_UP)
+	{
+		if (state.cursor_y < state.screen_rows - 1)
+		{
+			state.cursor_y = 0;
+		}
+		else
+		{
+			state.cursor_y -= (state.screen_rows - 1);
+		}
+		scroll();
+		return true;
+	}
+	else if (c == KEY_PAGE_DOWN)
+	{
+		size_t total_lines = buffer_get_total_lines(buffer);
+		size_t new_pos = state.cursor_y + (state.screen_rows - 1);
 
-		fflush(stdout);
+		if (new_pos >= total_lines)
+		{
+			state.cursor_y = total_lines - 1;
+		}
+		else
+		{
+			state.cursor_y = new_pos;
+		}
+		scroll();
+		return true;
+	}
+	else if (c == KEY_PASTE)
+	{
+		if (!editor_read_only())
+		{
+			editor_handle_paste(buffer, event->paste, event->paste_len);
+		}
+		return true;
+	}
+	else if (c >= 256)
+	{
+		// Function keys, Insert/Delete and unmapped sequences have no bindings yet
+		return true;
+	}
 
-		char c;
-		read(STDIN_FILENO, &c, 1);
+	if (state.mode == NORMAL)
+	{
+		bool edits = c == 'u' || c == 18 || c == 'i' || (state.pending_key == 'g' && (c == '-' || c == '+'));
 
-		if (c == 19)
+		if (edits && editor_read_only())
 		{
-			save_file(filename, buffer, &state);
-			scroll();
-			continue;
+			state.pending_key = 0;
+			return true;
 		}
 
-		// Check for arrow keys first
-		if (c == 27)
+		// g- and g+ walk the undo states in the order they were made,
+		// across branches
+		if (state.pending_key == 'g')
 		{
-			char seq[2];
+			state.pending_key = 0;
 
-			if (read(STDIN_FILENO, &seq[0], 1) == 1)
+			if (c == '-')
 			{
-				if (seq[0] == '[')
-				{
-					if (read(STDIN_FILENO, &seq[1], 1) == 1)
-					{
-						if (seq[1] == 'A')
-						{
-							if (state.cursor_y > 0)
-							{
-								state.cursor_y--;
-							}
-						}
-						else if (seq[1] == 'B')
-						{
-							if (state.cursor_y < state.screen_rows - 1)
-							{
-								state.cursor_y++;
-							}
-						}
-						else if (seq[1] == 'C')
-						{
-							if (state.cursor_x < state.screen_cols - 1)
-							{
-								state.cursor_x++;
-							}
-						}
-						else if (seq[1] == 'D')
-						{
-							if (state.cursor_x > 0)
-							{
-								state.cursor_x--;
-							}
-						}
-						else if (seq[1] == 'H')
-						{
-							state.cursor_x = 0;
-							scroll();
-							continue;
-						}
-						else if (seq[1] == '1')
-						{
-							char seq2;
-							if (read(STDIN_FILENO, &seq2, 1) == 1)
-							{
-								if (seq2 == '~')
-								{
-									state.cursor_x = 0;
-									scroll();
-									continue;
-								}
-							}
-						}
-						else if (seq[1] == 'F')
-						{
-							// End key: ESC [ F
-							size_t line_length = buffer_get_line_length(buffer, state.cursor_y);
-							state.cursor_x = line_length;
-							scroll();
-							continue;
-						}
-						else if (seq[1] == '4')
-						{
-							// Might be End key (ESC [ 4 ~)
-							char seq2;
-							if (read(STDIN_FILENO, &seq2, 1) == 1)
-							{
-								if (seq2 == '~')
-								{
-									// It's End key!
-									size_t line_length = buffer_get_line_length(buffer, state.cursor_y);
-									state.cursor_x = line_length;
-									scroll();
-									continue;
-								}
-							}
-						}
-						else if (seq[1] == '5')
-						{
-							// Might be Page Up (ESC [ 5 ~)
-							char seq2;
-							if (read(STDIN_FILENO, &seq2, 1) == 1)
-							{
-								if (seq2 == '~')
-								{
-									// It's Page Up!
-									if (state.cursor_y < state.screen_rows - 1)
-									{
-										state.cursor_y = 0;
-									}
-									else
-									{
-										state.cursor_y -= (state.screen_rows - 1);
-									}
-									scroll();
-									continue;
-								}
-							}
-						}
-						else if (seq[1] == '6')
-						{
-							// Might be Page Down (ESC [ 6 ~)
-							char seq2;
-							if (read(STDIN_FILENO, &seq2, 1) == 1)
-							{
-								if (seq2 == '~')
-								{
-									// It's Page Down!
-									size_t total_lines = buffer_get_total_lines(buffer);
-									size_t new_pos = state.cursor_y + (state.screen_rows - 1);
-
-									if (new_pos >= total_lines)
-									{
-										state.cursor_y = total_lines - 1;
-									}
-									else
-									{
-										state.cursor_y = new_pos;
-									}
-									scroll();
-									continue;
-								}
-							}
-						}
-
-						scroll();
-						continue;
-					}
-				}
+				editor_undo_goto(buffer, undo_step_target(state.undo_manager, 1, false), false);
 			}
-		}
-
-		if (state.mode == NORMAL)
-		{
-			if (c == 'q')
+			else if (c == '+')
 			{
-				break;
+				editor_undo_goto(buffer, undo_step_target(state.undo_manager, 1, true), true);
 			}
-			else if (c == '/')
+			else if (c == 't' || c == 'T')
 			{
-				state.mode = SEARCH;
-				state.search_buffer[0] = '\0';
-				state.search_length = 0;
-				state.search_forward = true;  // Forward search
+				editor_step_tab(c == 't');
 			}
-			else if (c == '?')
+		}
+		else if (c == 'g')
+		{
+			state.pending_key = 'g';
+		}
+		else if (c == 27 && state.search_job != NULL)
+		{
+			editor_pager_stop_search();
+			state.message = "Search stopped";
+		}
+		else if (c == 'q')
+		{
+			return false;
+		}
+		else if (c == '/')
+		{
+			state.mode = SEARCH;
+			state.search_buffer[0] = '\0';
+			state.search_length = 0;
+			state.search_forward = true;  // Forward search
+		}
+		else if (c == '?')
+		{
+			state.mode = SEARCH;
+			state.search_buffer[0] = '\0';
+			state.search_length = 0;
+			state.search_forward = false;  // Backward search
+		}
+		else if (c == 'n')  // Next match
+		{
+			if (state.last_search_pattern[0] == '\0')
 			{
-				state.mode = SEARCH;
-				state.search_buffer[0] = '\0';
-				state.search_length = 0;
-				state.search_forward = false;  // Backward search
+				state.message = "No previous search pattern";
 			}
-			else if (c == 'n')  // Next match
+			else if (state.pager != NULL)
 			{
-				if (state.last_search_pattern[0] == '\0')
-				{
-					state.message = "No previous search pattern";
-				}
-				else
-				{
-					// Get current buffer position
-					size_t current_pos = buffer_screen_to_index(buffer, state.cursor_y, state.cursor_x);
-					ssize_t match_pos;
-					
-					if (state.last_search_forward)
-					{
-						// Search forward from current position + 1
-						match_pos = buffer_find_pattern(buffer, state.last_search_pattern, current_pos + 1);
-					}
-					else
-					{
-						// Search backward from current position - 1
-						match_pos = buffer_find_pattern_backward(buffer, state.last_search_pattern, current_pos - 1);
-					}
-					
-					if (match_pos != -1)
-					{
-						buffer_index_to_screen(buffer, match_pos, &state.cursor_y, &state.cursor_x);
-						state.message = "Pattern found";
-					}
-					else
-					{
-						state.message = "Pattern not found";
-					}
-				}
+				editor_pager_search(state.last_search_pattern, state.last_search_forward);
 			}
-			else if (c == 'N')  // Previous match (opposite direction)
+			else
 			{
-				if (state.last_search_pattern[0] == '\0')
+				// Get current buffer position
+				size_t current_pos = buffer_screen_to_index(buffer, state.cursor_y, state.cursor_x);
+				ssize_t match_pos;
+				
+				if (state.last_search_forward)
 				{
-					state.message = "No previous search pattern";
+					// Search forward from current position + 1
+					match_pos = buffer_find_pattern(buffer, state.last_search_pattern, current_pos + 1);
 				}
 				else
 				{
-					// Get current buffer position
-					size_t current_pos = buffer_screen_to_index(buffer, state.cursor_y, state.cursor_x);
-					ssize_t match_pos;
-					
-					if (state.last_search_forward)
-					{
-						// Search backward (opposite of original forward search)
-						match_pos = buffer_find_pattern_backward(buffer, state.last_search_pattern, current_pos - 1);
-					}
-					else
-					{
-						// Search forward (opposite of original backward search)
-						match_pos = buffer_find_pattern(buffer, state.last_search_pattern, current_pos + 1);
-					}
-					
-					if (match_pos != -1)
-					{
-						buffer_index_to_screen(buffer, match_pos, &state.cursor_y, &state.cursor_x);
-						state.message = "Pattern found";
-					}
-					else
-					{
-						state.message = "Pattern not found";
-					}
+					// Search backward from current position - 1
+					match_pos = buffer_find_pattern_backward(buffer, state.last_search_pattern, current_pos - 1);
+				}
+				
+				if (match_pos != -1)
+				{
+					buffer_index_to_screen(buffer, match_pos, &state.cursor_y, &state.cursor_x);
+					state.message = "Pattern found";
+				}
+				else
+				{
+					state.message = "Pattern not found";
 				}
 			}
-			else if (c == 'u')
-			{
-				undo_operation(state.undo_manager, buffer, &state);
-			}
-			else if (c == 18)
+		}
+		else if (c == 'N')  // Previous match (opposite direction)
+		{
+			if (state.last_search_pattern[0] == '\0')
 			{
-				redo_operation(state.undo_manager, buffer, &state);
+				state.message = "No previous search pattern";
 			}
-			else if (c == ':')
+			else if (state.pager != NULL)
 			{
-				state.mode = COMMAND;
-				state.command_buffer[0] = '\0';
-				state.command_length = 0;
+				editor_pager_search(state.last_search_pattern, !state.last_search_forward);
 			}
-			else if (c == 'h')
+			else
 			{
-				if (state.cursor_x > 0)
+				// Get current buffer position
+				size_t current_pos = buffer_screen_to_index(buffer, state.cursor_y, state.cursor_x);
+				ssize_t match_pos;
+				
+				if (state.last_search_forward)
 				{
-					state.cursor_x--;
+					// Search backward (opposite of original forward search)
+					match_pos = buffer_find_pattern_backward(buffer, state.last_search_pattern, current_pos - 1);
 				}
-			}
-			else if (c == 'l')
-			{
-				if (state.cursor_x < state.screen_cols - 1)
+				else
 				{
-					state.cursor_x++;
+					// Search forward (opposite of original backward search)
+					match_pos = buffer_find_pattern(buffer, state.last_search_pattern, current_pos + 1);
 				}
-			}
-			else if (c == 'k')
-			{
-				if (state.cursor_y > 0)
+				
+				if (match_pos != -1)
+				{
+					buffer_index_to_screen(buffer, match_pos, &state.cursor_y, &state.cursor_x);
+					state.message = "Pattern found";
+				}
+				else
 				{
-					state.cursor_y--;
+					state.message = "Pattern not found";
 				}
 			}
-			else if (c == 'j')
+		}
+		else if (c == 'u')
+		{
+			if (!undo_operation(state.undo_manager, buffer, &state.cursor_x, &state.cursor_y))
 			{
-				if (state.cursor_y < state.screen_rows - 1)
-				{
-					state.cursor_y++;
-				}
+				state.message = "Nothing to undo";
 			}
-			else if (c == '0')
+		}
+		else if (c == 18)
+		{
+			if (!redo_operation(state.undo_manager, buffer, &state.cursor_x, &state.cursor_y))
+			{
+				state.message = "Nothing to redo";
+			}
+		}
+		else if (c == ':')
+		{
+			state.mode = COMMAND;
+			state.command_buffer[0] = '\0';
+			state.command_length = 0;
+
+			// A leftover message would block typing, see the COMMAND branch
+			state.message = NULL;
+		}
+		else if (c == 'h')
+		{
+			if (state.cursor_x > 0)
 			{
-				state.cursor_x = 0;
+				state.cursor_x--;
 			}
-			else if (c == '$')
+		}
+		else if (c == 'l')
+		{
+			if (state.cursor_x < state.screen_cols - 1)
 			{
-				size_t line_length = buffer_get_line_length(buffer, state.cursor_y);
-				state.cursor_x = line_length;
+				state.cursor_x++;
 			}
-			else if (c == 'i')
+		}
+		else if (c == 'k')
+		{
+			if (state.cursor_y > 0)
 			{
-				state.mode = INSERT;
-
-				state.undo_manager->in_insert_session = true;
-				state.undo_manager->insert_start_x = state.cursor_x;
-				state.undo_manager->insert_start_y = state.cursor_y;
-				state.undo_manager->insert_start_pos = buffer->gap_start;
-				state.undo_manager->current_insert_len = 0;
-
-				state.undo_manager->current_insert_buffer[0] = '\0';
+				state.cursor_y--;
 			}
 		}
-		else if (state.mode == INSERT)
+		else if (c == 'j')
 		{
-			// If ESC is clicked switch to NORMAL mode
-			if (c == 27)
+			if (state.cursor_y < state.screen_rows - 1)
 			{
-				// Save INSERT operation before switching mode
-				if (state.undo_manager->in_insert_session && state.undo_manager->current_insert_len > 0)
-				{
-					undo_push_operation(
-						state.undo_manager,
-						OP_INSERT,
-						state.undo_manager->current_insert_buffer,
-						state.undo_manager->insert_start_pos,
-						state.undo_manager->insert_start_x,
-						state.undo_manager->insert_start_y);
-				}
+				state.cursor_y++;
+			}
+		}
+		else if (c == '0')
+		{
+			state.cursor_x = 0;
+		}
+		else if (c == '$')
+		{
+			size_t line_length = buffer_get_line_length(buffer, state.cursor_y);
+			state.cursor_x = line_length;
+		}
+		else if (c == 'i')
+		{
+			state.mode = INSERT;
 
-				state.undo_manager->in_insert_session = false;
-				state.mode = NORMAL;
+			undo_begin_insert(state.undo_manager, buffer->gap_start);
+		}
+	}
+	else if (state.mode == INSERT)
+	{
+		// If ESC is clicked switch to NORMAL mode
+		if (c == 27)
+		{
+			// Close the INSERT record before switching mode
+			undo_end_insert(state.undo_manager);
+			state.mode = NORMAL;
+		}
+		else if (c == 0)
+		{
+			if (state.ghost_text_active)
+			{
+				return true;
 			}
-			else if (c == 0)
+
+			if (state.api_key == NULL)
 			{
-				if (state.ghost_text_active)
-				{
-					continue;
-				}
+				state.message = "Error: API key not configured";
+				return true;
+			}
 
-				if (state.api_key == NULL)
-				{
-					state.message = "Error: API key not configured";
-					continue;
-				}
+			char context[532];
+			extract_current_line_context(buffer, state.cursor_y, state.cursor_x, context, sizeof(context));
 
-				char context[532];
-				extract_current_line_context(buffer, state.cursor_y, state.cursor_x, context, sizeof(context));
+			if (state.ai_request_pending)
+			{
+				return true;
+			}
 
+			// The request runs on a worker, the reply comes back through the event loop
+			if (ai_request_suggestion(&event_loop, context, state.api_key, editor_on_ai_suggestion, NULL))
+			{
+				state.ai_request_pending = true;
 				state.message = "Requesting AI suggesstion...";
+			}
+			else
+			{
+				state.message = "Error: Failed to get AI suggestion";
+			}
+		}
+		// If BACKSPACE is clicked delete the character
+		else if (c == 127)
+		{
+			// The character is recorded first, backspace can go past what was typed
+			if (buffer->gap_start > 0)
+			{
+				undo_backspace(state.undo_manager, buffer->data[buffer->gap_start - 1]);
+			}
 
-				char *response = call_claude_api(context, state.api_key);
-
-				// TEMPORARY DEBUG - print to stderr so it doesn't mess up the screen
-				fprintf(stderr, "\n=== DEBUG ===\n");
-				fprintf(stderr, "Context sent: '%s'\n", context);
-				fprintf(stderr, "Response received: %s\n", response ? response : "NULL");
-				fprintf(stderr, "=============\n");
-
-
-				if (response != NULL)
-    			{
-					// Copy to suggestion buffer (truncate if too long)
-					strncpy(state.ai_suggestion, response, sizeof(state.ai_suggestion) - 1);
-					state.ai_suggestion[sizeof(state.ai_suggestion) - 1] = '\0';
-					
-					// Free the response
-					free(response);
-					
-					// Activate ghost text
-					state.ghost_text_active = true;
-					state.message = "Suggestion ready (Tab to accept, Esc to reject)";
-				}
-				else
-				{
-					state.message = "Error: Failed to get AI suggestion";
-				}
+			buffer_delete_char(buffer);
+
+			// Move cursor left
+			if (state.cursor_x > 0)
+			{
+				state.cursor_x--;
 			}
-			// If BACKSPACE is clicked delete the character
-			else if (c == 127)
+			else if (state.cursor_y > 0)
 			{
-				buffer_delete_char(buffer);
+				// At start of line, move to end of previous line
+				state.cursor_y--;
+				state.cursor_x = buffer_get_line_length(buffer, state.cursor_y);
+			}
+		}
+		else if (c == 13 || c == 10)
+		{
+			buffer_insert_char(buffer, '\n');
 
-				// Move cursor left
-				if (state.cursor_x > 0)
-				{
-					state.cursor_x--;
-				}
-				else if (state.cursor_y > 0)
-				{
-					// At start of line, move to end of previous line
-					state.cursor_y--;
-					state.cursor_x = buffer_get_line_length(buffer, state.cursor_y);
-				}
+			state.cursor_y++;
+			state.cursor_x = 0;
 
-				if (state.undo_manager->in_insert_session && state.undo_manager->current_insert_len > 0)
-				{
-					state.undo_manager->current_insert_len--;
-					state.undo_manager->current_insert_buffer[state.undo_manager->current_insert_len] = '\0';
-				}
+			// Also track newline in the INSERT record
+			undo_insert_char(state.undo_manager, '\n');
+		}
+
+		// If Character is to be inserted insert the character
+		else if (c >= 32 && c <= 126)
+		{
+			buffer_insert_char(buffer, c);
+
+			state.cursor_x++;
+
+			undo_insert_char(state.undo_manager, c);
+		}
+	}
+
+	else if (state.mode == COMMAND)
+	{
+		if (c == 27)
+		{
+			state.mode = NORMAL;
+			state.command_buffer[0] = '\0';
+			state.command_length = 0;
+			state.message = NULL;
+		}
+
+		else if (c == 127)
+		{
+			if (state.command_length > 0)
+			{
+				state.command_length--;
+
+				// add null terminator at current_length position
+				state.command_buffer[state.command_length] = '\0';
 			}
-			else if (c == 13 || c == 10)
+		}
+
+		else if (c == 13 || c == 10)
+		{
+			// Parse the command
+			if (strcmp(state.command_buffer, "q") == 0 || strcmp(state.command_buffer, "quit") == 0)
 			{
-				buffer_insert_char(buffer, '\n');
+				return false;
+			}
 
-				state.cursor_y++;
-				state.cursor_x = 0;
+			// Save the command
+			else if (strcmp(state.command_buffer, "w") == 0 || strcmp(state.command_buffer, "write") == 0)
+			{
+				if (!editor_read_only())
+				{
+					editor_save(filename, buffer);
+				}
+			}
 
-				// Also track newline in insert buffer
-				if (state.undo_manager->in_insert_session)
+			// Save and quit
+			else if (strcmp(state.command_buffer, "wq") == 0 || strcmp(state.command_buffer, "x") == 0)
+			{
+				// A background save quits once it lands, a failed one stays
+				if (!editor_read_only() && editor_save(filename, buffer))
 				{
-					// Check if buffer needs to grow
-					if (state.undo_manager->current_insert_len >= state.undo_manager->current_insert_capacity - 1)
+					if (!state.save_pending)
 					{
-						state.undo_manager->current_insert_capacity *= 2;
-						state.undo_manager->current_insert_buffer = realloc(
-							state.undo_manager->current_insert_buffer,
-							state.undo_manager->current_insert_capacity);
+						return false;
 					}
 
-					// Add newline
-					state.undo_manager->current_insert_buffer[state.undo_manager->current_insert_len] = '\n';
-					state.undo_manager->current_insert_len++;
-					state.undo_manager->current_insert_buffer[state.undo_manager->current_insert_len] = '\0';
+					state.quit_after_save = true;
 				}
 			}
 
-			// If Character is to be inserted insert the character
-			else if (c >= 32 && c <= 126)
+			// :N goes to line N
+			else if (state.command_buffer[0] != '\0' &&
+			         strspn(state.command_buffer, "0123456789") == strlen(state.command_buffer))
 			{
-				buffer_insert_char(buffer, c);
+				editor_goto_line(buffer, strtoull(state.command_buffer, NULL, 10));
+			}
 
-				state.cursor_x++;
+			// The other files given on the command line
+			else if (strcmp(state.command_buffer, "tabn") == 0 || strcmp(state.command_buffer, "tabnext") == 0)
+			{
+				editor_step_tab(true);
+			}
 
-				if (state.undo_manager->in_insert_session)
-				{
-					// Check if buffer needs to grow
-					if (state.undo_manager->current_insert_len >= state.undo_manager->current_insert_capacity - 1)
-					{
+			else if (strcmp(state.command_buffer, "tabp") == 0 || strcmp(state.command_buffer, "tabprevious") == 0)
+			{
+				editor_step_tab(false);
+			}
 
-						// Double the capacity
-						state.undo_manager->current_insert_capacity *= 2;
-						state.undo_manager->current_insert_buffer = realloc(
-							state.undo_manager->current_insert_buffer,
-							state.undo_manager->current_insert_capacity);
-					}
+			else if (strncmp(state.command_buffer, "tabn ", 5) == 0 || strncmp(state.command_buffer, "tabnext ", 8) == 0)
+			{
+				size_t number = strtoul(strchr(state.command_buffer, ' ') + 1, NULL, 10);
 
-					// Add character
-					state.undo_manager->current_insert_buffer[state.undo_manager->current_insert_len] = c;
-					state.undo_manager->current_insert_len++;
-					state.undo_manager->current_insert_buffer[state.undo_manager->current_insert_len] = '\0';
+				if (number >= 1 && number <= state.tab_count)
+				{
+					editor_switch_tab(number - 1);
+				}
+				else
+				{
+					state.message = "No such tab";
 				}
 			}
-		}
 
-		else if (state.mode == COMMAND)
-		{
-			if (c == 27)
+			else if (strcmp(state.command_buffer, "tabs") == 0)
 			{
-				state.mode = NORMAL;
-				state.command_buffer[0] = '\0';
-				state.command_length = 0;
-				state.message = NULL;
+				editor_list_tabs();
 			}
 
-			else if (c == 127)
+			// Keep reading what is appended to the file and show its end
+			else if (strcmp(state.command_buffer, "follow") == 0)
 			{
-				if (state.command_length > 0)
-				{
-					state.command_length--;
+				editor_toggle_follow();
+			}
+
+			// Toggle the per-stage timing overlay
+			else if (strcmp(state.command_buffer, "profile") == 0)
+			{
+				profile_set_enabled(!profile_enabled);
 
-					// add null terminator at current_length position
-					state.command_buffer[state.command_length] = '\0';
+				if (!profile_enabled)
+				{
+					render_repaint_rows(0, PROFILE_OVERLAY_ROWS);
 				}
 			}
 
-			else if (c == 13 || c == 10)
+			// Undo tree time travel, by states or by time
+			else if (strcmp(state.command_buffer, "earlier") == 0 || strncmp(state.command_buffer, "earlier ", 8) == 0)
 			{
-				// Parse the command
-				if (strcmp(state.command_buffer, "q") == 0 || strcmp(state.command_buffer, "quit") == 0)
+				if (!editor_read_only())
 				{
-					break;
+					editor_undo_travel(buffer, state.command_buffer + (state.command_buffer[7] == ' ' ? 8 : 7), false);
 				}
+			}
 
-				// Save the command
-				else if (strcmp(state.command_buffer, "w") == 0 || strcmp(state.command_buffer, "write") == 0)
+			else if (strcmp(state.command_buffer, "later") == 0 || strncmp(state.command_buffer, "later ", 6) == 0)
+			{
+				if (!editor_read_only())
 				{
-					save_file(current_filename, buffer, &state);
+					editor_undo_travel(buffer, state.command_buffer + (state.command_buffer[5] == ' ' ? 6 : 5), true);
 				}
+			}
+
+			// Toggle the per-subsystem allocation counters
+			else if (strcmp(state.command_buffer, "memstats") == 0)
+			{
+				mem_overlay_enabled = !mem_overlay_enabled;
 
-				// Save and quit
-				else if (strcmp(state.command_buffer, "wq") == 0 || strcmp(state.command_buffer, "x") == 0)
+				if (!mem_overlay_enabled)
 				{
-					save_file(current_filename, buffer, &state);
-					break;
+					render_repaint_rows(0, PROFILE_OVERLAY_ROWS + MEM_OVERLAY_ROWS);
 				}
+			}
 
-				else if (state.command_buffer[0] == '\0')
+			// Chrome trace of everything between start and stop
+			else if (strcmp(state.command_buffer, "trace start") == 0)
+			{
+				if (!trace_compiled_in())
 				{
+					state.message = "Tracing is not built in (make TRACE=1)";
 				}
-
 				else
 				{
-					state.message = "This command is not recognized";
+					trace_start();
+					state.message = "Tracing...";
 				}
-
-				state.command_buffer[0] = '\0';
-				state.command_length = 0;
-				state.mode = NORMAL;
 			}
 
-			else if (c >= 32 && c <= 126)
+			else if (strcmp(state.command_buffer, "trace stop") == 0 || strncmp(state.command_buffer, "trace stop ", 11) == 0)
 			{
-				if (state.message != NULL && state.message[0] != '\0')
+				char *path = state.command_buffer[10] == ' ' ? state.command_buffer + 11 : "vesper-trace.json";
+
+				if (!trace_active())
 				{
+					state.message = "No trace running";
 				}
-
-				else if (state.command_length < 255)
+				else if (trace_stop(path) == 0)
 				{
-					state.command_buffer[state.command_length] = c;
-					state.command_length++;
-					state.command_buffer[state.command_length] = '\0';
+					state.message = "Trace written";
 				}
-
 				else
 				{
-					state.command_buffer[0] = '\0';
-					state.command_length = 0;
-
-					state.message = "Command too long";
+					state.message = "Error: Cannot write trace";
 				}
 			}
+
+			else if (state.command_buffer[0] == '\0')
+			{
+			}
+
+			else
+			{
+				state.message = "This command is not recognized";
+			}
+
+			state.command_buffer[0] = '\0';
+			state.command_length = 0;
+			state.mode = NORMAL;
 		}
 
-		else if (state.mode == SEARCH)
+		else if (c >= 32 && c <= 126)
 		{
-			if (c == 27) // ESC
+			if (state.message != NULL && state.message[0] != '\0')
 			{
-				state.mode = NORMAL;
-				state.search_buffer[0] = '\0';
-				state.search_length = 0;
-				state.message = NULL;
 			}
-			else if (c == 127) // Backspace
+
+			else if (state.command_length < 255)
 			{
-				if (state.search_length > 0)
-				{
-					state.search_length--;
-					state.search_buffer[state.search_length] = '\0';
-				}
+				state.command_buffer[state.command_length] = c;
+				state.command_length++;
+				state.command_buffer[state.command_length] = '\0';
 			}
-			else if (c == 13 || c == 10) // Enter
+
+			else
 			{
-				ssize_t match_pos;
+				state.command_buffer[0] = '\0';
+				state.command_length = 0;
 
-				if (state.search_forward) 
-				{
-					match_pos = buffer_find_pattern(buffer, state.search_buffer, 0);
-				}
-				else
-				{
-					match_pos = buffer_find_pattern_backward(buffer, state.search_buffer, buffer->capacity - 1);
-				}
-				if (match_pos != -1)
-				{
-					buffer_index_to_screen(buffer, match_pos, &state.cursor_y, &state.cursor_x);
-					state.message = "Pattern found";
+				state.message = "Command too long";
+			}
+		}
+	}
 
-					strcpy(state.last_search_pattern, state.search_buffer);
-					state.last_search_forward = state.search_forward;
-				}
-				else
-				{
-					state.message = "Pattern not found";
-				}
+	else if (state.mode == SEARCH)
+	{
+		if (c == 27) // ESC
+		{
+			state.mode = NORMAL;
+			state.search_buffer[0] = '\0';
+			state.search_length = 0;
+			state.message = NULL;
+		}
+		else if (c == 127) // Backspace
+		{
+			if (state.search_length > 0)
+			{
+				state.search_length--;
+				state.search_buffer[state.search_length] = '\0';
+			}
+		}
+		else if ((c == 13 || c == 10) && state.pager != NULL)
+		{
+			// Too big to search from an end, it goes from the cursor
+			if (state.search_buffer[0] != '\0')
+			{
+				strcpy(state.last_search_pattern, state.search_buffer);
+				state.last_search_forward = state.search_forward;
+				editor_pager_search(state.search_buffer, state.search_forward);
+			}
+
+			state.search_buffer[0] = '\0';
+			state.search_length = 0;
+			state.mode = NORMAL;
+		}
+		else if (c == 13 || c == 10) // Enter
+		{
+			ssize_t match_pos;
+
+			if (state.search_forward) 
+			{
+				match_pos = buffer_find_pattern(buffer, state.search_buffer, 0);
+			}
+			else
+			{
+				match_pos = buffer_find_pattern_backward(buffer, state.search_buffer, buffer->capacity - 1);
+			}
+			if (match_pos != -1)
+			{
+				buffer_index_to_screen(buffer, match_pos, &state.cursor_y, &state.cursor_x);
+				state.message = "Pattern found";
 
-				state.search_buffer[0] = '\0';
-				state.search_length = 0;
-				state.mode = NORMAL;
+				strcpy(state.last_search_pattern, state.search_buffer);
+				state.last_search_forward = state.search_forward;
 			}
-			else if (c >= 32 && c <= 126) // Printable characters
+			else
 			{
-				if (state.search_length < 255)
-				{
-					state.search_buffer[state.search_length] = c;
-					state.search_length++;
-					state.search_buffer[state.search_length] = '\0';
-				}
+				state.message = "Pattern not found";
+			}
+
+			state.search_buffer[0] = '\0';
+			state.search_length = 0;
+			state.mode = NORMAL;
+		}
+		else if (c >= 32 && c <= 126) // Printable characters
+		{
+			if (state.search_length < 255)
+			{
+				state.search_buffer[state.search_length] = c;
+				state.search_length++;
+				state.search_buffer[state.search_length] = '\0';
 			}
 		}
 	}
 
+	return true;
+}
+
+bool editor_handle_key(GapBuffer *buffer, char *filename, KeyEvent *event)
+{
+	// Alt+key and ESC typed quickly before a key arrive the same way, like
+	// Vim treat both as ESC followed by the key
+	if ((event->modifiers & KEY_MOD_ALT) && event->key < 256)
+	{
+		KeyEvent escape = { 27, 0, NULL, 0 };
+
+		if (!editor_process_key(buffer, filename, &escape))
+		{
+			return false;
+		}
+
+		event->modifiers &= ~KEY_MOD_ALT;
+	}
+
+	bool keep_going = editor_process_key(buffer, filename, event);
+
+	if (state.pager != NULL)
+	{
+		editor_pager_recenter();
+	}
+
+	return keep_going;
+}
+
+static void editor_on_frame(void *data)
+{
+	frame_timer = -1;
+
+	TRACE_BEGIN("frame");
+	editor_draw_frame(state.buffer);
+	TRACE_END("frame");
+
+	last_frame = monotonic_ms();
+}
+
+// Schedules one redraw, at most max_fps apart, however many changes come in first
+static void editor_request_frame(void)
+{
+	if (frame_timer >= 0)
+	{
+		return;
+	}
+
+	long long delay = 0;
+
+	if (state.config.max_fps > 0)
+	{
+		delay = last_frame + 1000 / state.config.max_fps - monotonic_ms();
+
+		if (delay < 0)
+		{
+			delay = 0;
+		}
+	}
+
+	frame_timer = event_loop_add_timer(&event_loop, delay, 0, editor_on_frame, NULL);
+
+	if (frame_timer < 0)
+	{
+		editor_on_frame(NULL);
+	}
+}
+
+static void editor_on_escape_timeout(void *data);
+
+// Applies every key that has been fully decoded so far
+static void editor_drain_keys(void)
+{
+	KeyEvent event;
+
+	while (true)
+	{
+		long long stage_start = profile_begin();
+		bool decoded = input_next_key(&input, &event);
+		profile_end(PROF_INPUT_DECODE, stage_start);
+
+		if (!decoded)
+		{
+			break;
+		}
+
+		TRACE_BEGIN("key");
+		stage_start = profile_begin();
+		bool keep_running = editor_handle_key(state.buffer, state.filename, &event);
+		profile_end(PROF_DISPATCH, stage_start);
+		TRACE_END("key");
+
+		if (!keep_running)
+		{
+			event_loop_stop(&event_loop);
+			return;
+		}
+	}
+
+	// A lone ESC, or a sequence cut off mid-read: give the rest a moment.
+	// A paste gets longer, but not forever if its terminator got lost.
+	InputPartial partial = input_partial(&input);
+
+	if (partial != INPUT_IDLE && escape_timer < 0)
+	{
+		int timeout = partial == INPUT_IN_PASTE ? INPUT_PASTE_TIMEOUT_MS : state.config.escape_timeout_ms;
+		escape_timer = event_loop_add_timer(&event_loop, timeout, 0, editor_on_escape_timeout, NULL);
+	}
+
+	editor_request_frame();
+}
+
+static void editor_on_escape_timeout(void *data)
+{
+	escape_timer = -1;
+	input_expire_escape(&input);
+	editor_drain_keys();
+}
+
+static void editor_on_input(int fd, void *data)
+{
+	TRACE_BEGIN("input read");
+	long long stage_start = profile_begin();
+	ssize_t got = input_read(&input, fd, 0);
+	profile_end(PROF_INPUT_DECODE, stage_start);
+	TRACE_END("input read");
+
+	if (got < 0)
+	{
+		// The terminal went away, not a quit: the swap stays for recovery
+		input_lost = true;
+		event_loop_stop(&event_loop);
+		return;
+	}
+
+	if (escape_timer >= 0)
+	{
+		event_loop_cancel_timer(&event_loop, escape_timer);
+		escape_timer = -1;
+	}
+
+	editor_drain_keys();
+	editor_schedule_swap();
+
+	// Back in NORMAL mode, or a question answered
+	if (state.disk_check_deferred && event_loop.running)
+	{
+		editor_check_disk();
+	}
+}
+
+static void editor_on_resize(void *data)
+{
+	get_terminal_size(&state.screen_rows, &state.screen_cols);
+	screen_clear();
+	render_invalidate();
+	editor_request_frame();
+}
+
+// Logs raw terminal input to path while the editor runs, see bench/replay.c
+void editor_record_input(const char *path)
+{
+	record_path = path;
+}
+
+// Traces the whole session, file load included, and writes it to path on exit
+void editor_trace_session(const char *path)
+{
+	trace_path = path;
+}
+
+// Returns how many changes came back, undo_message says so when any did
+static size_t editor_open_undo_journal(char *filename, GapBuffer *buffer)
+{
+	char journal_path[4096];
+	size_t restored = 0;
+
+	if (state.config.persistent_undo && undo_journal_path(filename, journal_path, sizeof(journal_path)))
+	{
+		restored = undo_journal_open(state.undo_manager, journal_path, buffer);
+
+		if (restored > 0)
+		{
+			snprintf(undo_message, sizeof(undo_message), "Undo history restored (%zu changes)", restored);
+		}
+	}
+
+	return restored;
+}
+
+// Files at least this big come in on a worker a chunk at a time, the first
+// screenful shows up as soon as it is read. Smaller ones are read in full
+// before the first frame, that's quicker than a frame anyway.
+#define LOAD_ASYNC_MIN (4 * 1024 * 1024)
+
+static char load_message[64];
+
+static void editor_on_load_progress(size_t loaded, bool done, bool ok, void *data)
+{
+	GapBuffer *buffer = data;
+
+	// Nothing edits while loading, the gap is still right after the text
+	// and ahead of what the loader writes
+	if (loaded > state.load_used || done)
+	{
+		state.load_used += file_take_text(buffer, state.load_dest + state.load_used, loaded - state.load_used, &state.format,
+		                                  &state.load_skip, done);
+	}
+
+	if (!done)
+	{
+		snprintf(load_message, sizeof(load_message), "Loading... %d%% (%zu lines)",
+		         (int)(loaded * 100 / state.load_size), buffer_get_total_lines(buffer));
+		editor_show_message(load_message);
+	}
+	else
+	{
+		state.loader = NULL;
+
+		if (ok)
+		{
+			snprintf(load_message, sizeof(load_message), "%zu lines loaded", buffer_get_total_lines(buffer));
+			editor_show_message(editor_open_undo_journal(state.filename, buffer) > 0 ? undo_message : load_message);
+			editor_track_file(state.filename);
+		}
+		else
+		{
+			editor_show_message("Error: Cannot read the whole file");
+		}
+	}
+
+	if (event_loop.running)
+	{
+		editor_request_frame();
+	}
+}
+
+static void editor_load_file(char *filename, GapBuffer *buffer)
+{
+	// Before it is read, a change made meanwhile is seen as one
+	file_stamp(filename, &state.disk_stamp);
+
+	int fd = open(filename, O_RDONLY);
+
+	state.format = (TextFormat){ ENCODING_UTF8, LINE_ENDING_LF };
+	state.load_skip = 0;
+
+	if (fd < 0)
+	{
+		// A new file, it is created on save
+		editor_track_file(filename);
+		return;
+	}
+
+	struct stat st;
+	size_t size = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? (size_t)st.st_size : 0;
+
+	// Too big to hold at all, it's read a window at a time. No undo,
+	// swap or watch: nothing can change it from here.
+	if (state.config.pager_min_mb > 0 && size >= (size_t)state.config.pager_min_mb << 20 && event_loop.running)
+	{
+		state.pager = pager_open(&event_loop, filename, editor_on_pager_index, NULL);
+
+		if (state.pager != NULL)
+		{
+			close(fd);
+			editor_pager_show(0, 0, 0);
+			state.message = "Huge file, read-only view, indexing lines...";
+			return;
+		}
+	}
+
+	bool utf16;
+
+	state.format = file_detect_format(fd);
+	state.load_skip = text_bom_length(state.format.encoding);
+	utf16 = state.format.encoding == ENCODING_UTF16LE || state.format.encoding == ENCODING_UTF16BE;
+
+	// The worker reports through the loop, replays run without one
+	if (size >= LOAD_ASYNC_MIN && event_loop.running && !utf16)
+	{
+		buffer_reserve(buffer, size);
+
+		if (buffer->gap_end - buffer->gap_start >= size)
+		{
+			state.load_size = size;
+			state.load_dest = &buffer->data[buffer->gap_start];
+			state.load_used = 0;
+			state.loader = file_load_async(&event_loop, fd, &buffer->data[buffer->gap_start], size,
+			                               editor_on_load_progress, buffer);
+
+			if (state.loader != NULL)
+			{
+				state.message = "Loading...";
+				return;
+			}
+		}
+	}
+
+	TRACE_BEGIN("file load");
+
+	if (!file_read_text(buffer, fd, size, &state.format, NULL))
+	{
+		state.message = "Error: Cannot read file";
+	}
+
+	TRACE_END("file load");
+	close(fd);
+
+	if (editor_open_undo_journal(filename, buffer) > 0)
+	{
+		state.message = undo_message;
+	}
+
+	editor_track_file(filename);
+}
+
+// More than one file on the command line: the first is loaded as ever and
+// shown, the others are read by a pool of workers at once, each into its
+// own tab, while it's on screen. Only the tab on screen lives in state;
+// the others are parked in their Tab with nothing running for them, no
+// watch, swap timer or pager, and pick up what changed on disk when shown.
+static LoadPool *load_pool = NULL;
+static int tabs_loading = 0;
+static char tab_message[256];
+
+static void editor_on_tab_loaded(LoadPoolResult *result, void *data)
+{
+	Tab *tab = data;
+
+	tabs_loading--;
+	tab->loading = false;
+	tab->format = result->format;
+	tab->disk_stamp = result->stamp;
+	tab->deferred = result->too_big;
+	tab->load_failed = !result->ok;
+
+	// Not over a command being typed or a question
+	if (tabs_loading == 0 && state.mode != COMMAND && !state.recovery_pending && !state.reload_pending &&
+	    event_loop.running)
+	{
+		snprintf(tab_message, sizeof(tab_message), "%zu files open, gt and gT switch", state.tab_count);
+		state.message = tab_message;
+		editor_request_frame();
+	}
+}
+
+// filenames[0] is already in state, the rest are queued. Files of
+// pager_min_mb and up are left for when they're shown, and so is
+// everything if the pool can't be started.
+static void editor_open_tabs(char **filenames, int count)
+{
+	state.tabs = mem_alloc(MEM_TABS, count * sizeof(Tab));
+
+	if (state.tabs == NULL)
+	{
+		return;
+	}
+
+	state.tab_capacity = count;
+	state.tab_count = 1;
+	state.active_tab = 0;
+	memset(&state.tabs[0], 0, sizeof(Tab));
+	state.tabs[0].opened = true;
+
+	// One per CPU but at least 4, the workers wait on the disk as much as
+	// they compute; and no more than there are files
+	int threads = state.config.load_threads;
+
+	if (threads == 0)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = cpus > 4 ? (int)cpus : 4;
+	}
+
+	if (threads > count - 1)
+	{
+		threads = count - 1;
+	}
+
+	load_pool = load_pool_create(&event_loop, threads);
+
+	size_t max_size = state.config.pager_min_mb > 0 ? (size_t)state.config.pager_min_mb << 20 : 0;
+
+	for (int i = 1; i < count; i++)
+	{
+		Tab *tab = &state.tabs[state.tab_count++];
+
+		create_tab(tab, filenames[i]);
+		tab->loading = load_pool != NULL &&
+		               load_pool_add(load_pool, filenames[i], tab->buffer, max_size, editor_on_tab_loaded, tab);
+
+		if (tab->loading)
+		{
+			tabs_loading++;
+		}
+		else
+		{
+			tab->deferred = true;
+		}
+	}
+}
+
+// Moves the file on screen into its tab and stops what runs for it
+static void editor_park_tab(void)
+{
+	Tab *tab = &state.tabs[state.active_tab];
+
+	if (state.pager != NULL)
+	{
+		// Paged from the top again when it's back, its window isn't kept
+		editor_pager_stop_search();
+		pager_close(state.pager);
+		state.pager = NULL;
+		buffer_free(state.buffer);
+		state.buffer = buffer_create(1024);
+		tab->deferred = true;
+		tab->opened = false;
+	}
+
+	event_loop_cancel_timer(&event_loop, swap_timer);
+	swap_timer = -1;
+
+	if (state.swap != NULL)
+	{
+		swap_flush(state.swap);
+	}
+
+	file_watch_stop(state.watch);
+	state.watch = NULL;
+	event_loop_cancel_timer(&event_loop, disk_timer);
+	disk_timer = -1;
+	state.disk_check_deferred = false;
+
+	tab->buffer = state.buffer;
+	tab->cursor_x = state.cursor_x;
+	tab->cursor_y = state.cursor_y;
+	tab->row_offset = state.row_offset;
+	tab->col_offset = state.col_offset;
+	tab->filename = state.filename;
+	tab->undo_manager = state.undo_manager;
+	tab->language = state.language;
+	tab->highlighter = state.highlighter;
+	tab->format = state.format;
+	tab->swap = state.swap;
+	tab->disk_stamp = state.disk_stamp;
+	tab->disk_node = state.disk_node;
+	tab->disk_compactions = state.disk_compactions;
+	tab->modified = editor_modified();
+}
+
+static void editor_show_tab(size_t index)
+{
+	Tab *tab = &state.tabs[index];
+
+	state.active_tab = index;
+	state.buffer = tab->buffer;
+	state.cursor_x = tab->cursor_x;
+	state.cursor_y = tab->cursor_y;
+	state.row_offset = tab->row_offset;
+	state.col_offset = tab->col_offset;
+	state.filename = tab->filename;
+	state.undo_manager = tab->undo_manager;
+	state.language = tab->language;
+	state.highlighter = tab->highlighter;
+	state.format = tab->format;
+	state.swap = tab->swap;
+	state.disk_stamp = tab->disk_stamp;
+	state.disk_node = tab->disk_node;
+	state.disk_compactions = tab->disk_compactions;
+	state.follow_dropped = 0;
+	state.pending_key = 0;
+	state.ghost_text_active = false;
+
+	screen_clear();
+	render_invalidate();
+
+	snprintf(tab_message, sizeof(tab_message), "[%zu/%zu] %s", index + 1, state.tab_count, state.filename);
+	state.message = tab_message;
+
+	if (tab->deferred)
+	{
+		tab->deferred = false;
+		tab->opened = true;
+		editor_load_file(state.filename, state.buffer);
+		return;
+	}
+
+	if (!tab->opened)
+	{
+		// First time on screen: its text is what was on disk when read
+		tab->opened = true;
+
+		if (tab->load_failed)
+		{
+			state.message = "Error: Cannot read file";
+		}
+
+		if (editor_open_undo_journal(state.filename, state.buffer) > 0)
+		{
+			state.message = undo_message;
+		}
+
+		editor_track_file(state.filename);
+	}
+	else if (event_loop.running)
+	{
+		state.watch = file_watch_start(&event_loop, state.filename, editor_on_file_changed, NULL);
+	}
+
+	// Changed on disk since it was read or last on screen
+	editor_check_disk();
+}
+
+// gt, gT and :tabn. Not while something still reports back to the file on
+// screen through state, its load or save, or while it's followed.
+static void editor_switch_tab(size_t index)
+{
+	if (state.tab_count < 2)
+	{
+		state.message = "Only one file open";
+		return;
+	}
+
+	if (index == state.active_tab)
+	{
+		return;
+	}
+
+	if (state.loader != NULL)
+	{
+		state.message = "Still loading, switch tabs when it's done";
+	}
+	else if (state.save_pending)
+	{
+		state.message = "Saving, switch tabs when it's done";
+	}
+	else if (state.follow)
+	{
+		state.message = "Following, :follow stops it before switching tabs";
+	}
+	else if (state.tabs[index].loading)
+	{
+		snprintf(tab_message, sizeof(tab_message), "%s is still loading", state.tabs[index].filename);
+		state.message = tab_message;
+	}
+	else
+	{
+		editor_park_tab();
+		editor_show_tab(index);
+	}
+}
+
+// :tabs, on the status line by file name without the directory, from the
+// one on screen (marked >) on. + marks unsaved edits.
+static void editor_list_tabs(void)
+{
+	size_t used = 0;
+
+	tab_message[0] = '\0';
+
+	for (size_t n = 0; n < state.tab_count && used < sizeof(tab_message); n++)
+	{
+		size_t i = (state.active_tab + n) % state.tab_count;
+		Tab *tab = &state.tabs[i];
+		bool active = i == state.active_tab;
+		bool modified = active ? editor_modified() : tab->modified;
+		char *path = active ? state.filename : tab->filename;
+		char *name = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+
+		used += snprintf(tab_message + used, sizeof(tab_message) - used, "%s%s%zu %s%s%s", n > 0 ? "  " : "",
+		                 active ? ">" : "", i + 1, name, modified ? "+" : "", tab->loading ? " (loading)" : "");
+	}
+
+	state.message = state.tab_count > 1 ? tab_message : "Only one file open";
+}
+
+// Resets the editor state and loads filename, without touching the terminal
+void editor_init(char *filename)
+{
+	state.row_offset = 0;
+	state.col_offset = 0;
+	state.cursor_x = 0;
+	state.cursor_y = 0;
+	state.mode = NORMAL;
+	state.message = NULL;
+	state.command_buffer[0] = 0;
+	state.command_length = 0;
+	state.undo_stack = NULL;
+	state.redo_stack = NULL;
+	state.insert_buffer = NULL;
+	state.insert_start = 0;
+	state.undo_manager = undo_manager_create();
+	state.pending_key = 0;
+	state.search_buffer[0] = '\0';
+	state.search_length = 0;
+	state.search_forward = true;
+	state.last_search_pattern[0] = '\0';
+	state.last_search_forward = true;
+	state.highlight_search = false;
+	state.highlight_pattern[0] = '\0';
+	state.ai_suggestion[0] = '\0';
+	state.ghost_text_active = false;
+	state.ai_request_pending = false;
+	state.swap = NULL;
+	state.recovery_pending = false;
+	state.watch = NULL;
+	state.disk_check_deferred = false;
+	state.reload_pending = false;
+	state.follow = false;
+	state.follow_dropped = 0;
+	state.pager = NULL;
+	state.search_job = NULL;
+	state.tabs = NULL;
+	state.tab_count = 0;
+	state.tab_capacity = 0;
+	state.active_tab = 0;
+	config_load(&state.config);
+	state.undo_manager->budget = (size_t)state.config.undo_budget_mb << 20;
+
+	GapBuffer *buffer = buffer_create(1024);
+
+	state.language = detect_language(filename);
+	highlighter_init(&state.highlighter, state.language);
+
+	state.buffer = buffer;
+	state.filename = filename;
+
+	if (filename != NULL)
+	{
+		editor_load_file(filename, buffer);
+	}
+}
+
+void editorLoop(char **filenames, int count)
+{
+	TRACE_THREAD_NAME("input loop");
+
+	if (trace_path != NULL)
+	{
+		trace_start();
+	}
+
+	// Before editor_init, a big file starts loading on it right away
+	event_loop_init(&event_loop);
+
+	editor_init(count > 0 ? filenames[0] : NULL);
+
+	// The first file is on screen by now, or coming in; the others follow
+	if (count > 1)
+	{
+		editor_open_tabs(filenames, count);
+	}
+
+	get_terminal_size(&state.screen_rows, &state.screen_cols);
+	ai_init();
+
+	// Build each frame in one buffer and hand it to the terminal in one write
+	setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+	fprintf(stderr, "env check: %s\n", getenv("ANTHROPIC_API_KEY") ? "SET" : "NULL");
+	state.api_key = read_api_key();
+
+	if (state.api_key == NULL)
+	{
+		fprintf(stderr, "Warning: ANTHROPIC_API_KEY not found!\n");
+		fprintf(stderr, "Set environment variable or create ~/.vesperrc\n");
+	}
+
+	input_init(&input);
+
+	FILE *record = NULL;
+
+	if (record_path != NULL)
+	{
+		record = fopen(record_path, "w");
+		input_record(&input, record);
+	}
+
+	event_loop_watch_fd(&event_loop, STDIN_FILENO, editor_on_input, NULL);
+	event_loop_on_resize(&event_loop, editor_on_resize, NULL);
+
+	editor_request_frame();
+	event_loop_run(&event_loop);
+
+	// A save still being written finishes before the editor goes, and a
+	// load or search still running stops, with nothing but their
+	// completions left for the loop to wake up for
+	if (state.loader != NULL)
+	{
+		file_load_cancel(state.loader);
+	}
+
+	if (state.pager != NULL)
+	{
+		editor_pager_stop_search();
+		pager_close(state.pager);
+		state.pager = NULL;
+	}
+
+	// Files still being read for other tabs are dropped
+	load_pool_free(load_pool);
+	load_pool = NULL;
+
+	if (state.save_pending || state.loader != NULL || searches_running > 0 || tabs_loading > 0)
+	{
+		event_loop_unwatch_fd(&event_loop, STDIN_FILENO);
+		// None of them fire from here on, see event_loop_run_once
+		event_loop_cancel_timer(&event_loop, frame_timer);
+		event_loop_cancel_timer(&event_loop, escape_timer);
+		event_loop_cancel_timer(&event_loop, swap_timer);
+		event_loop_cancel_timer(&event_loop, disk_timer);
+		frame_timer = -1;
+		escape_timer = -1;
+		swap_timer = -1;
+		disk_timer = -1;
+
+		while (state.save_pending || state.loader != NULL || searches_running > 0 || tabs_loading > 0)
+		{
+			event_loop_run_once(&event_loop, -1);
+		}
+	}
+
+	file_watch_stop(state.watch);
+	state.watch = NULL;
+	event_loop_cancel_timer(&event_loop, disk_timer);
+
+	// Quitting leaves nothing to recover
+	event_loop_cancel_timer(&event_loop, swap_timer);
+	swap_close(state.swap, !input_lost);
+	state.buffer->edit_hook = NULL;
+	state.swap = NULL;
+
+	// And the same for the tabs that aren't on screen
+	for (size_t i = 0; i < state.tab_count; i++)
+	{
+		if (i != state.active_tab && state.tabs[i].swap != NULL)
+		{
+			swap_close(state.tabs[i].swap, !input_lost);
+			state.tabs[i].buffer->edit_hook = NULL;
+			state.tabs[i].swap = NULL;
+		}
+	}
+
+	// An AI request still out isn't waited for, it could take as long as
+	// the network does
+	ai_shutdown();
+	event_loop_free(&event_loop);
+	input_free(&input);
+
+	if (record != NULL)
+	{
+		fclose(record);
+	}
+
+	if (trace_path != NULL && trace_active())
+	{
+		trace_stop(trace_path);
+	}
+
 	scroll();
 
 	scroll();
@@ -1839,7 +2672,7 @@ void editorLoop(char *filename)
     // Free API key
     if (state.api_key != NULL)
     {
-        free(state.api_key);
+        mem_free(MEM_AI, state.api_key);
         state.api_key = NULL;
     }
 }
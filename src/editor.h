@@ -9,6 +9,14 @@
 #define COLOR_RESET "\x1b[0m"
 #include <stdbool.h>
 #include "buffer.h"
+#include "highlight.h"
+#include "config.h"
+#include "input.h"
+#include "undo.h"
+#include "file_io.h"
+#include "swap.h"
+#include "file_watch.h"
+#include "pager.h"
 
 typedef enum 
 {
@@ -27,43 +35,6 @@ typedef struct Action
 
 } Action;
 
-typedef enum  
-{
-	OP_INSERT,
-	OP_DELETE
-
-} OpType;
-
-typedef struct 
-{
-	OpType type;
-	char *content;
-	size_t position;
-	size_t cursor_x;
-	size_t cursor_y;
-
-} UndoOperation;
-
-typedef struct 
-{
-	UndoOperation *undo_stack;
-	size_t undo_count;
-	size_t undo_capacity;
-
-	UndoOperation *redo_stack;
-	size_t redo_count;
-	size_t redo_capacity;
-
-	char *current_insert_buffer;
-	size_t current_insert_len;
-	size_t current_insert_capacity;
-	size_t insert_start_pos;
-	size_t insert_start_x;
-	size_t insert_start_y;
-	bool in_insert_session;
-
-} UndoManager;
-	
 typedef enum 
 {
 	NORMAL,
@@ -73,29 +44,6 @@ typedef enum
 
 } EditorMode;
 
-typedef enum
-{
-	LANG_NONE,
-	LANG_C,
-	LANG_PYTHON,
-	LANG_JAVA,
-	LANG_GO,
-	LANG_JAVASCRIPT,
-	LANG_RUST,
-
-} LanguageType;
-
-typedef enum
-{
-	KEYWORDS,
-	STRINGS,
-	COMMENTS,
-	NUMBERS,
-	OPERATORS,
-	NORMALTXT
-
-} TokenType;
-
 typedef struct {
 
 	GapBuffer *buffer;
@@ -104,7 +52,20 @@ typedef struct {
 	char *filename;
 	UndoManager *undo_manager;
 	LanguageType language;
+	Highlighter highlighter;
 	bool modified;
+	TextFormat format;   // Encoding and line endings the file is saved back with
+
+	// Only the tab on screen lives in EditorState, the others keep their
+	// file's state here until they are switched to
+	SwapFile *swap;
+	FileStamp disk_stamp;
+	size_t disk_node;
+	size_t disk_compactions;
+	bool loading;        // Still being read by the load pool
+	bool load_failed;
+	bool deferred;       // Left for editor_load_file when shown, too big for the pool
+	bool opened;         // Shown before: undo journal, swap and stamp are set up
 
 } Tab;
 
@@ -124,6 +85,7 @@ typedef struct {
     char *insert_buffer;
     size_t insert_start;
     UndoManager *undo_manager;
+    char pending_key;    // First key of a two-key NORMAL command, like g-
     char search_buffer[256];
     size_t search_length;
     bool search_forward;
@@ -134,15 +96,65 @@ typedef struct {
 	char *api_key;
 	bool ghost_text_active;
 	char ai_suggestion[1024];
+	bool ai_request_pending;
 	LanguageType language;
+	Highlighter highlighter;
 	Tab *tabs;
 	size_t tab_count;
 	size_t tab_capacity;
 	size_t active_tab;
-} EditorState;
+	EditorConfig config;
+	GapBuffer *buffer;
+	char *filename;
 
-TokenType classify_token(GapBuffer *buffer, size_t pos, LanguageType lang);
+	// Background save, one at a time
+	bool save_pending;
+	bool save_again;          // Asked for again while it ran
+	bool quit_after_save;     // :wq waiting for it
+	char *save_filename;
+	size_t save_node;         // Undo state the snapshot was taken in
+	size_t save_compactions;
+
+	// Big files come in on a worker, the buffer is read-only meanwhile
+	FileLoader *loader;
+	size_t load_size;
+	char *load_dest;          // Where the loader puts the file's bytes
+	size_t load_used;         // How many of them are text in the buffer by now
+
+	// The file's encoding and line endings, undone on load and redone on save
+	TextFormat format;
+	size_t load_skip;         // BOM bytes still to drop
+
+	// Edits since the last save, journaled for crash recovery
+	SwapFile *swap;
+	bool recovery_pending;    // Asking whether to replay a dead session's edits
+	size_t save_swap_mark;    // Where the swap stood when the save's snapshot was taken
+
+	// The file as last read or written here, so changes made by someone
+	// else can be told from our own
+	FileWatch *watch;
+	FileStamp disk_stamp;
+	size_t disk_node;         // Undo state the text on disk is in
+	size_t disk_compactions;
+	bool disk_check_deferred; // Changed while it couldn't be looked at
+	bool reload_pending;      // Asking whether to drop edits for the new file
+
+	// :follow, the view stays on the end of the file as it grows
+	bool follow;
+	size_t follow_dropped;    // Bytes at the start of the file let go under follow_max_mb
+
+	// Files over pager_min_mb aren't loaded: the buffer holds a window of
+	// lines and cursor_y counts from its first one
+	Pager *pager;
+	PagerSearch *search_job;  // Searching the file on a worker
+} EditorState;
 
-void editorLoop(char *filename);
+void editorLoop(char **filenames, int count);
+void editor_init(char *filename);
+void editor_record_input(const char *path);
+void editor_trace_session(const char *path);
+bool editor_handle_key(GapBuffer *buffer, char *filename, KeyEvent *event);
+void editor_draw_frame(GapBuffer *buffer);
+void editor_show_message(char *message);
 
 #endif
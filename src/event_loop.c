@@ -0,0 +1,390 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include "event_loop.h"
+#include "utils.h"
+#include "trace.h"
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// Signal handlers can't take a pointer, so the loop handling SIGWINCH lives here
+static EventLoop *resize_loop = NULL;
+
+static void event_loop_wake(EventLoop *loop)
+{
+#ifdef __linux__
+	uint64_t one = 1;
+	ssize_t ignored = write(loop->wake_write_fd, &one, sizeof(one));
+#else
+	char one = 1;
+	ssize_t ignored = write(loop->wake_write_fd, &one, sizeof(one));
+#endif
+	(void)ignored;
+}
+
+static void sigwinch_handler(int sig)
+{
+	(void)sig;
+
+	// Only async-signal-safe work here, the loop does the rest
+	if (resize_loop != NULL)
+	{
+		resize_loop->resize_pending = 1;
+		event_loop_wake(resize_loop);
+	}
+}
+
+#ifndef __linux__
+static void set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+#endif
+
+int event_loop_init(EventLoop *loop)
+{
+	memset(loop, 0, sizeof(EventLoop));
+
+#ifdef __linux__
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	loop->wake_read_fd = fd;
+	loop->wake_write_fd = fd;
+#else
+	int fds[2];
+
+	if (pipe(fds) < 0)
+	{
+		return -1;
+	}
+
+	set_nonblocking(fds[0]);
+	set_nonblocking(fds[1]);
+	loop->wake_read_fd = fds[0];
+	loop->wake_write_fd = fds[1];
+#endif
+
+	pthread_mutex_init(&loop->completion_lock, NULL);
+	loop->completions = NULL;
+	loop->completions_tail = NULL;
+	loop->running = true;
+
+	return 0;
+}
+
+void event_loop_free(EventLoop *loop)
+{
+	if (resize_loop == loop)
+	{
+		signal(SIGWINCH, SIG_DFL);
+		resize_loop = NULL;
+	}
+
+	close(loop->wake_read_fd);
+
+	if (loop->wake_write_fd != loop->wake_read_fd)
+	{
+		close(loop->wake_write_fd);
+	}
+
+	// Completions nobody will run any more are their posters' to free
+	pthread_mutex_destroy(&loop->completion_lock);
+}
+
+int event_loop_watch_fd(EventLoop *loop, int fd, FdCallback callback, void *data)
+{
+	if (loop->watch_count >= EVENT_LOOP_MAX_WATCHES)
+	{
+		return -1;
+	}
+
+	loop->fds[loop->watch_count] = fd;
+	loop->fd_callbacks[loop->watch_count] = callback;
+	loop->fd_data[loop->watch_count] = data;
+	loop->watch_count++;
+
+	return 0;
+}
+
+void event_loop_unwatch_fd(EventLoop *loop, int fd)
+{
+	for (size_t i = 0; i < loop->watch_count; i++)
+	{
+		if (loop->fds[i] == fd)
+		{
+			// Keep the remaining watches in order
+			memmove(&loop->fds[i], &loop->fds[i + 1], sizeof(int) * (loop->watch_count - i - 1));
+			memmove(&loop->fd_callbacks[i], &loop->fd_callbacks[i + 1], sizeof(FdCallback) * (loop->watch_count - i - 1));
+			memmove(&loop->fd_data[i], &loop->fd_data[i + 1], sizeof(void *) * (loop->watch_count - i - 1));
+			loop->watch_count--;
+			return;
+		}
+	}
+}
+
+int event_loop_add_timer(EventLoop *loop, long long delay_ms, long long interval_ms, EventCallback callback, void *data)
+{
+	for (int i = 0; i < EVENT_LOOP_MAX_TIMERS; i++)
+	{
+		EventTimer *timer = &loop->timers[i];
+
+		if (!timer->active)
+		{
+			timer->active = true;
+			timer->deadline_ms = monotonic_ms() + delay_ms;
+			timer->interval_ms = interval_ms;
+			timer->callback = callback;
+			timer->data = data;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+void event_loop_cancel_timer(EventLoop *loop, int timer_id)
+{
+	if (timer_id >= 0 && timer_id < EVENT_LOOP_MAX_TIMERS)
+	{
+		loop->timers[timer_id].active = false;
+	}
+}
+
+// Safe to call from any thread, callback runs on the loop's thread. The
+// completion has to stay put until then; it can be posted again once its
+// callback has started, and posting it while it's still queued does
+// nothing, the callback that's coming sees whatever changed.
+void event_loop_post(EventLoop *loop, Completion *completion, EventCallback callback, void *data)
+{
+	pthread_mutex_lock(&loop->completion_lock);
+
+	if (completion->queued)
+	{
+		pthread_mutex_unlock(&loop->completion_lock);
+		return;
+	}
+
+	completion->callback = callback;
+	completion->data = data;
+	completion->next = NULL;
+	completion->queued = true;
+
+	if (loop->completions_tail != NULL)
+	{
+		loop->completions_tail->next = completion;
+	}
+	else
+	{
+		loop->completions = completion;
+	}
+	loop->completions_tail = completion;
+
+	pthread_mutex_unlock(&loop->completion_lock);
+
+	event_loop_wake(loop);
+}
+
+// Whether completion is still waiting for its callback
+bool event_loop_posted(EventLoop *loop, Completion *completion)
+{
+	pthread_mutex_lock(&loop->completion_lock);
+	bool queued = completion->queued;
+	pthread_mutex_unlock(&loop->completion_lock);
+
+	return queued;
+}
+
+void event_loop_on_resize(EventLoop *loop, EventCallback callback, void *data)
+{
+	loop->resize_callback = callback;
+	loop->resize_data = data;
+	resize_loop = loop;
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigwinch_handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGWINCH, &sa, NULL);
+}
+
+static void event_loop_drain_wakeups(EventLoop *loop)
+{
+	char scratch[64];
+
+	while (read(loop->wake_read_fd, scratch, sizeof(scratch)) > 0)
+	{
+	}
+
+	if (loop->resize_pending)
+	{
+		loop->resize_pending = 0;
+
+		if (loop->resize_callback != NULL)
+		{
+			loop->resize_callback(loop->resize_data);
+		}
+	}
+
+	// Take the whole list at once so workers aren't blocked while callbacks run
+	pthread_mutex_lock(&loop->completion_lock);
+	Completion *completion = loop->completions;
+	loop->completions = NULL;
+	loop->completions_tail = NULL;
+	pthread_mutex_unlock(&loop->completion_lock);
+
+	while (completion != NULL)
+	{
+		// Once it's no longer queued it may be posted again or freed, so
+		// everything needed from it is read first
+		pthread_mutex_lock(&loop->completion_lock);
+		Completion *next = completion->next;
+		EventCallback callback = completion->callback;
+		void *data = completion->data;
+		completion->queued = false;
+		pthread_mutex_unlock(&loop->completion_lock);
+
+		callback(data);
+		completion = next;
+	}
+}
+
+static void event_loop_run_timers(EventLoop *loop)
+{
+	long long now = monotonic_ms();
+
+	for (int i = 0; i < EVENT_LOOP_MAX_TIMERS; i++)
+	{
+		EventTimer *timer = &loop->timers[i];
+
+		if (!timer->active || timer->deadline_ms > now)
+		{
+			continue;
+		}
+
+		if (timer->interval_ms > 0)
+		{
+			timer->deadline_ms = now + timer->interval_ms;
+		}
+		else
+		{
+			// Free the slot first, the callback may schedule a new timer
+			timer->active = false;
+		}
+
+		timer->callback(timer->data);
+	}
+}
+
+// Waits for the next fd, signal, completion or timer (at most max_wait_ms,
+// -1 for no limit) and dispatches everything that is ready
+void event_loop_run_once(EventLoop *loop, int max_wait_ms)
+{
+	long long timeout = max_wait_ms;
+	long long now = monotonic_ms();
+
+	// Once stopped, timers and fds are left alone, so waiting on them would
+	// only spin: just posted callbacks run, until the caller is done waiting
+	size_t watch_count = loop->running ? loop->watch_count : 0;
+
+	for (int i = 0; i < EVENT_LOOP_MAX_TIMERS && loop->running; i++)
+	{
+		if (loop->timers[i].active)
+		{
+			long long until = loop->timers[i].deadline_ms - now;
+
+			if (until < 0)
+			{
+				until = 0;
+			}
+
+			if (timeout < 0 || until < timeout)
+			{
+				timeout = until;
+			}
+		}
+	}
+
+	struct pollfd pfds[EVENT_LOOP_MAX_WATCHES + 1];
+
+	pfds[0].fd = loop->wake_read_fd;
+	pfds[0].events = POLLIN;
+	pfds[0].revents = 0;
+
+	for (size_t i = 0; i < watch_count; i++)
+	{
+		pfds[i + 1].fd = loop->fds[i];
+		pfds[i + 1].events = POLLIN;
+		pfds[i + 1].revents = 0;
+	}
+
+	TRACE_BEGIN("poll wait");
+	int ready = poll(pfds, watch_count + 1, (int)timeout);
+	TRACE_END("poll wait");
+
+	if (ready < 0 && errno != EINTR)
+	{
+		return;
+	}
+
+	if (ready > 0)
+	{
+		if (pfds[0].revents & POLLIN)
+		{
+			event_loop_drain_wakeups(loop);
+		}
+
+		for (size_t i = 0; i < watch_count && loop->running; i++)
+		{
+			if (pfds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+			{
+				// The callback may have unwatched this fd, look it up again
+				for (size_t j = 0; j < loop->watch_count; j++)
+				{
+					if (loop->fds[j] == pfds[i + 1].fd)
+					{
+						loop->fd_callbacks[j](loop->fds[j], loop->fd_data[j]);
+						break;
+					}
+				}
+			}
+		}
+	}
+	else if (loop->resize_pending)
+	{
+		event_loop_drain_wakeups(loop);
+	}
+
+	if (loop->running)
+	{
+		event_loop_run_timers(loop);
+	}
+}
+
+void event_loop_run(EventLoop *loop)
+{
+	while (loop->running)
+	{
+		event_loop_run_once(loop, -1);
+	}
+}
+
+void event_loop_stop(EventLoop *loop)
+{
+	loop->running = false;
+}
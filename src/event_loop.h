@@ -0,0 +1,73 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdbool.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+
+#define EVENT_LOOP_MAX_WATCHES 16
+#define EVENT_LOOP_MAX_TIMERS 32
+
+typedef void (*EventCallback)(void *data);
+typedef void (*FdCallback)(int fd, void *data);
+
+typedef struct
+{
+	bool active;
+	long long deadline_ms;
+	long long interval_ms;   // 0 for one-shot timers
+	EventCallback callback;
+	void *data;
+
+} EventTimer;
+
+// Lives in the posting job's own struct, so a post can't fail for memory
+typedef struct Completion
+{
+	EventCallback callback;
+	void *data;
+	struct Completion *next;
+	bool queued;   // Posted and its callback not started yet
+
+} Completion;
+
+typedef struct
+{
+	int fds[EVENT_LOOP_MAX_WATCHES];
+	FdCallback fd_callbacks[EVENT_LOOP_MAX_WATCHES];
+	void *fd_data[EVENT_LOOP_MAX_WATCHES];
+	size_t watch_count;
+
+	EventTimer timers[EVENT_LOOP_MAX_TIMERS];
+
+	// Written by signal handlers and worker threads to wake up poll()
+	int wake_read_fd;
+	int wake_write_fd;
+
+	pthread_mutex_t completion_lock;
+	Completion *completions;
+	Completion *completions_tail;
+
+	volatile sig_atomic_t resize_pending;
+	EventCallback resize_callback;
+	void *resize_data;
+
+	bool running;
+
+} EventLoop;
+
+int event_loop_init(EventLoop *loop);
+void event_loop_free(EventLoop *loop);
+int event_loop_watch_fd(EventLoop *loop, int fd, FdCallback callback, void *data);
+void event_loop_unwatch_fd(EventLoop *loop, int fd);
+int event_loop_add_timer(EventLoop *loop, long long delay_ms, long long interval_ms, EventCallback callback, void *data);
+void event_loop_cancel_timer(EventLoop *loop, int timer_id);
+void event_loop_post(EventLoop *loop, Completion *completion, EventCallback callback, void *data);
+bool event_loop_posted(EventLoop *loop, Completion *completion);
+void event_loop_on_resize(EventLoop *loop, EventCallback callback, void *data);
+void event_loop_run_once(EventLoop *loop, int max_wait_ms);
+void event_loop_run(EventLoop *loop);
+void event_loop_stop(EventLoop *loop);
+
+#endif
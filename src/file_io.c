@@ -0,0 +1,643 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "file_io.h"
+#include "alloc.h"
+#include "trace.h"
+
+// A file that isn't there is all zeros, like a new file's stamp
+bool file_stamp(const char *path, FileStamp *stamp)
+{
+	struct stat st;
+
+	memset(stamp, 0, sizeof(FileStamp));
+
+	if (stat(path, &st) != 0)
+	{
+		return false;
+	}
+
+	stamp->size = st.st_size;
+	stamp->inode = st.st_ino;
+	stamp->mtime_sec = st.st_mtim.tv_sec;
+	stamp->mtime_nsec = st.st_mtim.tv_nsec;
+	return true;
+}
+
+// Writes every byte of spans, going round again after short writes.
+// Linux hands back at most ~2 GB per call, so big buffers take a few.
+static bool write_all(int fd, struct iovec *spans, int count)
+{
+	while (count > 0)
+	{
+		ssize_t written = writev(fd, spans, count);
+
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		while (count > 0 && (size_t)written >= spans->iov_len)
+		{
+			written -= spans->iov_len;
+			spans++;
+			count--;
+		}
+
+		if (count > 0)
+		{
+			spans->iov_base = (char *)spans->iov_base + written;
+			spans->iov_len -= written;
+		}
+	}
+
+	return true;
+}
+
+// Text that isn't stored the way the buffer holds it goes out through a
+// bounce buffer a chunk at a time, converted on the way
+#define ENCODE_CHUNK (256 * 1024)
+
+static bool write_encoded(int fd, struct iovec *spans, int count, const TextFormat *format)
+{
+	char *in = mem_alloc(MEM_BUFFER, ENCODE_CHUNK + 4);
+	char *out = mem_alloc(MEM_BUFFER, ENCODE_CHUNK * 4 + 8);
+	size_t carry = 0;   // The start of a UTF-8 sequence the chunk cut off
+	bool ok = in != NULL && out != NULL;
+
+	if (ok)
+	{
+		struct iovec bom = { out, text_write_bom(format->encoding, out) };
+
+		ok = write_all(fd, &bom, 1);
+	}
+
+	for (int i = 0; ok && i < count; i++)
+	{
+		const char *text = spans[i].iov_base;
+		size_t len = spans[i].iov_len;
+		size_t pos = 0;
+
+		while (ok && pos < len)
+		{
+			size_t take = len - pos < ENCODE_CHUNK ? len - pos : ENCODE_CHUNK;
+			size_t used;
+
+			memcpy(in + carry, text + pos, take);
+			pos += take;
+
+			struct iovec encoded = { out, text_encode(format, in, carry + take, false, out, &used) };
+
+			carry = carry + take - used;
+			memmove(in, in + used, carry);
+			ok = write_all(fd, &encoded, 1);
+		}
+	}
+
+	if (ok && carry > 0)
+	{
+		size_t used;
+		struct iovec encoded = { out, text_encode(format, in, carry, true, out, &used) };
+
+		ok = write_all(fd, &encoded, 1);
+	}
+
+	mem_free(MEM_BUFFER, in);
+	mem_free(MEM_BUFFER, out);
+	return ok;
+}
+
+static bool sync_dir(const char *dir)
+{
+	int fd = open(dir, O_RDONLY | O_DIRECTORY);
+
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	bool ok = fsync(fd) == 0;
+
+	close(fd);
+
+	return ok;
+}
+
+// Saves spans to path without ever leaving a half-written file there: the
+// text goes to a temporary file in the same directory, which is renamed
+// over the old one once it is complete. The old file's mode (and owner,
+// where allowed) carries over. A symlink is followed, so the file it points
+// to is replaced rather than the link. The text is written in format, NULL
+// for as it is. spans is consumed.
+bool file_save_spans(const char *path, struct iovec *spans, int count, const TextFormat *format, FsyncPolicy policy)
+{
+	char target[PATH_MAX];
+	struct stat st;
+	bool exists = stat(path, &st) == 0;
+
+	if (realpath(path, target) == NULL)
+	{
+		// Not there yet, saved as a new file
+		if (snprintf(target, sizeof(target), "%s", path) >= (int)sizeof(target))
+		{
+			return false;
+		}
+	}
+
+	// The temporary file has to be on the same filesystem for rename
+	char dir[PATH_MAX];
+	char tmp_path[PATH_MAX];
+	char *slash = strrchr(target, '/');
+	const char *name = slash == NULL ? target : slash + 1;
+
+	if (slash == NULL)
+	{
+		strcpy(dir, ".");
+	}
+	else
+	{
+		snprintf(dir, sizeof(dir), "%.*s", slash == target ? 1 : (int)(slash - target), target);
+	}
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.XXXXXX", dir, name) >= (int)sizeof(tmp_path))
+	{
+		return false;
+	}
+
+	int fd = mkstemp(tmp_path);
+
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	bool ok;
+
+	if (exists)
+	{
+		ok = fchmod(fd, st.st_mode & 07777) == 0;
+
+		if (fchown(fd, st.st_uid, st.st_gid) != 0)
+		{
+			// Only root can give a file away, saving as ourselves is fine
+		}
+	}
+	else
+	{
+		// mkstemp makes 0600, a new file gets what open() would give it
+		mode_t mask = umask(0);
+
+		umask(mask);
+		ok = fchmod(fd, 0666 & ~mask) == 0;
+	}
+
+	TRACE_BEGIN("save write");
+	if (format == NULL || text_format_plain(format))
+	{
+		ok = ok && write_all(fd, spans, count);
+	}
+	else
+	{
+		ok = ok && write_encoded(fd, spans, count, format);
+	}
+
+	TRACE_END("save write");
+
+	if (ok && policy != FSYNC_NEVER)
+	{
+		TRACE_BEGIN("save fsync");
+		ok = fsync(fd) == 0;
+		TRACE_END("save fsync");
+	}
+
+	ok = close(fd) == 0 && ok;
+	ok = ok && rename(tmp_path, target) == 0;
+
+	if (!ok)
+	{
+		unlink(tmp_path);
+		return false;
+	}
+
+	if (policy == FSYNC_FULL)
+	{
+		sync_dir(dir);
+	}
+
+	return true;
+}
+
+// The two spans around the gap, in one writev
+bool file_save_buffer(const char *path, GapBuffer *buffer, const TextFormat *format, FsyncPolicy policy)
+{
+	struct iovec spans[2] = {
+		{ buffer->data, buffer->gap_start },
+		{ buffer->data + buffer->gap_end, buffer->capacity - buffer->gap_end },
+	};
+
+	return file_save_spans(path, spans, 2, format, policy);
+}
+
+typedef struct
+{
+	EventLoop *loop;
+	char *path;
+	TextFormat format;
+	FsyncPolicy policy;
+	bool want_hash;
+	SaveResult result;
+	SaveCallback callback;
+	void *data;
+	Completion done;
+
+} SaveRequest;
+
+// Runs back on the loop's thread once the file is written
+static void file_save_done(void *data)
+{
+	SaveRequest *request = data;
+
+	TRACE_BEGIN("save callback");
+	request->callback(&request->result, request->data);
+	TRACE_END("save callback");
+
+	mem_free(MEM_BUFFER, request->path);
+	mem_free(MEM_BUFFER, request);
+}
+
+static void *file_save_worker(void *data)
+{
+	SaveRequest *request = data;
+	BufferSnapshot *snapshot = request->result.snapshot;
+	struct iovec spans[2] = {
+		{ snapshot->data, snapshot->gap_start },
+		{ snapshot->data + snapshot->gap_end, snapshot->capacity - snapshot->gap_end },
+	};
+
+	TRACE_THREAD_NAME("save worker");
+	TRACE_BEGIN("file save");
+	request->result.ok = file_save_spans(request->path, spans, 2, &request->format, request->policy);
+
+	if (request->result.ok && request->want_hash)
+	{
+		request->result.hash = buffer_snapshot_hash(snapshot);
+	}
+
+	TRACE_END("file save");
+
+	event_loop_post(request->loop, &request->done, file_save_done, request);
+
+	return NULL;
+}
+
+// Writes snapshot on a worker thread so editing goes on meanwhile. The
+// worker only reads the snapshot, which the buffer stops sharing before it
+// writes over it. callback runs on the loop's thread; false if the worker
+// couldn't be started, the snapshot is then still the caller's.
+bool file_save_async(EventLoop *loop, const char *path, BufferSnapshot *snapshot, const TextFormat *format,
+                     FsyncPolicy policy, bool want_hash, SaveCallback callback, void *data)
+{
+	SaveRequest *request = mem_alloc(MEM_BUFFER, sizeof(SaveRequest));
+
+	if (request == NULL)
+	{
+		return false;
+	}
+
+	memset(request, 0, sizeof(SaveRequest));
+	request->loop = loop;
+	request->path = mem_strdup(MEM_BUFFER, path);
+	request->format = format != NULL ? *format : (TextFormat){ ENCODING_UTF8, LINE_ENDING_LF };
+	request->policy = policy;
+	request->want_hash = want_hash;
+	request->result.ok = false;
+	request->result.snapshot = snapshot;
+	request->result.length = snapshot->gap_start + (snapshot->capacity - snapshot->gap_end);
+	request->result.hash = 0;
+	request->callback = callback;
+	request->data = data;
+
+	pthread_t thread;
+
+	if (request->path == NULL || pthread_create(&thread, NULL, file_save_worker, request) != 0)
+	{
+		mem_free(MEM_BUFFER, request->path);
+		mem_free(MEM_BUFFER, request);
+		return false;
+	}
+
+	pthread_detach(thread);
+	return true;
+}
+
+// The first read is small so the first screenful shows up right away,
+// later ones grow to cut down on wakeups
+#define LOAD_FIRST_CHUNK (64 * 1024)
+#define LOAD_MAX_CHUNK (16 * 1024 * 1024)
+
+struct FileLoader
+{
+	EventLoop *loop;
+	int fd;
+	char *dest;
+	size_t size;
+	LoadCallback callback;
+	void *data;
+
+	// Written by the worker, read on the loop's thread
+	atomic_size_t loaded;
+	atomic_bool failed;
+	atomic_bool cancelled;
+
+	// Set while a progress callback is posted and hasn't looked yet, so a
+	// fast reader doesn't queue one per chunk
+	atomic_bool notify_pending;
+	Completion progress;
+	Completion finished;
+};
+
+// Runs on the loop's thread. Clearing notify_pending before reading the
+// count means anything the worker publishes afterwards posts again.
+static void file_load_progress(void *data)
+{
+	FileLoader *loader = data;
+
+	atomic_store(&loader->notify_pending, false);
+
+	TRACE_BEGIN("load callback");
+	loader->callback(atomic_load(&loader->loaded), false, false, loader->data);
+	TRACE_END("load callback");
+}
+
+// Posted once after the worker is done with loader, always last, so this
+// is the one place that may free it
+static void file_load_finished(void *data)
+{
+	FileLoader *loader = data;
+	bool ok = !atomic_load(&loader->failed) && !atomic_load(&loader->cancelled);
+
+	TRACE_BEGIN("load callback");
+	loader->callback(atomic_load(&loader->loaded), true, ok, loader->data);
+	TRACE_END("load callback");
+
+	mem_free(MEM_BUFFER, loader);
+}
+
+static void *file_load_worker(void *data)
+{
+	FileLoader *loader = data;
+	size_t loaded = 0;
+	size_t chunk = LOAD_FIRST_CHUNK;
+
+	TRACE_THREAD_NAME("load worker");
+	TRACE_BEGIN("file load");
+
+	while (loaded < loader->size && !atomic_load(&loader->cancelled))
+	{
+		size_t want = loader->size - loaded < chunk ? loader->size - loaded : chunk;
+		ssize_t got = read(loader->fd, loader->dest + loaded, want);
+
+		if (got < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (got <= 0)
+		{
+			// An error, or the file got shorter since it was measured
+			atomic_store(&loader->failed, got < 0);
+			break;
+		}
+
+		loaded += got;
+		atomic_store(&loader->loaded, loaded);
+
+		if (!atomic_exchange(&loader->notify_pending, true))
+		{
+			event_loop_post(loader->loop, &loader->progress, file_load_progress, loader);
+		}
+
+		if (chunk < LOAD_MAX_CHUNK)
+		{
+			chunk *= 2;
+		}
+	}
+
+	TRACE_END("file load");
+	close(loader->fd);
+
+	event_loop_post(loader->loop, &loader->finished, file_load_finished, loader);
+
+	return NULL;
+}
+
+// Reads size bytes of fd into dest on a worker thread, so the editor can
+// show the start of a big file while the rest comes in. dest has to stay
+// put and untouched past what was reported loaded until the last callback,
+// after which the loader is gone. fd is the loader's to close, unless it
+// couldn't be started (NULL).
+FileLoader *file_load_async(EventLoop *loop, int fd, char *dest, size_t size, LoadCallback callback, void *data)
+{
+	FileLoader *loader = mem_alloc(MEM_BUFFER, sizeof(FileLoader));
+
+	if (loader == NULL)
+	{
+		return NULL;
+	}
+
+	memset(loader, 0, sizeof(FileLoader));
+	loader->loop = loop;
+	loader->fd = fd;
+	loader->dest = dest;
+	loader->size = size;
+	loader->callback = callback;
+	loader->data = data;
+	atomic_init(&loader->loaded, 0);
+	atomic_init(&loader->failed, false);
+	atomic_init(&loader->cancelled, false);
+	atomic_init(&loader->notify_pending, false);
+
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, file_load_worker, loader) != 0)
+	{
+		mem_free(MEM_BUFFER, loader);
+		return NULL;
+	}
+
+	pthread_detach(thread);
+	return loader;
+}
+
+// Stops after the chunk being read, the last callback still comes
+void file_load_cancel(FileLoader *loader)
+{
+	atomic_store(&loader->cancelled, true);
+}
+
+// The encoding and line endings of the file open at fd, by its first few
+// KB; the rest is taken to match
+TextFormat file_detect_format(int fd)
+{
+	char head[TEXT_DETECT_BYTES];
+	ssize_t len = pread(fd, head, sizeof(head), 0);
+
+	return text_detect(head, len > 0 ? len : 0);
+}
+
+// The file's bytes at raw, somewhere in the buffer's gap, become text
+// before it: the BOM goes (*skip is how much of it is left), and CRLF
+// becomes LF in the same pass that moves them down. A \r at the end waits
+// for the next chunk's \n unless it's the last. Returns how many bytes of
+// raw were used.
+size_t file_take_text(GapBuffer *buffer, char *raw, size_t len, const TextFormat *format, size_t *skip, bool last)
+{
+	char *dest = &buffer->data[buffer->gap_start];
+	size_t skipped = *skip < len ? *skip : len;
+	size_t text_len;
+
+	*skip -= skipped;
+	raw += skipped;
+	len -= skipped;
+
+	if (format->line_ending == LINE_ENDING_CRLF)
+	{
+		if (!last && len > 0 && raw[len - 1] == '\r')
+		{
+			len--;
+		}
+
+		text_len = text_crlf_to_lf(dest, raw, len);
+	}
+	else
+	{
+		// Plain files are read right where they go
+		if (dest != raw)
+		{
+			memmove(dest, raw, len);
+		}
+
+		text_len = len;
+	}
+
+	buffer_commit_gap(buffer, text_len);
+
+	return skipped + len;
+}
+
+// UTF-16 is rare enough to be read whole and converted in one go, into
+// the gap; as UTF-8 it is at most half as long again
+static bool read_utf16(GapBuffer *buffer, int fd, size_t size, const TextFormat *format)
+{
+	char *raw = mem_alloc(MEM_TABS, size + 1);
+	size_t got = 0;
+
+	while (raw != NULL && got < size)
+	{
+		ssize_t n = read(fd, raw + got, size - got);
+
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (n <= 0)
+		{
+			break;
+		}
+
+		got += n;
+	}
+
+	size_t bom = text_bom_length(format->encoding);
+
+	if (raw == NULL || got < bom)
+	{
+		mem_free(MEM_TABS, raw);
+		return false;
+	}
+
+	buffer_reserve(buffer, got / 2 * 3 + 4);
+
+	char *dest = &buffer->data[buffer->gap_start];
+	size_t len = text_utf16_to_utf8(dest, raw + bom, got - bom, format->encoding == ENCODING_UTF16BE);
+
+	if (format->line_ending == LINE_ENDING_CRLF)
+	{
+		len = text_crlf_to_lf(dest, dest, len);
+	}
+
+	buffer_commit_gap(buffer, len);
+	mem_free(MEM_TABS, raw);
+
+	return got == size;
+}
+
+// Reads fd to the end straight into the gap, as text in format. No copy
+// on the way unless the text has to be converted. size is only a hint,
+// a file that grew since it was measured is read to its new end. A read
+// is at most LOAD_MAX_CHUNK, with cancelled (if given) looked at between
+// them; a cancelled read returns false.
+bool file_read_text(GapBuffer *buffer, int fd, size_t size, const TextFormat *format, atomic_bool *cancelled)
+{
+	if (format->encoding == ENCODING_UTF16LE || format->encoding == ENCODING_UTF16BE)
+	{
+		return read_utf16(buffer, fd, size, format);
+	}
+
+	size_t skip = text_bom_length(format->encoding);
+	size_t held = 0;   // Read but not text yet, at the start of the gap
+
+	buffer_reserve(buffer, size + 4096);
+
+	while (true)
+	{
+		if (buffer->gap_end - buffer->gap_start < held + 4096)
+		{
+			// Not a regular file, or it grew since it was measured
+			buffer_reserve(buffer, 64 * 1024);
+
+			if (buffer->gap_end - buffer->gap_start < held + 4096)
+			{
+				return false;
+			}
+		}
+
+		if (cancelled != NULL && atomic_load(cancelled))
+		{
+			return false;
+		}
+
+		char *raw = &buffer->data[buffer->gap_start];
+		size_t room = buffer->gap_end - buffer->gap_start - held;
+		ssize_t got = read(fd, raw + held, room < LOAD_MAX_CHUNK ? room : LOAD_MAX_CHUNK);
+
+		if (got < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (got <= 0)
+		{
+			file_take_text(buffer, raw, held, format, &skip, true);
+			return got == 0;
+		}
+
+		size_t used = file_take_text(buffer, raw, held + got, format, &skip, false);
+
+		held = held + got - used;
+		memmove(&buffer->data[buffer->gap_start], raw + used, held);
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include "buffer.h"
+#include "event_loop.h"
+#include "text_format.h"
+
+// How hard a save makes sure the data reached the disk
+typedef enum
+{
+	FSYNC_NEVER,   // Leave it to the kernel, fastest
+	FSYNC_FILE,    // fsync the new file before it replaces the old one
+	FSYNC_FULL     // And the directory afterwards, so the rename survives a crash too
+
+} FsyncPolicy;
+
+// What a background save reports back on the loop's thread. The snapshot
+// is the callback's to release.
+typedef struct
+{
+	bool ok;
+	BufferSnapshot *snapshot;
+	size_t length;
+	uint64_t hash;        // Of what was written, only if asked for
+
+} SaveResult;
+
+// Which version of a file is on disk, cheap to get: no hashing
+typedef struct
+{
+	uint64_t size;
+	uint64_t inode;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+
+} FileStamp;
+
+typedef void (*SaveCallback)(SaveResult *result, void *data);
+
+// Progress of a file being read in by a worker: loaded bytes are at the
+// front of dest and may be used. The last call has done set; ok is false
+// if the read failed or was cancelled before the end.
+typedef void (*LoadCallback)(size_t loaded, bool done, bool ok, void *data);
+
+typedef struct FileLoader FileLoader;
+
+bool file_stamp(const char *path, FileStamp *stamp);
+bool file_save_spans(const char *path, struct iovec *spans, int count, const TextFormat *format, FsyncPolicy policy);
+bool file_save_buffer(const char *path, GapBuffer *buffer, const TextFormat *format, FsyncPolicy policy);
+bool file_save_async(EventLoop *loop, const char *path, BufferSnapshot *snapshot, const TextFormat *format,
+                     FsyncPolicy policy, bool want_hash, SaveCallback callback, void *data);
+FileLoader *file_load_async(EventLoop *loop, int fd, char *dest, size_t size, LoadCallback callback, void *data);
+void file_load_cancel(FileLoader *loader);
+TextFormat file_detect_format(int fd);
+size_t file_take_text(GapBuffer *buffer, char *raw, size_t len, const TextFormat *format, size_t *skip, bool last);
+bool file_read_text(GapBuffer *buffer, int fd, size_t size, const TextFormat *format, atomic_bool *cancelled);
+
+#endif
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include "file_watch.h"
+#include "alloc.h"
+#include "trace.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+struct FileWatch
+{
+	EventLoop *loop;
+	int fd;
+	char name[NAME_MAX + 1];   // Of the file in the watched directory
+	FileWatchCallback callback;
+	void *data;
+};
+
+#ifdef __linux__
+
+// Drains every queued event and calls back once if any was about our file
+static void file_watch_on_events(int fd, void *data)
+{
+	FileWatch *watch = data;
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool ours = false;
+	ssize_t got;
+
+	while ((got = read(fd, events, sizeof(events))) > 0)
+	{
+		for (char *at = events; at < events + got; )
+		{
+			struct inotify_event *event = (struct inotify_event *)at;
+
+			// An overflowed queue lost events, maybe ours
+			if ((event->mask & IN_Q_OVERFLOW) || (event->len > 0 && strcmp(event->name, watch->name) == 0))
+			{
+				ours = true;
+			}
+
+			at += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	if (ours)
+	{
+		TRACE_BEGIN("file changed");
+		watch->callback(watch->data);
+		TRACE_END("file changed");
+	}
+}
+
+// The directory is watched rather than the file: a save that renames a
+// new file over the old one (Vesper's own, git's, most editors') replaces
+// the inode a file watch would be stuck on
+FileWatch *file_watch_start(EventLoop *loop, const char *path, FileWatchCallback callback, void *data)
+{
+	char target[PATH_MAX];
+	char dir[PATH_MAX];
+
+	// Through a symlink the file it points to is what changes
+	if (realpath(path, target) == NULL && snprintf(target, sizeof(target), "%s", path) >= (int)sizeof(target))
+	{
+		return NULL;
+	}
+
+	char *slash = strrchr(target, '/');
+	const char *name = slash == NULL ? target : slash + 1;
+
+	if (slash == NULL)
+	{
+		strcpy(dir, ".");
+	}
+	else
+	{
+		snprintf(dir, sizeof(dir), "%.*s", slash == target ? 1 : (int)(slash - target), target);
+	}
+
+	if (strlen(name) > NAME_MAX)
+	{
+		return NULL;
+	}
+
+	FileWatch *watch = mem_alloc(MEM_BUFFER, sizeof(FileWatch));
+
+	if (watch == NULL)
+	{
+		return NULL;
+	}
+
+	watch->loop = loop;
+	watch->callback = callback;
+	watch->data = data;
+	strcpy(watch->name, name);
+	watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	uint32_t mask = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+	if (watch->fd < 0 || inotify_add_watch(watch->fd, dir, mask) < 0 ||
+	    event_loop_watch_fd(loop, watch->fd, file_watch_on_events, watch) < 0)
+	{
+		if (watch->fd >= 0)
+		{
+			close(watch->fd);
+		}
+
+		mem_free(MEM_BUFFER, watch);
+		return NULL;
+	}
+
+	return watch;
+}
+
+void file_watch_stop(FileWatch *watch)
+{
+	if (watch == NULL)
+	{
+		return;
+	}
+
+	event_loop_unwatch_fd(watch->loop, watch->fd);
+	close(watch->fd);
+	mem_free(MEM_BUFFER, watch);
+}
+
+#else
+
+// No inotify: changes on disk go unnoticed, as before
+FileWatch *file_watch_start(EventLoop *loop, const char *path, FileWatchCallback callback, void *data)
+{
+	return NULL;
+}
+
+void file_watch_stop(FileWatch *watch)
+{
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef FILE_WATCH_H
+#define FILE_WATCH_H
+
+#include "event_loop.h"
+
+// Tells when a file may have been changed by someone else: written to,
+// truncated, replaced by a rename or deleted. The callback runs on the
+// loop's thread, once per batch of events; what changed is for it to stat.
+
+typedef void (*FileWatchCallback)(void *data);
+
+typedef struct FileWatch FileWatch;
+
+FileWatch *file_watch_start(EventLoop *loop, const char *path, FileWatchCallback callback, void *data);
+void file_watch_stop(FileWatch *watch);
+
+#endif
@@ -0,0 +1,887 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "highlight.h"
+#include "alloc.h"
+#include "buffer.h"
+#include "profile.h"
+
+char *c_keywords[] = 
+{
+	"auto",
+	"break",
+	"case",
+	"char",
+	"const",
+	"continue",
+	"default",
+	"do",
+	"double",
+	"else",
+	"enum",
+	"extern",
+	"float",
+	"for",
+	"goto",
+	"if",
+	"int",
+	"long",
+	"register",
+	"return",
+	"short",
+	"signed",
+	"sizeof",
+	"static",
+	"struct",
+	"switch",
+	"typedef",
+	"union",
+	"unsigned",
+	"void",
+	"volatile",
+	"while", 
+	NULL
+};
+
+
+char *python_keywords[] = 
+{
+	"and", "as", "assert", "async", "await",
+	"break", "class", "continue",
+	"def", "del",
+	"elif", "else", "except",
+	"False", "finally", "for", "from",
+	"global",
+	"if", "import", "in", "is",
+	"lambda",
+	"None", "nonlocal", "not",
+	"or",
+	"pass",
+	"raise", "return",
+	"True", "try",
+	"while", "with",
+	"yield",
+	NULL
+};
+
+
+char *javascript_keywords[] = 
+{
+	"abstract", "arguments", "await",
+	"break",
+	"case", "catch", "class", "const", "continue",
+	"debugger", "default", "delete", "do",
+	"else", "enum", "eval", "export", "extends",
+	"false", "finally", "for", "function",
+	"if", "implements", "import", "in", "instanceof", "interface",
+	"let",
+	"new", "null",
+	"package", "private", "protected", "public",
+	"return",
+	"static", "super", "switch",
+	"this", "throw", "true", "try", "typeof",
+	"var", "void",
+	"while", "with",
+	"yield",
+	NULL
+};
+
+
+char *java_keywords[] = 
+{
+	"abstract", "assert",
+	"boolean", "break", "byte",
+	"case", "catch", "char", "class", "const", "continue",
+	"default", "do", "double",
+	"else", "enum", "extends",
+	"false", "final", "finally", "float", "for",
+	"goto",
+	"if", "implements", "import", "instanceof", "int", "interface",
+	"long",
+	"native", "new", "null",
+	"package", "private", "protected", "public",
+	"return",
+	"short", "static", "strictfp", "super", "switch", "synchronized",
+	"this", "throw", "throws", "transient", "true", "try",
+	"void", "volatile",
+	"while",
+	NULL
+};
+
+
+char *go_keywords[] = 
+{
+	"break",
+	"case", "chan", "const", "continue",
+	"default", "defer",
+	"else",
+	"fallthrough", "for", "func",
+	"go", "goto",
+	"if", "import", "interface",
+	"map",
+	"package",
+	"range", "return",
+	"select", "struct", "switch",
+	"type",
+	"var",
+	NULL
+};
+
+
+char *rust_keywords[] = 
+{
+	"as", "async", "await",
+	"break",
+	"const", "continue", "crate",
+	"dyn",
+	"else", "enum", "extern",
+	"false", "fn", "for",
+	"if", "impl", "in",
+	"let", "loop",
+	"match", "mod", "move", "mut",
+	"pub",
+	"ref", "return",
+	"self", "Self", "static", "struct", "super",
+	"trait", "true", "type",
+	"unsafe", "use",
+	"where", "while",
+	"yield",
+	NULL
+};
+
+bool is_c_keyword(char *word) 
+{
+	for (int i = 0; c_keywords[i] != NULL; i++)
+	{
+		if(strcmp(c_keywords[i], word) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool is_python_keyword(char *word) 
+{
+	for (int i = 0; python_keywords[i] != NULL; i++)
+	{
+		if(strcmp(python_keywords[i], word) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool is_java_keyword(char *word) 
+{
+	for (int i = 0; java_keywords[i] != NULL; i++)
+	{
+		if(strcmp(java_keywords[i], word) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool is_go_keyword(char *word) 
+{
+	for (int i = 0; go_keywords[i] != NULL; i++)
+	{
+		if(strcmp(go_keywords[i], word) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool is_rust_keyword(char *word) 
+{
+	for (int i = 0; rust_keywords[i] != NULL; i++)
+	{
+		if(strcmp(rust_keywords[i], word) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool is_javascript_keyword(char *word) 
+{
+	for (int i = 0; javascript_keywords[i] != NULL; i++)
+	{
+		if(strcmp(javascript_keywords[i], word) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool is_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+	{
+		return true;
+	}
+
+	return false;
+}
+
+bool is_operator(char c)
+{
+	if (c == '+' || c == '-' || c == '*' || c == '/' || c == '%' || c == '<' || c == '>' || c == '=' || c == '!' || c == '&' || c == '|' || c == '^' || c == '~' || c == '(' || c == ')' || c == '{' || c == '}' || c == '[' || c == ']' || c == ';' || c == ',' || c == '.') 
+	{
+		return true;
+	}
+
+	return false;
+}
+
+bool is_word_char(char c)
+{
+	if (c >= 'a' && c <= 'z')
+	{
+		return true;
+	}
+
+	if (c >= 'A' && c <= 'Z')
+	{
+		return true;
+	}
+
+	if (c >= '0' && c <= '9')
+	{
+		return true;
+	}
+
+	if (c == '_')
+	{
+		return true;
+	}
+
+	return false;
+}
+
+void extract_word(GapBuffer *buffer, size_t pos, char *word_buffer, size_t max_len)
+{
+	size_t word_start = pos;
+
+	while (word_start > 0)
+	{
+		size_t check_pos = word_start - 1;
+		
+		// Skip if in gap
+		if (check_pos >= buffer->gap_start && check_pos < buffer->gap_end)
+		{
+			word_start--;
+			continue;
+		}
+		
+		// Check if it's a word character
+		if (is_word_char(buffer->data[check_pos]))
+		{
+			word_start--;
+		}
+		else
+		{
+			break;  // Found non-word character, stop!
+		}
+	}		
+
+	size_t word_end = pos;
+
+	while (word_end < buffer->capacity)
+	{
+		// Skip if in gap
+		if (word_end >= buffer->gap_start && word_end < buffer->gap_end)
+		{
+			word_end++;
+			continue;
+		}
+		
+		// Check if it's a word character
+		if (is_word_char(buffer->data[word_end]))
+		{
+			word_end++;
+		}
+		else
+		{
+			break;  // Found non-word character, stop!
+		}
+	}
+
+	size_t word_len = 0;
+
+	for (size_t i = word_start; i < word_end && word_len < max_len - 1; i++)
+	{
+		// Skip gap
+		if (i >= buffer->gap_start && i < buffer->gap_end)
+		{
+			continue;
+		}
+		
+		// Copy character
+		word_buffer[word_len] = buffer->data[i];
+		word_len++;
+	}
+
+	// Null terminate
+	word_buffer[word_len] = '\0';
+}
+
+bool is_inside_line_comment(GapBuffer *buffer, size_t pos)
+{
+	size_t line_start = pos;
+
+	while(line_start > 0) 
+	{
+		size_t check_pos = line_start - 1;
+		
+		// Skip if in gap
+		if (check_pos >= buffer->gap_start && check_pos < buffer->gap_end)
+		{
+			line_start--;
+			continue;
+						
+		}
+
+		if (buffer->data[check_pos] == '\n')
+		{
+			break;
+		}
+
+		line_start--;
+	}
+
+	for (size_t i = line_start; i < pos; i++)
+	{
+		// Skip if current position is in gap
+		if (i >= buffer->gap_start && i < buffer->gap_end)
+		{
+			continue;
+		}
+
+		if (buffer->data[i] == '/')
+		{
+			// Now we need to check the NEXT position (i+1)
+			size_t next_pos = i + 1;
+			
+			// Make sure next_pos is not beyond our search range
+			if (next_pos >= pos)
+			{
+				continue;  // Can't check beyond pos
+			}
+			
+			// Skip if next position is in gap
+			if (next_pos >= buffer->gap_start && next_pos < buffer->gap_end)
+			{
+				continue;  // Can't form "//" if second char is in gap
+			}
+			
+			// Now check if next character is also '/'
+			if (buffer->data[next_pos] == '/')
+			{
+				return true;  // Found "//" before pos!
+			}
+		}
+	}
+
+	return false;
+}
+
+bool is_inside_string(GapBuffer *buffer, size_t pos)
+{
+	size_t line_start = pos;
+
+	while(line_start > 0) 
+	{
+		size_t check_pos = line_start - 1;
+		
+		// Skip if in gap
+		if (check_pos >= buffer->gap_start && check_pos < buffer->gap_end)
+		{
+			line_start--;
+			continue;
+						
+		}
+
+		if (buffer->data[check_pos] == '\n')
+		{
+			break;
+		}
+
+		line_start--;
+	}
+
+	int quote_count = 0;
+
+	for (size_t i = line_start; i < pos; i++)
+	{
+		if (i >= buffer->gap_start && i < buffer->gap_end)
+		{
+			continue;
+		}
+
+		if (buffer->data[i] == '"')
+		{
+			bool is_escaped = false;
+
+			if (i > line_start)
+			{
+				size_t prev_pos = i - 1;
+
+				// Make sure previous position is not in gap
+				if (prev_pos < buffer->gap_start || prev_pos >= buffer->gap_end)
+				{
+					// Check if previous character is backslash
+					if (buffer->data[prev_pos] == '\\')
+					{
+						is_escaped = true;
+					}
+				}
+			}
+			
+			// If NOT escaped, count it
+			if (!is_escaped)
+			{
+				quote_count++;
+			}
+		}
+	}	
+
+	return (quote_count % 2 == 1);
+}
+
+bool is_inside_block_comment(GapBuffer *buffer, size_t pos)
+{
+	for (size_t i = pos; i > 0; i--)
+	{
+		size_t check_pos = i - 1;
+
+		if (check_pos >= buffer->gap_start && check_pos < buffer->gap_end)
+		{
+			continue;
+		}
+
+		size_t next_pos = check_pos + 1;
+
+		// Make sure next_pos is not in gap and is valid
+        if (next_pos >= buffer->capacity)
+        {
+            continue;
+        }
+        
+        if (next_pos >= buffer->gap_start && next_pos < buffer->gap_end)
+        {
+            continue;
+        }
+        
+        // Now check for "*/" (closing comment)
+        if (buffer->data[check_pos] == '*' && buffer->data[next_pos] == '/')
+        {
+            return false;  // Found closing, we're outside
+        }
+        
+        // Check for "/*" (opening comment)
+        if (buffer->data[check_pos] == '/' && buffer->data[next_pos] == '*')
+        {
+            return true;  // Found opening, we're inside
+        }
+	}
+
+	return false;
+}
+
+TokenType classify_token(GapBuffer *buffer, size_t pos, LanguageType lang)
+{
+	if (lang == LANG_NONE)
+    {
+        return NORMALTXT;  // Only highlight C for now
+    }
+    
+    // Step 2: Check if inside string (PRIORITY)
+    if (is_inside_string(buffer, pos))
+    {
+        return STRINGS;
+    }
+    
+    // Step 3: Check if inside line comment
+    if (is_inside_line_comment(buffer, pos))
+    {
+        return COMMENTS;
+    }
+    
+    // Step 4: Check if inside block comment
+    if (is_inside_block_comment(buffer, pos))
+    {
+        return COMMENTS;
+    }
+
+	// Check if position is in gap
+	if (pos >= buffer->gap_start && pos < buffer->gap_end)
+	{
+		return NORMALTXT;  // Can't classify gap
+	}
+
+	char c = buffer->data[pos];
+
+	if (is_digit(c))
+	{
+    	return NUMBERS;
+	}
+
+	if (is_operator(c))
+	{
+		return OPERATORS;
+	}
+
+	if (is_word_char(c))
+	{
+		char word[256];
+		extract_word(buffer, pos, word, 256);
+		
+		// Check based on language
+		bool is_keyword = false;
+		
+		if (lang == LANG_C && is_c_keyword(word))
+		{
+			is_keyword = true;
+		}
+		else if (lang == LANG_PYTHON && is_python_keyword(word))
+		{
+			is_keyword = true;
+		}
+		else if (lang == LANG_JAVA && is_java_keyword(word))
+		{
+			is_keyword = true;
+		}
+		else if (lang == LANG_GO && is_go_keyword(word))
+		{
+			is_keyword = true;
+		}
+		else if (lang == LANG_JAVASCRIPT && is_javascript_keyword(word))
+		{
+			is_keyword = true;
+		}
+		else if (lang == LANG_RUST && is_rust_keyword(word))
+		{
+			is_keyword = true;
+		}
+
+		if (is_keyword)
+		{
+			return KEYWORDS;
+		}
+
+		// It's a word, but not a keyword
+		return NORMALTXT;
+	}
+
+	return NORMALTXT;
+}
+
+bool is_keyword_for_language(char *word, LanguageType lang)
+{
+	switch (lang)
+	{
+		case LANG_C:          return is_c_keyword(word);
+		case LANG_PYTHON:     return is_python_keyword(word);
+		case LANG_JAVA:       return is_java_keyword(word);
+		case LANG_GO:         return is_go_keyword(word);
+		case LANG_JAVASCRIPT: return is_javascript_keyword(word);
+		case LANG_RUST:       return is_rust_keyword(word);
+		default:              return false;
+	}
+}
+
+void highlighter_init(Highlighter *hl, LanguageType language)
+{
+	hl->language = language;
+	hl->capacity = 256;
+	hl->line_state = mem_alloc(MEM_HIGHLIGHT, hl->capacity);
+
+	if (hl->line_state == NULL)
+	{
+		hl->capacity = 0;
+	}
+	else
+	{
+		// Nothing can be open before the first line
+		hl->line_state[0] = HL_STATE_NORMAL;
+	}
+
+	hl->lines_valid = 1;
+	hl->lines_known = 1;
+}
+
+void highlighter_free(Highlighter *hl)
+{
+	mem_free(MEM_HIGHLIGHT, hl->line_state);
+	hl->line_state = NULL;
+	hl->capacity = 0;
+	hl->lines_valid = 1;
+	hl->lines_known = 1;
+}
+
+void highlighter_invalidate(Highlighter *hl, DirtyLines *dirty)
+{
+	if (!dirty->any)
+	{
+		return;
+	}
+
+	// The state at the start of the first dirty line is still correct
+	if (hl->lines_valid > dirty->first + 1)
+	{
+		hl->lines_valid = dirty->first + 1;
+	}
+
+	// Lines below moved, so their old states can't be compared any more
+	if (dirty->to_end && hl->lines_known > hl->lines_valid)
+	{
+		hl->lines_known = hl->lines_valid;
+	}
+}
+
+// Runs the lexer over one line starting in `state`, filling tokens[0, max_tokens)
+// if tokens is not NULL, and returns the state at the start of the next line
+static LineState lex_line(GapBuffer *buffer, size_t start, size_t len, LineState state, LanguageType lang, TokenType *tokens, size_t max_tokens)
+{
+	size_t i = 0;
+
+	#define EMIT(index, type) do { if (tokens != NULL && (index) < max_tokens) tokens[(index)] = (type); } while (0)
+
+	while (i < len)
+	{
+		char c = buffer_char_at(buffer, start + i);
+		char next = (i + 1 < len) ? buffer_char_at(buffer, start + i + 1) : '\0';
+
+		if (state == HL_STATE_BLOCK_COMMENT)
+		{
+			EMIT(i, COMMENTS);
+
+			if (c == '*' && next == '/')
+			{
+				EMIT(i + 1, COMMENTS);
+				state = HL_STATE_NORMAL;
+				i += 2;
+				continue;
+			}
+
+			i++;
+			continue;
+		}
+
+		if (c == '"')
+		{
+			// String runs to the next unescaped quote or the end of the line
+			EMIT(i, STRINGS);
+			i++;
+
+			while (i < len)
+			{
+				char s = buffer_char_at(buffer, start + i);
+				EMIT(i, STRINGS);
+				i++;
+
+				if (s == '"' && buffer_char_at(buffer, start + i - 2) != '\\')
+				{
+					break;
+				}
+			}
+			continue;
+		}
+
+		if (c == '/' && next == '/')
+		{
+			// Nothing after a line comment can change the state
+			for (; tokens != NULL && i < len && i < max_tokens; i++)
+			{
+				EMIT(i, COMMENTS);
+			}
+			break;
+		}
+
+		if (c == '/' && next == '*')
+		{
+			EMIT(i, COMMENTS);
+			EMIT(i + 1, COMMENTS);
+			state = HL_STATE_BLOCK_COMMENT;
+			i += 2;
+			continue;
+		}
+
+		if (is_word_char(c))
+		{
+			char word[256];
+			size_t word_len = 0;
+			size_t word_start = i;
+
+			while (i < len)
+			{
+				char w = buffer_char_at(buffer, start + i);
+
+				if (!is_word_char(w))
+				{
+					break;
+				}
+
+				if (word_len < sizeof(word) - 1)
+				{
+					word[word_len++] = w;
+				}
+				i++;
+			}
+			word[word_len] = '\0';
+
+			bool is_keyword = tokens != NULL && is_keyword_for_language(word, lang);
+
+			for (size_t j = word_start; j < i; j++)
+			{
+				// Digits stay numbers even inside identifiers, like classify_token
+				if (is_digit(buffer_char_at(buffer, start + j)))
+				{
+					EMIT(j, NUMBERS);
+				}
+				else
+				{
+					EMIT(j, is_keyword ? KEYWORDS : NORMALTXT);
+				}
+			}
+			continue;
+		}
+
+		if (is_operator(c))
+		{
+			EMIT(i, OPERATORS);
+		}
+		else
+		{
+			EMIT(i, NORMALTXT);
+		}
+		i++;
+	}
+
+	#undef EMIT
+
+	return state;
+}
+
+static bool highlighter_reserve(Highlighter *hl, size_t lines)
+{
+	if (lines <= hl->capacity)
+	{
+		return true;
+	}
+
+	size_t new_capacity = hl->capacity == 0 ? 256 : hl->capacity;
+
+	while (new_capacity < lines)
+	{
+		new_capacity *= 2;
+	}
+
+	unsigned char *new_state = mem_realloc(MEM_HIGHLIGHT, hl->line_state, new_capacity);
+
+	if (new_state == NULL)
+	{
+		return false;
+	}
+
+	if (hl->capacity == 0)
+	{
+		new_state[0] = HL_STATE_NORMAL;
+	}
+
+	hl->line_state = new_state;
+	hl->capacity = new_capacity;
+	return true;
+}
+
+// Records the state at the start of line_number; if it differs from what the
+// line was last drawn with, everything below has to be redrawn
+static void highlighter_store_state(Highlighter *hl, GapBuffer *buffer, size_t line_number, LineState state)
+{
+	if (!highlighter_reserve(hl, line_number + 1))
+	{
+		return;
+	}
+
+	if (line_number < hl->lines_known && hl->line_state[line_number] != state)
+	{
+		buffer_mark_dirty_from(buffer, line_number);
+		hl->lines_known = line_number;
+
+		// Anything lexed below this line started from the old state
+		hl->lines_valid = line_number;
+	}
+
+	hl->line_state[line_number] = state;
+
+	if (hl->lines_valid < line_number + 1)
+	{
+		hl->lines_valid = line_number + 1;
+	}
+
+	if (hl->lines_known < hl->lines_valid)
+	{
+		hl->lines_known = hl->lines_valid;
+	}
+}
+
+static size_t highlight_line_tokens(Highlighter *hl, GapBuffer *buffer, size_t line_number, TokenType *tokens, size_t max_tokens)
+{
+	size_t len = buffer_get_line_length(buffer, line_number);
+
+	if (hl->language == LANG_NONE || hl->line_state == NULL)
+	{
+		for (size_t i = 0; i < len && i < max_tokens; i++)
+		{
+			tokens[i] = NORMALTXT;
+		}
+		return len;
+	}
+
+	// Catch up on the lines above that haven't been lexed since the last edit
+	while (hl->lines_valid <= line_number)
+	{
+		size_t prev = hl->lines_valid - 1;
+		size_t prev_start = buffer_line_start(buffer, prev);
+		size_t prev_len = buffer_get_line_length(buffer, prev);
+
+		LineState next = lex_line(buffer, prev_start, prev_len, hl->line_state[prev], hl->language, NULL, 0);
+		highlighter_store_state(hl, buffer, prev + 1, next);
+
+		if (hl->lines_valid <= prev + 1)
+		{
+			break;  // Out of memory, draw without the carried state
+		}
+	}
+
+	LineState start_state = line_number < hl->lines_valid ? hl->line_state[line_number] : HL_STATE_NORMAL;
+	size_t start = buffer_line_start(buffer, line_number);
+
+	LineState end_state = lex_line(buffer, start, len, start_state, hl->language, tokens, max_tokens);
+
+	if (line_number + 1 < buffer_get_total_lines(buffer))
+	{
+		highlighter_store_state(hl, buffer, line_number + 1, end_state);
+	}
+
+	return len;
+}
+
+size_t highlight_line(Highlighter *hl, GapBuffer *buffer, size_t line_number, TokenType *tokens, size_t max_tokens)
+{
+	long long profile_start = profile_begin();
+	size_t len = highlight_line_tokens(hl, buffer, line_number, tokens, max_tokens);
+
+	profile_end(PROF_HIGHLIGHT, profile_start);
+
+	return len;
+}
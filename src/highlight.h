@@ -0,0 +1,56 @@
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include <stdbool.h>
+#include "buffer.h"
+
+typedef enum
+{
+	LANG_NONE,
+	LANG_C,
+	LANG_PYTHON,
+	LANG_JAVA,
+	LANG_GO,
+	LANG_JAVASCRIPT,
+	LANG_RUST,
+
+} LanguageType;
+
+typedef enum
+{
+	KEYWORDS,
+	STRINGS,
+	COMMENTS,
+	NUMBERS,
+	OPERATORS,
+	NORMALTXT
+
+} TokenType;
+
+// Lexer state carried from the end of one line to the start of the next
+typedef enum
+{
+	HL_STATE_NORMAL,
+	HL_STATE_BLOCK_COMMENT
+
+} LineState;
+
+typedef struct
+{
+	LanguageType language;
+
+	unsigned char *line_state;  // State at the start of each line
+	size_t lines_valid;         // line_state[0, lines_valid) is up to date
+	size_t lines_known;         // line_state[0, lines_known) is comparable after an edit
+	size_t capacity;
+
+} Highlighter;
+
+TokenType classify_token(GapBuffer *buffer, size_t pos, LanguageType lang);
+
+void highlighter_init(Highlighter *hl, LanguageType language);
+void highlighter_free(Highlighter *hl);
+void highlighter_invalidate(Highlighter *hl, DirtyLines *dirty);
+size_t highlight_line(Highlighter *hl, GapBuffer *buffer, size_t line_number, TokenType *tokens, size_t max_tokens);
+
+#endif
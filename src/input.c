@@ -0,0 +1,534 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include "input.h"
+#include "alloc.h"
+#include "utils.h"
+
+#define RING_MASK (INPUT_RING_SIZE - 1)
+#define MAX_SEQUENCE 32
+#define PASTE_END "\x1b[201~"
+#define PASTE_END_LEN 6
+#define PASTE_MAX (16 << 20)   // Bigger pastes are handed over in pieces this size
+
+void input_init(InputDecoder *in)
+{
+	in->head = 0;
+	in->tail = 0;
+
+	in->in_paste = false;
+	in->paste = NULL;
+	in->paste_len = 0;
+	in->paste_capacity = 0;
+	in->paste_sent = false;
+
+	in->escape_expired = false;
+	in->closed = false;
+
+	in->record = NULL;
+	in->record_start_ns = 0;
+}
+
+void input_free(InputDecoder *in)
+{
+	mem_free(MEM_INPUT, in->paste);
+	in->paste = NULL;
+	in->paste_capacity = 0;
+}
+
+static size_t ring_used(InputDecoder *in)
+{
+	return in->head - in->tail;
+}
+
+static unsigned char ring_peek(InputDecoder *in, size_t offset)
+{
+	return in->ring[(in->tail + offset) & RING_MASK];
+}
+
+// Reads whatever is available (waiting up to timeout_ms, -1 blocks) in one
+// read call. Returns bytes read, 0 on timeout or signal, -1 once fd is closed
+ssize_t input_read(InputDecoder *in, int fd, int timeout_ms)
+{
+	size_t free_space = INPUT_RING_SIZE - ring_used(in);
+
+	if (in->closed)
+	{
+		return -1;
+	}
+
+	if (free_space == 0)
+	{
+		return 0;
+	}
+
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	// Timed out, or interrupted by a signal such as SIGWINCH
+	if (poll(&pfd, 1, timeout_ms) <= 0)
+	{
+		return 0;
+	}
+
+	size_t start = in->head & RING_MASK;
+	size_t contiguous = INPUT_RING_SIZE - start;
+
+	if (contiguous > free_space)
+	{
+		contiguous = free_space;
+	}
+
+	ssize_t n = read(fd, &in->ring[start], contiguous);
+
+	// Readable but nothing to read means the terminal went away
+	if (n == 0)
+	{
+		in->closed = true;
+		return -1;
+	}
+
+	if (n < 0)
+	{
+		return 0;
+	}
+
+	if (in->record != NULL)
+	{
+		// One line per read: microseconds since recording started, then the bytes in hex
+		fprintf(in->record, "%lld ", (monotonic_ns() - in->record_start_ns) / 1000);
+
+		for (ssize_t i = 0; i < n; i++)
+		{
+			fprintf(in->record, "%02x", (unsigned char)in->ring[start + i]);
+		}
+
+		fputc('\n', in->record);
+		fflush(in->record);
+	}
+
+	in->head += n;
+	return n;
+}
+
+// Queues bytes that didn't come from a file descriptor, returns how many fit
+size_t input_feed(InputDecoder *in, const char *bytes, size_t len)
+{
+	size_t free_space = INPUT_RING_SIZE - ring_used(in);
+
+	if (len > free_space)
+	{
+		len = free_space;
+	}
+
+	for (size_t i = 0; i < len; i++)
+	{
+		in->ring[(in->head + i) & RING_MASK] = bytes[i];
+	}
+
+	in->head += len;
+	return len;
+}
+
+static bool paste_reserve(InputDecoder *in, size_t extra)
+{
+	if (in->paste_len + extra <= in->paste_capacity)
+	{
+		return true;
+	}
+
+	size_t new_capacity = in->paste_capacity == 0 ? 4096 : in->paste_capacity;
+
+	while (new_capacity < in->paste_len + extra)
+	{
+		new_capacity *= 2;
+	}
+
+	char *new_paste = mem_realloc(MEM_INPUT, in->paste, new_capacity);
+
+	if (new_paste == NULL)
+	{
+		return false;
+	}
+
+	in->paste = new_paste;
+	in->paste_capacity = new_capacity;
+	return true;
+}
+
+// Finds the bracketed paste terminator in paste[from, paste_len)
+static char *find_paste_end(InputDecoder *in, size_t from)
+{
+	char *p = in->paste + from;
+	char *end = in->paste + in->paste_len;
+
+	while ((p = memchr(p, '\x1b', end - p)) != NULL)
+	{
+		if ((size_t)(end - p) >= PASTE_END_LEN && memcmp(p, PASTE_END, PASTE_END_LEN) == 0)
+		{
+			return p;
+		}
+		p++;
+	}
+
+	return NULL;
+}
+
+// Ends the payload at length, with CR turned into \n. Unless done the paste
+// goes on and the next piece starts empty. True if there is text to insert.
+static bool paste_finish(InputDecoder *in, size_t length, bool done)
+{
+	in->paste_len = length;
+	in->in_paste = !done;
+	in->paste_sent = !done;
+
+	// Terminals send Enter as CR inside a paste
+	size_t out = 0;
+
+	for (size_t i = 0; i < in->paste_len; i++)
+	{
+		if (in->paste[i] == '\r')
+		{
+			if (i + 1 < in->paste_len && in->paste[i + 1] == '\n')
+			{
+				continue;
+			}
+			in->paste[out++] = '\n';
+		}
+		else
+		{
+			in->paste[out++] = in->paste[i];
+		}
+	}
+
+	in->paste_len = out;
+	return out > 0;
+}
+
+// Moves buffered bytes into the paste payload, returns true once there is
+// something to insert: the whole paste, or a piece of one too big to hold
+static bool paste_drain(InputDecoder *in)
+{
+	if (in->paste_sent)
+	{
+		in->paste_len = 0;
+		in->paste_sent = false;
+	}
+
+	size_t avail = ring_used(in);
+
+	if (avail > 0 && !paste_reserve(in, avail))
+	{
+		// Out of memory: hand over what we have so the ring can drain. With
+		// nothing held the paste ends and the rest comes through as keys.
+		if (in->paste_len == 0)
+		{
+			in->in_paste = false;
+			return false;
+		}
+
+		return paste_finish(in, in->paste_len, false);
+	}
+
+	size_t old_len = in->paste_len;
+
+	for (size_t i = 0; i < avail; i++)
+	{
+		in->paste[in->paste_len++] = ring_peek(in, i);
+	}
+
+	in->tail += avail;
+
+	// The terminator may have started in the previous chunk
+	size_t search_from = old_len >= PASTE_END_LEN ? old_len - (PASTE_END_LEN - 1) : 0;
+	char *end = avail > 0 ? find_paste_end(in, search_from) : NULL;
+
+	if (end != NULL)
+	{
+		// Give back whatever was typed after the paste, it is still in the ring
+		in->tail -= (in->paste + in->paste_len) - (end + PASTE_END_LEN);
+		return paste_finish(in, end - in->paste, true);
+	}
+
+	if (in->escape_expired)
+	{
+		// Nothing came for INPUT_PASTE_TIMEOUT_MS and the terminator never
+		// did either. Keys typed from here on are keys again.
+		in->escape_expired = false;
+		return paste_finish(in, in->paste_len, true);
+	}
+
+	if (in->paste_len >= PASTE_MAX)
+	{
+		// Insert this much and carry on, holding back the last few bytes in
+		// case the terminator starts there
+		size_t keep = avail < PASTE_END_LEN - 1 ? avail : PASTE_END_LEN - 1;
+		in->tail -= keep;
+		return paste_finish(in, in->paste_len - keep, false);
+	}
+
+	return false;
+}
+
+static int modifiers_from_param(int param)
+{
+	// xterm sends 1 + (shift | alt << 1 | ctrl << 2)
+	if (param < 2)
+	{
+		return 0;
+	}
+
+	return (param - 1) & (KEY_MOD_SHIFT | KEY_MOD_ALT | KEY_MOD_CTRL);
+}
+
+static int key_for_letter(char final)
+{
+	switch (final)
+	{
+		case 'A': return KEY_ARROW_UP;
+		case 'B': return KEY_ARROW_DOWN;
+		case 'C': return KEY_ARROW_RIGHT;
+		case 'D': return KEY_ARROW_LEFT;
+		case 'H': return KEY_HOME;
+		case 'F': return KEY_END;
+		case 'P': return KEY_F1;
+		case 'Q': return KEY_F2;
+		case 'R': return KEY_F3;
+		case 'S': return KEY_F4;
+		default:  return KEY_UNKNOWN;
+	}
+}
+
+static int key_for_tilde(int param)
+{
+	switch (param)
+	{
+		case 1:  return KEY_HOME;
+		case 2:  return KEY_INSERT;
+		case 3:  return KEY_DELETE;
+		case 4:  return KEY_END;
+		case 5:  return KEY_PAGE_UP;
+		case 6:  return KEY_PAGE_DOWN;
+		case 7:  return KEY_HOME;
+		case 8:  return KEY_END;
+		case 11: return KEY_F1;
+		case 12: return KEY_F2;
+		case 13: return KEY_F3;
+		case 14: return KEY_F4;
+		case 15: return KEY_F5;
+		case 17: return KEY_F6;
+		case 18: return KEY_F7;
+		case 19: return KEY_F8;
+		case 20: return KEY_F9;
+		case 21: return KEY_F10;
+		case 23: return KEY_F11;
+		case 24: return KEY_F12;
+		default: return KEY_UNKNOWN;
+	}
+}
+
+// Parses ESC [ params final starting at the '[', returns the sequence length
+// or 0 if it hasn't fully arrived yet
+static size_t parse_csi(InputDecoder *in, KeyEvent *event)
+{
+	size_t used = ring_used(in);
+	int params[2] = { 0, 0 };
+	size_t param_index = 0;
+
+	for (size_t i = 2; i < used; i++)
+	{
+		unsigned char c = ring_peek(in, i);
+
+		if (c >= '0' && c <= '9')
+		{
+			if (param_index < 2 && params[param_index] < 10000)
+			{
+				params[param_index] = params[param_index] * 10 + (c - '0');
+			}
+		}
+		else if (c == ';')
+		{
+			param_index++;
+		}
+		else if (c >= 0x20 && c <= 0x3F)
+		{
+			// Private markers and intermediates, nothing we map uses them
+		}
+		else if (c >= 0x40 && c <= 0x7E)
+		{
+			event->modifiers = modifiers_from_param(params[1]);
+
+			if (c == '~')
+			{
+				if (params[0] == 200)
+				{
+					event->key = KEY_PASTE;
+				}
+				else
+				{
+					event->key = key_for_tilde(params[0]);
+				}
+			}
+			else if (c == 'Z')
+			{
+				// Shift-Tab
+				event->key = '\t';
+				event->modifiers |= KEY_MOD_SHIFT;
+			}
+			else
+			{
+				event->key = key_for_letter(c);
+			}
+
+			return i + 1;
+		}
+		else
+		{
+			// Not a valid CSI byte, drop what we have so far
+			event->key = KEY_UNKNOWN;
+			return i;
+		}
+
+		if (i + 1 >= MAX_SEQUENCE)
+		{
+			event->key = KEY_UNKNOWN;
+			return i + 1;
+		}
+	}
+
+	return 0;
+}
+
+bool input_next_key(InputDecoder *in, KeyEvent *event)
+{
+	event->key = KEY_UNKNOWN;
+	event->modifiers = 0;
+	event->paste = NULL;
+	event->paste_len = 0;
+
+	if (in->in_paste)
+	{
+		if (paste_drain(in))
+		{
+			event->key = KEY_PASTE;
+			event->paste = in->paste;
+			event->paste_len = in->paste_len;
+			return true;
+		}
+
+		if (in->in_paste)
+		{
+			return false;
+		}
+	}
+
+	size_t used = ring_used(in);
+
+	if (used == 0)
+	{
+		return false;
+	}
+
+	unsigned char c = ring_peek(in, 0);
+
+	if (c != 27)
+	{
+		in->tail++;
+		event->key = c;
+		return true;
+	}
+
+	size_t length = 0;
+
+	if (used >= 2)
+	{
+		unsigned char next = ring_peek(in, 1);
+
+		if (next == '[')
+		{
+			length = parse_csi(in, event);
+		}
+		else if (next == 'O')
+		{
+			if (used >= 3)
+			{
+				event->key = key_for_letter(ring_peek(in, 2));
+				length = 3;
+			}
+		}
+		else if (next == 27)
+		{
+			// ESC ESC is a plain ESC followed by whatever the second one starts
+			event->key = 27;
+			length = 1;
+		}
+		else
+		{
+			// ESC then a key is how terminals send Alt+key
+			event->key = next;
+			event->modifiers = KEY_MOD_ALT;
+			length = 2;
+		}
+	}
+
+	if (length == 0)
+	{
+		if (!in->escape_expired)
+		{
+			return false;
+		}
+
+		// Nothing more came in time, so it was a real ESC keypress
+		event->key = 27;
+		event->modifiers = 0;
+		length = 1;
+	}
+
+	in->escape_expired = false;
+	in->tail += length;
+
+	if (event->key == KEY_PASTE)
+	{
+		in->in_paste = true;
+		in->paste_len = 0;
+		in->paste_sent = false;
+		return input_next_key(in, event);
+	}
+
+	return true;
+}
+
+InputPartial input_partial(InputDecoder *in)
+{
+	if (in->in_paste)
+	{
+		return INPUT_IN_PASTE;
+	}
+
+	// input_next_key only leaves bytes behind when a sequence is cut off
+	if (ring_used(in) > 0)
+	{
+		return INPUT_PARTIAL_ESCAPE;
+	}
+
+	return INPUT_IDLE;
+}
+
+void input_expire_escape(InputDecoder *in)
+{
+	in->escape_expired = true;
+}
+
+// Logs every chunk input_read gets from now on, for bench/replay
+void input_record(InputDecoder *in, FILE *out)
+{
+	in->record = out;
+	in->record_start_ns = monotonic_ns();
+
+	if (out != NULL)
+	{
+		fprintf(out, "# vesper input recording: <usec> <hex bytes>\n");
+	}
+}
@@ -0,0 +1,92 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define INPUT_RING_SIZE 4096   // Must be a power of two
+#define INPUT_PASTE_TIMEOUT_MS 1000   // A paste this quiet has lost its terminator
+
+// Keys below 256 are plain bytes, so 'a', 13 and 27 (ESC) mean what they always did
+typedef enum
+{
+	KEY_ARROW_UP = 1000,
+	KEY_ARROW_DOWN,
+	KEY_ARROW_RIGHT,
+	KEY_ARROW_LEFT,
+	KEY_HOME,
+	KEY_END,
+	KEY_PAGE_UP,
+	KEY_PAGE_DOWN,
+	KEY_INSERT,
+	KEY_DELETE,
+	KEY_F1,
+	KEY_F2,
+	KEY_F3,
+	KEY_F4,
+	KEY_F5,
+	KEY_F6,
+	KEY_F7,
+	KEY_F8,
+	KEY_F9,
+	KEY_F10,
+	KEY_F11,
+	KEY_F12,
+	KEY_PASTE,     // Bracketed paste, payload in KeyEvent.paste
+	KEY_UNKNOWN    // Well-formed escape sequence we don't map
+
+} KeyCode;
+
+#define KEY_MOD_SHIFT 1
+#define KEY_MOD_ALT   2
+#define KEY_MOD_CTRL  4
+
+typedef struct
+{
+	int key;
+	int modifiers;
+	char *paste;        // Owned by the decoder, valid until the next input_next_key
+	size_t paste_len;
+
+} KeyEvent;
+
+typedef enum
+{
+	INPUT_IDLE,             // Nothing half-decoded
+	INPUT_PARTIAL_ESCAPE,   // ESC or part of a sequence, resolve after a short timeout
+	INPUT_IN_PASTE          // Inside ESC [ 200 ~ ... waiting for ESC [ 201 ~, resolve after INPUT_PASTE_TIMEOUT_MS
+
+} InputPartial;
+
+typedef struct
+{
+	char ring[INPUT_RING_SIZE];
+	size_t head;   // Total bytes written
+	size_t tail;   // Total bytes consumed
+
+	bool in_paste;
+	char *paste;
+	size_t paste_len;
+	size_t paste_capacity;
+	bool paste_sent;   // paste went out as a piece of a longer paste
+
+	bool escape_expired;   // Treat a buffered partial sequence as complete
+	bool closed;
+
+	FILE *record;               // Raw bytes are logged here when set
+	long long record_start_ns;
+
+} InputDecoder;
+
+void input_init(InputDecoder *in);
+void input_free(InputDecoder *in);
+ssize_t input_read(InputDecoder *in, int fd, int timeout_ms);
+size_t input_feed(InputDecoder *in, const char *bytes, size_t len);
+bool input_next_key(InputDecoder *in, KeyEvent *event);
+InputPartial input_partial(InputDecoder *in);
+void input_expire_escape(InputDecoder *in);
+void input_record(InputDecoder *in, FILE *out);
+
+#endif
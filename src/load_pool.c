@@ -0,0 +1,250 @@
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "load_pool.h"
+#include "alloc.h"
+#include "trace.h"
+
+typedef struct LoadJob
+{
+	struct LoadJob *next;
+	EventLoop *loop;
+	char *path;
+	GapBuffer *buffer;
+	size_t max_size;
+	LoadPoolResult result;
+	LoadPoolCallback callback;
+	void *data;
+	Completion done;
+
+} LoadJob;
+
+struct LoadPool
+{
+	EventLoop *loop;
+
+	// The queue, first in first out, and the workers waiting on it
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	LoadJob *head;
+	LoadJob *tail;
+
+	// Set once by load_pool_free. Reads in progress stop at their next
+	// chunk, queued jobs are handed back unread.
+	atomic_bool stopping;
+
+	pthread_t threads[LOAD_POOL_MAX_THREADS];
+	int thread_count;
+};
+
+// Runs on the loop's thread, the job is done with by then
+static void load_pool_done(void *data)
+{
+	LoadJob *job = data;
+
+	TRACE_BEGIN("load callback");
+	job->callback(&job->result, job->data);
+	TRACE_END("load callback");
+
+	mem_free(MEM_TABS, job->path);
+	mem_free(MEM_TABS, job);
+}
+
+// The buffer is the job's alone until its callback, nothing else looks at it
+static void load_pool_run(LoadPool *pool, LoadJob *job)
+{
+	LoadPoolResult *result = &job->result;
+
+	result->exists = file_stamp(job->path, &result->stamp);
+
+	int fd = open(job->path, O_RDONLY);
+
+	if (fd < 0)
+	{
+		// A new file, created on save
+		result->ok = !result->exists;
+		return;
+	}
+
+	struct stat st;
+	size_t size = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? (size_t)st.st_size : 0;
+
+	if (job->max_size > 0 && size >= job->max_size)
+	{
+		result->too_big = true;
+		result->ok = true;
+		close(fd);
+		return;
+	}
+
+	TRACE_BEGIN("file load");
+	result->format = file_detect_format(fd);
+	result->ok = file_read_text(job->buffer, fd, size, &result->format, &pool->stopping);
+	result->cancelled = !result->ok && atomic_load(&pool->stopping);
+	TRACE_END("file load");
+
+	close(fd);
+}
+
+static void *load_pool_worker(void *data)
+{
+	LoadPool *pool = data;
+
+	TRACE_THREAD_NAME("load pool");
+
+	while (true)
+	{
+		pthread_mutex_lock(&pool->lock);
+
+		while (pool->head == NULL && !atomic_load(&pool->stopping))
+		{
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		}
+
+		LoadJob *job = pool->head;
+
+		if (job != NULL)
+		{
+			pool->head = job->next;
+
+			if (pool->head == NULL)
+			{
+				pool->tail = NULL;
+			}
+		}
+
+		pthread_mutex_unlock(&pool->lock);
+
+		if (job == NULL)
+		{
+			// Stopping, and the queue is empty
+			return NULL;
+		}
+
+		if (atomic_load(&pool->stopping))
+		{
+			job->result.cancelled = true;
+		}
+		else
+		{
+			load_pool_run(pool, job);
+		}
+
+		event_loop_post(job->loop, &job->done, load_pool_done, job);
+	}
+}
+
+// Starts threads workers (at least one) that wait for jobs. NULL if none
+// could be started.
+LoadPool *load_pool_create(EventLoop *loop, int threads)
+{
+	LoadPool *pool = mem_alloc(MEM_TABS, sizeof(LoadPool));
+
+	if (pool == NULL)
+	{
+		return NULL;
+	}
+
+	memset(pool, 0, sizeof(LoadPool));
+	pool->loop = loop;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	atomic_init(&pool->stopping, false);
+
+	if (threads < 1)
+	{
+		threads = 1;
+	}
+
+	if (threads > LOAD_POOL_MAX_THREADS)
+	{
+		threads = LOAD_POOL_MAX_THREADS;
+	}
+
+	while (pool->thread_count < threads &&
+	       pthread_create(&pool->threads[pool->thread_count], NULL, load_pool_worker, pool) == 0)
+	{
+		pool->thread_count++;
+	}
+
+	if (pool->thread_count == 0)
+	{
+		load_pool_free(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+// Queues path to be read into buffer, which has to stay untouched until
+// callback runs on the loop's thread. A file of max_size or more (unless
+// 0) is left unread, for the caller to deal with some other way.
+bool load_pool_add(LoadPool *pool, const char *path, GapBuffer *buffer, size_t max_size, LoadPoolCallback callback,
+                   void *data)
+{
+	LoadJob *job = mem_alloc(MEM_TABS, sizeof(LoadJob));
+
+	if (job == NULL)
+	{
+		return false;
+	}
+
+	memset(job, 0, sizeof(LoadJob));
+	job->loop = pool->loop;
+	job->path = mem_strdup(MEM_TABS, path);
+	job->buffer = buffer;
+	job->max_size = max_size;
+	job->callback = callback;
+	job->data = data;
+
+	if (job->path == NULL)
+	{
+		mem_free(MEM_TABS, job);
+		return false;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+
+	if (pool->tail != NULL)
+	{
+		pool->tail->next = job;
+	}
+	else
+	{
+		pool->head = job;
+	}
+
+	pool->tail = job;
+	pthread_cond_signal(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	return true;
+}
+
+// Stops the workers and waits for them, each is at most a chunk away.
+// Every job still gets its callback, those not read to the end cancelled:
+// they are all posted to the loop by the time this returns.
+void load_pool_free(LoadPool *pool)
+{
+	if (pool == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	atomic_store(&pool->stopping, true);
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->thread_count; i++)
+	{
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+	mem_free(MEM_TABS, pool);
+}
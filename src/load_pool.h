@@ -0,0 +1,40 @@
+#ifndef LOAD_POOL_H
+#define LOAD_POOL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "buffer.h"
+#include "event_loop.h"
+#include "file_io.h"
+
+// Reads many files at once, each on whichever of a few worker threads is
+// free, straight into its own buffer's gap as text (see file_read_text).
+// Opening a shell glob's worth of files then takes about as long as the
+// biggest of them, not all of them added up. Jobs start in the order they
+// were added.
+
+// At most this many workers, however many are asked for
+#define LOAD_POOL_MAX_THREADS 64
+
+typedef struct LoadPool LoadPool;
+
+// What a job reports back on the loop's thread
+typedef struct
+{
+	bool ok;              // Read in full, or there is no such file yet
+	bool exists;
+	bool too_big;         // At least max_size, left unread
+	bool cancelled;       // The pool was freed first, left unread or read in part
+	TextFormat format;
+	FileStamp stamp;      // Taken before the read, so a change made meanwhile shows
+
+} LoadPoolResult;
+
+typedef void (*LoadPoolCallback)(LoadPoolResult *result, void *data);
+
+LoadPool *load_pool_create(EventLoop *loop, int threads);
+bool load_pool_add(LoadPool *pool, const char *path, GapBuffer *buffer, size_t max_size, LoadPoolCallback callback,
+                   void *data);
+void load_pool_free(LoadPool *pool);
+
+#endif
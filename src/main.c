@@ -1,27 +1,41 @@
 #include <stdlib.h>
+#include <string.h>
 #include "terminal.h"
 #include "editor.h"
 
 
 int main(int argc, char *argv[])
 {
-	// save original settings
-        atexit(disableRawMode);
- 
-        enableRawMode();
+	int arg = 1;
 
-	if (argc > 1)
+	while (argc > arg + 1)
 	{
+		// --record FILE logs raw keystrokes for bench/replay
+		if (strcmp(argv[arg], "--record") == 0)
+		{
+			editor_record_input(argv[arg + 1]);
+		}
+		// --trace FILE writes a Chrome trace of the whole session (TRACE=1 builds)
+		else if (strcmp(argv[arg], "--trace") == 0)
+		{
+			editor_trace_session(argv[arg + 1]);
+		}
+		else
+		{
+			break;
+		}
 
-		editorLoop(argv[1]);
-
+		arg += 2;
 	}
 
-	else 
-	{
-		editorLoop(NULL);
-	}
- 
+	// save original settings
+        atexit(disableRawMode);
+
+        enableRawMode();
+
+	// Every file named gets a tab, the first one is shown
+	editorLoop(argv + arg, argc - arg);
+
         return 0;
 
 }
@@ -0,0 +1,675 @@
+#define _GNU_SOURCE   // memmem, memrchr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "pager.h"
+#include "alloc.h"
+#include "trace.h"
+
+// The indexer reads this much at a time and tells the page cache it is done
+// with it afterwards, a 50 GB file shouldn't push everything else out
+#define INDEX_CHUNK (16 * 1024 * 1024)
+
+// Newlines are counted this many bytes at a time, and only a block holding
+// the next indexed line is walked with memchr
+#define INDEX_COUNT_BLOCK (64 * 1024)
+
+// Entries per block of the index. Blocks are allocated as the worker gets
+// to them and never move, so entries below entry_count can be read without
+// a lock.
+#define INDEX_BLOCK_ENTRIES 65536
+
+// Searches and line lookups read this much at a time
+#define SCAN_CHUNK (1024 * 1024)
+
+struct Pager
+{
+	EventLoop *loop;
+	int fd;
+	int index_fd;   // The worker's own, so its readahead advice is its own
+	uint64_t size;
+	PagerWindow window;
+
+	// Entry k is where line k * PAGER_INDEX_STEP starts
+	uint64_t **blocks;
+	size_t block_count;
+
+	// Written by the worker, read on the loop's thread. An entry is stored
+	// before entry_count covers it, and entry_count before lines does.
+	atomic_size_t entry_count;
+	atomic_uint_fast64_t lines;
+	atomic_uint_fast64_t bytes;
+	atomic_bool done;
+	atomic_bool cancelled;
+
+	// Set while on_index is posted and hasn't looked yet
+	atomic_bool notify_pending;
+	PagerCallback on_index;
+	void *data;
+	Completion notify;
+
+	pthread_t thread;
+	bool started;
+	bool closed;     // Closed with notify queued, which frees it
+};
+
+struct PagerSearch
+{
+	EventLoop *loop;
+	int fd;
+	uint64_t size;
+	char *pattern;
+	size_t pattern_len;
+	bool forward;
+	uint64_t from;
+	uint64_t line;
+	uint64_t line_start;
+	PagerMatch match;
+	atomic_bool cancelled;
+	PagerSearchCallback callback;
+	void *data;
+	Completion done;
+};
+
+// pread until len bytes are in or the file ends; how many came
+static size_t read_at(int fd, char *dest, size_t len, uint64_t offset)
+{
+	size_t total = 0;
+
+	while (total < len)
+	{
+		ssize_t got = pread(fd, dest + total, len - total, offset + total);
+
+		if (got < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (got <= 0)
+		{
+			break;
+		}
+
+		total += got;
+	}
+
+	return total;
+}
+
+// Runs for on_index on the loop's thread, unless the pager was closed
+// meanwhile: then it's the last thing holding it
+static void pager_index_posted(void *data)
+{
+	Pager *pager = data;
+
+	if (pager->closed)
+	{
+		mem_free(MEM_BUFFER, pager);
+		return;
+	}
+
+	pager->on_index(pager->data);
+}
+
+static void pager_notify(Pager *pager)
+{
+	if (!atomic_exchange(&pager->notify_pending, true))
+	{
+		event_loop_post(pager->loop, &pager->notify, pager_index_posted, pager);
+	}
+}
+
+static bool pager_add_entry(Pager *pager, size_t index, uint64_t offset)
+{
+	size_t block = index / INDEX_BLOCK_ENTRIES;
+
+	if (block >= pager->block_count)
+	{
+		// The file grew since it was measured; what's past size isn't shown
+		return false;
+	}
+
+	if (pager->blocks[block] == NULL)
+	{
+		pager->blocks[block] = mem_alloc(MEM_BUFFER, INDEX_BLOCK_ENTRIES * sizeof(uint64_t));
+
+		if (pager->blocks[block] == NULL)
+		{
+			return false;
+		}
+	}
+
+	pager->blocks[block][index % INDEX_BLOCK_ENTRIES] = offset;
+	atomic_store_explicit(&pager->entry_count, index + 1, memory_order_release);
+	return true;
+}
+
+static uint64_t pager_entry(Pager *pager, size_t index)
+{
+	return pager->blocks[index / INDEX_BLOCK_ENTRIES][index % INDEX_BLOCK_ENTRIES];
+}
+
+static void *pager_index_worker(void *data)
+{
+	Pager *pager = data;
+	char *chunk = mem_alloc(MEM_BUFFER, INDEX_CHUNK);
+	uint64_t offset = 0;
+	uint64_t lines = 0;                  // Newlines passed
+	uint64_t next = PAGER_INDEX_STEP;    // The next line to find
+	size_t entries = 1;
+	bool ok = chunk != NULL;
+
+	TRACE_THREAD_NAME("pager index");
+	TRACE_BEGIN("pager index");
+
+	posix_fadvise(pager->index_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	while (ok && offset < pager->size && !atomic_load(&pager->cancelled))
+	{
+		size_t want = pager->size - offset < INDEX_CHUNK ? pager->size - offset : INDEX_CHUNK;
+		size_t got = read_at(pager->index_fd, chunk, want, offset);
+		size_t pos = 0;
+
+		// A read error, or the file got shorter; the lines so far still count
+		ok = got == want;
+
+		while (pos < got)
+		{
+			size_t len = got - pos < INDEX_COUNT_BLOCK ? got - pos : INDEX_COUNT_BLOCK;
+			size_t count = buffer_count_newlines(chunk + pos, len);
+
+			if (lines + count < next)
+			{
+				lines += count;
+				pos += len;
+				continue;
+			}
+
+			// Line next starts right after one of the newlines in here
+			const char *at = chunk + pos;
+
+			while (lines < next)
+			{
+				at = (const char *)memchr(at, '\n', chunk + pos + len - at) + 1;
+				lines++;
+			}
+
+			pos = at - chunk;
+
+			if (!pager_add_entry(pager, entries, offset + pos))
+			{
+				ok = false;
+				break;
+			}
+
+			entries++;
+			next += PAGER_INDEX_STEP;
+		}
+
+		// The rest of the block after a failed entry isn't counted
+		offset += pos;
+
+		posix_fadvise(pager->index_fd, offset - pos, pos, POSIX_FADV_DONTNEED);
+		atomic_store_explicit(&pager->lines, lines, memory_order_release);
+		atomic_store(&pager->bytes, offset);
+		pager_notify(pager);
+	}
+
+	TRACE_END("pager index");
+	mem_free(MEM_BUFFER, chunk);
+
+	if (!atomic_load(&pager->cancelled))
+	{
+		atomic_store(&pager->done, true);
+		pager_notify(pager);
+	}
+
+	return NULL;
+}
+
+// Opens path for viewing and starts indexing it. on_index is posted to the
+// loop's thread as the index grows and once more when it is done; it
+// should call pager_index_status, which lets the next one be posted. It
+// doesn't come after pager_close. NULL if the file can't be read.
+Pager *pager_open(EventLoop *loop, const char *path, PagerCallback on_index, void *data)
+{
+	Pager *pager = mem_alloc(MEM_BUFFER, sizeof(Pager));
+	struct stat st;
+
+	if (pager == NULL)
+	{
+		return NULL;
+	}
+
+	memset(pager, 0, sizeof(Pager));
+	pager->loop = loop;
+	pager->on_index = on_index;
+	pager->data = data;
+	pager->fd = open(path, O_RDONLY);
+	pager->index_fd = open(path, O_RDONLY);
+
+	if (pager->fd < 0 || pager->index_fd < 0 || fstat(pager->fd, &st) != 0)
+	{
+		pager_close(pager);
+		return NULL;
+	}
+
+	// Every indexed line takes at least a byte, so this many blocks is enough
+	pager->size = st.st_size;
+	pager->block_count = pager->size / PAGER_INDEX_STEP / INDEX_BLOCK_ENTRIES + 2;
+	pager->blocks = mem_alloc(MEM_BUFFER, pager->block_count * sizeof(uint64_t *));
+
+	if (pager->blocks == NULL)
+	{
+		pager_close(pager);
+		return NULL;
+	}
+
+	memset(pager->blocks, 0, pager->block_count * sizeof(uint64_t *));
+	atomic_init(&pager->entry_count, 0);
+	atomic_init(&pager->lines, 0);
+	atomic_init(&pager->bytes, 0);
+	atomic_init(&pager->done, false);
+	atomic_init(&pager->cancelled, false);
+	atomic_init(&pager->notify_pending, false);
+
+	// Line 0 is always at 0
+	if (!pager_add_entry(pager, 0, 0) || pthread_create(&pager->thread, NULL, pager_index_worker, pager) != 0)
+	{
+		pager_close(pager);
+		return NULL;
+	}
+
+	pager->started = true;
+	return pager;
+}
+
+// Stops the indexer and waits for it, it's at most one chunk away
+void pager_close(Pager *pager)
+{
+	if (pager == NULL)
+	{
+		return;
+	}
+
+	if (pager->started)
+	{
+		atomic_store(&pager->cancelled, true);
+		pthread_join(pager->thread, NULL);
+	}
+
+	for (size_t i = 0; pager->blocks != NULL && i < pager->block_count; i++)
+	{
+		mem_free(MEM_BUFFER, pager->blocks[i]);
+	}
+
+	if (pager->fd >= 0)
+	{
+		close(pager->fd);
+	}
+
+	if (pager->index_fd >= 0)
+	{
+		close(pager->index_fd);
+	}
+
+	mem_free(MEM_BUFFER, pager->blocks);
+	pager->blocks = NULL;
+
+	// The worker is gone, but what it posted last may not have run yet
+	if (event_loop_posted(pager->loop, &pager->notify))
+	{
+		pager->closed = true;
+		return;
+	}
+
+	mem_free(MEM_BUFFER, pager);
+}
+
+uint64_t pager_size(Pager *pager)
+{
+	return pager->size;
+}
+
+PagerWindow pager_window(Pager *pager)
+{
+	return pager->window;
+}
+
+void pager_index_status(Pager *pager, PagerIndexStatus *status)
+{
+	atomic_store(&pager->notify_pending, false);
+
+	status->done = atomic_load(&pager->done);
+	status->lines = atomic_load_explicit(&pager->lines, memory_order_acquire) + (status->done ? 1 : 0);
+	status->bytes = atomic_load(&pager->bytes);
+}
+
+// Where line starts, from its index entry and reading on from there. False
+// if the indexer hasn't got that far yet, or the file has fewer lines.
+bool pager_find_line(Pager *pager, uint64_t line, uint64_t *offset)
+{
+	uint64_t known = atomic_load_explicit(&pager->lines, memory_order_acquire);
+	size_t entry = line / PAGER_INDEX_STEP;
+
+	if (line > known || entry >= atomic_load_explicit(&pager->entry_count, memory_order_acquire))
+	{
+		return false;
+	}
+
+	uint64_t pos = pager_entry(pager, entry);
+	uint64_t skip = line - (uint64_t)entry * PAGER_INDEX_STEP;
+
+	if (skip == 0)
+	{
+		*offset = pos;
+		return true;
+	}
+
+	char *chunk = mem_alloc(MEM_BUFFER, SCAN_CHUNK);
+	bool found = false;
+
+	while (chunk != NULL && !found)
+	{
+		size_t got = read_at(pager->fd, chunk, SCAN_CHUNK, pos);
+		size_t count = buffer_count_newlines(chunk, got);
+
+		if (got == 0)
+		{
+			break;
+		}
+
+		if (count < skip)
+		{
+			skip -= count;
+			pos += got;
+			continue;
+		}
+
+		const char *at = chunk;
+
+		for (; skip > 0; skip--)
+		{
+			at = (const char *)memchr(at, '\n', chunk + got - at) + 1;
+		}
+
+		*offset = pos + (at - chunk);
+		found = true;
+	}
+
+	mem_free(MEM_BUFFER, chunk);
+	return found;
+}
+
+// Fills buffer with the window around line, which starts at line_start:
+// up to PAGER_WINDOW bytes of whole lines with it in the middle, fewer at
+// either end of the file. The buffer's old text goes, its memory is
+// reused. *row is where line ended up in the buffer.
+bool pager_show(Pager *pager, GapBuffer *buffer, uint64_t line_start, uint64_t line, size_t *row)
+{
+	uint64_t start = line_start > PAGER_WINDOW / 2 ? line_start - PAGER_WINDOW / 2 : 0;
+	size_t want = pager->size - start < PAGER_WINDOW ? pager->size - start : PAGER_WINDOW;
+
+	if (line_start > pager->size)
+	{
+		return false;
+	}
+
+	TRACE_BEGIN("pager show");
+
+	buffer_drop_front(buffer, buffer_length(buffer));
+	buffer_reserve(buffer, want);
+
+	char *dest = &buffer->data[buffer->gap_start];
+	size_t got = read_at(pager->fd, dest, want, start);
+	size_t skip = 0;
+	size_t keep;
+
+	if (got < line_start - start)
+	{
+		TRACE_END("pager show");
+		return false;
+	}
+
+	// Starting mid-line, that line goes. The newline ending the one before
+	// line_start is in there at the latest, unless the file changed.
+	if (start > 0)
+	{
+		const char *first = memchr(dest, '\n', got);
+
+		if (first != NULL && (uint64_t)(first - dest) < line_start - start)
+		{
+			skip = first - dest + 1;
+		}
+	}
+
+	keep = got - skip;
+
+	// Same at the end, unless that cuts off line itself: one line longer
+	// than half a window is shown in part
+	if (start + got < pager->size)
+	{
+		const char *last = memrchr(dest + skip, '\n', keep);
+
+		if (last != NULL && (uint64_t)(last - dest) >= line_start - start)
+		{
+			keep = last - (dest + skip) + 1;
+		}
+	}
+
+	memmove(dest, dest + skip, keep);
+	buffer_commit_gap(buffer, keep);
+
+	pager->window.start = start + skip;
+	pager->window.end = pager->window.start + keep;
+	*row = buffer_count_newlines(dest, line_start - pager->window.start);
+	pager->window.first_line = line - *row;
+
+	TRACE_END("pager show");
+	return true;
+}
+
+static void pager_search_forward(PagerSearch *search, char *chunk)
+{
+	size_t overlap = search->pattern_len - 1;
+	uint64_t pos = search->from;
+	uint64_t line = search->line;
+	uint64_t line_start = search->line_start;
+	size_t skip = 1;   // Only matches after from
+
+	while (pos < search->size && !atomic_load(&search->cancelled))
+	{
+		size_t got = read_at(search->fd, chunk, SCAN_CHUNK + overlap, pos);
+
+		if (got <= skip)
+		{
+			break;
+		}
+
+		// A match starting in the overlap is whole in the next chunk
+		char *hit = memmem(chunk + skip, got - skip, search->pattern, search->pattern_len);
+		size_t used = hit != NULL ? (size_t)(hit - chunk) : got < SCAN_CHUNK ? got : SCAN_CHUNK;
+		size_t count = buffer_count_newlines(chunk, used);
+
+		if (count > 0)
+		{
+			line += count;
+			line_start = pos + ((const char *)memrchr(chunk, '\n', used) - chunk) + 1;
+		}
+
+		if (hit != NULL)
+		{
+			search->match.found = true;
+			search->match.offset = pos + used;
+			search->match.line = line;
+			search->match.line_start = line_start;
+			return;
+		}
+
+		pos += used;
+		skip = 0;
+	}
+}
+
+// Where the line holding offset starts, reading back for the newline before it
+static uint64_t pager_line_start_before(PagerSearch *search, char *chunk, uint64_t offset)
+{
+	while (offset > 0)
+	{
+		uint64_t start = offset > SCAN_CHUNK ? offset - SCAN_CHUNK : 0;
+		size_t got = read_at(search->fd, chunk, offset - start, start);
+		const char *newline = memrchr(chunk, '\n', got);
+
+		if (newline != NULL)
+		{
+			return start + (newline - chunk) + 1;
+		}
+
+		offset = start;
+	}
+
+	return 0;
+}
+
+static void pager_search_backward(PagerSearch *search, char *chunk)
+{
+	size_t overlap = search->pattern_len - 1;
+	uint64_t end = search->from;
+	uint64_t line = search->line;
+
+	while (end > 0 && !atomic_load(&search->cancelled))
+	{
+		uint64_t start = end > SCAN_CHUNK ? end - SCAN_CHUNK : 0;
+		size_t span = end - start;   // Where a match may start
+		size_t got = read_at(search->fd, chunk, span + overlap, start);
+
+		if (got < span)
+		{
+			break;
+		}
+
+		// The last one starting before end
+		char *hit = NULL;
+		char *at = chunk;
+
+		while ((at = memmem(at, got - (at - chunk), search->pattern, search->pattern_len)) != NULL &&
+		       (size_t)(at - chunk) < span)
+		{
+			hit = at;
+			at++;
+		}
+
+		size_t from = hit != NULL ? (size_t)(hit - chunk) : 0;
+		size_t count = buffer_count_newlines(chunk + from, span - from);
+
+		line -= count;
+
+		if (hit != NULL)
+		{
+			search->match.found = true;
+			search->match.offset = start + from;
+			search->match.line = line;
+			search->match.line_start = count == 0 ? search->line_start : pager_line_start_before(search, chunk, start + from);
+			return;
+		}
+
+		end = start;
+	}
+}
+
+// Runs back on the loop's thread, always, found or not
+static void pager_search_done(void *data)
+{
+	PagerSearch *search = data;
+
+	search->callback(&search->match, search->data);
+
+	close(search->fd);
+	mem_free(MEM_BUFFER, search->pattern);
+	mem_free(MEM_BUFFER, search);
+}
+
+static void *pager_search_worker(void *data)
+{
+	PagerSearch *search = data;
+	char *chunk = mem_alloc(MEM_BUFFER, SCAN_CHUNK + search->pattern_len);
+
+	TRACE_THREAD_NAME("pager search");
+	TRACE_BEGIN("pager search");
+
+	if (chunk != NULL && search->forward)
+	{
+		pager_search_forward(search, chunk);
+	}
+	else if (chunk != NULL)
+	{
+		pager_search_backward(search, chunk);
+	}
+
+	TRACE_END("pager search");
+	mem_free(MEM_BUFFER, chunk);
+
+	event_loop_post(search->loop, &search->done, pager_search_done, search);
+
+	return NULL;
+}
+
+// Looks for pattern on a worker: the first match after from, or the last
+// one before it. line and line_start are where the line holding from is,
+// so the match's line can be counted from there. The search has its own
+// fd and outlives the pager if it has to; callback runs on the loop's
+// thread once it's over, after which it is gone.
+PagerSearch *pager_search(Pager *pager, const char *pattern, bool forward, uint64_t from, uint64_t line,
+                          uint64_t line_start, PagerSearchCallback callback, void *data)
+{
+	PagerSearch *search = mem_alloc(MEM_BUFFER, sizeof(PagerSearch));
+
+	if (search == NULL || pattern[0] == '\0')
+	{
+		mem_free(MEM_BUFFER, search);
+		return NULL;
+	}
+
+	memset(search, 0, sizeof(PagerSearch));
+	search->loop = pager->loop;
+	search->fd = dup(pager->fd);
+	search->size = pager->size;
+	search->pattern = mem_strdup(MEM_BUFFER, pattern);
+	search->pattern_len = strlen(pattern);
+	search->forward = forward;
+	search->from = from;
+	search->line = line;
+	search->line_start = line_start;
+	search->callback = callback;
+	search->data = data;
+	atomic_init(&search->cancelled, false);
+
+	pthread_t thread;
+
+	if (search->fd < 0 || search->pattern == NULL || pthread_create(&thread, NULL, pager_search_worker, search) != 0)
+	{
+		if (search->fd >= 0)
+		{
+			close(search->fd);
+		}
+
+		mem_free(MEM_BUFFER, search->pattern);
+		mem_free(MEM_BUFFER, search);
+		return NULL;
+	}
+
+	pthread_detach(thread);
+	return search;
+}
+
+// Stops after the chunk being read, the callback still comes
+void pager_search_cancel(PagerSearch *search)
+{
+	atomic_store(&search->cancelled, true);
+}
@@ -0,0 +1,64 @@
+#ifndef PAGER_H
+#define PAGER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "buffer.h"
+#include "event_loop.h"
+
+// Read-only viewing of files too big to load. The buffer only ever holds a
+// window of whole lines around what is on screen, read with pread, and a
+// worker builds a sparse line index in the background: where every
+// PAGER_INDEX_STEP-th line starts. Any line that has been indexed can be
+// found by reading at most that many lines on from its entry, so memory
+// stays the same whether the file is 2 GB or 50.
+
+#define PAGER_WINDOW (4 * 1024 * 1024)
+#define PAGER_INDEX_STEP 4096
+
+typedef struct Pager Pager;
+typedef struct PagerSearch PagerSearch;
+
+// The part of the file in the buffer
+typedef struct
+{
+	uint64_t start;        // Offset of the buffer's first byte
+	uint64_t end;
+	uint64_t first_line;   // Line number of the buffer's first line
+
+} PagerWindow;
+
+typedef struct
+{
+	uint64_t lines;        // Lines known to start before bytes, the line count once done
+	uint64_t bytes;        // How far the index has read
+	bool done;
+
+} PagerIndexStatus;
+
+typedef struct
+{
+	bool found;
+	uint64_t offset;       // Of the match
+	uint64_t line;         // It is on
+	uint64_t line_start;   // Where that line starts
+
+} PagerMatch;
+
+typedef void (*PagerCallback)(void *data);
+typedef void (*PagerSearchCallback)(PagerMatch *match, void *data);
+
+Pager *pager_open(EventLoop *loop, const char *path, PagerCallback on_index, void *data);
+void pager_close(Pager *pager);
+uint64_t pager_size(Pager *pager);
+PagerWindow pager_window(Pager *pager);
+void pager_index_status(Pager *pager, PagerIndexStatus *status);
+bool pager_find_line(Pager *pager, uint64_t line, uint64_t *offset);
+bool pager_show(Pager *pager, GapBuffer *buffer, uint64_t line_start, uint64_t line, size_t *row);
+
+PagerSearch *pager_search(Pager *pager, const char *pattern, bool forward, uint64_t from, uint64_t line,
+                          uint64_t line_start, PagerSearchCallback callback, void *data);
+void pager_search_cancel(PagerSearch *search);
+
+#endif
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "utils.h"
+
+#ifdef __GLIBC__
+#include <stdio_ext.h>
+#endif
+
+bool profile_enabled = false;
+
+static const char *stage_names[PROF_STAGE_COUNT] = {
+	"input decode",
+	"dispatch",
+	"buffer edit",
+	"line index",
+	"highlight",
+	"render_text",
+	"status line",
+	"flush",
+};
+
+// Time spent in each stage since the last frame, moved to the rings on commit
+static long long frame_totals[PROF_STAGE_COUNT];
+static ProfileRing stage_rings[PROF_STAGE_COUNT];
+static ProfileRing output_ring;
+
+static void ring_push(ProfileRing *ring, long long value)
+{
+	ring->samples[ring->next] = value;
+	ring->next = (ring->next + 1) % PROFILE_RING_SIZE;
+
+	if (ring->count < PROFILE_RING_SIZE)
+	{
+		ring->count++;
+	}
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void ring_percentiles(ProfileRing *ring, long long *p50, long long *p99)
+{
+	long long sorted[PROFILE_RING_SIZE];
+
+	*p50 = 0;
+	*p99 = 0;
+
+	if (ring->count == 0)
+	{
+		return;
+	}
+
+	memcpy(sorted, ring->samples, sizeof(long long) * ring->count);
+	qsort(sorted, ring->count, sizeof(long long), compare_samples);
+
+	*p50 = sorted[ring->count / 2];
+	*p99 = sorted[ring->count * 99 / 100];
+}
+
+void profile_set_enabled(bool enabled)
+{
+	profile_enabled = enabled;
+
+	// Start every session from a clean window
+	memset(frame_totals, 0, sizeof(frame_totals));
+	memset(stage_rings, 0, sizeof(stage_rings));
+	memset(&output_ring, 0, sizeof(output_ring));
+}
+
+// Returns a start time for profile_end, or 0 when profiling is off
+long long profile_begin(void)
+{
+	if (!profile_enabled)
+	{
+		return 0;
+	}
+
+	return monotonic_ns();
+}
+
+void profile_end(ProfileStage stage, long long start)
+{
+	if (start == 0 || !profile_enabled)
+	{
+		return;
+	}
+
+	frame_totals[stage] += monotonic_ns() - start;
+}
+
+// Bytes sitting in stdout's buffer, i.e. the frame about to be flushed
+size_t profile_pending_output(void)
+{
+#ifdef __GLIBC__
+	return __fpending(stdout);
+#else
+	return 0;
+#endif
+}
+
+void profile_end_frame(size_t output_bytes)
+{
+	if (!profile_enabled)
+	{
+		return;
+	}
+
+	for (int i = 0; i < PROF_STAGE_COUNT; i++)
+	{
+		ring_push(&stage_rings[i], frame_totals[i]);
+		frame_totals[i] = 0;
+	}
+
+	ring_push(&output_ring, (long long)output_bytes);
+}
+
+// Draws the stage table in the top right corner, the caller repaints the
+// rows underneath on the next frame
+void profile_draw_overlay(size_t screen_cols)
+{
+	if (screen_cols < PROFILE_OVERLAY_COLS)
+	{
+		return;
+	}
+
+	size_t col = screen_cols - PROFILE_OVERLAY_COLS + 1;
+	long long p50;
+	long long p99;
+
+	printf("\x1b[1;%zuH\x1b[7m %-13s %8s %8s  \x1b[0m", col, "stage", "p50 us", "p99 us");
+
+	for (int i = 0; i < PROF_STAGE_COUNT; i++)
+	{
+		ring_percentiles(&stage_rings[i], &p50, &p99);
+		printf("\x1b[%d;%zuH\x1b[7m %-13s %8.1f %8.1f  \x1b[0m", i + 2, col, stage_names[i], p50 / 1000.0, p99 / 1000.0);
+	}
+
+	ring_percentiles(&output_ring, &p50, &p99);
+	printf("\x1b[%d;%zuH\x1b[7m %-13s %8lld %8lld  \x1b[0m", PROF_STAGE_COUNT + 2, col, "bytes/frame", p50, p99);
+}
@@ -0,0 +1,44 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Per-frame stage timings for the :profile overlay. Stages nest (an edit
+// runs inside dispatch, highlighting inside render), so times are inclusive.
+typedef enum
+{
+	PROF_INPUT_DECODE,
+	PROF_DISPATCH,
+	PROF_BUFFER_EDIT,
+	PROF_LINE_INDEX,
+	PROF_HIGHLIGHT,
+	PROF_RENDER,
+	PROF_STATUS,
+	PROF_FLUSH,
+	PROF_STAGE_COUNT
+
+} ProfileStage;
+
+#define PROFILE_RING_SIZE 128   // Frames kept per stage for the rolling percentiles
+#define PROFILE_OVERLAY_ROWS (PROF_STAGE_COUNT + 2)
+#define PROFILE_OVERLAY_COLS 34
+
+typedef struct
+{
+	long long samples[PROFILE_RING_SIZE];
+	size_t next;
+	size_t count;
+
+} ProfileRing;
+
+extern bool profile_enabled;
+
+void profile_set_enabled(bool enabled);
+long long profile_begin(void);
+void profile_end(ProfileStage stage, long long start);
+size_t profile_pending_output(void);
+void profile_end_frame(size_t output_bytes);
+void profile_draw_overlay(size_t screen_cols);
+
+#endif
@@ -1,6 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "render.h"
+#include "alloc.h"
 #include "buffer.h"
 #include "editor.h"
 
@@ -25,102 +27,210 @@ const char* get_color_for_token(TokenType type)
     }
 }
 
-void render_text(GapBuffer *buffer, size_t row_offset, size_t screen_rows, size_t col_offset, size_t screen_cols, bool in_search_mode, char *search_pattern, LanguageType language)
+// What the screen showed after the last frame, to decide what can be kept
+typedef struct
 {
-    size_t current_row = 0;
-    size_t current_col = 0;
-    TokenType current_token = NORMALTXT;
-    
-    for (size_t i = 0; i < buffer->capacity; i++)
+    bool valid;
+    size_t row_offset;
+    size_t col_offset;
+    size_t screen_rows;
+    size_t screen_cols;
+    bool in_search_mode;
+    char search_pattern[256];
+} RenderCache;
+
+static RenderCache last_frame;
+
+// Screen rows to repaint next frame whatever the buffer says, [first, end)
+static size_t repaint_first = 0;
+static size_t repaint_end = 0;
+
+static TokenType *line_tokens = NULL;
+static size_t line_tokens_capacity = 0;
+
+void render_invalidate(void)
+{
+    last_frame.valid = false;
+}
+
+// Repaints rows next frame without throwing away highlight state, for
+// things drawn over the text like ghost text or the profile overlay
+void render_repaint_rows(size_t first_row, size_t count)
+{
+    if (repaint_end == repaint_first)
+    {
+        repaint_first = first_row;
+        repaint_end = first_row + count;
+        return;
+    }
+
+    if (first_row < repaint_first)
+    {
+        repaint_first = first_row;
+    }
+
+    if (first_row + count > repaint_end)
+    {
+        repaint_end = first_row + count;
+    }
+}
+
+void render_repaint_all(void)
+{
+    render_repaint_rows(0, (size_t)-1 / 2);
+}
+
+static bool search_match_at(GapBuffer *buffer, size_t pos, size_t line_end, char *pattern, size_t pattern_len)
+{
+    if (pos + pattern_len > line_end)
+    {
+        return false;
+    }
+
+    for (size_t j = 0; j < pattern_len; j++)
     {
-        if (i >= buffer->gap_start && i < buffer->gap_end)
+        if (buffer_char_at(buffer, pos + j) != pattern[j])
         {
-            continue;
+            return false;
         }
-        
-        // Get the character
-        char c = buffer->data[i];
-        
-        // Only print if BOTH row AND column are in visible range
-        if (current_row >= row_offset && current_row < row_offset + screen_rows && current_col >= col_offset && current_col < col_offset + screen_cols)
+    }
+
+    return true;
+}
+
+static void render_line(GapBuffer *buffer, Highlighter *highlighter, size_t line, size_t col_offset, size_t screen_cols, bool in_search_mode, char *search_pattern)
+{
+    size_t visible_end = col_offset + screen_cols;
+
+    if (line_tokens_capacity < visible_end)
+    {
+        TokenType *new_tokens = mem_realloc(MEM_HIGHLIGHT, line_tokens, sizeof(TokenType) * visible_end);
+
+        if (new_tokens == NULL)
         {
-            if (in_search_mode && search_pattern[0] != '\0')
+            return;
+        }
+
+        line_tokens = new_tokens;
+        line_tokens_capacity = visible_end;
+    }
+
+    size_t line_start = buffer_line_start(buffer, line);
+    size_t line_len;
+
+    if (in_search_mode && search_pattern[0] != '\0')
+    {
+        line_len = buffer_get_line_length(buffer, line);
+    }
+    else
+    {
+        line_len = highlight_line(highlighter, buffer, line, line_tokens, visible_end);
+    }
+
+    size_t line_end = line_start + line_len;
+    size_t pattern_len = strlen(search_pattern);
+    bool colored = highlighter->language != LANG_NONE;
+    TokenType current_token = NORMALTXT;
+
+    for (size_t col = col_offset; col < line_len && col < visible_end; col++)
+    {
+        size_t pos = line_start + col;
+        char c = buffer_char_at(buffer, pos);
+
+        if (in_search_mode && search_pattern[0] != '\0')
+        {
+            if (search_match_at(buffer, pos, line_end, search_pattern, pattern_len))
             {
-                bool match_found = false;
-                size_t pattern_len = strlen(search_pattern);
-                
-                if (i + pattern_len <= buffer->capacity)
-                {
-                    match_found = true;
-                    
-                    for (size_t j = 0; j < pattern_len; j++)
-                    {
-                        size_t check_pos = i + j;
-                        
-                        if (check_pos >= buffer->gap_start && check_pos < buffer->gap_end)
-                        {
-                            match_found = false;
-                            break;
-                        }
-                        
-                        if (buffer->data[check_pos] != search_pattern[j])
-                        {
-                            match_found = false;
-                            break;
-                        }
-                    }
-                }
-                
-                if (match_found)
-                {
-                    printf("\x1b[43;30m");
-                    
-                    for (size_t j = 0; j < pattern_len; j++)
-                    {
-                        size_t print_pos = i + j;
-                        printf("%c", buffer->data[print_pos]);
-                    }
-                    
-                    printf("\x1b[0m");
-                    
-                    i += pattern_len - 1;
-                    current_col += pattern_len;
-                }
-                else
+                printf("\x1b[43;30m");
+
+                for (size_t j = 0; j < pattern_len && col < visible_end; j++, col++)
                 {
-                    printf("%c", c);
+                    printf("%c", buffer_char_at(buffer, pos + j));
                 }
+
+                printf("\x1b[0m");
+
+                col--;
             }
             else
             {
-                // Classify the token at position i
-                TokenType token_type = classify_token(buffer, i, language);
-                
-                // Only print color if type changed
-                if (token_type != current_token)
-                {
-                    printf("%s", get_color_for_token(token_type));
-                    current_token = token_type;
-                }
                 printf("%c", c);
             }
         }
-        
-        if (c == '\n')
+        else
         {
-            current_row++;
-            current_col = 0;
-            
-            if (current_row >= row_offset + screen_rows)
+            // Only print color if type changed
+            if (colored && line_tokens[col] != current_token)
             {
-                break;
+                printf("%s", get_color_for_token(line_tokens[col]));
+                current_token = line_tokens[col];
             }
+            printf("%c", c);
         }
-        else
+    }
+
+    if (current_token != NORMALTXT)
+    {
+        printf("%s", COLOR_RESET);
+    }
+}
+
+void render_text(GapBuffer *buffer, Highlighter *highlighter, size_t row_offset, size_t screen_rows, size_t col_offset, size_t screen_cols, bool in_search_mode, char *search_pattern)
+{
+    // Scrolling, resizing or changing the search highlight touches every row
+    bool full_redraw = !last_frame.valid
+        || last_frame.row_offset != row_offset
+        || last_frame.col_offset != col_offset
+        || last_frame.screen_rows != screen_rows
+        || last_frame.screen_cols != screen_cols
+        || last_frame.in_search_mode != in_search_mode
+        || (in_search_mode && strcmp(last_frame.search_pattern, search_pattern) != 0);
+
+    if (!last_frame.valid)
+    {
+        printf("\x1b[2J");
+    }
+
+    // Only edits change lexer state, a repaint must not send it back to line 0
+    highlighter_invalidate(highlighter, &buffer->dirty);
+
+    if (full_redraw)
+    {
+        buffer_mark_all_dirty(buffer);
+    }
+
+    size_t total_lines = buffer_get_total_lines(buffer);
+
+    for (size_t row = 0; row < screen_rows; row++)
+    {
+        size_t line = row_offset + row;
+
+        // Checked per row, highlighting a line can dirty the ones below it
+        if (!buffer_line_is_dirty(buffer, line) && (row < repaint_first || row >= repaint_end))
+        {
+            continue;
+        }
+
+        printf("\x1b[%zu;1H\x1b[K", row + 1);
+
+        if (line < total_lines)
         {
-            current_col++;
+            render_line(buffer, highlighter, line, col_offset, screen_cols, in_search_mode, search_pattern);
         }
     }
+
+    buffer_clear_dirty(buffer);
+    repaint_first = 0;
+    repaint_end = 0;
+
+    last_frame.valid = true;
+    last_frame.row_offset = row_offset;
+    last_frame.col_offset = col_offset;
+    last_frame.screen_rows = screen_rows;
+    last_frame.screen_cols = screen_cols;
+    last_frame.in_search_mode = in_search_mode;
+    strncpy(last_frame.search_pattern, search_pattern, sizeof(last_frame.search_pattern) - 1);
+    last_frame.search_pattern[sizeof(last_frame.search_pattern) - 1] = '\0';
 }
 
 void render_get_cursor_pos(GapBuffer *buffer, size_t *row, size_t *col)
@@ -144,7 +254,7 @@ void render_get_cursor_pos(GapBuffer *buffer, size_t *row, size_t *col)
 
 void draw_status_line(size_t cursor_x, size_t cursor_y, size_t screen_rows, EditorMode mode, char *message, char *command_buffer, char *search_buffer, bool search_forward)
 {
-    printf("\x1b[%zu;1H", screen_rows);
+    printf("\x1b[%zu;1H\x1b[K", screen_rows);
     printf("\x1b[7m");
 
     if (mode == INSERT) 
@@ -182,5 +292,4 @@ void draw_status_line(size_t cursor_x, size_t cursor_y, size_t screen_rows, Edit
     }
     
     printf("\x1b[m");
-    fflush(stdout);
 }
@@ -5,7 +5,10 @@
 #include "editor.h"
 
 void screen_clear(void);
-void render_text(GapBuffer *buffer, size_t row_offset, size_t screen_rows, size_t col_offset, size_t screen_cols, bool in_search_mode, char *search_pattern, LanguageType language);
+void render_text(GapBuffer *buffer, Highlighter *highlighter, size_t row_offset, size_t screen_rows, size_t col_offset, size_t screen_cols, bool in_search_mode, char *search_pattern);
+void render_invalidate(void);
+void render_repaint_all(void);
+void render_repaint_rows(size_t first_row, size_t count);
 void render_get_cursor_pos(GapBuffer *buffer, size_t *row, size_t *col);
 void draw_status_line(size_t cursor_x, size_t cursor_y, size_t screen_rows, EditorMode mode, char *message, char *command_buffer, char *search_buffer, bool search_forward);
 
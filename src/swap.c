@@ -0,0 +1,522 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "swap.h"
+#include "alloc.h"
+#include "utils.h"
+
+#define SWAP_MAGIC "VSPSWAP"
+#define SWAP_VERSION 2
+#define SWAP_INSERT 0x534e49   // "INS"
+#define SWAP_DELETE 0x4c4544   // "DEL"
+
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t pid;         // Of the session writing it
+	uint64_t started;     // Its process_start_id, 0 if unknown
+	FileStamp base;
+
+} SwapHeader;
+
+// One edit. An insert is followed by its text, a delete only says how much.
+// Ops are packed back to back, so they are copied in and out, never
+// accessed in place.
+typedef struct
+{
+	uint32_t type;
+	uint32_t unused;
+	uint64_t position;
+	uint64_t length;
+
+} SwapOp;
+
+bool swap_path(const char *filename, char *out, size_t out_len)
+{
+	return cache_file_path("swap", filename, out, out_len);
+}
+
+// This session's header, for the file as described by base
+static SwapHeader swap_header(const FileStamp *base)
+{
+	static uint64_t started = 0;
+
+	if (started == 0)
+	{
+		started = process_start_id(getpid());
+	}
+
+	SwapHeader header = { SWAP_MAGIC, SWAP_VERSION, getpid(), started, *base };
+	return header;
+}
+
+// The whole swap file, NULL if there is none or it isn't one of ours
+static char *swap_read(const char *path, size_t *size)
+{
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+
+	if (fd < 0)
+	{
+		return NULL;
+	}
+
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SwapHeader))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	char *data = mem_alloc(MEM_UNDO, st.st_size);
+	size_t got = 0;
+
+	while (data != NULL && got < (size_t)st.st_size)
+	{
+		ssize_t n = pread(fd, data + got, st.st_size - got, got);
+
+		if (n <= 0)
+		{
+			break;
+		}
+
+		got += n;
+	}
+
+	close(fd);
+
+	if (data == NULL || got < sizeof(SwapHeader) || memcmp(data, SWAP_MAGIC, sizeof(SWAP_MAGIC)) != 0 ||
+	    ((SwapHeader *)data)->version != SWAP_VERSION)
+	{
+		mem_free(MEM_UNDO, data);
+		return NULL;
+	}
+
+	*size = got;
+	return data;
+}
+
+// Steps over the op at *offset. false at the end, or at an op cut short by
+// a crash in the middle of a write, where replay stops.
+static bool swap_next(const char *data, size_t size, size_t *offset, SwapOp *op)
+{
+	if (size - *offset < sizeof(SwapOp))
+	{
+		return false;
+	}
+
+	memcpy(op, data + *offset, sizeof(SwapOp));
+
+	size_t text = op->type == SWAP_INSERT ? op->length : 0;
+
+	if ((op->type != SWAP_INSERT && op->type != SWAP_DELETE) || size - *offset - sizeof(SwapOp) < text)
+	{
+		return false;
+	}
+
+	*offset += sizeof(SwapOp) + text;
+	return true;
+}
+
+// What is in the swap at path for the file as described by base. edits is
+// how many ops there are to replay, owner the session that wrote them.
+SwapState swap_check(const char *path, const FileStamp *base, size_t *edits, pid_t *owner)
+{
+	size_t size;
+	char *data = swap_read(path, &size);
+
+	*edits = 0;
+	*owner = 0;
+
+	if (data == NULL)
+	{
+		return SWAP_NONE;
+	}
+
+	SwapHeader header;
+	SwapOp op;
+	size_t offset = sizeof(SwapHeader);
+
+	memcpy(&header, data, sizeof(header));
+
+	while (swap_next(data, size, &offset, &op))
+	{
+		(*edits)++;
+	}
+
+	mem_free(MEM_UNDO, data);
+	*owner = header.pid;
+
+	// A live process with the PID may not be the one that wrote it, after a
+	// reboot or once the PID came round again. Unknown counts as the same.
+	if (header.pid != 0 && (pid_t)header.pid != getpid() && (kill(header.pid, 0) == 0 || errno == EPERM))
+	{
+		uint64_t started = header.started != 0 ? process_start_id(header.pid) : 0;
+
+		if (started == 0 || started == header.started)
+		{
+			return SWAP_IN_USE;
+		}
+	}
+
+	if (memcmp(&header.base, base, sizeof(FileStamp)) != 0)
+	{
+		return *edits > 0 ? SWAP_STALE : SWAP_NONE;
+	}
+
+	return *edits > 0 ? SWAP_RECOVERABLE : SWAP_NONE;
+}
+
+// Applies the edits in the swap to buffer, which has to hold the file the
+// swap was made for. They go into um as one undo step, so u takes the
+// whole recovery back. Returns how many were applied.
+size_t swap_replay(const char *path, GapBuffer *buffer, UndoManager *um)
+{
+	size_t size;
+	char *data = swap_read(path, &size);
+
+	if (data == NULL)
+	{
+		return 0;
+	}
+
+	size_t offset = sizeof(SwapHeader);
+	size_t applied = 0;
+	SwapOp op;
+
+	while (swap_next(data, size, &offset, &op))
+	{
+		size_t length = buffer_length(buffer);
+
+		if (op.position > length || (op.type == SWAP_DELETE && op.length > length - op.position))
+		{
+			break;
+		}
+
+		buffer_move_gap(buffer, op.position);
+
+		// With the gap at position, deleted text is in one piece after it
+		bool insert = op.type == SWAP_INSERT;
+		OpType type = insert ? OP_INSERT : OP_DELETE;
+		const char *text = insert ? data + offset - op.length : &buffer->data[buffer->gap_end];
+
+		if (applied == 0)
+		{
+			undo_push_operation(um, type, text, op.length, op.position);
+		}
+		else
+		{
+			undo_push_joined(um, type, text, op.length, op.position);
+		}
+
+		if (insert)
+		{
+			buffer_insert_text(buffer, text, op.length);
+		}
+		else
+		{
+			buffer_delete_range(buffer, op.position, op.length);
+		}
+
+		applied++;
+	}
+
+	mem_free(MEM_UNDO, data);
+	return applied;
+}
+
+static bool write_at(int fd, const char *data, size_t len, size_t offset)
+{
+	while (len > 0)
+	{
+		ssize_t written = pwrite(fd, data, len, offset);
+
+		if (written < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (written <= 0)
+		{
+			return false;
+		}
+
+		data += written;
+		len -= written;
+		offset += written;
+	}
+
+	return true;
+}
+
+// A new swap for base, or with resume the one at path after its edits were
+// replayed: the session carries on appending to it
+SwapFile *swap_open(const char *path, const FileStamp *base, bool resume)
+{
+	SwapFile *swap = mem_alloc(MEM_UNDO, sizeof(SwapFile));
+
+	if (swap == NULL)
+	{
+		return NULL;
+	}
+
+	memset(swap, 0, sizeof(SwapFile));
+	swap->path = mem_strdup(MEM_UNDO, path);
+	swap->fd = open(path, resume ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+	bool ok = swap->path != NULL && swap->fd >= 0;
+
+	if (ok && resume)
+	{
+		size_t size;
+		char *data = swap_read(path, &size);
+		size_t end = sizeof(SwapHeader);
+		SwapOp op;
+		SwapHeader header = swap_header(base);
+
+		// A torn op at the end goes, new ones are appended after the last whole one
+		while (data != NULL && swap_next(data, size, &end, &op))
+		{
+		}
+
+		ok = data != NULL && ftruncate(swap->fd, end) == 0 &&
+		     write_at(swap->fd, (char *)&header.pid, sizeof(header.pid), offsetof(SwapHeader, pid)) &&
+		     write_at(swap->fd, (char *)&header.started, sizeof(header.started), offsetof(SwapHeader, started));
+		swap->written = end;
+		mem_free(MEM_UNDO, data);
+	}
+	else if (ok)
+	{
+		SwapHeader header = swap_header(base);
+
+		ok = write_at(swap->fd, (char *)&header, sizeof(header), 0);
+		swap->written = sizeof(header);
+	}
+
+	if (!ok)
+	{
+		swap_close(swap, false);
+		return NULL;
+	}
+
+	return swap;
+}
+
+static bool swap_reserve(SwapFile *swap, size_t extra)
+{
+	if (swap->batch_capacity - swap->batch_used >= extra)
+	{
+		return true;
+	}
+
+	size_t capacity = swap->batch_capacity == 0 ? 4096 : swap->batch_capacity * 2;
+
+	while (capacity - swap->batch_used < extra)
+	{
+		capacity *= 2;
+	}
+
+	char *batch = mem_realloc(MEM_UNDO, swap->batch, capacity);
+
+	if (batch == NULL)
+	{
+		return false;
+	}
+
+	swap->batch = batch;
+	swap->batch_capacity = capacity;
+	return true;
+}
+
+// Without memory or disk the swap stops where it is: what's in it is
+// still a prefix of the session's edits, so it recovers to an earlier state
+static void swap_stop(SwapFile *swap)
+{
+	if (swap->fd >= 0)
+	{
+		close(swap->fd);
+		swap->fd = -1;
+	}
+
+	swap->batch_used = 0;
+}
+
+// The buffer's edit hook. Only copies into the batch; typing at the end of
+// the last insert, or backspacing/deleting against the last delete, grows
+// that op instead of adding one.
+void swap_record(void *data, bool insert, size_t pos, const char *text, size_t len)
+{
+	SwapFile *swap = data;
+	SwapOp op;
+
+	if (swap->fd < 0)
+	{
+		return;
+	}
+
+	if (swap->can_extend)
+	{
+		memcpy(&op, swap->batch + swap->last_op, sizeof(op));
+
+		bool extends = insert ? op.type == SWAP_INSERT && pos == op.position + op.length
+		                      : op.type == SWAP_DELETE && (pos + len == op.position || pos == op.position);
+
+		if (extends)
+		{
+			if (insert)
+			{
+				if (!swap_reserve(swap, len))
+				{
+					swap_stop(swap);
+					return;
+				}
+
+				memcpy(swap->batch + swap->batch_used, text, len);
+				swap->batch_used += len;
+			}
+
+			op.position = insert ? op.position : pos;
+			op.length += len;
+			memcpy(swap->batch + swap->last_op, &op, sizeof(op));
+			return;
+		}
+	}
+
+	if (!swap_reserve(swap, sizeof(SwapOp) + (insert ? len : 0)))
+	{
+		swap_stop(swap);
+		return;
+	}
+
+	if (swap->batch_used == 0)
+	{
+		swap->pending_since = monotonic_ms();
+	}
+
+	op.type = insert ? SWAP_INSERT : SWAP_DELETE;
+	op.unused = 0;
+	op.position = pos;
+	op.length = len;
+
+	swap->last_op = swap->batch_used;
+	memcpy(swap->batch + swap->batch_used, &op, sizeof(op));
+	swap->batch_used += sizeof(op);
+
+	if (insert)
+	{
+		memcpy(swap->batch + swap->batch_used, text, len);
+		swap->batch_used += len;
+	}
+
+	swap->can_extend = true;
+}
+
+bool swap_pending(SwapFile *swap)
+{
+	return swap->fd >= 0 && swap->batch_used > 0;
+}
+
+// Everything batched goes out in one write
+void swap_flush(SwapFile *swap)
+{
+	if (!swap_pending(swap))
+	{
+		return;
+	}
+
+	if (!write_at(swap->fd, swap->batch, swap->batch_used, swap->written))
+	{
+		swap_stop(swap);
+		return;
+	}
+
+	swap->written += swap->batch_used;
+	swap->batch_used = 0;
+	swap->can_extend = false;
+}
+
+// Where the edits made so far end. A save remembers it when it takes its
+// snapshot; later edits start a new op so they can be told apart.
+size_t swap_mark(SwapFile *swap)
+{
+	swap->can_extend = false;
+
+	return swap->written + swap->batch_used;
+}
+
+// The file was saved with every edit up to mark in it, now as base: only
+// the edits after mark are kept. They go to a new swap renamed over the
+// old one, a crash halfway leaves one or the other.
+void swap_rebase(SwapFile *swap, size_t mark, const FileStamp *base)
+{
+	swap_flush(swap);
+
+	if (swap->fd < 0 || mark < sizeof(SwapHeader) || mark > swap->written)
+	{
+		return;
+	}
+
+	char tmp_path[4096];
+	size_t tail = swap->written - mark;
+	char *edits = mem_alloc(MEM_UNDO, tail + 1);
+	SwapHeader header = swap_header(base);
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.new", swap->path);
+
+	int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	bool ok = edits != NULL && fd >= 0 && pread(swap->fd, edits, tail, mark) == (ssize_t)tail &&
+	          write_at(fd, (char *)&header, sizeof(header), 0) &&
+	          write_at(fd, edits, tail, sizeof(header)) &&
+	          rename(tmp_path, swap->path) == 0;
+
+	mem_free(MEM_UNDO, edits);
+
+	if (!ok)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+			unlink(tmp_path);
+		}
+
+		swap_stop(swap);
+		return;
+	}
+
+	close(swap->fd);
+	swap->fd = fd;
+	swap->written = sizeof(header) + tail;
+}
+
+// remove on a clean exit: nothing left to recover
+void swap_close(SwapFile *swap, bool remove)
+{
+	if (swap == NULL)
+	{
+		return;
+	}
+
+	if (remove && swap->path != NULL)
+	{
+		unlink(swap->path);
+	}
+	else
+	{
+		swap_flush(swap);
+	}
+
+	if (swap->fd >= 0)
+	{
+		close(swap->fd);
+	}
+
+	mem_free(MEM_UNDO, swap->batch);
+	mem_free(MEM_UNDO, swap->path);
+	mem_free(MEM_UNDO, swap);
+}
@@ -0,0 +1,55 @@
+#ifndef SWAP_H
+#define SWAP_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "buffer.h"
+#include "undo.h"
+#include "file_io.h"
+
+// Crash recovery. Every edit made since the file was opened or last saved
+// is appended to a swap file in ~/.cache/vesper/swap: what was inserted
+// where, and how much was deleted where. A session that dies leaves the
+// swap behind and the next one to open the file can replay it.
+
+typedef enum
+{
+	SWAP_NONE,          // Nothing to recover
+	SWAP_RECOVERABLE,   // Edits from a session that is gone, for the file as it is
+	SWAP_STALE,         // Edits for a version of the file that isn't there any more
+	SWAP_IN_USE         // A live session is editing the file right now
+
+} SwapState;
+
+typedef struct
+{
+	int fd;               // -1 once a write failed, the session goes on without
+	char *path;
+	size_t written;       // Bytes in the file
+
+	// Edits not written yet. Typing and backspacing grow the last op
+	// instead of adding one per key.
+	char *batch;
+	size_t batch_used;
+	size_t batch_capacity;
+	size_t last_op;       // Offset of the last op in batch
+	bool can_extend;      // It's still in batch and nothing sealed it
+	long long pending_since;
+
+} SwapFile;
+
+bool swap_path(const char *filename, char *out, size_t out_len);
+SwapState swap_check(const char *path, const FileStamp *base, size_t *edits, pid_t *owner);
+size_t swap_replay(const char *path, GapBuffer *buffer, UndoManager *um);
+
+SwapFile *swap_open(const char *path, const FileStamp *base, bool resume);
+void swap_record(void *data, bool insert, size_t pos, const char *text, size_t len);
+bool swap_pending(SwapFile *swap);
+void swap_flush(SwapFile *swap);
+size_t swap_mark(SwapFile *swap);
+void swap_rebase(SwapFile *swap, size_t mark, const FileStamp *base);
+void swap_close(SwapFile *swap, bool remove);
+
+#endif
@@ -4,6 +4,7 @@
 #include <signal.h>
 #include <stdio.h> 
 #include <stdlib.h>
+#include "terminal.h"
 
 struct termios original_termios;
 
@@ -27,11 +28,15 @@ void enableRawMode()
 	// Apply the modified settings to the terminal
 	tcsetattr(STDIN_FILENO, TCSAFLUSH, &new_termios);
 
+	// Ask the terminal to wrap pastes in ESC [ 200 ~ ... ESC [ 201 ~
+	write(STDOUT_FILENO, "\x1b[?2004h", 8);
+
 }
 
 void disableRawMode() 
 { 
 	// restore terminal in this function
+	write(STDOUT_FILENO, "\x1b[?2004l", 8);
 	tcsetattr(STDIN_FILENO, TCSAFLUSH, &original_termios);
 }
 
@@ -0,0 +1,391 @@
+#include <string.h>
+#include <stdint.h>
+#include "text_format.h"
+
+// The same eight-bytes-at-a-time test as buffer_count_newlines: nonzero if
+// any byte of word is c
+static inline uint64_t word_has(uint64_t word, unsigned char c)
+{
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+
+	word ^= ones * c;
+
+	return ~(((word & low7) + low7) | word | low7);
+}
+
+// The BOM says the encoding. Without one it's taken as UTF-8, which plain
+// ASCII and most files are. CRLF if the sample has line breaks and every
+// one of them is CRLF, so a file with a stray \r stays LF.
+TextFormat text_detect(const char *head, size_t len)
+{
+	const unsigned char *bytes = (const unsigned char *)head;
+	TextFormat format = { ENCODING_UTF8, LINE_ENDING_LF };
+
+	if (len >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF)
+	{
+		format.encoding = ENCODING_UTF8_BOM;
+	}
+	else if (len >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE)
+	{
+		format.encoding = ENCODING_UTF16LE;
+	}
+	else if (len >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF)
+	{
+		format.encoding = ENCODING_UTF16BE;
+	}
+
+	size_t start = text_bom_length(format.encoding);
+	size_t unit = format.encoding == ENCODING_UTF16LE || format.encoding == ENCODING_UTF16BE ? 2 : 1;
+	size_t low = format.encoding == ENCODING_UTF16BE ? 1 : 0;   // The byte holding an ASCII char
+	size_t line_breaks = 0;
+	size_t crlf = 0;
+
+	for (size_t i = start; i + unit <= len; i += unit)
+	{
+		// In UTF-16 the other byte of a \n unit is zero
+		if (bytes[i + low] != '\n' || (unit == 2 && bytes[i + 1 - low] != 0))
+		{
+			continue;
+		}
+
+		line_breaks++;
+
+		if (i >= start + unit && bytes[i - unit + low] == '\r' && (unit == 1 || bytes[i - unit + 1 - low] == 0))
+		{
+			crlf++;
+		}
+	}
+
+	if (line_breaks > 0 && crlf == line_breaks)
+	{
+		format.line_ending = LINE_ENDING_CRLF;
+	}
+
+	return format;
+}
+
+// What the buffer holds already, nothing to convert either way
+bool text_format_plain(const TextFormat *format)
+{
+	return format->encoding == ENCODING_UTF8 && format->line_ending == LINE_ENDING_LF;
+}
+
+size_t text_bom_length(TextEncoding encoding)
+{
+	return encoding == ENCODING_UTF8_BOM ? 3 : encoding == ENCODING_UTF8 ? 0 : 2;
+}
+
+size_t text_write_bom(TextEncoding encoding, char *dest)
+{
+	static const char *boms[] = { "", "\xEF\xBB\xBF", "\xFF\xFE", "\xFE\xFF" };
+	size_t len = text_bom_length(encoding);
+
+	memcpy(dest, boms[encoding], len);
+	return len;
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// The bytes of word without those whose high bit is set in drop, packed
+// down into the low end. Returns how many are left.
+static inline size_t pack_word(uint64_t word, uint64_t drop, uint64_t *packed)
+{
+	uint64_t kept = 0;
+	size_t filled = 0;
+	size_t from = 0;
+
+	while (drop != 0)
+	{
+		size_t at = __builtin_ctzll(drop) / 8;
+
+		kept |= ((word >> (from * 8)) & ((1ULL << ((at - from) * 8)) - 1)) << (filled * 8);
+		filled += at - from;
+		from = at + 1;
+		drop &= drop - 1;
+	}
+
+	if (from < 8)
+	{
+		kept |= (word >> (from * 8)) << (filled * 8);
+		filled += 8 - from;
+	}
+
+	*packed = kept;
+	return filled;
+}
+#endif
+
+// Copies src to dest without the \r of each \r\n. dest may be src, or
+// anywhere before it: nothing is written past what has been read. On
+// little-endian machines every word goes across eight bytes at a time,
+// packed in a register when it has a \r\n; elsewhere only words without a
+// \r do. A \r at a word's end looks at the first byte of the next. A \r at
+// the very end is kept, the caller holds it back if a \n may follow.
+size_t text_crlf_to_lf(char *dest, const char *src, size_t len)
+{
+	size_t in = 0;
+	size_t out = 0;
+
+	while (in < len)
+	{
+		if (in + 8 <= len)
+		{
+			uint64_t word;
+
+			memcpy(&word, src + in, 8);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			// Each byte's \n bit moved down onto the byte before it, so a
+			// \r to drop has its bit set in both
+			uint64_t lf = word_has(word, '\n') >> 8;
+
+			if (in + 8 < len && src[in + 8] == '\n')
+			{
+				lf |= 0x80ULL << 56;
+			}
+
+			uint64_t drop = word_has(word, '\r') & lf;
+			uint64_t packed;
+			size_t kept;
+
+			if ((drop & (drop - 1)) == 0)
+			{
+				// None or one, by far the usual: no branch on which, a
+				// mispredicted one per line would cost more than the copy
+				uint64_t below = drop != 0 ? (1ULL << (__builtin_ctzll(drop) - 7)) - 1 : ~0ULL;
+
+				packed = (word & below) | ((word >> 8) & ~below);
+				kept = 8 - (drop != 0);
+			}
+			else
+			{
+				kept = pack_word(word, drop, &packed);
+			}
+
+			memcpy(dest + out, &packed, 8);
+			in += 8;
+			out += kept;
+			continue;
+#else
+			while (src[in] != '\r')
+			{
+				dest[out++] = src[in++];
+			}
+#endif
+		}
+
+		if (src[in] == '\r' && in + 1 < len && src[in + 1] == '\n')
+		{
+			in++;
+		}
+
+		dest[out++] = src[in++];
+	}
+
+	return out;
+}
+
+// Copies src to dest with a \r before every \n. dest holds up to twice
+// len and can't overlap src.
+size_t text_lf_to_crlf(char *dest, const char *src, size_t len)
+{
+	size_t in = 0;
+	size_t out = 0;
+
+	while (in < len)
+	{
+		if (in + 8 <= len)
+		{
+			uint64_t word;
+
+			memcpy(&word, src + in, 8);
+
+			if (word_has(word, '\n') == 0)
+			{
+				memcpy(dest + out, &word, 8);
+				in += 8;
+				out += 8;
+				continue;
+			}
+
+			while (src[in] != '\n')
+			{
+				dest[out++] = src[in++];
+			}
+		}
+
+		if (src[in] == '\n')
+		{
+			dest[out++] = '\r';
+		}
+
+		dest[out++] = src[in++];
+	}
+
+	return out;
+}
+
+static size_t put_utf8(char *dest, uint32_t code)
+{
+	if (code < 0x80)
+	{
+		dest[0] = code;
+		return 1;
+	}
+
+	if (code < 0x800)
+	{
+		dest[0] = 0xC0 | (code >> 6);
+		dest[1] = 0x80 | (code & 0x3F);
+		return 2;
+	}
+
+	if (code < 0x10000)
+	{
+		dest[0] = 0xE0 | (code >> 12);
+		dest[1] = 0x80 | ((code >> 6) & 0x3F);
+		dest[2] = 0x80 | (code & 0x3F);
+		return 3;
+	}
+
+	dest[0] = 0xF0 | (code >> 18);
+	dest[1] = 0x80 | ((code >> 12) & 0x3F);
+	dest[2] = 0x80 | ((code >> 6) & 0x3F);
+	dest[3] = 0x80 | (code & 0x3F);
+	return 4;
+}
+
+static size_t put_utf16(char *dest, uint32_t code, bool big_endian)
+{
+	uint16_t units[2];
+	size_t count = 1;
+
+	if (code >= 0x10000)
+	{
+		code -= 0x10000;
+		units[0] = 0xD800 | (code >> 10);
+		units[1] = 0xDC00 | (code & 0x3FF);
+		count = 2;
+	}
+	else
+	{
+		units[0] = code;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		dest[i * 2 + (big_endian ? 1 : 0)] = units[i] & 0xFF;
+		dest[i * 2 + (big_endian ? 0 : 1)] = units[i] >> 8;
+	}
+
+	return count * 2;
+}
+
+// UTF-16 without its BOM into UTF-8, which is at most half as long again.
+// A lone surrogate, or an odd byte at the end, becomes U+FFFD.
+size_t text_utf16_to_utf8(char *dest, const char *src, size_t len, bool big_endian)
+{
+	const unsigned char *bytes = (const unsigned char *)src;
+	size_t hi = big_endian ? 0 : 1;
+	size_t out = 0;
+	size_t i = 0;
+
+	for (; i + 2 <= len; i += 2)
+	{
+		uint32_t code = bytes[i + hi] << 8 | bytes[i + 1 - hi];
+
+		if (code >= 0xD800 && code < 0xDC00 && i + 4 <= len)
+		{
+			uint32_t low = bytes[i + 2 + hi] << 8 | bytes[i + 3 - hi];
+
+			if (low >= 0xDC00 && low < 0xE000)
+			{
+				code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				i += 2;
+			}
+		}
+
+		if (code >= 0xD800 && code < 0xE000)
+		{
+			code = 0xFFFD;
+		}
+
+		out += put_utf8(dest + out, code);
+	}
+
+	if (i < len)
+	{
+		out += put_utf8(dest + out, 0xFFFD);
+	}
+
+	return out;
+}
+
+// Buffer text into the file's format, a chunk at a time, without the BOM.
+// dest holds up to four times len. A UTF-8 sequence cut off at the end of
+// src is left for the next chunk unless last; *used says how much of src
+// went. Bytes that aren't valid UTF-8 become U+FFFD in UTF-16.
+size_t text_encode(const TextFormat *format, const char *src, size_t len, bool last, char *dest, size_t *used)
+{
+	if (format->encoding == ENCODING_UTF8 || format->encoding == ENCODING_UTF8_BOM)
+	{
+		*used = len;
+
+		if (format->line_ending == LINE_ENDING_CRLF)
+		{
+			return text_lf_to_crlf(dest, src, len);
+		}
+
+		memcpy(dest, src, len);
+		return len;
+	}
+
+	const unsigned char *bytes = (const unsigned char *)src;
+	bool big_endian = format->encoding == ENCODING_UTF16BE;
+	bool crlf = format->line_ending == LINE_ENDING_CRLF;
+	size_t out = 0;
+	size_t i = 0;
+
+	while (i < len)
+	{
+		uint32_t code = bytes[i];
+		size_t n = 1;
+
+		if (code >= 0x80)
+		{
+			n = code >= 0xF8 ? 1 : code >= 0xF0 ? 4 : code >= 0xE0 ? 3 : code >= 0xC0 ? 2 : 1;
+
+			if (i + n > len && !last)
+			{
+				break;
+			}
+
+			static const uint32_t lead_bits[] = { 0, 0, 0x1F, 0x0F, 0x07 };
+			bool valid = n > 1 && i + n <= len;
+
+			code &= lead_bits[n];
+
+			for (size_t k = 1; valid && k < n; k++)
+			{
+				valid = (bytes[i + k] & 0xC0) == 0x80;
+				code = code << 6 | (bytes[i + k] & 0x3F);
+			}
+
+			if (!valid || code > 0x10FFFF || (code >= 0xD800 && code < 0xE000))
+			{
+				code = 0xFFFD;
+				n = 1;
+			}
+		}
+		else if (code == '\n' && crlf)
+		{
+			out += put_utf16(dest + out, '\r', big_endian);
+		}
+
+		out += put_utf16(dest + out, code, big_endian);
+		i += n;
+	}
+
+	*used = i;
+	return out;
+}
@@ -0,0 +1,47 @@
+#ifndef TEXT_FORMAT_H
+#define TEXT_FORMAT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// How a file's text is stored on disk. The buffer always holds UTF-8 with
+// \n line endings; the file's own format is turned into that on load and
+// back on save, so a CRLF or UTF-16 file is saved the way it came.
+
+typedef enum
+{
+	ENCODING_UTF8,
+	ENCODING_UTF8_BOM,    // With EF BB BF in front
+	ENCODING_UTF16LE,     // Always with a BOM, that's how it's recognized
+	ENCODING_UTF16BE
+
+} TextEncoding;
+
+typedef enum
+{
+	LINE_ENDING_LF,
+	LINE_ENDING_CRLF
+
+} LineEnding;
+
+typedef struct
+{
+	TextEncoding encoding;
+	LineEnding line_ending;
+
+} TextFormat;
+
+// How much of the start of a file text_detect wants to see
+#define TEXT_DETECT_BYTES 8192
+
+TextFormat text_detect(const char *head, size_t len);
+bool text_format_plain(const TextFormat *format);
+size_t text_bom_length(TextEncoding encoding);
+size_t text_write_bom(TextEncoding encoding, char *dest);
+
+size_t text_crlf_to_lf(char *dest, const char *src, size_t len);
+size_t text_lf_to_crlf(char *dest, const char *src, size_t len);
+size_t text_utf16_to_utf8(char *dest, const char *src, size_t len, bool big_endian);
+size_t text_encode(const TextFormat *format, const char *src, size_t len, bool last, char *dest, size_t *used);
+
+#endif
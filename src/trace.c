@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "trace.h"
+#include "utils.h"
+
+#ifdef VESPER_TRACE
+
+typedef struct
+{
+	const char *name;
+	long long ts_ns;
+	int tid;
+	char phase;
+
+} TraceEvent;
+
+// One per thread, only its owner writes. head counts every event ever
+// written, the dump reads the last TRACE_RING_SIZE of them.
+typedef struct TraceRing
+{
+	TraceEvent events[TRACE_RING_SIZE];
+	atomic_size_t head;
+	size_t start;           // head when the current trace started
+	int tid;
+	const char *thread_name;
+	struct TraceRing *next;
+	struct TraceRing *next_free;
+
+} TraceRing;
+
+static atomic_bool tracing = false;
+static long long trace_origin_ns = 0;
+
+// Rings are only added or recycled when a thread first traces or exits
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceRing *all_rings = NULL;
+static TraceRing *free_rings = NULL;
+static int next_tid = 1;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static __thread TraceRing *local_ring = NULL;
+static __thread int local_tid = 0;
+static __thread const char *local_thread_name = NULL;
+
+static void ring_release(void *data)
+{
+	TraceRing *ring = data;
+
+	// Keep its events for the dump, a later thread can take over the memory
+	pthread_mutex_lock(&rings_lock);
+	ring->next_free = free_rings;
+	free_rings = ring;
+	pthread_mutex_unlock(&rings_lock);
+}
+
+static void ring_key_create(void)
+{
+	pthread_key_create(&ring_key, ring_release);
+}
+
+static TraceRing *ring_for_thread(void)
+{
+	if (local_ring != NULL)
+	{
+		return local_ring;
+	}
+
+	pthread_once(&ring_key_once, ring_key_create);
+	pthread_mutex_lock(&rings_lock);
+
+	TraceRing *ring = free_rings;
+
+	if (ring != NULL)
+	{
+		free_rings = ring->next_free;
+	}
+	else
+	{
+		ring = calloc(1, sizeof(TraceRing));
+
+		if (ring != NULL)
+		{
+			ring->next = all_rings;
+			all_rings = ring;
+		}
+	}
+
+	if (ring != NULL)
+	{
+		local_tid = next_tid++;
+		ring->tid = local_tid;
+		ring->thread_name = local_thread_name;
+	}
+
+	pthread_mutex_unlock(&rings_lock);
+
+	if (ring != NULL)
+	{
+		pthread_setspecific(ring_key, ring);
+		local_ring = ring;
+	}
+
+	return ring;
+}
+
+bool trace_compiled_in(void)
+{
+	return true;
+}
+
+bool trace_active(void)
+{
+	return atomic_load_explicit(&tracing, memory_order_relaxed);
+}
+
+void trace_start(void)
+{
+	pthread_mutex_lock(&rings_lock);
+
+	for (TraceRing *ring = all_rings; ring != NULL; ring = ring->next)
+	{
+		ring->start = atomic_load_explicit(&ring->head, memory_order_acquire);
+	}
+
+	trace_origin_ns = monotonic_ns();
+	pthread_mutex_unlock(&rings_lock);
+
+	atomic_store_explicit(&tracing, true, memory_order_release);
+}
+
+void trace_event(const char *name, char phase)
+{
+	if (!atomic_load_explicit(&tracing, memory_order_relaxed))
+	{
+		return;
+	}
+
+	TraceRing *ring = ring_for_thread();
+
+	if (ring == NULL)
+	{
+		return;
+	}
+
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	TraceEvent *event = &ring->events[head % TRACE_RING_SIZE];
+
+	event->name = name;
+	event->ts_ns = monotonic_ns();
+	event->tid = local_tid;
+	event->phase = phase;
+
+	// Publishes the event to the dump
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Applied when the thread first records an event, so naming costs nothing
+void trace_set_thread_name(const char *name)
+{
+	local_thread_name = name;
+
+	if (local_ring != NULL)
+	{
+		local_ring->thread_name = name;
+	}
+}
+
+static void write_json_string(FILE *fp, const char *text)
+{
+	fputc('"', fp);
+
+	for (const char *p = text; *p != '\0'; p++)
+	{
+		if (*p == '"' || *p == '\\')
+		{
+			fputc('\\', fp);
+		}
+		fputc(*p, fp);
+	}
+
+	fputc('"', fp);
+}
+
+// Stops tracing and writes everything recorded since trace_start to path
+int trace_stop(const char *path)
+{
+	atomic_store_explicit(&tracing, false, memory_order_release);
+
+	FILE *fp = fopen(path, "w");
+
+	if (fp == NULL)
+	{
+		return -1;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+	bool first = true;
+
+	pthread_mutex_lock(&rings_lock);
+
+	for (TraceRing *ring = all_rings; ring != NULL; ring = ring->next)
+	{
+		size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		size_t from = ring->start;
+
+		// The ring wrapped, only the newest events are still there
+		if (head - from > TRACE_RING_SIZE)
+		{
+			from = head - TRACE_RING_SIZE;
+		}
+
+		if (ring->thread_name != NULL)
+		{
+			fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",\n", ring->tid);
+			write_json_string(fp, ring->thread_name);
+			fprintf(fp, "}}");
+			first = false;
+		}
+
+		for (size_t i = from; i < head; i++)
+		{
+			TraceEvent *event = &ring->events[i % TRACE_RING_SIZE];
+			long long ts_ns = event->ts_ns - trace_origin_ns;
+
+			fprintf(fp, "%s{\"name\":", first ? "" : ",\n");
+			write_json_string(fp, event->name);
+			fprintf(fp, ",\"ph\":\"%c\",\"ts\":%lld.%03lld,\"pid\":1,\"tid\":%d}",
+				event->phase, ts_ns / 1000, ts_ns % 1000, event->tid);
+			first = false;
+		}
+
+		ring->start = head;
+	}
+
+	pthread_mutex_unlock(&rings_lock);
+
+	fprintf(fp, "\n]}\n");
+
+	return fclose(fp) == 0 ? 0 : -1;
+}
+
+#else
+
+bool trace_compiled_in(void)
+{
+	return false;
+}
+
+bool trace_active(void)
+{
+	return false;
+}
+
+void trace_start(void)
+{
+}
+
+int trace_stop(const char *path)
+{
+	(void)path;
+	return -1;
+}
+
+void trace_event(const char *name, char phase)
+{
+	(void)name;
+	(void)phase;
+}
+
+void trace_set_thread_name(const char *name)
+{
+	(void)name;
+}
+
+#endif
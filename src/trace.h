@@ -0,0 +1,30 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+// Begin/end events for Chrome's trace_event format (open the file in
+// Perfetto or chrome://tracing). Build with TRACE=1 (-DVESPER_TRACE) to
+// compile the probes in; otherwise TRACE_BEGIN/TRACE_END expand to nothing.
+// Names must be string literals, only the pointer is stored.
+
+#define TRACE_RING_SIZE 16384   // Events kept per thread, oldest are overwritten
+
+#ifdef VESPER_TRACE
+#define TRACE_BEGIN(name) trace_event((name), 'B')
+#define TRACE_END(name) trace_event((name), 'E')
+#define TRACE_THREAD_NAME(name) trace_set_thread_name(name)
+#else
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#endif
+
+bool trace_compiled_in(void);
+bool trace_active(void);
+void trace_start(void);
+int trace_stop(const char *path);
+void trace_event(const char *name, char phase);
+void trace_set_thread_name(const char *name);
+
+#endif
@@ -0,0 +1,784 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "undo.h"
+#include "undo_journal.h"
+#include "alloc.h"
+
+#define UNDO_LOG_INITIAL 4096
+#define UNDO_RECORD_SPLIT (64 * 1024)
+
+UndoManager *undo_manager_create()
+{
+	UndoManager *um = mem_alloc(MEM_UNDO, sizeof(UndoManager));
+
+	if (um == NULL)
+	{
+		return NULL;
+	}
+
+	memset(um, 0, sizeof(UndoManager));
+	um->journal_fd = -1;
+
+	// redo_child always has a slot for the original text
+	um->redo_child = mem_alloc(MEM_UNDO, sizeof(size_t));
+
+	if (um->redo_child == NULL)
+	{
+		mem_free(MEM_UNDO, um);
+		return NULL;
+	}
+
+	um->redo_child[0] = 0;
+
+	return um;
+}
+
+void undo_manager_free(UndoManager *um)
+{
+	if (um == NULL)
+	{
+		return;
+	}
+
+	undo_journal_close(um);
+
+	mem_free(MEM_UNDO, um->log);
+	mem_free(MEM_UNDO, um->records);
+	mem_free(MEM_UNDO, um->redo_child);
+	mem_free(MEM_UNDO, um);
+}
+
+UndoRecord *undo_record(UndoManager *um, size_t node)
+{
+	size_t offset = um->records[node - 1];
+
+	if (offset < um->map_size)
+	{
+		return (UndoRecord *)(um->map + offset);
+	}
+
+	return (UndoRecord *)(um->log + offset - um->map_size);
+}
+
+char *undo_record_text(UndoRecord *record)
+{
+	return (char *)(record + 1);
+}
+
+// Tree accessors that also answer for node 0, the original text
+static size_t node_parent(UndoManager *um, size_t node)
+{
+	return node == 0 ? 0 : undo_record(um, node)->parent;
+}
+
+static size_t node_depth(UndoManager *um, size_t node)
+{
+	return node == 0 ? 0 : undo_record(um, node)->depth;
+}
+
+static size_t node_jump(UndoManager *um, size_t node)
+{
+	return node == 0 ? 0 : undo_record(um, node)->jump;
+}
+
+static size_t *node_child(UndoManager *um, size_t node)
+{
+	return &um->redo_child[node];
+}
+
+// Makes room for `extra` more bytes at the end of the log
+static bool log_reserve(UndoManager *um, size_t extra)
+{
+	if (um->log_used + extra <= um->log_capacity)
+	{
+		return true;
+	}
+
+	size_t new_capacity = um->log_capacity == 0 ? UNDO_LOG_INITIAL : um->log_capacity * 2;
+
+	while (new_capacity < um->log_used + extra)
+	{
+		new_capacity *= 2;
+	}
+
+	char *new_log = mem_realloc(MEM_UNDO, um->log, new_capacity);
+
+	if (new_log == NULL)
+	{
+		return false;
+	}
+
+	um->log = new_log;
+	um->log_capacity = new_capacity;
+
+	return true;
+}
+
+// Skip pointer for a new child of parent. Skew-binary: equal-sized hops
+// double up, so any ancestor is reached in O(log depth) steps.
+static size_t jump_for_child(UndoManager *um, size_t parent)
+{
+	size_t jump = node_jump(um, parent);
+
+	if (parent != 0 && node_depth(um, parent) - node_depth(um, jump) == node_depth(um, jump) - node_depth(um, node_jump(um, jump)))
+	{
+		return node_jump(um, jump);
+	}
+
+	return parent;
+}
+
+// Indexes the complete record at offset as the next node and makes it the
+// branch redo follows from its parent. The journal uses this for records it
+// maps in, log_append for new ones.
+bool undo_add_node(UndoManager *um, size_t offset)
+{
+	if (um->record_count == um->record_capacity)
+	{
+		size_t new_capacity = um->record_capacity == 0 ? 64 : um->record_capacity * 2;
+		size_t *new_records = mem_realloc(MEM_UNDO, um->records, sizeof(size_t) * new_capacity);
+
+		if (new_records == NULL)
+		{
+			return false;
+		}
+
+		um->records = new_records;
+
+		size_t *new_children = mem_realloc(MEM_UNDO, um->redo_child, sizeof(size_t) * (new_capacity + 1));
+
+		if (new_children == NULL)
+		{
+			return false;
+		}
+
+		um->redo_child = new_children;
+		um->record_capacity = new_capacity;
+	}
+
+	um->records[um->record_count++] = offset;
+	um->redo_child[um->record_count] = 0;
+
+	size_t *child = node_child(um, undo_record(um, um->record_count)->parent);
+
+	um->insert_prev_child = *child;
+	*child = um->record_count;
+
+	return true;
+}
+
+// Appends a record as a new child of the current state and moves there.
+// Older branches stay in the log, reachable with undo_goto.
+static UndoRecord *log_append(UndoManager *um, OpType type, size_t len, size_t pos)
+{
+	size_t offset = UNDO_ALIGN(um->log_used);
+
+	if (!log_reserve(um, offset - um->log_used + sizeof(UndoRecord) + len))
+	{
+		return NULL;
+	}
+
+	UndoRecord *record = (UndoRecord *)(um->log + offset);
+
+	// Padding included, the header goes to the journal byte for byte
+	memset(record, 0, sizeof(UndoRecord));
+	record->type = type;
+	record->length = len;
+	record->position = pos;
+	record->parent = um->current;
+	record->depth = node_depth(um, um->current) + 1;
+	record->jump = jump_for_child(um, um->current);
+	record->time = (long long)time(NULL);
+
+	if (!undo_add_node(um, um->map_size + offset))
+	{
+		return NULL;
+	}
+
+	um->log_used = offset + sizeof(UndoRecord) + len;
+	um->current = um->record_count;
+
+	return record;
+}
+
+// What the history costs: records in the log or the journal map, plus
+// the per-node index
+size_t undo_history_bytes(UndoManager *um)
+{
+	return um->map_size + um->log_used + um->record_count * 2 * sizeof(size_t);
+}
+
+static size_t node_bytes(UndoManager *um, size_t node)
+{
+	return UNDO_ALIGN(sizeof(UndoRecord) + undo_record(um, node)->length) + 2 * sizeof(size_t);
+}
+
+// Size an open record is closed at. It can't be dropped while it's still
+// growing, so a quarter of the budget is kept free for it.
+static size_t record_limit(UndoManager *um)
+{
+	if (um->budget != 0 && um->budget / 4 < UNDO_RECORD_SPLIT)
+	{
+		return um->budget / 4;
+	}
+
+	return UNDO_RECORD_SPLIT;
+}
+
+#define UNDO_DROPPED ((size_t)-1)
+
+// Over budget, counting room for the next open record: a state on the way
+// up from the current one becomes the new original text, a checkpoint, and
+// everything not below it goes. The checkpoint is the oldest state whose
+// descendants fit in half the budget, so this runs at most once per quarter
+// budget of new edits. Survivors are copied into a new log and keep their
+// order under new numbers.
+static void undo_compact(UndoManager *um)
+{
+	size_t room = UNDO_ALIGN(sizeof(UndoRecord) + record_limit(um)) + 2 * sizeof(size_t);
+
+	if (um->budget == 0 || undo_history_bytes(um) + room <= um->budget)
+	{
+		return;
+	}
+
+	size_t count = um->record_count;
+	size_t *subtree = mem_alloc(MEM_UNDO, sizeof(size_t) * (count + 1));
+
+	if (subtree == NULL)
+	{
+		return;
+	}
+
+	// Children always come after their parent, so one pass backwards sums
+	// every subtree
+	memset(subtree, 0, sizeof(size_t) * (count + 1));
+
+	for (size_t n = count; n > 0; n--)
+	{
+		subtree[n] += node_bytes(um, n);
+		subtree[node_parent(um, n)] += subtree[n];
+	}
+
+	size_t root = um->current;
+
+	while (root != 0)
+	{
+		size_t parent = node_parent(um, root);
+		size_t below = subtree[parent] - (parent == 0 ? 0 : node_bytes(um, parent));
+
+		if (below > um->budget / 2)
+		{
+			break;
+		}
+
+		root = parent;
+	}
+
+	if (root == 0)
+	{
+		mem_free(MEM_UNDO, subtree);
+		return;
+	}
+
+	// Reuse the array for the new numbering
+	size_t *new_id = subtree;
+	size_t kept = 0;
+	size_t kept_bytes = 0;
+
+	for (size_t n = 1; n <= count; n++)
+	{
+		if (n == root)
+		{
+			new_id[n] = 0;
+		}
+		else if (n < root || new_id[node_parent(um, n)] == UNDO_DROPPED)
+		{
+			new_id[n] = UNDO_DROPPED;
+		}
+		else
+		{
+			new_id[n] = ++kept;
+			kept_bytes = UNDO_ALIGN(kept_bytes) + sizeof(UndoRecord) + undo_record(um, n)->length;
+		}
+	}
+
+	size_t capacity = kept_bytes < UNDO_LOG_INITIAL ? UNDO_LOG_INITIAL : kept_bytes * 2;
+	char *new_log = mem_alloc(MEM_UNDO, capacity);
+
+	if (new_log == NULL)
+	{
+		mem_free(MEM_UNDO, subtree);
+		return;
+	}
+
+	size_t root_depth = node_depth(um, root);
+	size_t used = 0;
+
+	// New ids never pass the old ones, so records and redo_child are
+	// rewritten in place, reading ahead of the writes
+	um->redo_child[0] = um->redo_child[root] == 0 ? 0 : new_id[um->redo_child[root]];
+
+	for (size_t n = root + 1; n <= count; n++)
+	{
+		if (new_id[n] == UNDO_DROPPED)
+		{
+			continue;
+		}
+
+		UndoRecord *old = undo_record(um, n);
+		size_t offset = UNDO_ALIGN(used);
+		UndoRecord *record = (UndoRecord *)(new_log + offset);
+		size_t child = um->redo_child[n];
+
+		memcpy(record, old, sizeof(UndoRecord) + old->length);
+		record->parent = new_id[old->parent];
+		record->depth = old->depth - root_depth;
+		record->joined = old->joined && record->parent != 0;
+
+		used = offset + sizeof(UndoRecord) + old->length;
+		um->records[new_id[n] - 1] = offset;
+		um->redo_child[new_id[n]] = child == 0 ? 0 : new_id[child];
+	}
+
+	if (um->map != NULL)
+	{
+		undo_journal_unmap(um);
+	}
+
+	mem_free(MEM_UNDO, um->log);
+	um->log = new_log;
+	um->log_used = used;
+	um->log_capacity = capacity;
+	um->record_count = kept;
+	um->current = new_id[um->current];
+	um->compactions++;
+
+	// Skip pointers depend on the numbering, rebuild them top down
+	for (size_t n = 1; n <= kept; n++)
+	{
+		undo_record(um, n)->jump = jump_for_child(um, undo_record(um, n)->parent);
+	}
+
+	if (um->saved_known)
+	{
+		um->saved_known = um->saved_node != 0 && new_id[um->saved_node] != UNDO_DROPPED;
+		um->saved_node = um->saved_known ? new_id[um->saved_node] : 0;
+	}
+
+	mem_free(MEM_UNDO, subtree);
+
+	undo_journal_rewrite(um);
+}
+
+static void push_operation(UndoManager *um, OpType type, const char *content, size_t len, size_t pos, bool joined)
+{
+	UndoRecord *record = log_append(um, type, len, pos);
+
+	if (record != NULL)
+	{
+		memcpy(undo_record_text(record), content, len);
+		record->joined = joined && record->parent != 0;
+		undo_journal_append(um, um->record_count);
+		undo_compact(um);
+	}
+}
+
+void undo_push_operation(UndoManager *um, OpType type, const char *content, size_t len, size_t pos)
+{
+	push_operation(um, type, content, len, pos, false);
+}
+
+// Like undo_push_operation, but undone and redone together with the one before
+void undo_push_joined(UndoManager *um, OpType type, const char *content, size_t len, size_t pos)
+{
+	push_operation(um, type, content, len, pos, true);
+}
+
+// Finishes the open record. It goes to the journal and counts against the
+// budget only now, while it's open it can still change.
+static void record_close(UndoManager *um)
+{
+	if (!um->record_open)
+	{
+		return;
+	}
+
+	um->record_open = false;
+
+	UndoRecord *record = undo_record(um, um->record_count);
+
+	// Everything typed was backspaced away, drop the empty record
+	if (record->length == 0)
+	{
+		*node_child(um, record->parent) = um->insert_prev_child;
+		um->current = record->parent;
+		um->record_count--;
+		um->log_used = um->records[um->record_count] - um->map_size;
+		return;
+	}
+
+	// Backspaces collect the text right to left, put it in order
+	if (record->type == OP_DELETE)
+	{
+		char *text = undo_record_text(record);
+
+		for (size_t i = 0, j = record->length - 1; i < j; i++, j--)
+		{
+			char c = text[i];
+			text[i] = text[j];
+			text[j] = c;
+		}
+	}
+
+	um->session_joined = um->in_insert_session;
+
+	undo_journal_append(um, um->record_count);
+	undo_compact(um);
+}
+
+// Opens a record for the session at the end of the log. Records after the
+// first one in a session join it, so the session still undoes as one.
+static bool record_start(UndoManager *um, OpType type)
+{
+	UndoRecord *record = log_append(um, type, 0, um->session_pos);
+
+	if (record == NULL)
+	{
+		return false;
+	}
+
+	record->joined = um->session_joined && record->parent != 0;
+	um->record_open = true;
+
+	return true;
+}
+
+// Adds a byte to the open record, which is always the last thing in the log
+static void record_add(UndoManager *um, char c)
+{
+	if (!log_reserve(um, 1))
+	{
+		return;
+	}
+
+	UndoRecord *record = undo_record(um, um->record_count);
+
+	um->log[um->log_used++] = c;
+	record->length++;
+}
+
+// Typing between entering and leaving INSERT mode undoes as one record
+void undo_begin_insert(UndoManager *um, size_t pos)
+{
+	record_close(um);
+
+	um->in_insert_session = true;
+	um->session_joined = false;
+	um->session_pos = pos;
+}
+
+void undo_insert_char(UndoManager *um, char c)
+{
+	if (!um->in_insert_session)
+	{
+		return;
+	}
+
+	// A long session is cut into pieces, so the budget can drop the oldest
+	if (um->record_open && (undo_record(um, um->record_count)->type != OP_INSERT || undo_record(um, um->record_count)->length >= record_limit(um)))
+	{
+		record_close(um);
+	}
+
+	// The record only exists once something was typed
+	if (!um->record_open && !record_start(um, OP_INSERT))
+	{
+		return;
+	}
+
+	record_add(um, c);
+	um->session_pos++;
+}
+
+// Backspace takes typed characters back off the record. Past where the
+// session started it deletes text that was there before, and that is
+// recorded as a delete.
+void undo_backspace(UndoManager *um, char deleted)
+{
+	if (!um->in_insert_session || um->session_pos == 0)
+	{
+		return;
+	}
+
+	um->session_pos--;
+
+	if (um->record_open)
+	{
+		UndoRecord *record = undo_record(um, um->record_count);
+
+		if (record->type == OP_INSERT && record->length > 0)
+		{
+			record->length--;
+			um->log_used--;
+			return;
+		}
+
+		if (record->type == OP_INSERT || record->length >= record_limit(um))
+		{
+			record_close(um);
+		}
+	}
+
+	if (!um->record_open && !record_start(um, OP_DELETE))
+	{
+		return;
+	}
+
+	record_add(um, deleted);
+	undo_record(um, um->record_count)->position = um->session_pos;
+}
+
+void undo_end_insert(UndoManager *um)
+{
+	um->in_insert_session = false;
+	record_close(um);
+}
+
+// Closes what was typed so far without ending the session, for a save to
+// point at. Typing on joins a new record, so the session still undoes as one.
+void undo_split_insert(UndoManager *um)
+{
+	record_close(um);
+}
+
+// Moves the gap to pos and puts the cursor there, using the line index
+static void undo_seek(GapBuffer *buffer, size_t pos, size_t *cursor_x, size_t *cursor_y)
+{
+	buffer_move_gap(buffer, pos);
+
+	*cursor_y = buffer->gap_line;
+	*cursor_x = buffer->gap_start - buffer_line_start(buffer, buffer->gap_line);
+}
+
+// Each record is applied where it happened, with one gap move and one
+// bulk insert or delete, wherever the gap was left since
+static void apply_record(UndoRecord *record, bool forward, GapBuffer *buffer, size_t *cursor_x, size_t *cursor_y)
+{
+	bool insert = (record->type == OP_INSERT) == forward;
+
+	undo_seek(buffer, record->position, cursor_x, cursor_y);
+
+	if (insert)
+	{
+		buffer_insert_text(buffer, undo_record_text(record), record->length);
+	}
+	else
+	{
+		buffer_delete_range(buffer, record->position, record->length);
+	}
+}
+
+static void step_undo(UndoManager *um, GapBuffer *buffer, size_t *cursor_x, size_t *cursor_y)
+{
+	size_t node = um->current;
+	size_t parent = node_parent(um, node);
+
+	apply_record(undo_record(um, node), false, buffer, cursor_x, cursor_y);
+
+	// Redo comes back down the branch that was just undone
+	*node_child(um, parent) = node;
+	um->current = parent;
+}
+
+static void step_redo(UndoManager *um, size_t child, GapBuffer *buffer, size_t *cursor_x, size_t *cursor_y)
+{
+	apply_record(undo_record(um, child), true, buffer, cursor_x, cursor_y);
+	um->current = child;
+}
+
+// A joined child comes right after its parent, and the parent is then in
+// the middle of an INSERT session, not a state undo stops at
+static bool mid_session(UndoManager *um, size_t node)
+{
+	return node < um->record_count && undo_record(um, node + 1)->joined && undo_record(um, node + 1)->parent == node;
+}
+
+bool undo_operation(UndoManager *um, GapBuffer *buffer, size_t *cursor_x, size_t *cursor_y)
+{
+	if (um->current == 0)
+	{
+		return false;
+	}
+
+	bool joined;
+
+	do
+	{
+		joined = undo_record(um, um->current)->joined;
+		step_undo(um, buffer, cursor_x, cursor_y);
+	}
+	while (joined && um->current != 0);
+
+	return true;
+}
+
+bool redo_operation(UndoManager *um, GapBuffer *buffer, size_t *cursor_x, size_t *cursor_y)
+{
+	size_t child = *node_child(um, um->current);
+
+	if (child == 0)
+	{
+		return false;
+	}
+
+	step_redo(um, child, buffer, cursor_x, cursor_y);
+
+	while ((child = *node_child(um, um->current)) != 0 && undo_record(um, child)->joined)
+	{
+		step_redo(um, child, buffer, cursor_x, cursor_y);
+	}
+
+	return true;
+}
+
+static size_t ancestor_at_depth(UndoManager *um, size_t node, size_t depth)
+{
+	while (node_depth(um, node) > depth)
+	{
+		size_t jump = node_jump(um, node);
+
+		node = node_depth(um, jump) >= depth ? jump : node_parent(um, node);
+	}
+
+	return node;
+}
+
+static size_t common_ancestor(UndoManager *um, size_t a, size_t b)
+{
+	size_t depth_a = node_depth(um, a);
+	size_t depth_b = node_depth(um, b);
+
+	a = ancestor_at_depth(um, a, depth_a < depth_b ? depth_a : depth_b);
+	b = ancestor_at_depth(um, b, depth_a < depth_b ? depth_a : depth_b);
+
+	// Nodes at equal depth have jumps of equal length, so they hop in step
+	while (a != b)
+	{
+		if (node_jump(um, a) != node_jump(um, b))
+		{
+			a = node_jump(um, a);
+			b = node_jump(um, b);
+		}
+		else
+		{
+			a = node_parent(um, a);
+			b = node_parent(um, b);
+		}
+	}
+
+	return a;
+}
+
+// Takes the text to any state in the tree: undo up to the common ancestor,
+// then redo down the target's branch. That path is the fewest records to
+// apply; the skip pointers only make finding the ancestor cheap. A state
+// inside an INSERT session lands on the end of the session.
+bool undo_goto(UndoManager *um, size_t node, GapBuffer *buffer, size_t *cursor_x, size_t *cursor_y)
+{
+	if (node > um->record_count)
+	{
+		return false;
+	}
+
+	while (mid_session(um, node))
+	{
+		node++;
+	}
+
+	if (node == um->current)
+	{
+		return false;
+	}
+
+	size_t ancestor = common_ancestor(um, um->current, node);
+
+	while (um->current != ancestor)
+	{
+		step_undo(um, buffer, cursor_x, cursor_y);
+	}
+
+	// Point redo along the way down, which also leaves it there afterwards
+	for (size_t n = node; n != ancestor; n = node_parent(um, n))
+	{
+		*node_child(um, node_parent(um, n)) = n;
+	}
+
+	while (um->current != node)
+	{
+		step_redo(um, *node_child(um, um->current), buffer, cursor_x, cursor_y);
+	}
+
+	return true;
+}
+
+// The state count steps before or after the current one in the order they
+// were made, for g-/g+ and :earlier/:later. Going back, states inside an
+// INSERT session are stepped over; going forward undo_goto does that.
+size_t undo_step_target(UndoManager *um, size_t count, bool forward)
+{
+	size_t node = um->current;
+
+	if (forward)
+	{
+		return um->record_count - node > count ? node + count : um->record_count;
+	}
+
+	node = node > count ? node - count : 0;
+
+	while (node > 0 && mid_session(um, node))
+	{
+		node--;
+	}
+
+	return node;
+}
+
+// Newest state made at most `seconds` after (or before, when negative) the
+// current one was. Nodes are numbered in time order, so that is the last
+// node whose time fits.
+size_t undo_time_target(UndoManager *um, long long seconds)
+{
+	if (um->record_count == 0)
+	{
+		return 0;
+	}
+
+	long long base = um->current == 0 ? undo_record(um, 1)->time : undo_record(um, um->current)->time;
+	long long limit = base + seconds;
+	size_t low = 0;
+	size_t high = um->record_count;
+
+	while (low < high)
+	{
+		size_t mid = low + (high - low + 1) / 2;
+
+		if (undo_record(um, mid)->time <= limit)
+		{
+			low = mid;
+		}
+		else
+		{
+			high = mid - 1;
+		}
+	}
+
+	// :earlier from the original text with nothing older stays put
+	if (seconds < 0 && low > um->current)
+	{
+		return um->current;
+	}
+
+	return low;
+}
@@ -0,0 +1,104 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "buffer.h"
+
+// Records start on 8 byte boundaries, in the log and in the journal
+#define UNDO_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+typedef enum
+{
+	OP_INSERT,
+	OP_DELETE
+
+} OpType;
+
+// Header of one record in the undo log, `length` payload bytes follow it.
+// position is the logical offset the text was inserted at or deleted from.
+// Records are the nodes of the undo tree, numbered from 1 in the order they
+// were made; node 0 is the text as it was loaded. A record never changes
+// once it is complete, which is what lets the journal map old ones in.
+typedef struct
+{
+	OpType type;
+	bool joined;         // Undone and redone together with its parent, same INSERT session
+	size_t length;
+	size_t position;
+
+	size_t parent;       // State this edit was made on
+	size_t depth;        // Edits between the original text and this state
+	size_t jump;         // Skip ancestor, finds common ancestors in O(log depth)
+	long long time;      // Wall clock seconds when the edit was made
+
+} UndoRecord;
+
+// Undo history as an undo tree kept in one append-only arena. Each record
+// is a header followed by its payload, padded to 8 bytes. A new edit after
+// undoing starts a branch instead of throwing the old redo path away, and
+// moving between states only applies records, nothing is copied or freed.
+// With a journal open, records from earlier sessions are read straight from
+// the mapped file and only this session's edits are on the heap.
+typedef struct
+{
+	char *log;
+	size_t log_used;
+	size_t log_capacity;
+
+	const char *map;        // Journal records from earlier sessions, read-only
+	size_t map_size;
+	int journal_fd;         // -1 without a journal
+
+	size_t *records;        // Offset of each record, node n at n - 1. Offsets
+	                        // below map_size are in the map, the rest in log
+	size_t *redo_child;     // Per state, 0 included: where redo goes from it,
+	                        // the newest or last visited branch
+	size_t record_count;
+	size_t record_capacity;
+
+	size_t current;         // State the text is in
+	size_t budget;          // Bytes of history kept before the oldest is dropped, 0 = no limit
+	size_t compactions;     // Times compaction renumbered the states
+
+	// An INSERT session grows an open record at the end of the log: typed
+	// text, or a run of backspaces past where the session started
+	bool in_insert_session;
+	bool record_open;
+	bool session_joined;    // The session already made a record, the next one joins it
+	size_t session_pos;     // Where the next typed character goes
+	size_t insert_prev_child;
+
+	// Journal only: the state the file on disk is in, written again when
+	// compaction rewrites the journal
+	char *journal_path;
+	bool saved_known;
+	size_t saved_node;
+	size_t saved_length;
+	uint64_t saved_hash;
+
+} UndoManager;
+
+UndoManager *undo_manager_create();
+void undo_manager_free(UndoManager *um);
+void undo_push_operation(UndoManager *um, OpType type, const char *content, size_t len, size_t pos);
+void undo_push_joined(UndoManager *um, OpType type, const char *content, size_t len, size_t pos);
+UndoRecord *undo_record(UndoManager *um, size_t node);
+size_t undo_history_bytes(UndoManager *um);
+char *undo_record_text(UndoRecord *record);
+bool undo_add_node(UndoManager *um, size_t offset);
+
+void undo_begin_insert(UndoManager *um, size_t pos);
+void undo_insert_char(UndoManager *um, char c);
+void undo_backspace(UndoManager *um, char deleted);
+void undo_end_insert(UndoManager *um);
+void undo_split_insert(UndoManager *um);
+
+bool undo_operation(UndoManager *um, GapBuffer *buffer, size_t *cursor_x, size_t *cursor_y);
+bool redo_operation(UndoManager *um, GapBuffer *buffer, size_t *cursor_x, size_t *cursor_y);
+bool undo_goto(UndoManager *um, size_t node, GapBuffer *buffer, size_t *cursor_x, size_t *cursor_y);
+size_t undo_step_target(UndoManager *um, size_t count, bool forward);
+size_t undo_time_target(UndoManager *um, long long seconds);
+
+#endif
@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "undo_journal.h"
+#include "alloc.h"
+#include "utils.h"
+
+#define JOURNAL_MAGIC "VSPUNDO"
+#define JOURNAL_VERSION 2
+#define JOURNAL_MARK 0x4b52414d   // "MARK", never a valid OpType
+
+// Start of the file. record_size catches a journal written by a build with
+// a different UndoRecord layout, the records are native structs.
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+
+} JournalHeader;
+
+// Written on every save: the file had this length and hash in state node
+typedef struct
+{
+	uint32_t type;
+	uint32_t unused;
+	uint64_t node;
+	uint64_t length;
+	uint64_t hash;
+
+} JournalMark;
+
+// Journal for filename under $XDG_CACHE_HOME/vesper/undo (~/.cache by
+// default), named as cache_file_path does
+bool undo_journal_path(const char *filename, char *out, size_t out_len)
+{
+	return cache_file_path("undo", filename, out, out_len);
+}
+
+// Appends iov to the journal. A failed or short write stops journaling for
+// the session, a torn entry at the end is cut off on the next open.
+static void journal_write(UndoManager *um, struct iovec *iov, int count)
+{
+	size_t total = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		total += iov[i].iov_len;
+	}
+
+	if (writev(um->journal_fd, iov, count) != (ssize_t)total)
+	{
+		close(um->journal_fd);
+		um->journal_fd = -1;
+	}
+}
+
+// Writes the saved state remembered in um
+static void write_mark(UndoManager *um)
+{
+	JournalMark mark = { JOURNAL_MARK, 0, um->saved_node, um->saved_length, um->saved_hash };
+	struct iovec iov = { &mark, sizeof(mark) };
+
+	journal_write(um, &iov, 1);
+}
+
+static void remember_saved(UndoManager *um, size_t node, size_t length, uint64_t hash)
+{
+	um->saved_known = true;
+	um->saved_node = node;
+	um->saved_length = length;
+	um->saved_hash = hash;
+}
+
+static void write_header(UndoManager *um)
+{
+	JournalHeader header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+	header.version = JOURNAL_VERSION;
+	header.record_size = sizeof(UndoRecord);
+
+	struct iovec iov = { &header, sizeof(header) };
+
+	journal_write(um, &iov, 1);
+}
+
+// Indexes the records in the mapped journal and finds the newest save mark
+// matching the text. Returns where the valid entries end; anything after
+// that is a torn write or garbage.
+static size_t journal_scan(UndoManager *um, uint64_t hash, size_t length, size_t *saved_node, bool *saved)
+{
+	size_t size = um->map_size;
+	size_t pos = sizeof(JournalHeader);
+
+	while (pos + sizeof(uint32_t) <= size)
+	{
+		uint32_t type;
+
+		memcpy(&type, um->map + pos, sizeof(type));
+
+		if (type == JOURNAL_MARK)
+		{
+			if (pos + sizeof(JournalMark) > size)
+			{
+				break;
+			}
+
+			JournalMark mark;
+
+			memcpy(&mark, um->map + pos, sizeof(mark));
+
+			if (mark.node > um->record_count)
+			{
+				break;
+			}
+
+			if (mark.length == length && mark.hash == hash)
+			{
+				*saved_node = mark.node;
+				*saved = true;
+			}
+
+			pos += sizeof(JournalMark);
+			continue;
+		}
+
+		if ((type != OP_INSERT && type != OP_DELETE) || pos + sizeof(UndoRecord) > size)
+		{
+			break;
+		}
+
+		const UndoRecord *record = (const UndoRecord *)(um->map + pos);
+		size_t node = um->record_count + 1;
+
+		if (record->length > size - pos - sizeof(UndoRecord) || record->parent >= node || record->jump >= node ||
+		    (record->joined && record->parent != node - 1))
+		{
+			break;
+		}
+
+		// Walking the tree trusts depths, check them against the parent
+		size_t parent_depth = record->parent == 0 ? 0 : undo_record(um, record->parent)->depth;
+		size_t jump_depth = record->jump == 0 ? 0 : undo_record(um, record->jump)->depth;
+
+		if (record->depth != parent_depth + 1 || jump_depth >= record->depth)
+		{
+			break;
+		}
+
+		if (!undo_add_node(um, pos))
+		{
+			break;
+		}
+
+		pos = UNDO_ALIGN(pos + sizeof(UndoRecord) + record->length);
+	}
+
+	return pos < size ? pos : size;
+}
+
+static bool header_valid(const char *map, size_t size)
+{
+	JournalHeader header;
+
+	if (size < sizeof(header))
+	{
+		return false;
+	}
+
+	memcpy(&header, map, sizeof(header));
+
+	return memcmp(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) == 0 &&
+	       header.version == JOURNAL_VERSION &&
+	       header.record_size == sizeof(UndoRecord);
+}
+
+// Compaction copies what it keeps out of the map before dropping it
+void undo_journal_unmap(UndoManager *um)
+{
+	if (um->map != NULL)
+	{
+		munmap((void *)um->map, um->map_size);
+	}
+
+	um->map = NULL;
+	um->map_size = 0;
+}
+
+static void forget_history(UndoManager *um)
+{
+	undo_journal_unmap(um);
+
+	um->record_count = 0;
+	um->redo_child[0] = 0;
+	um->current = 0;
+}
+
+// Opens the journal at path for a freshly loaded buffer. History from
+// earlier sessions is kept if the text hashes to a state it saved, and
+// the editor starts in that state. Returns how many records came back.
+size_t undo_journal_open(UndoManager *um, const char *path, GapBuffer *buffer)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	um->journal_fd = fd;
+	um->journal_path = mem_strdup(MEM_UNDO, path);
+
+	uint64_t hash = buffer_hash(buffer);
+	size_t length = buffer_length(buffer);
+	struct stat st;
+	bool saved = false;
+	size_t saved_node = 0;
+
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(JournalHeader))
+	{
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+		if (map != MAP_FAILED)
+		{
+			um->map = map;
+			um->map_size = st.st_size;
+
+			if (header_valid(um->map, um->map_size))
+			{
+				size_t end = journal_scan(um, hash, length, &saved_node, &saved);
+
+				// Cut a torn tail off so new entries follow valid ones
+				if (saved && end < um->map_size)
+				{
+					munmap(map, um->map_size);
+					map = ftruncate(fd, end) == 0 ? mmap(NULL, end, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+					um->map = map == MAP_FAILED ? NULL : map;
+					um->map_size = map == MAP_FAILED ? 0 : end;
+					saved = map != MAP_FAILED;
+				}
+			}
+		}
+	}
+
+	if (!saved)
+	{
+		// Missing, stale or unreadable: the file changed outside the
+		// editor, start a new history from the text as it is
+		forget_history(um);
+
+		if (ftruncate(fd, 0) != 0)
+		{
+			close(fd);
+			um->journal_fd = -1;
+			return 0;
+		}
+
+		remember_saved(um, 0, length, hash);
+		write_header(um);
+		write_mark(um);
+
+		return 0;
+	}
+
+	// Redo from any state on the way leads back to the saved one
+	remember_saved(um, saved_node, length, hash);
+	um->current = saved_node;
+
+	for (size_t n = saved_node; n != 0; n = undo_record(um, n)->parent)
+	{
+		um->redo_child[undo_record(um, n)->parent] = n;
+	}
+
+	return um->record_count;
+}
+
+// Called once a record is complete and will not change again
+void undo_journal_append(UndoManager *um, size_t node)
+{
+	if (um->journal_fd < 0)
+	{
+		return;
+	}
+
+	static const char zeros[8];
+	UndoRecord *record = undo_record(um, node);
+	size_t len = sizeof(UndoRecord) + record->length;
+	struct iovec iov[2] = {
+		{ record, len },
+		{ (void *)zeros, UNDO_ALIGN(len) - len },
+	};
+
+	journal_write(um, iov, 2);
+}
+
+void undo_journal_mark_saved(UndoManager *um, GapBuffer *buffer)
+{
+	if (um->journal_fd < 0)
+	{
+		return;
+	}
+
+	remember_saved(um, um->current, buffer_length(buffer), buffer_hash(buffer));
+	write_mark(um);
+}
+
+// For a save that finished after editing went on: the file holds state
+// node, which a compaction since may have renumbered (compactions tells)
+void undo_journal_mark_saved_state(UndoManager *um, size_t node, size_t compactions, size_t length, uint64_t hash)
+{
+	if (um->journal_fd < 0 || compactions != um->compactions)
+	{
+		return;
+	}
+
+	remember_saved(um, node, length, hash);
+	write_mark(um);
+}
+
+// After compaction renumbered the tree, the journal is written again from
+// what is left: to a temporary file first, renamed over the old one only
+// once it is complete
+void undo_journal_rewrite(UndoManager *um)
+{
+	if (um->journal_fd < 0)
+	{
+		return;
+	}
+
+	char tmp_path[PATH_MAX];
+	int old_fd = um->journal_fd;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", um->journal_path);
+	um->journal_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+
+	if (um->journal_fd >= 0)
+	{
+		write_header(um);
+	}
+
+	for (size_t n = 1; n <= um->record_count && um->journal_fd >= 0; n++)
+	{
+		undo_journal_append(um, n);
+	}
+
+	if (um->journal_fd >= 0 && um->saved_known)
+	{
+		write_mark(um);
+	}
+
+	close(old_fd);
+
+	if (um->journal_fd < 0 || rename(tmp_path, um->journal_path) != 0)
+	{
+		// The old journal stays, it still holds a valid older history
+		unlink(tmp_path);
+
+		if (um->journal_fd >= 0)
+		{
+			close(um->journal_fd);
+			um->journal_fd = -1;
+		}
+	}
+}
+
+void undo_journal_close(UndoManager *um)
+{
+	undo_journal_unmap(um);
+
+	if (um->journal_fd >= 0)
+	{
+		close(um->journal_fd);
+		um->journal_fd = -1;
+	}
+
+	mem_free(MEM_UNDO, um->journal_path);
+	um->journal_path = NULL;
+}
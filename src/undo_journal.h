@@ -0,0 +1,24 @@
+#ifndef UNDO_JOURNAL_H
+#define UNDO_JOURNAL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "buffer.h"
+#include "undo.h"
+
+// Per-file undo history that outlives the editor. The journal is an
+// append-only file of undo records exactly as they sit in the undo log,
+// plus a save mark (content hash and state) every time the file is
+// written. On reopen the records are mapped, not read, and the history is
+// only used if the file's hash matches one of the marks.
+bool undo_journal_path(const char *filename, char *out, size_t out_len);
+size_t undo_journal_open(UndoManager *um, const char *path, GapBuffer *buffer);
+void undo_journal_append(UndoManager *um, size_t node);
+void undo_journal_mark_saved(UndoManager *um, GapBuffer *buffer);
+void undo_journal_mark_saved_state(UndoManager *um, size_t node, size_t compactions, size_t length, uint64_t hash);
+void undo_journal_rewrite(UndoManager *um);
+void undo_journal_unmap(UndoManager *um);
+void undo_journal_close(UndoManager *um);
+
+#endif
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "utils.h"
+
+long long monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long monotonic_ms(void)
+{
+	return monotonic_ns() / 1000000;
+}
+
+static uint64_t fnv1a(uint64_t hash, const char *text, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		hash = (hash ^ (unsigned char)text[i]) * 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+// Creates dir if it isn't there, true if it exists afterwards
+static bool make_dir(const char *dir)
+{
+	return mkdir(dir, 0700) == 0 || access(dir, W_OK) == 0;
+}
+
+// Per-file state under $XDG_CACHE_HOME/vesper/<kind> (~/.cache by default),
+// named after the file's absolute path with '/' turned into '%'. A path
+// that has a '%' of its own would name the same file as another one (/a%b
+// and /a/b), so it is named by its hash instead, after a "%%" no other
+// name starts with.
+bool cache_file_path(const char *kind, const char *filename, char *out, size_t out_len)
+{
+	char absolute[PATH_MAX];
+
+	if (realpath(filename, absolute) == NULL)
+	{
+		// A new file doesn't exist yet, build the path by hand
+		char cwd[PATH_MAX];
+
+		if (filename[0] == '/')
+		{
+			snprintf(absolute, sizeof(absolute), "%s", filename);
+		}
+		else if (getcwd(cwd, sizeof(cwd)) == NULL || (size_t)snprintf(absolute, sizeof(absolute), "%s/%s", cwd, filename) >= sizeof(absolute))
+		{
+			return false;
+		}
+	}
+
+	char dir[PATH_MAX];
+	char *cache = getenv("XDG_CACHE_HOME");
+	char *home = getenv("HOME");
+
+	if (cache != NULL && cache[0] != '\0')
+	{
+		snprintf(dir, sizeof(dir), "%s", cache);
+	}
+	else if (home != NULL)
+	{
+		snprintf(dir, sizeof(dir), "%s/.cache", home);
+	}
+	else
+	{
+		return false;
+	}
+
+	if (!make_dir(dir))
+	{
+		return false;
+	}
+
+	strncat(dir, "/vesper", sizeof(dir) - strlen(dir) - 1);
+
+	if (!make_dir(dir))
+	{
+		return false;
+	}
+
+	strncat(dir, "/", sizeof(dir) - strlen(dir) - 1);
+	strncat(dir, kind, sizeof(dir) - strlen(dir) - 1);
+
+	if (!make_dir(dir))
+	{
+		return false;
+	}
+
+	if (strchr(absolute, '%') != NULL)
+	{
+		char *name = strrchr(absolute, '/') + 1;
+
+		return (size_t)snprintf(out, out_len, "%s/%%%%%016llx%%%s", dir,
+		                        (unsigned long long)fnv1a(0xcbf29ce484222325ULL, absolute, strlen(absolute)),
+		                        name) < out_len;
+	}
+
+	// Built by hand a path can have "//", which would start a "%%" too
+	char *to = absolute;
+
+	for (char *c = absolute; *c; c++)
+	{
+		if (*c == '/' && to > absolute && to[-1] == '%')
+		{
+			continue;
+		}
+
+		*to++ = *c == '/' ? '%' : *c;
+	}
+
+	*to = '\0';
+
+	return (size_t)snprintf(out, out_len, "%s/%s", dir, absolute) < out_len;
+}
+
+// Tells this run of process pid from any other that has or had the same
+// PID: the boot it's in and when in that boot it started, hashed. 0 if
+// that can't be read (no /proc, or pid isn't running).
+uint64_t process_start_id(pid_t pid)
+{
+	char path[64];
+	char stat[1024];
+	char boot[64];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+	if ((fp = fopen(path, "r")) == NULL)
+	{
+		return 0;
+	}
+
+	size_t stat_len = fread(stat, 1, sizeof(stat) - 1, fp);
+	fclose(fp);
+	stat[stat_len] = '\0';
+
+	if ((fp = fopen("/proc/sys/kernel/random/boot_id", "r")) == NULL)
+	{
+		return 0;
+	}
+
+	size_t boot_len = fread(boot, 1, sizeof(boot), fp);
+	fclose(fp);
+
+	// The name in parentheses can hold anything, the fields count from after
+	// it: state is the 3rd, starttime the 22nd
+	char *field = strrchr(stat, ')');
+
+	for (int i = 2; field != NULL && i < 22; i++)
+	{
+		field = strchr(field + 1, ' ');
+	}
+
+	if (field == NULL)
+	{
+		return 0;
+	}
+
+	unsigned long long started = strtoull(field + 1, NULL, 10);
+	uint64_t hash = fnv1a(0xcbf29ce484222325ULL, boot, boot_len);
+
+	return fnv1a(hash, (char *)&started, sizeof(started));
+}
@@ -0,0 +1,14 @@
+#ifndef UTILS_H
+#define UTILS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+long long monotonic_ms(void);
+long long monotonic_ns(void);
+bool cache_file_path(const char *kind, const char *filename, char *out, size_t out_len);
+uint64_t process_start_id(pid_t pid);
+
+#endif
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "editor.h"
+#include "event_loop.h"
+#include "file_io.h"
+
+extern EditorState state;
+
+#define SIZE (32 << 20)
+
+int progress = 0;
+int finished = 0;
+char message[64];
+
+// What the editor does with a loader's progress, as a command is typed
+void on_progress(size_t loaded, bool done, bool ok, void *data)
+{
+    snprintf(message, sizeof(message), "Loading... %d%%", (int)(loaded * 100 / SIZE));
+    editor_show_message(message);
+    progress++;
+    finished = done;
+}
+
+void type_key(int key)
+{
+    KeyEvent event = { key, 0, NULL, 0 };
+    editor_handle_key(state.buffer, state.filename, &event);
+}
+
+int main() {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_command_typing.%d", (int)getpid());
+
+    char *text = malloc(SIZE);
+    memset(text, 'x', SIZE);
+    FILE *fp = fopen(path, "w");
+    fwrite(text, 1, SIZE, fp);
+    fclose(fp);
+
+    editor_init(NULL);
+    state.screen_rows = 24;
+    state.screen_cols = 80;
+
+    EventLoop loop;
+    event_loop_init(&loop);
+    FileLoader *loader = file_load_async(&loop, open(path, O_RDONLY), text, SIZE, on_progress, NULL);
+
+    // One key per trip round the loop, progress lands between them
+    const char *command = "set number";
+    int typed_during = 0;
+    type_key(':');
+
+    for (size_t i = 0; command[i] != '\0'; i++) {
+        if (!finished) {
+            event_loop_run_once(&loop, 1000);
+            typed_during += !finished;
+        }
+        type_key(command[i]);
+    }
+
+    while (!finished) {
+        event_loop_run_once(&loop, 1000);
+    }
+
+    printf("Test 1 - Typing a command while a file loads:\n");
+    printf("started: %d, progress while typing: %d, typed: \"%s\", message: %d\n", loader != NULL, typed_during > 0,
+           state.command_buffer, state.message != NULL);
+    printf("Expected: started: 1, progress while typing: 1, typed: \"set number\", message: 0\n\n");
+
+    // Outside COMMAND mode it's shown as ever
+    type_key(27);
+    editor_show_message("Loaded");
+
+    printf("Test 2 - The same message in NORMAL mode:\n");
+    printf("mode: %d, message: %s\n", state.mode, state.message != NULL ? state.message : "(none)");
+    printf("Expected: mode: 0, message: Loaded\n");
+
+    event_loop_free(&loop);
+    free(text);
+    unlink(path);
+    return 0;
+}
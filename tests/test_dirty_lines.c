@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include "buffer.h"
+#include "highlight.h"
+
+void print_dirty(GapBuffer *buf)
+{
+    printf("any: %d, first: %zu, last: %zu, to_end: %d\n",
+           buf->dirty.any, buf->dirty.first, buf->dirty.last, buf->dirty.to_end);
+}
+
+int main() {
+    GapBuffer *buf = buffer_create(16);
+
+    char *text = "int x;\nint y;\nint z;";
+    for (size_t i = 0; text[i]; i++) {
+        buffer_insert_char(buf, text[i]);
+    }
+
+    buffer_clear_dirty(buf);
+
+    // Typing on the last line only touches that line
+    buffer_insert_char(buf, ' ');
+
+    printf("Test 1 - After typing on line 2:\n");
+    print_dirty(buf);
+    printf("Expected: any: 1, first: 2, last: 2, to_end: 0\n\n");
+
+    buffer_clear_dirty(buf);
+
+    // A newline shifts everything below it
+    buffer_move_cursor_left(buf);
+    buffer_move_cursor_left(buf);
+    buffer_move_cursor_left(buf);
+    buffer_move_cursor_left(buf);
+    buffer_move_cursor_left(buf);
+    buffer_move_cursor_left(buf);
+    buffer_move_cursor_left(buf);
+    buffer_move_cursor_left(buf);
+    buffer_insert_char(buf, '\n');
+
+    printf("Test 2 - After inserting a newline at the end of line 1:\n");
+    print_dirty(buf);
+    printf("total lines: %zu, line 2 length: %zu\n",
+           buffer_get_total_lines(buf), buffer_get_line_length(buf, 2));
+    printf("Expected: any: 1, first: 1, last: 1, to_end: 1\n");
+    printf("Expected: total lines: 4, line 2 length: 0\n\n");
+
+    // Opening a block comment changes how the lines below are lexed
+    Highlighter hl;
+    highlighter_init(&hl, LANG_C);
+    TokenType tokens[64];
+
+    for (size_t line = 0; line < buffer_get_total_lines(buf); line++) {
+        highlight_line(&hl, buf, line, tokens, 64);
+    }
+
+    buffer_clear_dirty(buf);
+
+    buffer_move_cursor_left(buf);
+    buffer_move_cursor_left(buf);
+    buffer_insert_char(buf, '/');
+    buffer_insert_char(buf, '*');
+
+    highlighter_invalidate(&hl, &buf->dirty);
+    highlight_line(&hl, buf, 1, tokens, 64);
+
+    printf("Test 3 - After typing '/*' on line 1 and highlighting it:\n");
+    print_dirty(buf);
+    printf("Expected: any: 1, first: 1, last: 2, to_end: 1\n\n");
+
+    // A followed log lets its oldest lines go, both with the gap at the end
+    // and with it among the lines being dropped
+    GapBuffer *log = buffer_create(16);
+    buffer_insert_text(log, "one\ntwo\nthree\nfour\n", 19);
+    buffer_clear_dirty(log);
+    buffer_drop_front(log, 8);
+    size_t after_slide = buffer_get_total_lines(log);
+    size_t three_length = buffer_get_line_length(log, 0);
+    buffer_move_gap(log, 2);
+    buffer_drop_front(log, 6);
+
+    printf("Test 4 - Dropping the first lines:\n");
+    print_dirty(log);
+    printf("lines: %zu then %zu, line 0: %zu then %zu, gap_line: %zu, starts with: %c\n",
+           after_slide, buffer_get_total_lines(log), three_length, buffer_get_line_length(log, 0),
+           log->gap_line, buffer_char_at(log, 0));
+    printf("Expected: any: 1, first: 0, last: 0, to_end: 1\n");
+    printf("Expected: lines: 3 then 2, line 0: 5 then 4, gap_line: 0, starts with: f\n");
+
+    buffer_free(log);
+    return 0;
+}
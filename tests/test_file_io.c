@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "buffer.h"
+#include "file_io.h"
+#include "event_loop.h"
+
+void print_file(const char *path)
+{
+    char text[64] = {0};
+    FILE *fp = fopen(path, "r");
+    if (fp != NULL) {
+        fread(text, 1, sizeof(text) - 1, fp);
+        fclose(fp);
+    }
+    printf("file: \"%s\"\n", text);
+}
+
+int count_files(const char *dir)
+{
+    int count = 0;
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            count++;
+        }
+    }
+    closedir(d);
+    return count;
+}
+
+void print_snapshot(BufferSnapshot *snap)
+{
+    printf("snapshot: \"%.*s%.*s\"", (int)snap->gap_start, snap->data,
+           (int)(snap->capacity - snap->gap_end), snap->data + snap->gap_end);
+}
+
+int saves_done = 0;
+SaveResult last_result;
+
+void on_saved(SaveResult *result, void *data)
+{
+    last_result = *result;
+    saves_done++;
+    buffer_snapshot_release(data, result->snapshot);
+}
+
+int load_calls = 0;
+int load_done = 0;
+int load_ok = 0;
+
+void on_loaded(size_t loaded, bool done, bool ok, void *data)
+{
+    GapBuffer *buffer = data;
+    load_calls++;
+    buffer_commit_gap(buffer, loaded - buffer_length(buffer));
+    load_done = done;
+    load_ok = ok;
+}
+
+int main() {
+    char dir[] = "/tmp/test_file_io.XXXXXX";
+    char path[128];
+    char link_path[128];
+    mkdtemp(dir);
+    snprintf(path, sizeof(path), "%s/file.txt", dir);
+    snprintf(link_path, sizeof(link_path), "%s/link.txt", dir);
+
+    // Gap in the middle, both spans go out in one writev
+    GapBuffer *buf = buffer_create(16);
+    buffer_insert_text(buf, "hello world", 11);
+    buffer_move_gap(buf, 5);
+
+    bool ok = file_save_buffer(path, buf, NULL, FSYNC_FULL);
+
+    printf("Test 1 - New file with the gap in the middle:\n");
+    printf("ok: %d, ", ok);
+    print_file(path);
+    printf("Expected: ok: 1, file: \"hello world\"\n\n");
+
+    // The mode of the file being replaced carries over
+    chmod(path, 0640);
+    buffer_insert_text(buf, ",", 1);
+    file_save_buffer(path, buf, NULL, FSYNC_FILE);
+    struct stat st;
+    stat(path, &st);
+
+    printf("Test 2 - Saving over a 0640 file:\n");
+    printf("mode: %o, ", st.st_mode & 0777);
+    print_file(path);
+    printf("Expected: mode: 640, file: \"hello, world\"\n\n");
+
+    // Through a symlink the file it points to is replaced, the link stays
+    symlink("file.txt", link_path);
+    buffer_insert_text(buf, "!", 1);
+    file_save_buffer(link_path, buf, NULL, FSYNC_NEVER);
+    struct stat link_st;
+    lstat(link_path, &link_st);
+
+    printf("Test 3 - Saving through a symlink:\n");
+    printf("still a link: %d, ", S_ISLNK(link_st.st_mode));
+    print_file(path);
+    printf("Expected: still a link: 1, file: \"hello,! world\"\n\n");
+
+    // A failed save leaves no temporary file behind
+    char missing[160];
+    snprintf(missing, sizeof(missing), "%s/no/such/dir.txt", dir);
+    ok = file_save_buffer(missing, buf, NULL, FSYNC_NEVER);
+
+    printf("Test 4 - Saving into a missing directory:\n");
+    printf("ok: %d, files in dir: %d\n", ok, count_files(dir));
+    printf("Expected: ok: 0, files in dir: 2\n\n");
+
+    // Typing where the snapshot was taken goes into the gap, nothing is copied
+    buffer_free(buf);
+    buf = buffer_create(64);
+    buffer_insert_text(buf, "one two", 7);
+    buffer_move_gap(buf, 3);
+    char *shared = buf->data;
+    BufferSnapshot *snap = buffer_snapshot(buf);
+    buffer_insert_text(buf, " and", 4);
+
+    printf("Test 5 - Typing at the snapshot's gap:\n");
+    print_snapshot(snap);
+    printf(", shared: %d, second snapshot: %d\n", buf->data == shared && buf->snapshot == snap, buffer_snapshot(buf) != NULL);
+    printf("Expected: snapshot: \"one two\", shared: 1, second snapshot: 0\n\n");
+
+    // Editing anywhere else moves the buffer to a copy, the snapshot keeps its text
+    buffer_move_gap(buf, 0);
+    buffer_insert_text(buf, "just ", 5);
+
+    printf("Test 6 - Editing elsewhere:\n");
+    print_snapshot(snap);
+    printf(", shared: %d, owns data: %d, hash matches: %d\n", buf->data == shared, snap->owns_data,
+           buffer_snapshot_hash(snap) == buffer_snapshot_hash(&(BufferSnapshot){ "one two", 7, 7, 7, false }));
+    printf("Expected: snapshot: \"one two\", shared: 0, owns data: 1, hash matches: 1\n\n");
+
+    buffer_snapshot_release(buf, snap);
+
+    // A background save writes the text as it was while editing goes on
+    EventLoop loop;
+    event_loop_init(&loop);
+    snap = buffer_snapshot(buf);
+    ok = file_save_async(&loop, path, snap, NULL, FSYNC_FILE, true, on_saved, buf);
+    buffer_insert_char(buf, '!');
+    buffer_move_gap(buf, 0);
+    buffer_insert_char(buf, '>');
+
+    while (saves_done == 0) {
+        event_loop_run_once(&loop, 1000);
+    }
+
+    printf("Test 7 - Background save while editing:\n");
+    printf("ok: %d, length: %zu, hash right: %d, snapshot released: %d, ", ok && last_result.ok, last_result.length,
+           last_result.hash == buffer_snapshot_hash(&(BufferSnapshot){ "just one and two", 16, 16, 16, false }),
+           buf->snapshot == NULL);
+    print_file(path);
+    printf("Expected: ok: 1, length: 16, hash right: 1, snapshot released: 1, file: \"just one and two\"\n\n");
+
+    // A big file comes in a chunk at a time, straight into the gap
+    FILE *fp = fopen(path, "w");
+    for (int i = 0; i < 100000; i++) {
+        fprintf(fp, "line %05d\n", i);
+    }
+    fclose(fp);
+
+    GapBuffer *loaded = buffer_create(16);
+    int fd = open(path, O_RDONLY);
+    buffer_reserve(loaded, 1100000);
+    FileLoader *loader = file_load_async(&loop, fd, &loaded->data[loaded->gap_start], 1100000, on_loaded, loaded);
+
+    while (!load_done) {
+        event_loop_run_once(&loop, 1000);
+    }
+
+    printf("Test 8 - Loading in the background:\n");
+    printf("started: %d, ok: %d, several steps: %d, length: %zu, lines: %zu, line 99999 at: %zu\n",
+           loader != NULL, load_ok, load_calls > 2, buffer_length(loaded), buffer_get_total_lines(loaded),
+           buffer_line_start(loaded, 99999));
+    printf("Expected: started: 1, ok: 1, several steps: 1, length: 1100000, lines: 100001, line 99999 at: 1099989\n\n");
+
+    // The buffer's UTF-8 and \n go back out the way the file came in
+    buffer_free(buf);
+    buf = buffer_create(16);
+    buffer_insert_text(buf, "a\n\xC3\xA9\n", 5);
+    TextFormat bom_crlf = { ENCODING_UTF8_BOM, LINE_ENDING_CRLF };
+    TextFormat utf16 = { ENCODING_UTF16LE, LINE_ENDING_CRLF };
+    unsigned char bytes[2][32];
+    ssize_t sizes[2];
+    const TextFormat *formats[2] = { &bom_crlf, &utf16 };
+
+    for (int i = 0; i < 2; i++) {
+        file_save_buffer(path, buf, formats[i], FSYNC_NEVER);
+        fd = open(path, O_RDONLY);
+        sizes[i] = read(fd, bytes[i], sizeof(bytes[i]));
+        close(fd);
+    }
+
+    printf("Test 9 - Saving as CRLF with a BOM and as UTF-16LE:\n");
+    for (int i = 0; i < 2; i++) {
+        printf("%s", i == 0 ? "utf-8:" : ", utf-16le:");
+        for (ssize_t k = 0; k < sizes[i]; k++) {
+            printf(" %02X", bytes[i][k]);
+        }
+    }
+    printf("\nExpected: utf-8: EF BB BF 61 0D 0A C3 A9 0D 0A, utf-16le: FF FE 61 00 0D 00 0A 00 E9 00 0D 00 0A 00\n");
+
+    buffer_free(loaded);
+    event_loop_free(&loop);
+    unlink(link_path);
+    unlink(path);
+    rmdir(dir);
+    buffer_free(buf);
+    return 0;
+}
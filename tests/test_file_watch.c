@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "event_loop.h"
+#include "file_watch.h"
+
+int changes = 0;
+
+void on_changed(void *data)
+{
+    changes++;
+}
+
+void write_file(const char *path, const char *mode, const char *text)
+{
+    FILE *fp = fopen(path, mode);
+    fputs(text, fp);
+    fclose(fp);
+}
+
+// Runs the loop until it has nothing more to say
+void settle(EventLoop *loop)
+{
+    for (int i = 0; i < 5; i++) {
+        event_loop_run_once(loop, 20);
+    }
+}
+
+int main() {
+    char dir[] = "/tmp/test_file_watch.XXXXXX";
+    char path[128];
+    char other[128];
+    char tmp[128];
+    mkdtemp(dir);
+    snprintf(path, sizeof(path), "%s/watched.log", dir);
+    snprintf(other, sizeof(other), "%s/other.log", dir);
+    snprintf(tmp, sizeof(tmp), "%s/.watched.log.new", dir);
+    write_file(path, "w", "one\n");
+
+    EventLoop loop;
+    event_loop_init(&loop);
+    FileWatch *watch = file_watch_start(&loop, path, on_changed, NULL);
+
+    // Several writes before the loop looks are one callback
+    write_file(path, "a", "two\n");
+    write_file(path, "a", "three\n");
+    settle(&loop);
+
+    printf("Test 1 - Appending to the file:\n");
+    printf("watching: %d, callbacks: %d\n", watch != NULL, changes);
+    printf("Expected: watching: 1, callbacks: 1\n\n");
+
+    // Other files in the same directory don't count
+    changes = 0;
+    write_file(other, "w", "noise\n");
+    settle(&loop);
+
+    printf("Test 2 - Writing another file next to it:\n");
+    printf("callbacks: %d\n", changes);
+    printf("Expected: callbacks: 0\n\n");
+
+    // A save that renames a new file over it is still seen, and so are
+    // changes to the new file afterwards
+    changes = 0;
+    write_file(tmp, "w", "replaced\n");
+    rename(tmp, path);
+    settle(&loop);
+    int after_rename = changes;
+    write_file(path, "a", "more\n");
+    settle(&loop);
+
+    printf("Test 3 - Replaced by a rename, then written again:\n");
+    printf("after rename: %d, after writing: %d\n", after_rename, changes);
+    printf("Expected: after rename: 1, after writing: 2\n\n");
+
+    // Stopped, nothing more comes
+    file_watch_stop(watch);
+    changes = 0;
+    write_file(path, "a", "ignored\n");
+    settle(&loop);
+
+    printf("Test 4 - After stopping:\n");
+    printf("callbacks: %d\n", changes);
+    printf("Expected: callbacks: 0\n");
+
+    event_loop_free(&loop);
+    unlink(path);
+    unlink(other);
+    rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "input.h"
+
+// Feeds everything, decoding as it goes like the editor does, and returns
+// how many events came out. Paste text is added up in pasted.
+int feed_all(InputDecoder *in, const char *bytes, size_t len, KeyEvent *last, size_t *pasted)
+{
+    KeyEvent event;
+    size_t fed = 0;
+    int events = 0;
+
+    while (fed < len) {
+        fed += input_feed(in, bytes + fed, len - fed);
+        while (input_next_key(in, &event)) {
+            if (event.key == KEY_PASTE) {
+                *pasted += event.paste_len;
+            }
+            *last = event;
+            events++;
+        }
+    }
+    return events;
+}
+
+int main() {
+    InputDecoder in;
+    KeyEvent event;
+    size_t pasted = 0;
+    input_init(&in);
+
+    // The whole paste as one event, CRLF as \n, then the key typed after it
+    const char *paste = "\x1b[200~one\r\ntwo\x1b[201~x";
+    int events = feed_all(&in, paste, strlen(paste), &event, &pasted);
+
+    printf("Test 1 - A terminated paste:\n");
+    printf("events: %d, pasted: %zu, then: %c, state: %d\n", events, pasted, event.key, input_partial(&in));
+    printf("Expected: events: 2, pasted: 7, then: x, state: 0\n\n");
+
+    // No terminator: the keys wait until the timeout ends the paste
+    paste = "\x1b[200~lost";
+    pasted = 0;
+    events = feed_all(&in, paste, strlen(paste), &event, &pasted);
+    int waiting = input_partial(&in) == INPUT_IN_PASTE;
+
+    input_expire_escape(&in);
+    int ended = input_next_key(&in, &event) && event.key == KEY_PASTE && event.paste_len == 4;
+    events += feed_all(&in, "x", 1, &event, &pasted);
+
+    printf("Test 2 - A paste that never ends:\n");
+    printf("events: %d, waiting: %d, ended: %d, then: %c, state: %d\n", events, waiting, ended, event.key,
+           input_partial(&in));
+    printf("Expected: events: 1, waiting: 1, ended: 1, then: x, state: 0\n\n");
+
+    // Too big to hold at once, it comes in pieces with nothing lost
+    size_t big = 17 << 20;
+    char *bytes = malloc(big + 32);
+    memcpy(bytes, "\x1b[200~", 6);
+    memset(bytes + 6, 'a', big);
+    memcpy(bytes + 6 + big, "\x1b[201~y", 7);
+    pasted = 0;
+    events = feed_all(&in, bytes, big + 13, &event, &pasted);
+
+    printf("Test 3 - A paste over the limit:\n");
+    printf("events: %d, all pasted: %d, then: %c, state: %d\n", events, pasted == big, event.key, input_partial(&in));
+    printf("Expected: events: 3, all pasted: 1, then: y, state: 0\n");
+
+    free(bytes);
+    input_free(&in);
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "buffer.h"
+#include "event_loop.h"
+#include "load_pool.h"
+
+#define FILES 8
+
+int done = 0;
+LoadPoolResult results[FILES];
+
+void on_loaded(LoadPoolResult *result, void *data)
+{
+    results[(int)(size_t)data] = *result;
+    done++;
+}
+
+void write_file(const char *path, const char *text, size_t len)
+{
+    FILE *fp = fopen(path, "w");
+    fwrite(text, 1, len, fp);
+    fclose(fp);
+}
+
+int main() {
+    char dir[] = "/tmp/test_load_pool.XXXXXX";
+    char paths[FILES][128];
+    mkdtemp(dir);
+
+    for (int i = 0; i < FILES; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/file%d.txt", dir, i);
+    }
+
+    // Five plain files of 100000 lines, one CRLF, one too big, one missing
+    static char text[1100000];
+    for (int i = 0; i < 100000; i++) {
+        memcpy(text + i * 11, "0123456789\n", 11);
+    }
+    for (int i = 0; i < 5; i++) {
+        write_file(paths[i], text, 1100000);
+    }
+    write_file(paths[5], "one\r\ntwo\r\n", 10);
+    write_file(paths[6], text, 2048);
+
+    EventLoop loop;
+    event_loop_init(&loop);
+
+    GapBuffer *buffers[FILES];
+    LoadPool *pool = load_pool_create(&loop, 3);
+    bool added = true;
+
+    for (int i = 0; i < FILES; i++) {
+        buffers[i] = buffer_create(16);
+        added = load_pool_add(pool, paths[i], buffers[i], i == 6 ? 1024 : 0, on_loaded, (void *)(size_t)i) && added;
+    }
+
+    while (done < FILES) {
+        event_loop_run_once(&loop, 1000);
+    }
+
+    int all_read = 1;
+    for (int i = 0; i < 5; i++) {
+        all_read = all_read && results[i].ok && buffer_length(buffers[i]) == 1100000 &&
+                   buffer_get_total_lines(buffers[i]) == 100001;
+    }
+
+    printf("Test 1 - Five files read at once:\n");
+    printf("started: %d, added: %d, all read: %d, first stamp: %llu bytes\n", pool != NULL, added, all_read,
+           (unsigned long long)results[0].stamp.size);
+    printf("Expected: started: 1, added: 1, all read: 1, first stamp: 1100000 bytes\n\n");
+
+    // The same conversion as a file opened on its own
+    printf("Test 2 - A CRLF file:\n");
+    printf("ok: %d, crlf: %d, no \\r left: %d\n", results[5].ok, results[5].format.line_ending == LINE_ENDING_CRLF,
+           buffer_length(buffers[5]) == 8 && memcmp(buffers[5]->data, "one\ntwo\n", 8) == 0);
+    printf("Expected: ok: 1, crlf: 1, no \\r left: 1\n\n");
+
+    // Over the limit it's left alone, a missing file is a new one
+    printf("Test 3 - Too big and missing:\n");
+    printf("too big: %d, left unread: %d, missing ok: %d, exists: %d\n", results[6].too_big,
+           buffer_length(buffers[6]) == 0, results[7].ok, results[7].exists);
+    printf("Expected: too big: 1, left unread: 1, missing ok: 1, exists: 0\n\n");
+
+    // Freed with work queued: every job still reports back, the rest unread
+    load_pool_free(pool);
+    done = 0;
+    memset(results, 0, sizeof(results));
+    pool = load_pool_create(&loop, 1);
+
+    for (int i = 0; i < 5; i++) {
+        buffer_free(buffers[i]);
+        buffers[i] = buffer_create(16);
+        load_pool_add(pool, paths[i], buffers[i], 0, on_loaded, (void *)(size_t)i);
+    }
+
+    load_pool_free(pool);
+    while (done < 5) {
+        event_loop_run_once(&loop, 1000);
+    }
+
+    int cancelled = 0;
+    for (int i = 0; i < 5; i++) {
+        cancelled += results[i].cancelled;
+    }
+
+    printf("Test 4 - Freeing the pool with files queued:\n");
+    printf("callbacks: %d, some cancelled: %d, last one unread: %d\n", done, cancelled > 0,
+           results[4].cancelled && buffer_length(buffers[4]) == 0);
+    printf("Expected: callbacks: 5, some cancelled: 1, last one unread: 1\n");
+
+    for (int i = 0; i < FILES; i++) {
+        buffer_free(buffers[i]);
+        unlink(paths[i]);
+    }
+    rmdir(dir);
+    event_loop_free(&loop);
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "buffer.h"
+#include "event_loop.h"
+#include "pager.h"
+
+Pager *pager;
+int index_calls = 0;
+PagerIndexStatus index_status;
+
+void on_index(void *data)
+{
+    index_calls++;
+    pager_index_status(pager, &index_status);
+}
+
+int searches_done = 0;
+PagerMatch last_match;
+
+void on_search(PagerMatch *match, void *data)
+{
+    last_match = *match;
+    searches_done++;
+}
+
+void search(EventLoop *loop, const char *pattern, bool forward, uint64_t line)
+{
+    int done = searches_done;
+    pager_search(pager, pattern, forward, line * 12, line, line * 12, on_search, NULL);
+    while (searches_done == done) {
+        event_loop_run_once(loop, 1000);
+    }
+}
+
+void print_line(GapBuffer *buf, size_t row)
+{
+    size_t start = buffer_line_start(buf, row);
+    printf("\"");
+    for (size_t i = start; i < buffer_length(buf) && buffer_char_at(buf, i) != '\n'; i++) {
+        printf("%c", buffer_char_at(buf, i));
+    }
+    printf("\"");
+}
+
+int main() {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_pager.%d", (int)getpid());
+
+    // 12 bytes a line, about three windows' worth
+    FILE *fp = fopen(path, "w");
+    for (int i = 0; i < 1000000; i++) {
+        fprintf(fp, "line %06d\n", i);
+    }
+    fclose(fp);
+
+    EventLoop loop;
+    event_loop_init(&loop);
+
+    // The index is built in the background and reported as it goes
+    pager = pager_open(&loop, path, on_index, NULL);
+    while (!index_status.done) {
+        event_loop_run_once(&loop, 1000);
+    }
+
+    printf("Test 1 - Indexing the whole file:\n");
+    printf("opened: %d, lines: %llu, bytes: %llu, size: %llu\n", pager != NULL,
+           (unsigned long long)index_status.lines, (unsigned long long)index_status.bytes,
+           (unsigned long long)pager_size(pager));
+    printf("Expected: opened: 1, lines: 1000001, bytes: 12000000, size: 12000000\n\n");
+
+    // Lines between index entries are read on to
+    uint64_t offset[3] = {0};
+    bool found[3];
+    found[0] = pager_find_line(pager, 4096, &offset[0]);
+    found[1] = pager_find_line(pager, 999999, &offset[1]);
+    found[2] = pager_find_line(pager, 1000001, &offset[2]);
+
+    printf("Test 2 - Finding lines:\n");
+    printf("4096 at: %llu, 999999 at: %llu, past the end: %d\n", (unsigned long long)offset[0],
+           (unsigned long long)offset[1], found[0] && found[1] && !found[2]);
+    printf("Expected: 4096 at: 49152, 999999 at: 11999988, past the end: 1\n\n");
+
+    // Only the window around a line is in the buffer, made of whole lines
+    GapBuffer *buf = buffer_create(16);
+    size_t row;
+    pager_find_line(pager, 500000, &offset[0]);
+    bool shown = pager_show(pager, buf, offset[0], 500000, &row);
+    PagerWindow window = pager_window(pager);
+
+    printf("Test 3 - Showing the middle of the file:\n");
+    printf("shown: %d, at most a window: %d, whole lines: %d, line %llu at row %zu: ", shown,
+           buffer_length(buf) <= PAGER_WINDOW, window.start % 12 == 0 && window.end % 12 == 0,
+           (unsigned long long)(window.first_line + row), row);
+    print_line(buf, row);
+    printf("\nExpected: shown: 1, at most a window: 1, whole lines: 1, line 500000 at row %llu: \"line 500000\"\n\n",
+           (unsigned long long)(500000 - window.first_line));
+
+    // The same buffer is reused at the end of the file
+    size_t capacity = buf->capacity;
+    pager_show(pager, buf, 11999988, 999999, &row);
+    window = pager_window(pager);
+
+    printf("Test 4 - Showing the end:\n");
+    printf("ends at the end: %d, same memory: %d, last line: ", window.end == 12000000, buf->capacity == capacity);
+    print_line(buf, row);
+    printf("\nExpected: ends at the end: 1, same memory: 1, last line: \"line 999999\"\n\n");
+
+    // Searches read the file, not the window, and count lines as they go
+    search(&loop, "line 7", true, 500000);
+    PagerMatch forward = last_match;
+    search(&loop, "line 3", false, 500000);
+    PagerMatch backward = last_match;
+    search(&loop, "nowhere", true, 0);
+
+    printf("Test 5 - Searching:\n");
+    printf("forward: line %llu at %llu, backward: line %llu starting %llu, missing found: %d\n",
+           (unsigned long long)forward.line, (unsigned long long)forward.offset,
+           (unsigned long long)backward.line, (unsigned long long)backward.line_start, last_match.found);
+    printf("Expected: forward: line 700000 at 8400000, backward: line 399999 starting 4799988, missing found: 0\n");
+
+    pager_close(pager);
+    buffer_free(buf);
+    event_loop_free(&loop);
+    unlink(path);
+    return 0;
+}
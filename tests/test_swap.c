@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "buffer.h"
+#include "undo.h"
+#include "swap.h"
+#include "utils.h"
+
+void print_text(GapBuffer *buf)
+{
+    printf("text: \"");
+    for (size_t i = 0; i < buffer_length(buf); i++) {
+        printf("%c", buffer_char_at(buf, i));
+    }
+    printf("\"");
+}
+
+GapBuffer *load(const char *text)
+{
+    GapBuffer *buf = buffer_create(16);
+    buffer_insert_text(buf, text, strlen(text));
+    return buf;
+}
+
+// Journaled like the editor does it, through the buffer's edit hook
+GapBuffer *load_journaled(const char *text, SwapFile *swap)
+{
+    GapBuffer *buf = load(text);
+    buf->edit_hook = swap_record;
+    buf->edit_hook_data = swap;
+    return buf;
+}
+
+void type_text(GapBuffer *buf, size_t pos, const char *text)
+{
+    buffer_move_gap(buf, pos);
+    for (size_t i = 0; text[i] != '\0'; i++) {
+        buffer_insert_char(buf, text[i]);
+    }
+}
+
+size_t file_size(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+int main() {
+    char path[64];
+    char file[64];
+    size_t edits, cx, cy;
+    pid_t owner;
+    snprintf(path, sizeof(path), "/tmp/test_swap.%d", (int)getpid());
+    snprintf(file, sizeof(file), "/tmp/test_swap_file.%d", (int)getpid());
+    unlink(path);
+
+    FILE *fp = fopen(file, "w");
+    fputs("hello world", fp);
+    fclose(fp);
+
+    FileStamp base;
+    file_stamp(file, &base);
+
+    // Typing a word and backspacing over part of it is one op each
+    SwapFile *swap = swap_open(path, &base, false);
+    GapBuffer *buf = load_journaled("hello world", swap);
+    type_text(buf, 5, " there");
+    buffer_delete_char(buf);
+    buffer_delete_char(buf);
+
+    printf("Test 1 - Typing and backspacing are batched:\n");
+    printf("nothing written yet: %d, ", file_size(path) == 48);
+    swap_flush(swap);
+    swap_check(path, &base, &edits, &owner);
+    printf("ops: %zu\n", edits);
+    printf("Expected: nothing written yet: 1, ops: 2\n\n");
+
+    // A session that died leaves edits to recover
+    swap_close(swap, false);
+    fp = fopen(path, "r+b");
+    fseek(fp, 12, SEEK_SET);
+    fwrite(&(unsigned int){ 0 }, 4, 1, fp);
+    fclose(fp);
+    SwapState state = swap_check(path, &base, &edits, &owner);
+
+    printf("Test 2 - Checking a dead session's swap:\n");
+    printf("recoverable: %d, ops: %zu\n", state == SWAP_RECOVERABLE, edits);
+    printf("Expected: recoverable: 1, ops: 2\n\n");
+
+    // Replaying onto the file as it is gets the edits back, one undo takes them out
+    GapBuffer *recovered = load("hello world");
+    UndoManager *um = undo_manager_create();
+    size_t replayed = swap_replay(path, recovered, um);
+
+    printf("Test 3 - Replaying the swap:\n");
+    printf("replayed: %zu, ", replayed);
+    print_text(recovered);
+    undo_operation(um, recovered, &cx, &cy);
+    printf(", after one undo: ");
+    print_text(recovered);
+    printf("\nExpected: replayed: 2, text: \"hello the world\", after one undo: text: \"hello world\"\n\n");
+
+    // The recovered session carries on in the same swap
+    redo_operation(um, recovered, &cx, &cy);
+    swap = swap_open(path, &base, true);
+    recovered->edit_hook = swap_record;
+    recovered->edit_hook_data = swap;
+    buffer_move_gap(recovered, 0);
+    buffer_insert_text(recovered, ">> ", 3);
+    swap_flush(swap);
+    GapBuffer *again = load("hello world");
+    swap_replay(path, again, um);
+
+    printf("Test 4 - Editing on after a recovery:\n");
+    print_text(again);
+    printf("\nExpected: text: \">> hello the world\"\n\n");
+
+    // Saving keeps only what came after the save's mark
+    size_t mark = swap_mark(swap);
+    buffer_move_gap(recovered, buffer_length(recovered));
+    buffer_insert_text(recovered, "!", 1);
+    fp = fopen(file, "w");
+    fputs(">> hello the world", fp);
+    fclose(fp);
+    file_stamp(file, &base);
+    swap_rebase(swap, mark, &base);
+    swap_check(path, &base, &edits, &owner);
+    buffer_free(again);
+    again = load(">> hello the world");
+    swap_replay(path, again, um);
+
+    printf("Test 5 - Saving with an edit made meanwhile:\n");
+    printf("ops: %zu, ", edits);
+    print_text(again);
+    printf("\nExpected: ops: 1, text: \">> hello the world!\"\n\n");
+
+    // Half an op at the end, the process died mid-write
+    swap_close(swap, false);
+    fp = fopen(path, "ab");
+    fwrite("\x49\x4e\x53\x00\x00\x00", 6, 1, fp);
+    fclose(fp);
+    state = swap_check(path, &base, &edits, &owner);
+
+    printf("Test 6 - A torn write at the end:\n");
+    printf("own session: %d, ops: %zu\n", owner == getpid(), edits);
+    printf("Expected: own session: 1, ops: 1\n\n");
+
+    // Another live process owns it, and then one that only has its PID
+    fp = fopen(path, "r+b");
+    fseek(fp, 12, SEEK_SET);
+    fwrite(&(unsigned int){ 1 }, 4, 1, fp);
+    fwrite(&(uint64_t){ process_start_id(1) }, 8, 1, fp);
+    fclose(fp);
+    state = swap_check(path, &base, &edits, &owner);
+    fp = fopen(path, "r+b");
+    fseek(fp, 16, SEEK_SET);
+    fwrite(&(uint64_t){ process_start_id(1) + 1 }, 8, 1, fp);
+    fclose(fp);
+    SwapState reused = swap_check(path, &base, &edits, &owner);
+    fp = fopen(file, "a");
+    fputs("?", fp);
+    fclose(fp);
+    file_stamp(file, &base);
+    fp = fopen(path, "r+b");
+    fseek(fp, 12, SEEK_SET);
+    fwrite(&(unsigned int){ 0 }, 4, 1, fp);
+    fclose(fp);
+    SwapState stale = swap_check(path, &base, &edits, &owner);
+
+    printf("Test 7 - Swaps owned by another process, or out of date:\n");
+    printf("in use: %d, PID reused: %d, stale after the file changed: %d\n", state == SWAP_IN_USE,
+           reused == SWAP_RECOVERABLE, stale == SWAP_STALE);
+    printf("Expected: in use: 1, PID reused: 1, stale after the file changed: 1\n\n");
+
+    // A clean exit removes it
+    swap = swap_open(path, &base, false);
+    swap_close(swap, true);
+
+    printf("Test 8 - Closing after a quit:\n");
+    printf("removed: %d\n", access(path, F_OK) != 0);
+    printf("Expected: removed: 1\n\n");
+
+    // A '%' in a path mustn't give it another path's swap
+    char cache[64], plain[PATH_MAX], percent[PATH_MAX], doubled[PATH_MAX];
+    snprintf(cache, sizeof(cache), "/tmp/test_swap_cache.%d", (int)getpid());
+    setenv("XDG_CACHE_HOME", cache, 1);
+    swap_path("/tmp/a/b", plain, sizeof(plain));
+    swap_path("/tmp/a%b", percent, sizeof(percent));
+    swap_path("/tmp//a/b", doubled, sizeof(doubled));
+
+    printf("Test 9 - Naming swaps:\n");
+    printf("/tmp/a%%b apart from /tmp/a/b: %d, /tmp//a/b the same: %d\n",
+           strcmp(plain, percent) != 0, strcmp(plain, doubled) == 0);
+    printf("Expected: /tmp/a%%b apart from /tmp/a/b: 1, /tmp//a/b the same: 1\n");
+
+    buffer_free(again);
+    buffer_free(recovered);
+    buffer_free(buf);
+    undo_manager_free(um);
+    unlink(file);
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/vesper/swap", cache);
+    rmdir(dir);
+    snprintf(dir, sizeof(dir), "%s/vesper", cache);
+    rmdir(dir);
+    rmdir(cache);
+    return 0;
+}
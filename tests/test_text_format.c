@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <string.h>
+#include "text_format.h"
+
+void print_bytes(const char *text, size_t len)
+{
+    printf("\"");
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = text[i];
+        if (c == '\r') {
+            printf("\\r");
+        } else if (c == '\n') {
+            printf("\\n");
+        } else if (c < 32 || c >= 127) {
+            printf("\\x%02X", c);
+        } else {
+            printf("%c", c);
+        }
+    }
+    printf("\"");
+}
+
+int main() {
+    char out[256];
+    size_t used;
+
+    // A BOM says the encoding, line endings are CRLF only if all of them are
+    TextFormat lf = text_detect("one\ntwo\n", 8);
+    TextFormat crlf = text_detect("\xEF\xBB\xBFone\r\ntwo\r\n", 13);
+    TextFormat mixed = text_detect("one\r\ntwo\n", 9);
+    TextFormat utf16 = text_detect("\xFF\xFEo\0\r\0\n\0", 8);
+
+    printf("Test 1 - Detecting the format:\n");
+    printf("lf: %d/%d, bom crlf: %d/%d, mixed: %d/%d, utf-16le crlf: %d/%d\n", lf.encoding, lf.line_ending,
+           crlf.encoding, crlf.line_ending, mixed.encoding, mixed.line_ending, utf16.encoding, utf16.line_ending);
+    printf("Expected: lf: 0/0, bom crlf: 1/1, mixed: 0/0, utf-16le crlf: 2/1\n\n");
+
+    // In place, with \r\n straddling the eight-byte words and a lone \r kept
+    char text[] = "abcdefg\r\nhijklmnopq\r\n\r\nr\rs\r\n\r";
+    size_t len = text_crlf_to_lf(text, text, strlen(text));
+
+    printf("Test 2 - CRLF to LF in place:\n");
+    print_bytes(text, len);
+    printf("\nExpected: \"abcdefg\\nhijklmnopq\\n\\nr\\rs\\n\\r\"\n\n");
+
+    // And back, long runs without a newline go across a word at a time
+    len = text_lf_to_crlf(out, "a fairly long line\n\nend", 23);
+
+    printf("Test 3 - LF to CRLF:\n");
+    print_bytes(out, len);
+    printf("\nExpected: \"a fairly long line\\r\\n\\r\\nend\"\n\n");
+
+    // Surrogate pairs become one four-byte sequence, a lone one U+FFFD
+    len = text_utf16_to_utf8(out, "h\0\xE9\0\x3D\xD8\x00\xDE\x00\xD8!\0", 12, false);
+
+    printf("Test 4 - UTF-16LE to UTF-8:\n");
+    print_bytes(out, len);
+    printf("\nExpected: \"h\\xC3\\xA9\\xF0\\x9F\\x98\\x80\\xEF\\xBF\\xBD!\"\n\n");
+
+    // A sequence cut off at the end of a chunk waits for the next one
+    TextFormat be = { ENCODING_UTF16BE, LINE_ENDING_CRLF };
+    size_t first = text_encode(&be, "a\n\xC3", 3, false, out, &used);
+    size_t first_used = used;
+    size_t second = text_encode(&be, "\xC3\xA9", 2, true, out + first, &used);
+
+    printf("Test 5 - UTF-8 to UTF-16BE with CRLF in two chunks:\n");
+    printf("used: %zu, ", first_used);
+    print_bytes(out, first + second);
+    printf("\nExpected: used: 2, \"\\x00a\\x00\\r\\x00\\n\\x00\\xE9\"\n\n");
+
+    // A bad byte at the very end can't wait any longer
+    len = text_encode(&be, "\xC3", 1, true, out, &used);
+
+    printf("Test 6 - Invalid UTF-8 at the end:\n");
+    print_bytes(out, len);
+    printf("\nExpected: \"\\xFF\\xFD\"\n");
+
+    return 0;
+}
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <string.h>
+#include "buffer.h"
+#include "undo.h"
+
+void print_text(GapBuffer *buf)
+{
+    printf("text: \"");
+    for (size_t i = 0; i < buffer_length(buf); i++) {
+        char c = buffer_char_at(buf, i);
+        if (c == '\n') {
+            printf("\\n");
+        } else if (c == '\0') {
+            printf("\\0");
+        } else {
+            printf("%c", c);
+        }
+    }
+    printf("\"\n");
+}
+
+int main() {
+    GapBuffer *buf = buffer_create(16);
+    UndoManager *um = undo_manager_create();
+    size_t cx, cy;
+
+    buffer_insert_text(buf, "one\ntwo\nthree", 13);
+
+    // Type "big " at the start of line 1 as one INSERT session
+    buffer_move_gap(buf, 4);
+    undo_begin_insert(um, buf->gap_start);
+    char *typed = "big ";
+    for (size_t i = 0; typed[i]; i++) {
+        buffer_insert_char(buf, typed[i]);
+        undo_insert_char(um, typed[i]);
+    }
+    undo_end_insert(um);
+
+    printf("Test 1 - After typing on line 1:\n");
+    print_text(buf);
+    printf("Expected: text: \"one\\nbig two\\nthree\"\n\n");
+
+    // Move the gap somewhere else, undo must still remove the right text
+    buffer_move_gap(buf, buffer_length(buf));
+    undo_operation(um, buf, &cx, &cy);
+
+    printf("Test 2 - Undo with the gap at the end:\n");
+    print_text(buf);
+    printf("cursor: %zu,%zu\n", cy, cx);
+    printf("Expected: text: \"one\\ntwo\\nthree\"\n");
+    printf("Expected: cursor: 1,0\n\n");
+
+    buffer_move_gap(buf, 0);
+    redo_operation(um, buf, &cx, &cy);
+
+    printf("Test 3 - Redo with the gap at the start:\n");
+    print_text(buf);
+    printf("lines: %zu\n", buffer_get_total_lines(buf));
+    printf("Expected: text: \"one\\nbig two\\nthree\"\n");
+    printf("Expected: lines: 3\n\n");
+
+    // A delete spanning a newline, recorded with its position
+    undo_push_operation(um, OP_DELETE, "\nbig", 4, 3);
+    buffer_delete_range(buf, 3, 4);
+
+    printf("Test 4 - After deleting across a line break:\n");
+    print_text(buf);
+    printf("lines: %zu\n", buffer_get_total_lines(buf));
+    printf("Expected: text: \"one two\\nthree\"\n");
+    printf("Expected: lines: 2\n\n");
+
+    buffer_move_gap(buf, buffer_length(buf));
+    undo_operation(um, buf, &cx, &cy);
+
+    printf("Test 5 - Undo the delete:\n");
+    print_text(buf);
+    printf("lines: %zu, line 1 length: %zu\n", buffer_get_total_lines(buf), buffer_get_line_length(buf, 1));
+    printf("Expected: text: \"one\\nbig two\\nthree\"\n");
+    printf("Expected: lines: 3, line 1 length: 7\n\n");
+
+    // Pasted text keeps its NUL bytes
+    buffer_move_gap(buf, 0);
+    undo_push_operation(um, OP_INSERT, "a\0b", 3, 0);
+    buffer_insert_text(buf, "a\0b", 3);
+    undo_operation(um, buf, &cx, &cy);
+    redo_operation(um, buf, &cx, &cy);
+
+    printf("Test 6 - Undo and redo text with a NUL byte:\n");
+    print_text(buf);
+    printf("Expected: text: \"a\\0bone\\nbig two\\nthree\"\n\n");
+
+    // Everything undone gives back the original
+    while (undo_operation(um, buf, &cx, &cy)) {
+    }
+
+    printf("Test 7 - Undo everything:\n");
+    print_text(buf);
+    printf("Expected: text: \"one\\ntwo\\nthree\"\n\n");
+
+    undo_manager_free(um);
+    buffer_free(buf);
+
+    // A new edit after undoing starts a branch, the old one stays reachable
+    buf = buffer_create(16);
+    um = undo_manager_create();
+    buffer_insert_text(buf, "abc", 3);
+
+    undo_push_operation(um, OP_INSERT, "1", 1, 3);
+    buffer_insert_text(buf, "1", 1);
+    undo_operation(um, buf, &cx, &cy);
+    undo_push_operation(um, OP_INSERT, "2", 1, 3);
+    buffer_move_gap(buf, 3);
+    buffer_insert_text(buf, "2", 1);
+    undo_push_operation(um, OP_INSERT, "3", 1, 4);
+    buffer_insert_text(buf, "3", 1);
+
+    printf("Test 8 - Two branches, on the second:\n");
+    print_text(buf);
+    printf("state: %zu of %zu\n", um->current, um->record_count);
+    printf("Expected: text: \"abc23\"\n");
+    printf("Expected: state: 3 of 3\n\n");
+
+    undo_goto(um, 1, buf, &cx, &cy);
+
+    printf("Test 9 - Jump to the first branch:\n");
+    print_text(buf);
+    printf("state: %zu\n", um->current);
+    printf("Expected: text: \"abc1\"\n");
+    printf("Expected: state: 1\n\n");
+
+    undo_operation(um, buf, &cx, &cy);
+    redo_operation(um, buf, &cx, &cy);
+
+    printf("Test 10 - Undo then redo follows the branch last visited:\n");
+    print_text(buf);
+    printf("Expected: text: \"abc1\"\n\n");
+
+    undo_goto(um, 3, buf, &cx, &cy);
+    undo_goto(um, 2, buf, &cx, &cy);
+
+    printf("Test 11 - Back to the second branch, then one state earlier:\n");
+    print_text(buf);
+    printf("Expected: text: \"abc2\"\n\n");
+
+    // Times are whole seconds, set them so the lookup is predictable
+    undo_record(um, 1)->time = 100;
+    undo_record(um, 2)->time = 200;
+    undo_record(um, 3)->time = 300;
+    undo_goto(um, 3, buf, &cx, &cy);
+
+    printf("Test 12 - Time targets from state 3:\n");
+    printf("150s earlier: %zu, 100s earlier: %zu, 1000s earlier: %zu\n",
+           undo_time_target(um, -150), undo_time_target(um, -100), undo_time_target(um, -1000));
+    printf("Expected: 150s earlier: 1, 100s earlier: 2, 1000s earlier: 0\n\n");
+
+    undo_manager_free(um);
+    buffer_free(buf);
+
+    // Long branches, so the common ancestor is found through skip pointers
+    buf = buffer_create(16);
+    um = undo_manager_create();
+
+    for (size_t i = 0; i < 200; i++) {
+        undo_push_operation(um, OP_INSERT, "x", 1, i);
+        buffer_insert_char(buf, 'x');
+    }
+    undo_goto(um, 100, buf, &cx, &cy);
+    for (size_t i = 0; i < 50; i++) {
+        undo_push_operation(um, OP_INSERT, "y", 1, 100 + i);
+        buffer_insert_char(buf, 'y');
+    }
+
+    undo_goto(um, 150, buf, &cx, &cy);
+    size_t length_150 = buffer_length(buf);
+    undo_goto(um, 250, buf, &cx, &cy);
+    size_t length_250 = buffer_length(buf);
+    char last = buffer_char_at(buf, buffer_length(buf) - 1);
+
+    printf("Test 13 - Jumping between 200 x's and 100 x's + 50 y's:\n");
+    printf("state 150 length: %zu, state 250 length: %zu, last char: %c\n", length_150, length_250, last);
+    printf("Expected: state 150 length: 150, state 250 length: 150, last char: y\n\n");
+
+    undo_manager_free(um);
+    buffer_free(buf);
+
+    // Backspace past where typing started deletes text that was there
+    buf = buffer_create(16);
+    um = undo_manager_create();
+    buffer_insert_text(buf, "abcdef", 6);
+
+    undo_begin_insert(um, buf->gap_start);
+    buffer_insert_char(buf, 'x');
+    undo_insert_char(um, 'x');
+    for (int i = 0; i < 4; i++) {
+        undo_backspace(um, buf->data[buf->gap_start - 1]);
+        buffer_delete_char(buf);
+    }
+    buffer_insert_text(buf, "XY", 2);
+    undo_insert_char(um, 'X');
+    undo_insert_char(um, 'Y');
+    undo_end_insert(um);
+
+    printf("Test 14 - Type, backspace into the old text, type again:\n");
+    print_text(buf);
+    printf("records: %zu, delete: \"%.*s\" at %zu\n", um->record_count,
+           (int)undo_record(um, 1)->length, undo_record_text(undo_record(um, 1)), undo_record(um, 1)->position);
+    printf("Expected: text: \"abcXY\"\n");
+    printf("Expected: records: 2, delete: \"def\" at 3\n\n");
+
+    undo_operation(um, buf, &cx, &cy);
+
+    printf("Test 15 - One undo takes back the whole session:\n");
+    print_text(buf);
+    printf("Expected: text: \"abcdef\"\n\n");
+
+    redo_operation(um, buf, &cx, &cy);
+    undo_goto(um, 1, buf, &cx, &cy);
+
+    printf("Test 16 - Redo it, then go to the state inside the session:\n");
+    print_text(buf);
+    printf("state: %zu, g- goes to: %zu\n", um->current, undo_step_target(um, 1, false));
+    printf("Expected: text: \"abcXY\"\n");
+    printf("Expected: state: 2, g- goes to: 0\n\n");
+
+    undo_manager_free(um);
+    buffer_free(buf);
+
+    // A small budget keeps the newest history and drops the oldest
+    buf = buffer_create(16);
+    um = undo_manager_create();
+    um->budget = 16 * 1024;
+    size_t peak = 0;
+
+    for (size_t i = 0; i < 5000; i++) {
+        undo_push_operation(um, OP_INSERT, "z", 1, i);
+        buffer_insert_char(buf, 'z');
+        if (undo_history_bytes(um) > peak) {
+            peak = undo_history_bytes(um);
+        }
+    }
+
+    size_t undos = 0;
+    while (undo_operation(um, buf, &cx, &cy)) {
+        undos++;
+    }
+    size_t left = buffer_length(buf);
+    while (redo_operation(um, buf, &cx, &cy)) {
+    }
+
+    printf("Test 17 - 5000 edits under a 16K budget:\n");
+    printf("within budget: %d, can undo: %d, undone + left: %zu, redone length: %zu\n",
+           peak <= um->budget, undos > 100 && undos < 5000, undos + left, buffer_length(buf));
+    printf("Expected: within budget: 1, can undo: 1, undone + left: 5000, redone length: 5000\n\n");
+
+    undo_manager_free(um);
+    buffer_free(buf);
+
+    // One long INSERT session is cut into pieces the budget can drop
+    buf = buffer_create(16);
+    um = undo_manager_create();
+    um->budget = 256 * 1024;
+    peak = 0;
+
+    undo_begin_insert(um, 0);
+    for (size_t i = 0; i < 1000000; i++) {
+        buffer_insert_char(buf, 'a' + i % 26);
+        undo_insert_char(um, 'a' + i % 26);
+        if (undo_history_bytes(um) > peak) {
+            peak = undo_history_bytes(um);
+        }
+    }
+    undo_end_insert(um);
+    undo_operation(um, buf, &cx, &cy);
+
+    printf("Test 18 - 1M characters typed in one session with a 256K budget:\n");
+    printf("within budget: %d, undo leaves the older part: %d\n",
+           peak <= um->budget, buffer_length(buf) > 0 && buffer_length(buf) < 1000000);
+    printf("Expected: within budget: 1, undo leaves the older part: 1\n");
+
+    undo_manager_free(um);
+    buffer_free(buf);
+    return 0;
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "buffer.h"
+#include "undo.h"
+#include "undo_journal.h"
+
+void print_text(GapBuffer *buf)
+{
+    printf("text: \"");
+    for (size_t i = 0; i < buffer_length(buf); i++) {
+        printf("%c", buffer_char_at(buf, i));
+    }
+    printf("\"\n");
+}
+
+GapBuffer *load(const char *text)
+{
+    GapBuffer *buf = buffer_create(16);
+    buffer_insert_text(buf, text, strlen(text));
+    return buf;
+}
+
+void edit(UndoManager *um, GapBuffer *buf, const char *text, size_t pos)
+{
+    undo_push_operation(um, OP_INSERT, text, strlen(text), pos);
+    buffer_move_gap(buf, pos);
+    buffer_insert_text(buf, text, strlen(text));
+}
+
+int main() {
+    char path[64];
+    size_t cx, cy;
+    snprintf(path, sizeof(path), "/tmp/test_undo_journal.%d", (int)getpid());
+    unlink(path);
+
+    // First session: one saved edit, one that was never saved
+    GapBuffer *buf = load("hello");
+    UndoManager *um = undo_manager_create();
+    size_t restored = undo_journal_open(um, path, buf);
+
+    edit(um, buf, " world", 5);
+    undo_journal_mark_saved(um, buf);
+    edit(um, buf, "!", 11);
+
+    printf("Test 1 - New journal:\n");
+    printf("restored: %zu, journal open: %d\n", restored, um->journal_fd >= 0);
+    printf("Expected: restored: 0, journal open: 1\n\n");
+
+    undo_manager_free(um);
+    buffer_free(buf);
+
+    // Second session opens the file as it was saved
+    buf = load("hello world");
+    um = undo_manager_create();
+    restored = undo_journal_open(um, path, buf);
+    char *first = (char *)undo_record(um, 1);
+    int mapped = first >= um->map && first < um->map + um->map_size;
+
+    printf("Test 2 - Reopen the saved text:\n");
+    printf("restored: %zu, state: %zu, mapped: %d\n", restored, um->current, mapped);
+    printf("Expected: restored: 2, state: 1, mapped: 1\n\n");
+
+    undo_operation(um, buf, &cx, &cy);
+
+    printf("Test 3 - Undo across sessions:\n");
+    print_text(buf);
+    printf("Expected: text: \"hello\"\n\n");
+
+    redo_operation(um, buf, &cx, &cy);
+    redo_operation(um, buf, &cx, &cy);
+
+    printf("Test 4 - The unsaved edit is still there to redo:\n");
+    print_text(buf);
+    printf("Expected: text: \"hello world!\"\n\n");
+
+    // A new branch goes on the end of the journal
+    undo_goto(um, 1, buf, &cx, &cy);
+    edit(um, buf, "?", 11);
+    undo_manager_free(um);
+    buffer_free(buf);
+
+    buf = load("hello world");
+    um = undo_manager_create();
+    restored = undo_journal_open(um, path, buf);
+    undo_goto(um, 3, buf, &cx, &cy);
+
+    printf("Test 5 - Third session sees both sessions' edits:\n");
+    printf("restored: %zu\n", restored);
+    print_text(buf);
+    printf("Expected: restored: 3\n");
+    printf("Expected: text: \"hello world?\"\n\n");
+
+    undo_manager_free(um);
+    buffer_free(buf);
+
+    // Half a record at the end, like a crash in the middle of a write
+    struct stat st;
+    stat(path, &st);
+    int fd = open(path, O_WRONLY | O_APPEND);
+    write(fd, "\0\0\0\0garbage", 11);
+    close(fd);
+
+    buf = load("hello world");
+    um = undo_manager_create();
+    restored = undo_journal_open(um, path, buf);
+    struct stat after;
+    stat(path, &after);
+
+    printf("Test 6 - Torn write at the end:\n");
+    printf("restored: %zu, cut back: %d\n", restored, after.st_size == st.st_size);
+    printf("Expected: restored: 3, cut back: 1\n\n");
+
+    undo_manager_free(um);
+    buffer_free(buf);
+
+    // The file changed outside the editor, nothing matches its hash
+    buf = load("hello there");
+    um = undo_manager_create();
+    restored = undo_journal_open(um, path, buf);
+
+    printf("Test 7 - File changed behind our back:\n");
+    printf("restored: %zu, records: %zu, can undo: %d\n", restored, um->record_count, undo_operation(um, buf, &cx, &cy));
+    printf("Expected: restored: 0, records: 0, can undo: 0\n\n");
+
+    undo_manager_free(um);
+    buffer_free(buf);
+
+    // Compaction renumbers the tree, the journal is rewritten to match
+    unlink(path);
+    buf = load("");
+    um = undo_manager_create();
+    um->budget = 16 * 1024;
+    undo_journal_open(um, path, buf);
+
+    for (size_t i = 0; i < 3000; i++) {
+        edit(um, buf, "q", i);
+    }
+    undo_journal_mark_saved(um, buf);
+    size_t kept = um->record_count;
+    undo_manager_free(um);
+    buffer_free(buf);
+
+    buf = load("");
+    for (size_t i = 0; i < 3000; i++) {
+        buffer_insert_char(buf, 'q');
+    }
+    um = undo_manager_create();
+    restored = undo_journal_open(um, path, buf);
+    undo_operation(um, buf, &cx, &cy);
+    stat(path, &st);
+
+    printf("Test 8 - Reopen after the budget dropped old history:\n");
+    printf("restored all kept: %d, undo works: %d, journal small: %d\n",
+           restored == kept && kept < 3000, buffer_length(buf) == 2999, st.st_size < 16 * 1024);
+    printf("Expected: restored all kept: 1, undo works: 1, journal small: 1\n\n");
+
+    undo_manager_free(um);
+    buffer_free(buf);
+
+    // Ctrl-S while typing: the save splits the open record, and the marked
+    // state is one that made it to the journal
+    unlink(path);
+    buf = load("");
+    um = undo_manager_create();
+    undo_journal_open(um, path, buf);
+
+    undo_begin_insert(um, 0);
+    undo_insert_char(um, 'a');
+    undo_insert_char(um, 'b');
+    buffer_insert_text(buf, "ab", 2);
+    undo_split_insert(um);
+    undo_journal_mark_saved(um, buf);
+    undo_insert_char(um, 'c');
+    buffer_insert_char(buf, 'c');
+    undo_end_insert(um);
+    undo_manager_free(um);
+    buffer_free(buf);
+
+    buf = load("ab");
+    um = undo_manager_create();
+    restored = undo_journal_open(um, path, buf);
+    size_t saved_state = um->current;
+
+    printf("Test 9 - Reopen after saving mid-insert:\n");
+    redo_operation(um, buf, &cx, &cy);
+    print_text(buf);
+    undo_operation(um, buf, &cx, &cy);
+    printf("restored: %zu, state: %zu, undo to empty: %d\n", restored, saved_state, buffer_length(buf) == 0);
+    printf("Expected: text: \"abc\"\n");
+    printf("Expected: restored: 2, state: 1, undo to empty: 1\n");
+
+    undo_manager_free(um);
+    buffer_free(buf);
+    unlink(path);
+    return 0;
+}